@@ -0,0 +1,247 @@
+#include "baseline.h"
+#include <stdint.h>
+#include <string.h>
+
+#include "converter.h"
+
+#ifdef BENCH_HAS_ICONV
+#include <iconv.h>
+#endif
+
+#ifdef BENCH_HAS_UCHAR
+#include <limits.h>
+#include <locale.h>
+#include <uchar.h>
+#include <wchar.h>
+#endif
+
+static char const* const impl_names[BASELINE_COUNT] =
+{
+    "converter",
+    "iconv",
+    "uchar"
+};
+
+char const* baseline_name(baseline_impl impl)
+{
+    return impl_names[impl];
+}
+
+#ifdef BENCH_HAS_ICONV
+
+// The conversion descriptors from UTF-8 to UTF-16 and back, or (iconv_t)-1 if not open
+static iconv_t iconv_to_utf16 = (iconv_t)-1;
+static iconv_t iconv_to_utf8 = (iconv_t)-1;
+
+// Gets the iconv name of UTF-16 in the native byte order.
+// Plain "UTF-16" would add a byte order mark to the output.
+static char const* native_utf16_name(void)
+{
+    uint16_t probe = 1;
+    return *(uint8_t const*)&probe == 1 ? "UTF-16LE" : "UTF-16BE";
+}
+
+static bool open_iconv(void)
+{
+    iconv_to_utf16 = iconv_open(native_utf16_name(), "UTF-8");
+    iconv_to_utf8 = iconv_open("UTF-8", native_utf16_name());
+    return iconv_to_utf16 != (iconv_t)-1 && iconv_to_utf8 != (iconv_t)-1;
+}
+
+static void close_iconv(void)
+{
+    if (iconv_to_utf16 != (iconv_t)-1)
+        iconv_close(iconv_to_utf16);
+    if (iconv_to_utf8 != (iconv_t)-1)
+        iconv_close(iconv_to_utf8);
+
+    iconv_to_utf16 = (iconv_t)-1;
+    iconv_to_utf8 = (iconv_t)-1;
+}
+
+static bool convert_iconv(bool is_utf8, char const* input, size_t input_len, char* output, size_t output_capacity, size_t* output_len)
+{
+    iconv_t descriptor = is_utf8 ? iconv_to_utf16 : iconv_to_utf8;
+
+    // Every conversion starts from the initial state, like a conversion with a new descriptor
+    iconv(descriptor, NULL, NULL, NULL, NULL);
+
+    char* in = (char*)input;
+    size_t in_left = input_len;
+    char* out = output;
+    size_t out_left = output_capacity;
+
+    if (iconv(descriptor, &in, &in_left, &out, &out_left) == (size_t)-1)
+        return false;
+
+    *output_len = output_capacity - out_left;
+    return true;
+}
+
+#endif
+
+#ifdef BENCH_HAS_UCHAR
+
+// The locales tried, in order, until one of them converts UTF-8
+static char const* const utf8_locales[] = { "C.UTF-8", "C.utf8", "en_US.UTF-8", ".UTF-8", "" };
+
+// Checks if the current locale converts UTF-8, by converting a two-byte sequence
+static bool is_utf8_locale(void)
+{
+    mbstate_t state;
+    memset(&state, 0, sizeof state);
+
+    char16_t character = 0;
+    return mbrtoc16(&character, "\xC3\xA9", 2, &state) == 2 && character == 0xE9;
+}
+
+static bool open_uchar(void)
+{
+    for (size_t i = 0; i < sizeof utf8_locales / sizeof utf8_locales[0]; i++)
+    {
+        if (setlocale(LC_CTYPE, utf8_locales[i]) != NULL && is_utf8_locale())
+            return true;
+    }
+
+    return false;
+}
+
+static void close_uchar(void)
+{
+    setlocale(LC_CTYPE, "C");
+}
+
+static bool convert_uchar(bool is_utf8, char const* input, size_t input_len, char* output, size_t output_capacity, size_t* output_len)
+{
+    mbstate_t state;
+    memset(&state, 0, sizeof state);
+
+    if (is_utf8)
+    {
+        char16_t* utf16 = (char16_t*)output;
+        size_t utf16_capacity = output_capacity / sizeof(char16_t);
+        size_t in = 0;
+        size_t out = 0;
+
+        // The low surrogate of a codepoint outside of the BMP is returned by the call after it
+        while (in < input_len || !mbsinit(&state))
+        {
+            if (out >= utf16_capacity)
+                return false;
+
+            size_t read = mbrtoc16(&utf16[out], input + in, input_len - in, &state);
+            if (read == (size_t)-1 || read == (size_t)-2)
+                return false;
+
+            // A null character is read from one byte, but returns 0
+            if (read != (size_t)-3)
+                in += read == 0 ? 1 : read;
+
+            out++;
+        }
+
+        *output_len = out * sizeof(char16_t);
+        return true;
+    }
+
+    char16_t const* utf16 = (char16_t const*)input;
+    size_t utf16_len = input_len / sizeof(char16_t);
+    size_t out = 0;
+
+    for (size_t in = 0; in < utf16_len; in++)
+    {
+        char encoded[MB_LEN_MAX];
+        size_t written = c16rtomb(encoded, utf16[in], &state);
+        if (written == (size_t)-1 || written > output_capacity - out)
+            return false;
+
+        memcpy(output + out, encoded, written);
+        out += written;
+    }
+
+    // An unpaired high surrogate at the end leaves the state waiting for its low surrogate
+    if (!mbsinit(&state))
+        return false;
+
+    *output_len = out;
+    return true;
+}
+
+#endif
+
+bool baseline_open(baseline_impl impl)
+{
+    switch (impl)
+    {
+    case BASELINE_CONVERTER:
+        return true;
+
+#ifdef BENCH_HAS_ICONV
+    case BASELINE_ICONV:
+        if (open_iconv())
+            return true;
+
+        close_iconv();
+        return false;
+#endif
+
+#ifdef BENCH_HAS_UCHAR
+    case BASELINE_UCHAR:
+        return open_uchar();
+#endif
+
+    default:
+        return false;
+    }
+}
+
+void baseline_close(baseline_impl impl)
+{
+    switch (impl)
+    {
+#ifdef BENCH_HAS_ICONV
+    case BASELINE_ICONV:
+        close_iconv();
+        break;
+#endif
+
+#ifdef BENCH_HAS_UCHAR
+    case BASELINE_UCHAR:
+        close_uchar();
+        break;
+#endif
+
+    default:
+        break;
+    }
+}
+
+bool baseline_convert(
+    baseline_impl impl, bool is_utf8,
+    char const* input, size_t input_len,
+    char* output, size_t output_capacity,
+    size_t* output_len)
+{
+    switch (impl)
+    {
+    case BASELINE_CONVERTER:
+        if (is_utf8)
+            *output_len = sizeof(utf16_t) * utf8_to_utf16((utf8_t const*)input, input_len / sizeof(utf8_t), (utf16_t*)output, output_capacity / sizeof(utf16_t));
+        else
+            *output_len = sizeof(utf8_t) * utf16_to_utf8((utf16_t const*)input, input_len / sizeof(utf16_t), (utf8_t*)output, output_capacity / sizeof(utf8_t));
+        return true;
+
+#ifdef BENCH_HAS_ICONV
+    case BASELINE_ICONV:
+        return convert_iconv(is_utf8, input, input_len, output, output_capacity, output_len);
+#endif
+
+#ifdef BENCH_HAS_UCHAR
+    case BASELINE_UCHAR:
+        return convert_uchar(is_utf8, input, input_len, output, output_capacity, output_len);
+#endif
+
+    default:
+        return false;
+    }
+}
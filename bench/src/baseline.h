@@ -0,0 +1,49 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+// The conversions that the converter is compared against, behind a single interface:
+// iconv and the C11 uchar.h functions of the C library, when they're available.
+// All of them convert between UTF-8 and UTF-16 in the native byte order, and reject
+// ill-formed input instead of replacing it, so their output only matches the converter's
+// on well-formed input.
+
+// The implementations that can be benchmarked
+typedef enum
+{
+    BASELINE_CONVERTER, // This library
+    BASELINE_ICONV,     // iconv, with a descriptor opened once for every direction
+    BASELINE_UCHAR,     // mbrtoc16 and c16rtomb, one codepoint at a time, in a UTF-8 locale
+    BASELINE_COUNT
+} baseline_impl;
+
+// Gets the name of an implementation
+char const* baseline_name(baseline_impl impl);
+
+// Prepares an implementation to convert in both directions
+//
+// impl: The implementation
+//
+// return: If the implementation is available on this system
+bool baseline_open(baseline_impl impl);
+
+// Releases everything that baseline_open prepared
+void baseline_close(baseline_impl impl);
+
+// Converts an input with an implementation that was opened
+//
+// impl: The implementation
+// is_utf8: If the input is in UTF-8 and must be converted to UTF-16, otherwise the opposite
+// input: The input
+// input_len: The size of the input, in bytes
+// output: Where to write the output
+// output_capacity: The size of the output buffer, in bytes
+// output_len: Pointer to a variable that will receive the size of the output, in bytes
+//
+// return: If the whole input was converted. Fails on ill-formed input, except with BASELINE_CONVERTER.
+bool baseline_convert(
+    baseline_impl impl, bool is_utf8,
+    char const* input, size_t input_len,
+    char* output, size_t output_capacity,
+    size_t* output_len
+);
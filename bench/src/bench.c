@@ -0,0 +1,942 @@
+// clock_gettime and CLOCK_MONOTONIC are only declared by POSIX
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define BENCH_HAS_CYCLES
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_CYCLES
+#endif
+
+#include "baseline.h"
+#include "converter.h"
+#include "corpus.h"
+
+// The peak memory of a conversion is read from /proc, whose peak can be reset
+#if defined(__linux__)
+#define BENCH_HAS_PEAK_MEMORY
+#endif
+
+#if defined(BENCH_HAS_PEAK_MEMORY) && defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// The default number of timed samples for every benchmark
+#define DEFAULT_SAMPLES 51
+// The default number of untimed samples run before the timed ones
+#define DEFAULT_WARMUP 5
+// The minimum duration of a single sample, in nanoseconds.
+// Small inputs are converted repeatedly in each sample until they take at least this long,
+// so the clock resolution and the call overhead don't dominate the measurement.
+#define MIN_SAMPLE_NS 200000
+// The size of the smallest generated input when sweeping sizes, in bytes
+#define SWEEP_MIN_SIZE 1024
+// The default size of the largest generated input when sweeping sizes, in bytes
+#define DEFAULT_SWEEP_MAX_SIZE (64 * 1024 * 1024)
+// How much larger every generated input is than the previous one when sweeping sizes
+#define SWEEP_SIZE_FACTOR 4
+// The default percentage of invalid encodings in the 'invalid' mix
+#define DEFAULT_INVALID_PERCENT 1
+// The size of the short strings that the input is split in to measure the latency of a single
+// conversion, in bytes. Strings are cut at codepoint boundaries, so they may be a bit longer.
+#define SHORT_STRING_LEN 32
+
+static int help(const char* base)
+{
+    printf("Usage: %s [--samples <count>] [--warmup <count>] [--json <output>] [--compare] <input>... \n", base);
+    printf("       %s [--samples <count>] [--warmup <count>] [--json <output>] [--compare] --sweep [--max-size <bytes>] [--invalid-percent <percent>]\n", base);
+    printf("\n");
+    printf("input:\n");
+    printf("Path of a file to be converted. Files named *.utf8.txt are read as UTF-8, files named *.utf16.txt as UTF-16LE.\n");
+    printf("Every file is benchmarked in both directions: first from its own encoding, then converted back from the result.\n");
+    printf("\n");
+    printf("--samples:\n");
+    printf("The number of timed samples for every benchmark. Defaults to %d.\n", DEFAULT_SAMPLES);
+    printf("\n");
+    printf("--warmup:\n");
+    printf("The number of untimed samples run before the timed ones. Defaults to %d.\n", DEFAULT_WARMUP);
+    printf("\n");
+    printf("--json:\n");
+    printf("If set, the results will also be written to this file as JSON.\n");
+    printf("\n");
+    printf("--compare:\n");
+    printf("Also benchmark every available implementation from the C library (");
+    for (int impl = BASELINE_CONVERTER + 1; impl < BASELINE_COUNT; impl++)
+        printf("%s%s", impl > BASELINE_CONVERTER + 1 ? ", " : "", baseline_name((baseline_impl)impl));
+    printf(") on the same inputs,\n");
+    printf("check that their output is the same on well-formed inputs, and measure the latency of\n");
+    printf("converting strings of %d bytes and the peak memory of a conversion for every implementation.\n", SHORT_STRING_LEN);
+    printf("\n");
+    printf("--sweep:\n");
+    printf("Instead of reading input files, generate synthetic text of every mix (");
+    for (int mix = 0; mix < CORPUS_MIX_COUNT; mix++)
+        printf("%s%s", mix > 0 ? ", " : "", corpus_mix_name((corpus_mix)mix));
+    printf(")\n");
+    printf("in sizes from %d bytes, growing %dx at a time, and benchmark both directions for each.\n", SWEEP_MIN_SIZE, SWEEP_SIZE_FACTOR);
+    printf("\n");
+    printf("--max-size:\n");
+    printf("The size of the largest generated input, in bytes. Defaults to %d.\n", DEFAULT_SWEEP_MAX_SIZE);
+    printf("\n");
+    printf("--invalid-percent:\n");
+    printf("The percentage of codepoints replaced by invalid encodings in the 'invalid' mix. Defaults to %d.\n", DEFAULT_INVALID_PERCENT);
+    printf("\n");
+    return EXIT_SUCCESS;
+}
+
+// Reads the current time from a monotonic clock
+//
+// return: The current time, in nanoseconds from an arbitrary point
+static uint64_t now_ns(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+#endif
+}
+
+// Reads the CPU timestamp counter, which counts reference cycles at a constant rate
+//
+// return: The current timestamp, or 0 if the CPU has no timestamp counter
+static uint64_t now_cycles(void)
+{
+#ifdef BENCH_HAS_CYCLES
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Opens a file and reads its contents fully
+//
+// path: The path of the file to be read
+// buffer: Pointer to a variable that will receive the file content
+// buffer_len: Pointer to a variable that will receive the buffer length
+//
+// return: If the file was read successfully.
+static bool read_file(char const* path, char** buffer, size_t* buffer_len)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Unable to open input file %s\n", path);
+        return false;
+    }
+
+    size_t len = 0;
+    size_t capacity = 4096;
+    char* input = malloc(capacity);
+
+    while (input != NULL)
+    {
+        len += fread(input + len, 1, capacity - len, file);
+        if (len < capacity)
+            break;
+
+        capacity *= 2;
+        char* new_input = realloc(input, capacity);
+        if (new_input == NULL)
+            free(input);
+
+        input = new_input;
+    }
+
+    bool failed = input == NULL || ferror(file);
+    fclose(file);
+
+    if (failed)
+    {
+        fprintf(stderr, "Unable to read file %s\n", path);
+        free(input);
+        return false;
+    }
+
+    *buffer = input;
+    *buffer_len = len;
+    return true;
+}
+
+// Checks if a string ends with a suffix
+static bool ends_with(char const* string, char const* suffix)
+{
+    size_t string_len = strlen(string);
+    size_t suffix_len = strlen(suffix);
+    return string_len >= suffix_len && strcmp(string + string_len - suffix_len, suffix) == 0;
+}
+
+// The statistics of a benchmark
+typedef struct
+{
+    // The name of the input file, or the mix and size of the generated input
+    char name[256];
+    // The implementation that converted the input
+    baseline_impl impl;
+    // If the input was converted from UTF-8 to UTF-16
+    bool is_utf8;
+    // The size of the input, in bytes
+    size_t input_len;
+    // The size of the output, in bytes
+    size_t output_len;
+    // How many times the input was converted in every sample
+    size_t repetitions;
+    // The median, 10th and 90th percentile throughput, in gigabytes of input per second
+    double gbps_median;
+    double gbps_p10;
+    double gbps_p90;
+    // The median, 10th and 90th percentile of reference cycles per byte of input, or 0 if unavailable
+    double cpb_median;
+    double cpb_p10;
+    double cpb_p90;
+    // If the benchmark is part of a comparison between implementations, which fills in the fields below
+    bool compared;
+    // If the output was the same as the output of the converter
+    bool matches;
+    // The median time to convert a short string, in nanoseconds
+    double short_ns_median;
+    // The peak memory used by a single conversion, in KiB, or -1 if unavailable
+    long peak_kib;
+} bench_result;
+
+// Calculates the size of a buffer that can always hold the conversion of an input
+//
+// is_utf8: If the input is converted from UTF-8 to UTF-16
+// input_len: The size of the input, in bytes
+//
+// return: The size of the buffer, in bytes
+static size_t output_bound(bool is_utf8, size_t input_len)
+{
+    return is_utf8
+        ? sizeof(utf16_t) * utf8_to_utf16_bound(input_len / sizeof(utf8_t))
+        : sizeof(utf8_t) * utf16_to_utf8_bound(input_len / sizeof(utf16_t));
+}
+
+// Converts an input once, in the direction and with the implementation of the benchmark
+//
+// output: Where to write the output, at least output_bound bytes long
+// output_len: Pointer to a variable that will receive the size of the output, in bytes
+//
+// return: If the whole input was converted
+static bool convert(bench_result const* result, char const* input, size_t input_len, char* output, size_t* output_len)
+{
+    size_t capacity = output_bound(result->is_utf8, input_len);
+    return baseline_convert(result->impl, result->is_utf8, input, input_len, output, capacity, output_len);
+}
+
+// Compares two doubles, for qsort
+static int compare_doubles(void const* a, void const* b)
+{
+    double left = *(double const*)a;
+    double right = *(double const*)b;
+    return (left > right) - (left < right);
+}
+
+// Gets a percentile of a sorted array with the nearest-rank method
+static double percentile(double const* sorted, size_t len, int percent)
+{
+    size_t rank = (len * (size_t)percent + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// Runs the benchmark of a conversion
+//
+// result: The benchmark to run. Its name, implementation, direction and input size must be filled in.
+// input: The input to convert
+// output: Pointer to a variable that will receive the converted output, allocated with malloc
+// samples: The number of timed samples
+// warmup: The number of untimed samples
+//
+// return: If the benchmark ran successfully
+static bool run_benchmark(bench_result* result, char const* input, int samples, int warmup, char** output)
+{
+    size_t bound = output_bound(result->is_utf8, result->input_len);
+
+    // Empty inputs still get a buffer, so there's something to return
+    char* buffer = malloc(bound > 0 ? bound : 1);
+    double* nanos = malloc(sizeof(double) * samples);
+    double* cycles = malloc(sizeof(double) * samples);
+    if (buffer == NULL || nanos == NULL || cycles == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory to benchmark %s\n", result->name);
+        free(buffer);
+        free(nanos);
+        free(cycles);
+        return false;
+    }
+
+    // Only the converter accepts ill-formed input, so the others are only run on well-formed input
+    if (!convert(result, input, result->input_len, buffer, &result->output_len))
+    {
+        fprintf(stderr, "%s was unable to convert %s\n", baseline_name(result->impl), result->name);
+        free(buffer);
+        free(nanos);
+        free(cycles);
+        return false;
+    }
+
+    // Convert repeatedly until a sample is long enough to be measured precisely
+    size_t repetitions = 1;
+    for (;;)
+    {
+        uint64_t start = now_ns();
+        for (size_t i = 0; i < repetitions; i++)
+            convert(result, input, result->input_len, buffer, &result->output_len);
+
+        if (now_ns() - start >= MIN_SAMPLE_NS || repetitions >= SIZE_MAX / 2)
+            break;
+
+        repetitions *= 2;
+    }
+
+    for (int sample = -warmup; sample < samples; sample++)
+    {
+        uint64_t start = now_ns();
+        uint64_t start_cycles = now_cycles();
+
+        size_t output_len;
+        for (size_t i = 0; i < repetitions; i++)
+            convert(result, input, result->input_len, buffer, &output_len);
+
+        uint64_t end_cycles = now_cycles();
+        uint64_t end = now_ns();
+
+        if (sample < 0)
+            continue;
+
+        nanos[sample] = (double)(end - start) / (double)repetitions;
+        cycles[sample] = (double)(end_cycles - start_cycles) / (double)repetitions;
+    }
+
+    qsort(nanos, samples, sizeof(double), compare_doubles);
+    qsort(cycles, samples, sizeof(double), compare_doubles);
+
+    // Faster samples have higher throughput, so the percentiles of the throughput are reversed
+    double bytes = (double)result->input_len;
+    result->repetitions = repetitions;
+    result->gbps_median = bytes / percentile(nanos, samples, 50);
+    result->gbps_p10 = bytes / percentile(nanos, samples, 90);
+    result->gbps_p90 = bytes / percentile(nanos, samples, 10);
+    result->cpb_median = bytes > 0 ? percentile(cycles, samples, 50) / bytes : 0;
+    result->cpb_p10 = bytes > 0 ? percentile(cycles, samples, 10) / bytes : 0;
+    result->cpb_p90 = bytes > 0 ? percentile(cycles, samples, 90) / bytes : 0;
+
+    free(nanos);
+    free(cycles);
+
+    *output = buffer;
+    return true;
+}
+
+// Adds an empty result to the end of a growing array of results
+//
+// results: Pointer to the array of results, reallocated as needed
+// len: Pointer to the length of the array, increased by one
+//
+// return: The new result, or NULL if there wasn't enough memory
+static bench_result* add_result(bench_result** results, size_t* len)
+{
+    bench_result* new_results = realloc(*results, sizeof(bench_result) * (*len + 1));
+    if (new_results == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory for the results\n");
+        return NULL;
+    }
+
+    *results = new_results;
+    bench_result* result = &new_results[(*len)++];
+    memset(result, 0, sizeof *result);
+    return result;
+}
+
+// Finds where every short string starts when an input is split in strings of SHORT_STRING_LEN bytes,
+// moving every cut forward to the next codepoint boundary
+//
+// is_utf8: If the input is in UTF-8, otherwise it's in UTF-16
+// input: The input
+// input_len: The size of the input, in bytes
+// count: Pointer to a variable that will receive the number of strings
+//
+// return: The offsets of the strings, in bytes, followed by the size of the input,
+// allocated with malloc, or NULL if there wasn't enough memory
+static size_t* split_short_strings(bool is_utf8, char const* input, size_t input_len, size_t* count)
+{
+    size_t len = (input_len + SHORT_STRING_LEN - 1) / SHORT_STRING_LEN;
+    size_t* offsets = malloc(sizeof(size_t) * (len + 1));
+    if (offsets == NULL)
+        return NULL;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        size_t offset = i * SHORT_STRING_LEN;
+
+        if (is_utf8)
+        {
+            // Continuation bytes never start a codepoint
+            while (offset > 0 && offset < input_len && ((uint8_t)input[offset] & 0xC0) == 0x80)
+                offset++;
+        }
+        else if (offset > 0 && offset + sizeof(utf16_t) <= input_len)
+        {
+            // A low surrogate after a high surrogate is part of its codepoint
+            utf16_t previous = ((utf16_t const*)input)[offset / sizeof(utf16_t) - 1];
+            utf16_t current = ((utf16_t const*)input)[offset / sizeof(utf16_t)];
+            if ((previous & 0xFC00) == 0xD800 && (current & 0xFC00) == 0xDC00)
+                offset += sizeof(utf16_t);
+        }
+
+        offsets[i] = offset < input_len ? offset : input_len;
+    }
+
+    offsets[len] = input_len;
+    *count = len;
+    return offsets;
+}
+
+// Converts every short string of an input one by one, a number of times
+//
+// offsets: The offsets of the strings, as returned by split_short_strings
+// count: The number of strings
+// repetitions: How many times every string is converted
+// buffer: Where to write the output of every string
+static void convert_short_strings(bench_result const* result, char const* input, size_t const* offsets, size_t count, size_t repetitions, char* buffer)
+{
+    for (size_t i = 0; i < repetitions; i++)
+    {
+        for (size_t j = 0; j < count; j++)
+        {
+            size_t output_len;
+            convert(result, input + offsets[j], offsets[j + 1] - offsets[j], buffer, &output_len);
+        }
+    }
+}
+
+// Measures the latency of converting short strings, by splitting the input in short strings
+// and converting them one by one
+//
+// result: The benchmark, with its implementation, direction and input size filled in.
+// Receives the median time to convert one of the strings.
+// input: The input
+// samples: The number of timed samples
+// warmup: The number of untimed samples
+//
+// return: If the latency was measured successfully
+static bool measure_short_strings(bench_result* result, char const* input, int samples, int warmup)
+{
+    size_t count = 0;
+    size_t* offsets = split_short_strings(result->is_utf8, input, result->input_len, &count);
+
+    // Strings are at most a codepoint longer than SHORT_STRING_LEN, which is well below twice as long
+    char* buffer = malloc(output_bound(result->is_utf8, 2 * SHORT_STRING_LEN));
+    double* nanos = malloc(sizeof(double) * samples);
+    if (offsets == NULL || buffer == NULL || nanos == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory to benchmark short strings of %s\n", result->name);
+        free(offsets);
+        free(buffer);
+        free(nanos);
+        return false;
+    }
+
+    result->short_ns_median = 0;
+    if (count > 0)
+    {
+        // Convert every string repeatedly until a sample is long enough to be measured precisely
+        size_t repetitions = 1;
+        for (;;)
+        {
+            uint64_t start = now_ns();
+            convert_short_strings(result, input, offsets, count, repetitions, buffer);
+
+            if (now_ns() - start >= MIN_SAMPLE_NS || repetitions >= SIZE_MAX / 2)
+                break;
+
+            repetitions *= 2;
+        }
+
+        for (int sample = -warmup; sample < samples; sample++)
+        {
+            uint64_t start = now_ns();
+            convert_short_strings(result, input, offsets, count, repetitions, buffer);
+            uint64_t end = now_ns();
+
+            if (sample >= 0)
+                nanos[sample] = (double)(end - start) / (double)(repetitions * count);
+        }
+
+        qsort(nanos, samples, sizeof(double), compare_doubles);
+        result->short_ns_median = percentile(nanos, samples, 50);
+    }
+
+    free(offsets);
+    free(buffer);
+    free(nanos);
+    return true;
+}
+
+#ifdef BENCH_HAS_PEAK_MEMORY
+
+// Reads a memory size of this process from /proc/self/status
+//
+// field: The name of the field, followed by a colon
+//
+// return: The size, in KiB, or -1 if it couldn't be read
+static long read_memory_kib(char const* field)
+{
+    FILE* file = fopen("/proc/self/status", "r");
+    if (file == NULL)
+        return -1;
+
+    long kib = -1;
+    char line[256];
+    size_t field_len = strlen(field);
+    while (kib < 0 && fgets(line, sizeof line, file) != NULL)
+    {
+        if (strncmp(line, field, field_len) == 0)
+            kib = strtol(line + field_len, NULL, 10);
+    }
+
+    fclose(file);
+    return kib;
+}
+
+// Resets the peak memory of this process to its current memory
+//
+// return: If the peak was reset
+static bool reset_peak_memory(void)
+{
+    FILE* file = fopen("/proc/self/clear_refs", "w");
+    if (file == NULL)
+        return false;
+
+    bool written = fputs("5", file) >= 0;
+    return fclose(file) == 0 && written;
+}
+
+#endif
+
+// Measures the peak memory of converting an input once, from allocating the output to freeing it.
+// The converter allocates its output with the allocating conversion, like its callers would,
+// and the others allocate the upper bound of the output, like their callers must.
+// Memory is measured as the resident memory of the process, so only the parts of a buffer that
+// are actually written count, and it's only as precise as the kernel's accounting of it.
+//
+// result: The benchmark, with its implementation, direction and input size filled in.
+// Receives the peak memory, or -1 if it can't be measured.
+// input: The input
+static void measure_peak_memory(bench_result* result, char const* input)
+{
+    result->peak_kib = -1;
+
+#ifdef BENCH_HAS_PEAK_MEMORY
+#ifdef __GLIBC__
+    // Memory freed by earlier conversions would be reused without counting as new resident memory,
+    // so large buffers always get fresh pages and unused pages are given back before measuring
+    mallopt(M_MMAP_THRESHOLD, 128 * 1024);
+    malloc_trim(0);
+#endif
+
+    long before = read_memory_kib("VmRSS:");
+    if (before < 0 || !reset_peak_memory())
+        return;
+
+    if (result->impl == BASELINE_CONVERTER && result->is_utf8)
+    {
+        size_t output_len;
+        utf16_t* output = utf8_to_utf16_alloc((utf8_t const*)input, result->input_len / sizeof(utf8_t), NULL, &output_len);
+        utf16_free(output, output_len, NULL);
+    }
+    else if (result->impl == BASELINE_CONVERTER)
+    {
+        size_t output_len;
+        utf8_t* output = utf16_to_utf8_alloc((utf16_t const*)input, result->input_len / sizeof(utf16_t), NULL, &output_len);
+        utf8_free(output, output_len, NULL);
+    }
+    else
+    {
+        size_t output_len;
+        char* output = malloc(output_bound(result->is_utf8, result->input_len) + 1);
+        if (output != NULL)
+            convert(result, input, result->input_len, output, &output_len);
+        free(output);
+    }
+
+    long peak = read_memory_kib("VmHWM:");
+    if (peak >= before)
+        result->peak_kib = peak - before;
+#endif
+}
+
+// Compares every available implementation with the converter on the same input, benchmarking
+// each of them and measuring the latency of short strings and the peak memory of all of them.
+// The other implementations reject ill-formed input, so they're only run on well-formed input.
+//
+// results: Pointer to the array of results, reallocated as new results are added
+// results_len: Pointer to the length of the array
+// converter_index: The index of the result of the converter, which must have been benchmarked already
+// input: The input
+// converter_output: The output of the converter
+// available: Which implementations are available
+// samples: The number of timed samples
+// warmup: The number of untimed samples
+//
+// return: If all implementations were benchmarked successfully
+static bool compare_baselines(
+    bench_result** results, size_t* results_len, size_t converter_index,
+    char const* input, char const* converter_output,
+    bool const* available, int samples, int warmup)
+{
+    bench_result* converter = &(*results)[converter_index];
+    converter->compared = true;
+    converter->matches = true;
+    measure_peak_memory(converter, input);
+    if (!measure_short_strings(converter, input, samples, warmup))
+        return false;
+
+    bool well_formed = converter->is_utf8
+        ? utf8_validate((utf8_t const*)input, converter->input_len / sizeof(utf8_t), NULL)
+        : utf16_validate((utf16_t const*)input, converter->input_len / sizeof(utf16_t), NULL);
+
+    for (int impl = BASELINE_CONVERTER + 1; well_formed && impl < BASELINE_COUNT; impl++)
+    {
+        if (!available[impl])
+            continue;
+
+        bench_result* result = add_result(results, results_len);
+        if (result == NULL)
+            return false;
+
+        // Adding a result may have moved the converter's
+        converter = &(*results)[converter_index];
+        *result = *converter;
+        result->impl = (baseline_impl)impl;
+
+        char* output;
+        if (!run_benchmark(result, input, samples, warmup, &output))
+            return false;
+
+        result->matches = result->output_len == converter->output_len
+            && memcmp(output, converter_output, converter->output_len) == 0;
+        free(output);
+
+        if (!result->matches)
+            fprintf(stderr, "The output of %s is different from the converter's for %s\n", baseline_name(result->impl), result->name);
+
+        measure_peak_memory(result, input);
+        if (!measure_short_strings(result, input, samples, warmup))
+            return false;
+    }
+
+    return true;
+}
+
+// Prints the result of a benchmark to stdout, as a row of the results table
+static void print_result(bench_result const* result)
+{
+    printf("%-40.40s %-14s", result->name, result->is_utf8 ? "UTF-8->UTF-16" : "UTF-16->UTF-8");
+
+    if (result->compared)
+        printf(" %-10s", baseline_name(result->impl));
+
+    printf(" %12zu %8.3f %8.3f %8.3f", result->input_len, result->gbps_median, result->gbps_p10, result->gbps_p90);
+
+#ifdef BENCH_HAS_CYCLES
+    printf(" %8.3f %8.3f %8.3f", result->cpb_median, result->cpb_p10, result->cpb_p90);
+#endif
+
+    if (result->compared)
+    {
+        printf(" %10.1f", result->short_ns_median);
+
+        if (result->peak_kib >= 0)
+            printf(" %10ld", result->peak_kib);
+        else
+            printf(" %10s", "n/a");
+
+        printf(" %5s", result->impl == BASELINE_CONVERTER ? "-" : result->matches ? "yes" : "NO");
+    }
+
+    printf("\n");
+}
+
+// Writes the results of all benchmarks to a file, as JSON
+//
+// path: The path of the file to write to. Its contents will be completely overwritten.
+// results: The results of the benchmarks
+// len: Length of 'results'
+//
+// return: If the file was written successfully
+static bool write_json(char const* path, bench_result const* results, size_t len)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Unable to open file %s for writing\n", path);
+        return false;
+    }
+
+    fprintf(file, "[\n");
+    for (size_t i = 0; i < len; i++)
+    {
+        bench_result const* result = &results[i];
+
+        // File names are written as they are, so they must not need escaping
+        fprintf(file, "  {\"name\": \"%s\", \"direction\": \"%s\", ", result->name, result->is_utf8 ? "utf8-to-utf16" : "utf16-to-utf8");
+        fprintf(file, "\"input_bytes\": %zu, \"output_bytes\": %zu, \"repetitions\": %zu, ", result->input_len, result->output_len, result->repetitions);
+        fprintf(file, "\"gbps\": {\"median\": %.4f, \"p10\": %.4f, \"p90\": %.4f}", result->gbps_median, result->gbps_p10, result->gbps_p90);
+#ifdef BENCH_HAS_CYCLES
+        fprintf(file, ", \"cycles_per_byte\": {\"median\": %.4f, \"p10\": %.4f, \"p90\": %.4f}", result->cpb_median, result->cpb_p10, result->cpb_p90);
+#endif
+        if (result->compared)
+        {
+            fprintf(file, ", \"implementation\": \"%s\", \"short_string_ns\": %.2f, ", baseline_name(result->impl), result->short_ns_median);
+            if (result->peak_kib >= 0)
+                fprintf(file, "\"peak_kib\": %ld, ", result->peak_kib);
+            else
+                fprintf(file, "\"peak_kib\": null, ");
+            fprintf(file, "\"matches\": %s", result->matches ? "true" : "false");
+        }
+        fprintf(file, "}%s\n", i + 1 < len ? "," : "");
+    }
+    fprintf(file, "]\n");
+
+    bool failed = ferror(file) != 0;
+    fclose(file);
+
+    if (failed)
+        fprintf(stderr, "Error writing to %s, its contents may be corrupted\n", path);
+
+    return !failed;
+}
+
+// Benchmarks input files in both directions, the second one converting back the output of the first
+//
+// compare_with: Which implementations to compare the converter with, or NULL to only benchmark the converter
+//
+// return: If all files were benchmarked successfully
+static bool bench_files(char const* const* paths, int paths_len, bool const* compare_with, int samples, int warmup, bench_result** results, size_t* results_len)
+{
+    for (int i = 0; i < paths_len; i++)
+    {
+        char const* path = paths[i];
+
+        bool is_utf8;
+        if (ends_with(path, ".utf8.txt")) { is_utf8 = true; }
+        else if (ends_with(path, ".utf16.txt")) { is_utf8 = false; }
+        else
+        {
+            fprintf(stderr, "Input %s must be named *.utf8.txt or *.utf16.txt\n", path);
+            return false;
+        }
+
+        char* input;
+        size_t input_len;
+        if (!read_file(path, &input, &input_len))
+            return false;
+
+        for (int direction = 0; direction < 2; direction++)
+        {
+            size_t index = *results_len;
+            bench_result* result = add_result(results, results_len);
+            if (result == NULL)
+                return false;
+
+            snprintf(result->name, sizeof result->name, "%s", path);
+            result->impl = BASELINE_CONVERTER;
+            result->is_utf8 = direction == 0 ? is_utf8 : !is_utf8;
+            result->input_len = input_len;
+
+            char* output;
+            if (!run_benchmark(result, input, samples, warmup, &output))
+                return false;
+
+            if (compare_with != NULL && !compare_baselines(results, results_len, index, input, output, compare_with, samples, warmup))
+                return false;
+
+            for (size_t j = index; j < *results_len; j++)
+                print_result(&(*results)[j]);
+
+            free(input);
+            input = output;
+            input_len = (*results)[index].output_len;
+        }
+
+        free(input);
+    }
+
+    return true;
+}
+
+// Benchmarks generated inputs of every mix and size, in both directions
+//
+// compare_with: Which implementations to compare the converter with, or NULL to only benchmark the converter
+//
+// return: If all inputs were benchmarked successfully
+static bool bench_sweep(size_t max_size, int invalid_percent, bool const* compare_with, int samples, int warmup, bench_result** results, size_t* results_len)
+{
+    for (int mix = 0; mix < CORPUS_MIX_COUNT; mix++)
+    {
+        for (size_t size = SWEEP_MIN_SIZE; size <= max_size; size *= SWEEP_SIZE_FACTOR)
+        {
+            // Each direction gets its own input, so invalid encodings are generated for both
+            for (int direction = 0; direction < 2; direction++)
+            {
+                size_t index = *results_len;
+                bench_result* result = add_result(results, results_len);
+                if (result == NULL)
+                    return false;
+
+                snprintf(result->name, sizeof result->name, "%s/%zu", corpus_mix_name((corpus_mix)mix), size);
+                result->impl = BASELINE_CONVERTER;
+                result->is_utf8 = direction == 0;
+                result->input_len = size;
+
+                char* input = malloc(size);
+                if (input == NULL)
+                {
+                    fprintf(stderr, "Unable to allocate enough memory to generate %s\n", result->name);
+                    return false;
+                }
+
+                corpus_generate((corpus_mix)mix, invalid_percent, result->is_utf8, input, size);
+
+                char* output;
+                bool success = run_benchmark(result, input, samples, warmup, &output);
+                if (success)
+                {
+                    if (compare_with != NULL)
+                        success = compare_baselines(results, results_len, index, input, output, compare_with, samples, warmup);
+
+                    free(output);
+                }
+
+                free(input);
+                if (!success)
+                    return false;
+
+                for (size_t j = index; j < *results_len; j++)
+                    print_result(&(*results)[j]);
+            }
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char const* argv[])
+{
+    int samples = DEFAULT_SAMPLES;
+    int warmup = DEFAULT_WARMUP;
+    char const* json_path = NULL;
+    bool sweep = false;
+    bool compare = false;
+    size_t max_size = DEFAULT_SWEEP_MAX_SIZE;
+    int invalid_percent = DEFAULT_INVALID_PERCENT;
+
+    int first_input = 1;
+    while (first_input < argc && strncmp(argv[first_input], "--", 2) == 0)
+    {
+        char const* option = argv[first_input++];
+
+        if (strcmp(option, "--sweep") == 0)
+        {
+            sweep = true;
+            continue;
+        }
+
+        if (strcmp(option, "--compare") == 0)
+        {
+            compare = true;
+            continue;
+        }
+
+        if (first_input >= argc)
+            return help(argv[0]);
+
+        char const* value = argv[first_input++];
+
+        if (strcmp(option, "--samples") == 0)
+            samples = atoi(value);
+        else if (strcmp(option, "--warmup") == 0)
+            warmup = atoi(value);
+        else if (strcmp(option, "--json") == 0)
+            json_path = value;
+        else if (strcmp(option, "--max-size") == 0)
+            max_size = (size_t)strtoull(value, NULL, 10);
+        else if (strcmp(option, "--invalid-percent") == 0)
+            invalid_percent = atoi(value);
+        else
+            return help(argv[0]);
+    }
+
+    bool has_inputs = first_input < argc;
+    if (sweep == has_inputs || samples <= 0 || warmup < 0 || invalid_percent < 0 || invalid_percent > 100)
+        return help(argv[0]);
+
+    // The converter is always available, the others depend on the C library
+    bool available[BASELINE_COUNT];
+    for (int impl = 0; compare && impl < BASELINE_COUNT; impl++)
+    {
+        available[impl] = baseline_open((baseline_impl)impl);
+        if (!available[impl])
+            fprintf(stderr, "%s is not available, so it won't be compared\n", baseline_name((baseline_impl)impl));
+    }
+
+    printf("%-40s %-14s", "Input", "Direction");
+    if (compare)
+        printf(" %-10s", "Impl");
+    printf(" %12s %8s %8s %8s", "Bytes", "GB/s", "p10", "p90");
+#ifdef BENCH_HAS_CYCLES
+    printf(" %8s %8s %8s", "cyc/B", "p10", "p90");
+#endif
+    if (compare)
+        printf(" %10s %10s %5s", "ns/short", "Peak KiB", "Match");
+    printf("\n");
+
+    bench_result* results = NULL;
+    size_t results_len = 0;
+    bool const* compare_with = compare ? available : NULL;
+
+    bool success;
+    if (sweep)
+        success = bench_sweep(max_size, invalid_percent, compare_with, samples, warmup, &results, &results_len);
+    else
+        success = bench_files(argv + first_input, argc - first_input, compare_with, samples, warmup, &results, &results_len);
+
+    // Outputs that differ from the converter's were already reported, but still fail the comparison
+    bool all_match = true;
+    for (size_t i = 0; i < results_len; i++)
+        all_match = all_match && (!results[i].compared || results[i].matches);
+
+    if (success && json_path != NULL)
+        success = write_json(json_path, results, results_len);
+
+    for (int impl = 0; compare && impl < BASELINE_COUNT; impl++)
+    {
+        if (available[impl])
+            baseline_close((baseline_impl)impl);
+    }
+
+    free(results);
+
+    return success && all_match ? EXIT_SUCCESS : EXIT_FAILURE;
+}
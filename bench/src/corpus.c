@@ -0,0 +1,195 @@
+#include "corpus.h"
+#include <stdint.h>
+#include <string.h>
+
+// The seed of the random number generator, fixed so that the text is always the same
+#define CORPUS_SEED UINT64_C(0x9E3779B97F4A7C15)
+
+// The maximum number of bytes that a single generated codepoint or invalid encoding takes
+#define MAX_ENCODED_LEN 4
+
+static char const* const mix_names[CORPUS_MIX_COUNT] =
+{
+    "ascii",
+    "latin1",
+    "cjk",
+    "emoji",
+    "mixed",
+    "invalid"
+};
+
+char const* corpus_mix_name(corpus_mix mix)
+{
+    return mix_names[mix];
+}
+
+bool corpus_parse_mix(char const* name, corpus_mix* mix)
+{
+    for (int i = 0; i < CORPUS_MIX_COUNT; i++)
+    {
+        if (strcmp(name, mix_names[i]) == 0)
+        {
+            *mix = (corpus_mix)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Gets the next number of a xorshift64* random number generator
+// state: The state of the generator, never zero
+static uint64_t next_random(uint64_t* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+// Gets a random number from 0 up to, but not including, a limit
+static uint32_t random_below(uint64_t* state, uint32_t limit)
+{
+    return (uint32_t)((next_random(state) >> 32) % limit);
+}
+
+// Picks a random codepoint for a mix, other than CORPUS_MIXED or CORPUS_INVALID
+static uint32_t random_codepoint(uint64_t* state, corpus_mix mix)
+{
+    // Spaces and letters are weighted like real text
+    static char const ascii[] = "     eeettaaoinshrdlucmfwypvbgkqjxzETAOINS,.\n";
+
+    switch (mix)
+    {
+    case CORPUS_LATIN1:
+        if (random_below(state, 2) == 0)
+            return (uint8_t)ascii[random_below(state, sizeof ascii - 1)];
+        return 0xC0 + random_below(state, 0x40);
+
+    case CORPUS_CJK:
+        if (random_below(state, 8) == 0)
+            return (uint8_t)ascii[random_below(state, sizeof ascii - 1)];
+        return 0x4E00 + random_below(state, 0x5200);
+
+    case CORPUS_EMOJI:
+        if (random_below(state, 8) == 0)
+            return ' ';
+        return 0x1F300 + random_below(state, 0x700);
+
+    default:
+        return (uint8_t)ascii[random_below(state, sizeof ascii - 1)];
+    }
+}
+
+// Encodes a codepoint
+//
+// return: The number of bytes written
+static size_t encode(uint32_t codepoint, bool is_utf8, uint8_t* output)
+{
+    if (!is_utf8)
+    {
+        if (codepoint <= 0xFFFF)
+        {
+            output[0] = (uint8_t)codepoint;
+            output[1] = (uint8_t)(codepoint >> 8);
+            return 2;
+        }
+
+        codepoint -= 0x10000;
+        uint32_t high = 0xD800 | (codepoint >> 10);
+        uint32_t low = 0xDC00 | (codepoint & 0x3FF);
+        output[0] = (uint8_t)high;
+        output[1] = (uint8_t)(high >> 8);
+        output[2] = (uint8_t)low;
+        output[3] = (uint8_t)(low >> 8);
+        return 4;
+    }
+
+    if (codepoint <= 0x7F)
+    {
+        output[0] = (uint8_t)codepoint;
+        return 1;
+    }
+
+    if (codepoint <= 0x7FF)
+    {
+        output[0] = (uint8_t)(0xC0 | (codepoint >> 6));
+        output[1] = (uint8_t)(0x80 | (codepoint & 0x3F));
+        return 2;
+    }
+
+    if (codepoint <= 0xFFFF)
+    {
+        output[0] = (uint8_t)(0xE0 | (codepoint >> 12));
+        output[1] = (uint8_t)(0x80 | ((codepoint >> 6) & 0x3F));
+        output[2] = (uint8_t)(0x80 | (codepoint & 0x3F));
+        return 3;
+    }
+
+    output[0] = (uint8_t)(0xF0 | (codepoint >> 18));
+    output[1] = (uint8_t)(0x80 | ((codepoint >> 12) & 0x3F));
+    output[2] = (uint8_t)(0x80 | ((codepoint >> 6) & 0x3F));
+    output[3] = (uint8_t)(0x80 | (codepoint & 0x3F));
+    return 4;
+}
+
+// Writes a random invalid encoding, of every kind that the conversions replace with U+FFFD
+//
+// return: The number of bytes written
+static size_t encode_invalid(uint64_t* state, bool is_utf8, uint8_t* output)
+{
+    // Unmatched high or low surrogate
+    if (!is_utf8)
+    {
+        output[0] = 0;
+        output[1] = random_below(state, 2) == 0 ? 0xD8 : 0xDC;
+        return 2;
+    }
+
+    static uint8_t const invalid[][MAX_ENCODED_LEN] =
+    {
+        { 0x80 },             // Rogue continuation byte
+        { 0xC0, 0x81 },       // Overlong encoding
+        { 0xE2, 0x82 },       // Truncated sequence
+        { 0xED, 0xA0, 0x80 }, // Surrogate
+        { 0xF5 },             // Leading byte above UNICODE_MAX
+    };
+    static size_t const invalid_lens[] = { 1, 2, 2, 3, 1 };
+
+    size_t kind = random_below(state, sizeof invalid_lens / sizeof invalid_lens[0]);
+    memcpy(output, invalid[kind], invalid_lens[kind]);
+    return invalid_lens[kind];
+}
+
+void corpus_generate(corpus_mix mix, int invalid_percent, bool is_utf8, char* buffer, size_t len)
+{
+    uint64_t state = CORPUS_SEED ^ ((uint64_t)mix << 32);
+    uint8_t* output = (uint8_t*)buffer;
+    size_t index = 0;
+
+    while (index < len)
+    {
+        uint8_t encoded[MAX_ENCODED_LEN];
+        size_t encoded_len;
+
+        if (mix == CORPUS_INVALID && (int)random_below(&state, 100) < invalid_percent)
+        {
+            encoded_len = encode_invalid(&state, is_utf8, encoded);
+        }
+        else
+        {
+            corpus_mix codepoint_mix = mix;
+            if (mix == CORPUS_MIXED || mix == CORPUS_INVALID)
+                codepoint_mix = (corpus_mix)random_below(&state, CORPUS_MIXED);
+
+            encoded_len = encode(random_codepoint(&state, codepoint_mix), is_utf8, encoded);
+        }
+
+        // Pad the end with spaces, so that nothing is cut in half
+        if (index + encoded_len > len)
+            encoded_len = encode(' ', is_utf8, encoded);
+
+        memcpy(output + index, encoded, encoded_len);
+        index += encoded_len;
+    }
+}
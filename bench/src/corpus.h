@@ -0,0 +1,39 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+// Deterministic generator of synthetic text, used to measure how the conversions
+// scale with the size and the contents of their input.
+// The same mix, size and invalid percentage always generate exactly the same text.
+
+// The kinds of text that can be generated
+typedef enum
+{
+    CORPUS_ASCII,   // Only ASCII
+    CORPUS_LATIN1,  // Latin-1 supplement letters mixed with ASCII, like most European languages
+    CORPUS_CJK,     // CJK ideographs with some ASCII punctuation
+    CORPUS_EMOJI,   // Emoji outside of the BMP, encoded with 4 UTF-8 characters or a surrogate pair
+    CORPUS_MIXED,   // All of the above, randomly interleaved codepoint by codepoint
+    CORPUS_INVALID, // Like CORPUS_MIXED, with a percentage of codepoints replaced by invalid encodings
+    CORPUS_MIX_COUNT
+} corpus_mix;
+
+// Gets the name of a mix, as accepted by corpus_parse_mix
+char const* corpus_mix_name(corpus_mix mix);
+
+// Finds a mix by its name
+//
+// name: The name of the mix
+// mix: Pointer to a variable that will receive the mix
+//
+// return: If there is a mix with that name
+bool corpus_parse_mix(char const* name, corpus_mix* mix);
+
+// Generates synthetic text
+//
+// mix: The kind of text to generate
+// invalid_percent: The percentage of codepoints replaced by invalid encodings, only used by CORPUS_INVALID
+// is_utf8: If the text should be encoded in UTF-8 instead of UTF-16LE
+// buffer: Where to write the text
+// len: The size of the text, in bytes. Must be even for UTF-16.
+void corpus_generate(corpus_mix mix, int invalid_percent, bool is_utf8, char* buffer, size_t len);
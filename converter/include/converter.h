@@ -1,10 +1,13 @@
 #pragma once
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
 
 typedef uint8_t utf8_t; // The type of a single UTF-8 character
 typedef uint16_t utf16_t; // The type of a single UTF-16 character
+typedef uint32_t utf32_t; // The type of a single UTF-32 character
+typedef uint8_t latin1_t; // The type of a single Latin-1 (ISO-8859-1) character
 
 /*
  * Converts a UTF-16 string to a UTF-8 string.
@@ -34,6 +37,104 @@ size_t utf16_to_utf8(
     utf8_t* utf8,         size_t utf8_len
 );
 
+/*
+ * Converts as much of a UTF-16 string to a UTF-8 string as fits in the UTF-8 buffer.
+ * Conversion stops before the first codepoint that doesn't fit, so it can be
+ * resumed later from where it stopped, for example after flushing the buffer.
+ *
+ * utf16:
+ * The UTF-16 string, not null-terminated.
+ *
+ * utf16_len:
+ * The length of the UTF-16 string, in 16-bit characters.
+ *
+ * utf8:
+ * The buffer where the resulting UTF-8 string will be stored. Must not be NULL.
+ *
+ * utf8_len:
+ * The length of the UTF-8 buffer, in 8-bit characters.
+ *
+ * utf16_read:
+ * Pointer to a variable that will receive the number of 16-bit characters
+ * that were converted from the UTF-16 string.
+ * If this is less than utf16_len, the buffer is full, and conversion
+ * should be resumed from this index.
+ *
+ * return:
+ * The number of characters written to the utf8 buffer.
+ *
+ */
+size_t utf16_to_utf8_partial(
+    utf16_t const* utf16, size_t utf16_len,
+    utf8_t* utf8,         size_t utf8_len,
+    size_t* utf16_read
+);
+
+/*
+ * Calculates an upper bound for the size of a UTF-8 buffer that can hold
+ * a converted UTF-16 string, without looking at the string.
+ * 
+ * utf16_len: 
+ * The length of the UTF-16 string, in 16-bit characters.
+ * 
+ * return:
+ * A buffer size, in 8-bit characters, that is always large enough to hold the
+ * conversion of any UTF-16 string of this length.
+ * The result is meaningless if it doesn't fit in a size_t.
+ * 
+ */
+size_t utf16_to_utf8_bound(size_t utf16_len);
+
+/*
+ * Converts a UTF-16 string to a UTF-8 string in a single pass, without
+ * calculating the exact size of the UTF-8 string beforehand.
+ * 
+ * utf16: 
+ * The UTF-16 string, not null-terminated.
+ * 
+ * utf16_len: 
+ * The length of the UTF-16 string, in 16-bit characters.
+ * 
+ * utf8: 
+ * The buffer where the resulting UTF-8 string will be stored.
+ * Must be able to hold at least utf16_to_utf8_bound(utf16_len) 8-bit characters.
+ * 
+ * return:
+ * The number of characters written to the utf8 buffer.
+ * The rest of the buffer can be discarded or reused.
+ * 
+ */
+size_t utf16_to_utf8_bounded(
+    utf16_t const* utf16, size_t utf16_len, 
+    utf8_t* utf8
+);
+
+/*
+ * Converts a UTF-16 string that is known to be well-formed to a UTF-8 string,
+ * as fast as possible.
+ * Nothing is checked: the string isn't validated and the size of the buffer isn't checked
+ * on every write. Both preconditions must hold, or the result is undefined.
+ * Use utf16_validate or utf16_to_utf8_with_policy on strings that aren't trusted.
+ * 
+ * utf16: 
+ * The UTF-16 string, not null-terminated. Must be well-formed, as checked by utf16_validate.
+ * 
+ * utf16_len: 
+ * The length of the UTF-16 string, in 16-bit characters.
+ * 
+ * utf8: 
+ * The buffer where the resulting UTF-8 string will be stored.
+ * Must be able to hold at least utf16_to_utf8_bound(utf16_len) 8-bit characters.
+ * 
+ * return:
+ * The number of characters written to the utf8 buffer.
+ * 
+ */
+size_t utf16_to_utf8_unchecked(
+    utf16_t const* utf16, size_t utf16_len, 
+    utf8_t* utf8
+);
+
 /*
  * Converts a UTF-8 string to a UTF-16 string.
  * 
@@ -63,3 +164,1634 @@ size_t utf8_to_utf16(
     utf8_t const* utf8, size_t utf8_len, 
     utf16_t* utf16,     size_t utf16_len
 );
+
+/*
+ * Converts as much of a UTF-8 string to a UTF-16 string as fits in the UTF-16 buffer.
+ * Conversion stops before the first codepoint that doesn't fit, so it can be
+ * resumed later from where it stopped, for example after flushing the buffer.
+ *
+ * utf8:
+ * The UTF-8 string, not null-terminated.
+ *
+ * utf8_len:
+ * The length of the UTF-8 string, in 8-bit characters.
+ *
+ * utf16:
+ * The buffer where the resulting UTF-16 string will be stored. Must not be NULL.
+ *
+ * utf16_len:
+ * The length of the UTF-16 buffer, in 16-bit characters.
+ *
+ * utf8_read:
+ * Pointer to a variable that will receive the number of 8-bit characters
+ * that were converted from the UTF-8 string.
+ * If this is less than utf8_len, the buffer is full, and conversion
+ * should be resumed from this index.
+ *
+ * return:
+ * The number of characters written to the utf16 buffer, in 16-bit characters.
+ *
+ */
+size_t utf8_to_utf16_partial(
+    utf8_t const* utf8, size_t utf8_len,
+    utf16_t* utf16,     size_t utf16_len,
+    size_t* utf8_read
+);
+
+/*
+ * Calculates an upper bound for the size of a UTF-16 buffer that can hold
+ * a converted UTF-8 string, without looking at the string.
+ * 
+ * utf8_len: 
+ * The length of the UTF-8 string, in 8-bit characters.
+ * 
+ * return:
+ * A buffer size, in 16-bit characters, that is always large enough to hold the
+ * conversion of any UTF-8 string of this length.
+ * 
+ */
+size_t utf8_to_utf16_bound(size_t utf8_len);
+
+/*
+ * Converts a UTF-8 string to a UTF-16 string in a single pass, without
+ * calculating the exact size of the UTF-16 string beforehand.
+ * 
+ * utf8: 
+ * The UTF-8 string, not null-terminated.
+ * 
+ * utf8_len: 
+ * The length of the UTF-8 string, in 8-bit characters.
+ * 
+ * utf16: 
+ * The buffer where the resulting UTF-16 string will be stored.
+ * Must be able to hold at least utf8_to_utf16_bound(utf8_len) 16-bit characters.
+ * 
+ * return:
+ * The number of characters written to the utf16 buffer, in 16-bit characters.
+ * The rest of the buffer can be discarded or reused.
+ * 
+ */
+size_t utf8_to_utf16_bounded(
+    utf8_t const* utf8, size_t utf8_len, 
+    utf16_t* utf16
+);
+
+/*
+ * Converts a UTF-8 string that is known to be well-formed to a UTF-16 string,
+ * as fast as possible.
+ * Nothing is checked: the string isn't validated and the size of the buffer isn't checked
+ * on every write. Both preconditions must hold, or the result is undefined.
+ * Use utf8_validate or utf8_to_utf16_with_policy on strings that aren't trusted.
+ * 
+ * utf8: 
+ * The UTF-8 string, not null-terminated. Must be well-formed, as checked by utf8_validate.
+ * 
+ * utf8_len: 
+ * The length of the UTF-8 string, in 8-bit characters.
+ * 
+ * utf16: 
+ * The buffer where the resulting UTF-16 string will be stored.
+ * Must be able to hold at least utf8_to_utf16_bound(utf8_len) 16-bit characters.
+ * 
+ * return:
+ * The number of characters written to the utf16 buffer, in 16-bit characters.
+ * 
+ */
+size_t utf8_to_utf16_unchecked(
+    utf8_t const* utf8, size_t utf8_len, 
+    utf16_t* utf16
+);
+
+/*
+ * The state of a streaming conversion from UTF-8 to UTF-16.
+ * 
+ * A stream converts a string that is split in chunks, one chunk at a time,
+ * carrying codepoints that are cut off between chunks over to the next chunk.
+ * The result is exactly the same as converting the whole string at once.
+ * 
+ * Streams don't allocate any memory, and can be declared on the stack.
+ * Its fields are private and should only be handled by the stream functions.
+ * 
+ */
+typedef struct
+{
+    utf8_t pending[4];
+    int pending_len;
+} utf8_to_utf16_stream;
+
+/*
+ * Prepares a stream to convert a new string from UTF-8 to UTF-16.
+ * 
+ * stream:
+ * The stream to initialize.
+ * 
+ */
+void utf8_to_utf16_stream_init(utf8_to_utf16_stream* stream);
+
+/*
+ * Calculates the size of a UTF-16 buffer that can always hold the conversion of
+ * a chunk fed to a UTF-8 to UTF-16 stream.
+ * 
+ * utf8_len:
+ * The length of the UTF-8 chunk, in 8-bit characters.
+ * 
+ * return:
+ * The size of the UTF-16 buffer, in 16-bit characters.
+ * 
+ */
+size_t utf8_to_utf16_stream_bound(size_t utf8_len);
+
+/*
+ * Converts the next chunk of a UTF-8 string to UTF-16.
+ * 
+ * stream:
+ * The stream the chunk belongs to.
+ * 
+ * utf8:
+ * The UTF-8 chunk. It can end in the middle of a codepoint.
+ * 
+ * utf8_len:
+ * The length of the UTF-8 chunk, in 8-bit characters.
+ * 
+ * utf16:
+ * The buffer where the resulting UTF-16 string will be stored.
+ * Must be able to hold at least utf8_to_utf16_stream_bound(utf8_len) 16-bit characters.
+ * 
+ * utf16_len:
+ * The length of the UTF-16 buffer, in 16-bit characters.
+ * 
+ * return:
+ * The number of characters written to the utf16 buffer, in 16-bit characters.
+ * 
+ */
+size_t utf8_to_utf16_stream_feed(
+    utf8_to_utf16_stream* stream,
+    utf8_t const* utf8, size_t utf8_len,
+    utf16_t* utf16,     size_t utf16_len
+);
+
+/*
+ * Finishes converting a UTF-8 string to UTF-16.
+ * If the string ended in the middle of a codepoint, it is converted to U+FFFD.
+ * The stream can then be reused for a new string.
+ * 
+ * stream:
+ * The stream to finish.
+ * 
+ * utf16:
+ * The buffer where the rest of the UTF-16 string will be stored.
+ * Must be able to hold at least one 16-bit character.
+ * 
+ * utf16_len:
+ * The length of the UTF-16 buffer, in 16-bit characters.
+ * 
+ * return:
+ * The number of characters written to the utf16 buffer, in 16-bit characters.
+ * 
+ */
+size_t utf8_to_utf16_stream_finish(utf8_to_utf16_stream* stream, utf16_t* utf16, size_t utf16_len);
+
+/*
+ * The state of a streaming conversion from UTF-16 to UTF-8.
+ * 
+ * A stream converts a string that is split in chunks, one chunk at a time,
+ * carrying surrogate pairs that are cut off between chunks over to the next chunk.
+ * The result is exactly the same as converting the whole string at once.
+ * 
+ * Streams don't allocate any memory, and can be declared on the stack.
+ * Its fields are private and should only be handled by the stream functions.
+ * 
+ */
+typedef struct
+{
+    utf16_t pending;
+    int pending_len;
+} utf16_to_utf8_stream;
+
+/*
+ * Prepares a stream to convert a new string from UTF-16 to UTF-8.
+ * 
+ * stream:
+ * The stream to initialize.
+ * 
+ */
+void utf16_to_utf8_stream_init(utf16_to_utf8_stream* stream);
+
+/*
+ * Calculates the size of a UTF-8 buffer that can always hold the conversion of
+ * a chunk fed to a UTF-16 to UTF-8 stream.
+ * 
+ * utf16_len:
+ * The length of the UTF-16 chunk, in 16-bit characters.
+ * 
+ * return:
+ * The size of the UTF-8 buffer, in 8-bit characters.
+ * 
+ */
+size_t utf16_to_utf8_stream_bound(size_t utf16_len);
+
+/*
+ * Converts the next chunk of a UTF-16 string to UTF-8.
+ * 
+ * stream:
+ * The stream the chunk belongs to.
+ * 
+ * utf16:
+ * The UTF-16 chunk. It can end in the middle of a surrogate pair.
+ * 
+ * utf16_len:
+ * The length of the UTF-16 chunk, in 16-bit characters.
+ * 
+ * utf8:
+ * The buffer where the resulting UTF-8 string will be stored.
+ * Must be able to hold at least utf16_to_utf8_stream_bound(utf16_len) 8-bit characters.
+ * 
+ * utf8_len:
+ * The length of the UTF-8 buffer, in 8-bit characters.
+ * 
+ * return:
+ * The number of characters written to the utf8 buffer.
+ * 
+ */
+size_t utf16_to_utf8_stream_feed(
+    utf16_to_utf8_stream* stream,
+    utf16_t const* utf16, size_t utf16_len,
+    utf8_t* utf8,         size_t utf8_len
+);
+
+/*
+ * Finishes converting a UTF-16 string to UTF-8.
+ * If the string ended with a high surrogate, it is converted to U+FFFD.
+ * The stream can then be reused for a new string.
+ * 
+ * stream:
+ * The stream to finish.
+ * 
+ * utf8:
+ * The buffer where the rest of the UTF-8 string will be stored.
+ * Must be able to hold at least three 8-bit characters.
+ * 
+ * utf8_len:
+ * The length of the UTF-8 buffer, in 8-bit characters.
+ * 
+ * return:
+ * The number of characters written to the utf8 buffer.
+ * 
+ */
+size_t utf16_to_utf8_stream_finish(utf16_to_utf8_stream* stream, utf8_t* utf8, size_t utf8_len);
+
+/*
+ * A task of a parallel conversion.
+ * 
+ * context:
+ * The context given to the task runner, which must be passed to the task unchanged.
+ * 
+ * index:
+ * The index of the task, from 0 to the number of tasks - 1.
+ * 
+ */
+typedef void (*utf_task)(void* context, size_t index);
+
+/*
+ * A function that runs the tasks of a parallel conversion, such as a hook into
+ * an existing thread pool.
+ * It must call 'task' once for every index from 0 to 'task_count' - 1,
+ * in any order and on any threads, and only return after all tasks have finished.
+ * 
+ * runner_context:
+ * The context given to the parallel conversion function.
+ * 
+ * task:
+ * The task to run.
+ * 
+ * task_context:
+ * The context that must be passed to every task.
+ * 
+ * task_count:
+ * The number of tasks to run.
+ * 
+ */
+typedef void (*utf_task_runner)(void* runner_context, utf_task task, void* task_context, size_t task_count);
+
+/*
+ * Converts a UTF-16 string to a UTF-8 string using multiple threads.
+ * The result is exactly the same as utf16_to_utf8.
+ * 
+ * The string is split in up to 'thread_count' chunks that start at codepoint boundaries.
+ * The size of every chunk is calculated in parallel, and then every chunk is
+ * converted in parallel into its place in the UTF-8 buffer.
+ * Strings that are too short to benefit from this are converted on the calling thread.
+ * 
+ * utf16, utf16_len, utf8, utf8_len:
+ * The same as utf16_to_utf8.
+ * 
+ * thread_count:
+ * The maximum number of chunks to split the string in, usually the number of available CPUs.
+ * 
+ * runner:
+ * The function that runs the conversion tasks.
+ * If set to NULL, a new thread is started for every task if the C11 threads library
+ * is available, or every task is run on the calling thread if it isn't.
+ * 
+ * runner_context:
+ * A value that is passed to 'runner' unchanged.
+ * 
+ * return:
+ * The same as utf16_to_utf8.
+ * 
+ */
+size_t utf16_to_utf8_parallel(
+    utf16_t const* utf16, size_t utf16_len,
+    utf8_t* utf8,         size_t utf8_len,
+    size_t thread_count, utf_task_runner runner, void* runner_context
+);
+
+/*
+ * Converts a UTF-8 string to a UTF-16 string using multiple threads.
+ * The result is exactly the same as utf8_to_utf16.
+ * 
+ * The string is split in up to 'thread_count' chunks that start at codepoint boundaries.
+ * The size of every chunk is calculated in parallel, and then every chunk is
+ * converted in parallel into its place in the UTF-16 buffer.
+ * Strings that are too short to benefit from this are converted on the calling thread.
+ * 
+ * utf8, utf8_len, utf16, utf16_len:
+ * The same as utf8_to_utf16.
+ * 
+ * thread_count:
+ * The maximum number of chunks to split the string in, usually the number of available CPUs.
+ * 
+ * runner:
+ * The function that runs the conversion tasks.
+ * If set to NULL, a new thread is started for every task if the C11 threads library
+ * is available, or every task is run on the calling thread if it isn't.
+ * 
+ * runner_context:
+ * A value that is passed to 'runner' unchanged.
+ * 
+ * return:
+ * The same as utf8_to_utf16.
+ * 
+ */
+size_t utf8_to_utf16_parallel(
+    utf8_t const* utf8, size_t utf8_len,
+    utf16_t* utf16,     size_t utf16_len,
+    size_t thread_count, utf_task_runner runner, void* runner_context
+);
+
+/*
+ * Checks if a UTF-16 string is well-formed, without converting it.
+ * A string is well-formed if utf16_to_utf8 wouldn't replace any of its characters
+ * with U+FFFD, which means it has no unpaired surrogates.
+ * 
+ * utf16:
+ * The UTF-16 string, not null-terminated.
+ * 
+ * utf16_len:
+ * The length of the UTF-16 string, in 16-bit characters.
+ * 
+ * error_index:
+ * Pointer to a variable that will receive the index of the first invalid character,
+ * or utf16_len if the string is well-formed. May be NULL.
+ * 
+ * return:
+ * If the string is well-formed.
+ * 
+ */
+bool utf16_validate(utf16_t const* utf16, size_t utf16_len, size_t* error_index);
+
+/*
+ * Checks if a UTF-8 string is well-formed, without converting it.
+ * A string is well-formed if utf8_to_utf16 wouldn't replace any of its sequences
+ * with U+FFFD, which means it has no overlong encodings, surrogates, codepoints above
+ * U+10FFFF, truncated sequences or continuation bytes without a leading byte.
+ * 
+ * utf8:
+ * The UTF-8 string, not null-terminated.
+ * 
+ * utf8_len:
+ * The length of the UTF-8 string, in 8-bit characters.
+ * 
+ * error_index:
+ * Pointer to a variable that will receive the index of the first character of the
+ * first invalid sequence, or utf8_len if the string is well-formed. May be NULL.
+ * 
+ * return:
+ * If the string is well-formed.
+ * 
+ */
+bool utf8_validate(utf8_t const* utf8, size_t utf8_len, size_t* error_index);
+
+/*
+ * What a conversion does with invalid input: unpaired surrogates in UTF-16, and the
+ * sequences that utf8_validate rejects in UTF-8.
+ * 
+ * CONVERSION_REPLACE:
+ * Every invalid sequence is replaced with U+FFFD, like the regular conversion functions do.
+ * 
+ * CONVERSION_STOP:
+ * Conversion stops at the first invalid sequence, so input that will be rejected isn't converted.
+ * 
+ * CONVERSION_SKIP:
+ * Invalid sequences are left out of the output.
+ * 
+ */
+typedef enum
+{
+    CONVERSION_REPLACE,
+    CONVERSION_STOP,
+    CONVERSION_SKIP
+} conversion_error_policy;
+
+/*
+ * Converts a UTF-16 string to a UTF-8 string, handling unpaired surrogates with a policy.
+ * With CONVERSION_REPLACE, the result is the same as utf16_to_utf8.
+ * Every policy has its own conversion loop, so none of them slow down the others.
+ * 
+ * utf16, utf16_len, utf8, utf8_len:
+ * The same as utf16_to_utf8.
+ * 
+ * policy:
+ * What to do with unpaired surrogates.
+ * 
+ * error_index:
+ * Pointer to a variable that will receive the index of the first unpaired surrogate,
+ * or utf16_len if there is none. May be NULL.
+ * With CONVERSION_STOP, this is where the conversion stopped.
+ * 
+ * return:
+ * The same as utf16_to_utf8, only counting the characters before the first unpaired
+ * surrogate with CONVERSION_STOP.
+ * 
+ */
+size_t utf16_to_utf8_with_policy(
+    utf16_t const* utf16, size_t utf16_len,
+    utf8_t* utf8,         size_t utf8_len,
+    conversion_error_policy policy, size_t* error_index
+);
+
+/*
+ * Converts a UTF-8 string to a UTF-16 string, handling invalid sequences with a policy.
+ * With CONVERSION_REPLACE, the result is the same as utf8_to_utf16.
+ * Every policy has its own conversion loop, so none of them slow down the others.
+ * 
+ * utf8, utf8_len, utf16, utf16_len:
+ * The same as utf8_to_utf16.
+ * 
+ * policy:
+ * What to do with invalid sequences.
+ * 
+ * error_index:
+ * Pointer to a variable that will receive the index of the first character of the first
+ * invalid sequence, or utf8_len if there is none, the same as utf8_validate. May be NULL.
+ * With CONVERSION_STOP, this is where the conversion stopped.
+ * 
+ * return:
+ * The same as utf8_to_utf16, only counting the characters before the first invalid
+ * sequence with CONVERSION_STOP.
+ * 
+ */
+size_t utf8_to_utf16_with_policy(
+    utf8_t const* utf8, size_t utf8_len,
+    utf16_t* utf16,     size_t utf16_len,
+    conversion_error_policy policy, size_t* error_index
+);
+
+/*
+ * Statistics about the input of conversions, to see what the converted text looks like
+ * and how much of it the vectorized code handles.
+ * 
+ * Conversions add their counts to the statistics, so they must be zeroed before the first
+ * conversion, and can then be shared by many conversions to get totals.
+ * 
+ */
+typedef struct
+{
+    // Valid codepoints, by the length of their UTF-8 encoding
+    size_t ascii;
+    size_t two_byte;
+    size_t three_byte;
+    size_t four_byte;
+    // Valid codepoints outside of the BMP, which are encoded as a surrogate pair in UTF-16.
+    // The same as four_byte, but kept on its own for readers that think in UTF-16.
+    size_t surrogate_pairs;
+
+    // Invalid UTF-8 sequences that end before all of their continuation bytes
+    size_t truncated;
+    // Invalid UTF-8 sequences that encode a codepoint with more bytes than needed
+    size_t overlong;
+    // Invalid UTF-8 sequences that encode a surrogate
+    size_t surrogates;
+    // Invalid UTF-8 sequences that encode a codepoint above U+10FFFF
+    size_t out_of_range;
+    // UTF-8 continuation bytes without a leading byte, and bytes 0xF8 and above
+    size_t invalid_bytes;
+    // UTF-16 surrogates that aren't part of a pair
+    size_t unpaired_surrogates;
+
+    // The number of input characters converted by the vectorized code
+    size_t fast_path_len;
+    // The number of input characters converted one codepoint at a time
+    size_t slow_path_len;
+} conversion_stats;
+
+/*
+ * Converts a UTF-16 string to a UTF-8 string, and counts what was converted.
+ * The result is the same as utf16_to_utf8, which doesn't pay for the counting.
+ * 
+ * utf16, utf16_len, utf8, utf8_len:
+ * The same as utf16_to_utf8.
+ * 
+ * stats:
+ * The statistics to add the counts of this conversion to. Must not be NULL.
+ * 
+ * return:
+ * The same as utf16_to_utf8.
+ * 
+ */
+size_t utf16_to_utf8_with_stats(
+    utf16_t const* utf16, size_t utf16_len,
+    utf8_t* utf8,         size_t utf8_len,
+    conversion_stats* stats
+);
+
+/*
+ * Converts a UTF-8 string to a UTF-16 string, and counts what was converted.
+ * The result is the same as utf8_to_utf16, which doesn't pay for the counting.
+ * 
+ * utf8, utf8_len, utf16, utf16_len:
+ * The same as utf8_to_utf16.
+ * 
+ * stats:
+ * The statistics to add the counts of this conversion to. Must not be NULL.
+ * 
+ * return:
+ * The same as utf8_to_utf16.
+ * 
+ */
+size_t utf8_to_utf16_with_stats(
+    utf8_t const* utf8, size_t utf8_len,
+    utf16_t* utf16,     size_t utf16_len,
+    conversion_stats* stats
+);
+
+/*
+ * Converts a UTF-16 string to a WTF-8 string.
+ *
+ * WTF-8 is UTF-8 that also encodes unpaired surrogates, with the same 3-byte sequences
+ * as any other codepoint in the BMP. This makes the conversion lossless: every UTF-16 string,
+ * well-formed or not, can be converted back exactly with wtf8_to_utf16.
+ * Well-formed UTF-16 strings give the same output as utf16_to_utf8.
+ *
+ * utf16, utf16_len, wtf8, wtf8_len:
+ * The same as utf16_to_utf8.
+ *
+ * return:
+ * The same as utf16_to_utf8.
+ *
+ */
+size_t utf16_to_wtf8(
+    utf16_t const* utf16, size_t utf16_len,
+    utf8_t* wtf8,         size_t wtf8_len
+);
+
+/*
+ * Converts a WTF-8 string to a UTF-16 string.
+ *
+ * Encoded surrogates are converted to a single UTF-16 character with their value, so the
+ * output of utf16_to_wtf8 converts back to the original UTF-16 string.
+ * A high surrogate encoded right before a low surrogate converts to a surrogate pair, which is
+ * a well-formed codepoint, even though utf16_to_wtf8 would have encoded it in 4 bytes.
+ * Every other invalid sequence is replaced by U+FFFD, as in utf8_to_utf16.
+ *
+ * wtf8, wtf8_len, utf16, utf16_len:
+ * The same as utf8_to_utf16.
+ *
+ * return:
+ * The same as utf8_to_utf16.
+ *
+ */
+size_t wtf8_to_utf16(
+    utf8_t const* wtf8, size_t wtf8_len,
+    utf16_t* utf16,     size_t utf16_len
+);
+
+/*
+ * The byte order of a UTF-16 string stored in memory or in a file.
+ * 
+ * The regular conversion functions read and write utf16_t in the native byte order
+ * of the CPU. The functions below take or produce an explicit byte order instead,
+ * swapping the bytes of every character while converting if it isn't the native one,
+ * so no separate pass over the string is needed.
+ * 
+ */
+typedef enum
+{
+    UTF16_LITTLE_ENDIAN,
+    UTF16_BIG_ENDIAN
+} utf16_byte_order;
+
+/*
+ * Converts a UTF-16LE string to a UTF-8 string.
+ * The same as utf16_to_utf8, but the UTF-16 string is always read as little endian.
+ * 
+ */
+size_t utf16le_to_utf8(
+    utf16_t const* utf16, size_t utf16_len, 
+    utf8_t* utf8,         size_t utf8_len
+);
+
+/*
+ * Converts a UTF-16BE string to a UTF-8 string.
+ * The same as utf16_to_utf8, but the UTF-16 string is always read as big endian.
+ * 
+ */
+size_t utf16be_to_utf8(
+    utf16_t const* utf16, size_t utf16_len, 
+    utf8_t* utf8,         size_t utf8_len
+);
+
+/*
+ * Converts a UTF-8 string to a UTF-16LE string.
+ * The same as utf8_to_utf16, but the UTF-16 string is always written as little endian.
+ * 
+ */
+size_t utf8_to_utf16le(
+    utf8_t const* utf8, size_t utf8_len, 
+    utf16_t* utf16,     size_t utf16_len
+);
+
+/*
+ * Converts a UTF-8 string to a UTF-16BE string.
+ * The same as utf8_to_utf16, but the UTF-16 string is always written as big endian.
+ * 
+ */
+size_t utf8_to_utf16be(
+    utf8_t const* utf8, size_t utf8_len, 
+    utf16_t* utf16,     size_t utf16_len
+);
+
+/*
+ * Detects the byte order of a UTF-16 string from its byte order mark (BOM).
+ * The BOM is stripped without copying by converting from utf16 + the returned length,
+ * with utf16le_to_utf8 or utf16be_to_utf8 according to the detected byte order.
+ * 
+ * utf16:
+ * The UTF-16 string, not null-terminated.
+ * 
+ * utf16_len:
+ * The length of the UTF-16 string, in 16-bit characters.
+ * 
+ * order:
+ * Pointer to a variable that will receive the byte order of the string.
+ * Left unchanged if the string has no BOM, so it can be initialized with a default.
+ * 
+ * return:
+ * The length of the BOM, in 16-bit characters: 1 if the string starts with a BOM, 0 otherwise.
+ * 
+ */
+size_t utf16_detect_bom(utf16_t const* utf16, size_t utf16_len, utf16_byte_order* order);
+
+/*
+ * Writes a byte order mark (BOM) at the start of a UTF-16 buffer.
+ * A string with a BOM is produced without copying by converting to utf16 + the returned length
+ * with utf8_to_utf16le or utf8_to_utf16be, using the same byte order.
+ * 
+ * utf16:
+ * The buffer where the BOM will be written.
+ * If set to NULL, indicates that the function should just return the size of the BOM.
+ * 
+ * utf16_len:
+ * The length of the UTF-16 buffer, in 16-bit characters.
+ * Ignored if utf16 is NULL.
+ * 
+ * order:
+ * The byte order to write the BOM in.
+ * 
+ * return:
+ * The number of characters written to the utf16 buffer, or that would be written if it is NULL:
+ * 1, or 0 if the buffer is empty.
+ * 
+ */
+size_t utf16_write_bom(utf16_t* utf16, size_t utf16_len, utf16_byte_order order);
+
+/*
+ * Converts a UTF-8 string to a UTF-32 string.
+ * Invalid sequences are replaced by U+FFFD, exactly as in utf8_to_utf16.
+ * 
+ * utf8: 
+ * The UTF-8 string, not null-terminated.
+ * 
+ * utf8_len: 
+ * The length of the UTF-8 string, in 8-bit characters.
+ * 
+ * utf32: 
+ * The buffer where the resulting UTF-32 string will be stored.
+ * If set to NULL, indicates that the function should just calculate
+ * the required buffer size and not actually perform any conversions.
+ * 
+ * utf32_len: 
+ * The length of the UTF-32 buffer, in 32-bit characters.
+ * Ignored if utf32 is NULL.
+ * 
+ * return:
+ * If utf32 is NULL, the size of the required UTF-32 buffer, in 32-bit characters.
+ * Otherwise, the number of characters written to the utf32 buffer, in 32-bit characters.
+ * Conversion stops when the buffer is full.
+ * 
+ */
+size_t utf8_to_utf32(
+    utf8_t const* utf8, size_t utf8_len, 
+    utf32_t* utf32,     size_t utf32_len
+);
+
+/*
+ * Converts a UTF-16 string to a UTF-32 string.
+ * Unpaired surrogates are replaced by U+FFFD, exactly as in utf16_to_utf8.
+ * 
+ * utf16: 
+ * The UTF-16 string, not null-terminated.
+ * 
+ * utf16_len: 
+ * The length of the UTF-16 string, in 16-bit characters.
+ * 
+ * utf32: 
+ * The buffer where the resulting UTF-32 string will be stored.
+ * If set to NULL, indicates that the function should just calculate
+ * the required buffer size and not actually perform any conversions.
+ * 
+ * utf32_len: 
+ * The length of the UTF-32 buffer, in 32-bit characters.
+ * Ignored if utf32 is NULL.
+ * 
+ * return:
+ * If utf32 is NULL, the size of the required UTF-32 buffer, in 32-bit characters.
+ * Otherwise, the number of characters written to the utf32 buffer, in 32-bit characters.
+ * Conversion stops when the buffer is full.
+ * 
+ */
+size_t utf16_to_utf32(
+    utf16_t const* utf16, size_t utf16_len, 
+    utf32_t* utf32,       size_t utf32_len
+);
+
+/*
+ * Converts a UTF-32 string to a UTF-8 string.
+ * Characters that aren't valid codepoints (surrogates and values above U+10FFFF)
+ * are replaced by U+FFFD.
+ * 
+ * utf32: 
+ * The UTF-32 string, not null-terminated.
+ * 
+ * utf32_len: 
+ * The length of the UTF-32 string, in 32-bit characters.
+ * 
+ * utf8: 
+ * The buffer where the resulting UTF-8 string will be stored.
+ * If set to NULL, indicates that the function should just calculate
+ * the required buffer size and not actually perform any conversions.
+ * 
+ * utf8_len: 
+ * The length of the UTF-8 buffer, in 8-bit characters.
+ * Ignored if utf8 is NULL.
+ * 
+ * return:
+ * If utf8 is NULL, the size of the required UTF-8 buffer.
+ * Otherwise, the number of characters written to the utf8 buffer.
+ * Conversion stops before the first codepoint that doesn't fit in the buffer.
+ * 
+ */
+size_t utf32_to_utf8(
+    utf32_t const* utf32, size_t utf32_len, 
+    utf8_t* utf8,         size_t utf8_len
+);
+
+/*
+ * Converts a UTF-32 string to a UTF-16 string.
+ * Characters that aren't valid codepoints (surrogates and values above U+10FFFF)
+ * are replaced by U+FFFD.
+ * 
+ * utf32: 
+ * The UTF-32 string, not null-terminated.
+ * 
+ * utf32_len: 
+ * The length of the UTF-32 string, in 32-bit characters.
+ * 
+ * utf16: 
+ * The buffer where the resulting UTF-16 string will be stored.
+ * If set to NULL, indicates that the function should just calculate
+ * the required buffer size and not actually perform any conversions.
+ * 
+ * utf16_len: 
+ * The length of the UTF-16 buffer, in 16-bit characters.
+ * Ignored if utf16 is NULL.
+ * 
+ * return:
+ * If utf16 is NULL, the size of the required UTF-16 buffer, in 16-bit characters.
+ * Otherwise, the number of characters written to the utf16 buffer, in 16-bit characters.
+ * Conversion stops before the first codepoint that doesn't fit in the buffer.
+ * 
+ */
+size_t utf32_to_utf16(
+    utf32_t const* utf32, size_t utf32_len, 
+    utf16_t* utf16,       size_t utf16_len
+);
+
+/*
+ * Converts a UTF-8 string to a Latin-1 (ISO-8859-1) string.
+ * Latin-1 encodes every codepoint up to U+00FF as a single character with the same value.
+ * Codepoints above U+00FF and invalid sequences are replaced by '?', Latin-1 having no U+FFFD.
+ * 
+ * utf8: 
+ * The UTF-8 string, not null-terminated.
+ * 
+ * utf8_len: 
+ * The length of the UTF-8 string, in 8-bit characters.
+ * 
+ * latin1: 
+ * The buffer where the resulting Latin-1 string will be stored.
+ * If set to NULL, indicates that the function should just calculate
+ * the required buffer size and not actually perform any conversions.
+ * 
+ * latin1_len: 
+ * The length of the Latin-1 buffer, in 8-bit characters.
+ * Ignored if latin1 is NULL.
+ * 
+ * return:
+ * If latin1 is NULL, the size of the required Latin-1 buffer, which is the number of codepoints.
+ * Otherwise, the number of characters written to the latin1 buffer.
+ * Conversion stops when the buffer is full.
+ * 
+ */
+size_t utf8_to_latin1(
+    utf8_t const* utf8, size_t utf8_len, 
+    latin1_t* latin1,   size_t latin1_len
+);
+
+/*
+ * Converts a UTF-16 string to a Latin-1 (ISO-8859-1) string.
+ * Codepoints above U+00FF and unpaired surrogates are replaced by '?', as in utf8_to_latin1.
+ * 
+ * utf16: 
+ * The UTF-16 string, not null-terminated.
+ * 
+ * utf16_len: 
+ * The length of the UTF-16 string, in 16-bit characters.
+ * 
+ * latin1: 
+ * The buffer where the resulting Latin-1 string will be stored.
+ * If set to NULL, indicates that the function should just calculate
+ * the required buffer size and not actually perform any conversions.
+ * 
+ * latin1_len: 
+ * The length of the Latin-1 buffer, in 8-bit characters.
+ * Ignored if latin1 is NULL.
+ * 
+ * return:
+ * If latin1 is NULL, the size of the required Latin-1 buffer, which is the number of codepoints.
+ * Otherwise, the number of characters written to the latin1 buffer.
+ * Conversion stops when the buffer is full.
+ * 
+ */
+size_t utf16_to_latin1(
+    utf16_t const* utf16, size_t utf16_len, 
+    latin1_t* latin1,     size_t latin1_len
+);
+
+/*
+ * Converts a Latin-1 (ISO-8859-1) string to a UTF-8 string.
+ * Every Latin-1 string is valid, so nothing is ever replaced.
+ * 
+ * latin1: 
+ * The Latin-1 string, not null-terminated.
+ * 
+ * latin1_len: 
+ * The length of the Latin-1 string, in 8-bit characters.
+ * 
+ * utf8: 
+ * The buffer where the resulting UTF-8 string will be stored.
+ * If set to NULL, indicates that the function should just calculate
+ * the required buffer size and not actually perform any conversions.
+ * 
+ * utf8_len: 
+ * The length of the UTF-8 buffer, in 8-bit characters.
+ * Ignored if utf8 is NULL.
+ * 
+ * return:
+ * If utf8 is NULL, the size of the required UTF-8 buffer.
+ * Otherwise, the number of characters written to the utf8 buffer.
+ * Conversion stops before the first codepoint that doesn't fit in the buffer.
+ * 
+ */
+size_t latin1_to_utf8(
+    latin1_t const* latin1, size_t latin1_len, 
+    utf8_t* utf8,           size_t utf8_len
+);
+
+/*
+ * Converts a Latin-1 (ISO-8859-1) string to a UTF-16 string.
+ * Every Latin-1 character is converted to a single UTF-16 character, so nothing is ever replaced.
+ * 
+ * latin1: 
+ * The Latin-1 string, not null-terminated.
+ * 
+ * latin1_len: 
+ * The length of the Latin-1 string, in 8-bit characters.
+ * 
+ * utf16: 
+ * The buffer where the resulting UTF-16 string will be stored.
+ * If set to NULL, indicates that the function should just calculate
+ * the required buffer size and not actually perform any conversions.
+ * 
+ * utf16_len: 
+ * The length of the UTF-16 buffer, in 16-bit characters.
+ * Ignored if utf16 is NULL.
+ * 
+ * return:
+ * If utf16 is NULL, the size of the required UTF-16 buffer, which is always latin1_len.
+ * Otherwise, the number of characters written to the utf16 buffer, in 16-bit characters.
+ * Conversion stops when the buffer is full.
+ * 
+ */
+size_t latin1_to_utf16(
+    latin1_t const* latin1, size_t latin1_len, 
+    utf16_t* utf16,         size_t utf16_len
+);
+
+/*
+ * Checks if a UTF-8 string can be converted to Latin-1 without replacing anything:
+ * it must be valid and only have codepoints up to U+00FF.
+ * 
+ * This is much faster than a conversion, so it can be used to pick the narrowest storage
+ * for a string before converting it.
+ * 
+ * utf8: 
+ * The UTF-8 string, not null-terminated.
+ * 
+ * utf8_len: 
+ * The length of the UTF-8 string, in 8-bit characters.
+ * 
+ * return:
+ * If utf8_to_latin1 would convert the string without replacing any codepoint.
+ * 
+ */
+bool utf8_fits_latin1(utf8_t const* utf8, size_t utf8_len);
+
+/*
+ * Checks if a UTF-16 string can be converted to Latin-1 without replacing anything:
+ * it must only have characters up to U+00FF.
+ * The same as utf8_fits_latin1.
+ * 
+ */
+bool utf16_fits_latin1(utf16_t const* utf16, size_t utf16_len);
+
+/*
+ * Checks if a UTF-8 string only has ASCII characters, which are encoded the same way
+ * in UTF-8, Latin-1 and ASCII.
+ * 
+ * utf8: 
+ * The UTF-8 string, not null-terminated.
+ * 
+ * utf8_len: 
+ * The length of the UTF-8 string, in 8-bit characters.
+ * 
+ * return:
+ * If every character of the string is up to U+007F.
+ * 
+ */
+bool utf8_is_ascii(utf8_t const* utf8, size_t utf8_len);
+
+/*
+ * Checks if a UTF-16 string only has ASCII characters.
+ * The same as utf8_is_ascii.
+ * 
+ */
+bool utf16_is_ascii(utf16_t const* utf16, size_t utf16_len);
+
+/*
+ * Decodes the codepoint at an index of a UTF-8 string.
+ * Invalid sequences are decoded to U+FFFD, exactly as in utf8_to_utf32.
+ * 
+ * utf8: 
+ * The UTF-8 string, not null-terminated.
+ * 
+ * utf8_len: 
+ * The length of the UTF-8 string, in 8-bit characters.
+ * 
+ * utf8_index:
+ * Pointer to the index of the first character of the codepoint, which must be less than utf8_len.
+ * Advanced past the codepoint.
+ * 
+ * return:
+ * The decoded codepoint.
+ * 
+ */
+utf32_t utf8_decode_next(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index);
+
+/*
+ * Decodes the codepoint at an index of a UTF-16 string.
+ * Unpaired surrogates are decoded to U+FFFD, exactly as in utf16_to_utf32.
+ * 
+ * utf16: 
+ * The UTF-16 string, not null-terminated.
+ * 
+ * utf16_len: 
+ * The length of the UTF-16 string, in 16-bit characters.
+ * 
+ * utf16_index:
+ * Pointer to the index of the first character of the codepoint, which must be less than utf16_len.
+ * Advanced past the codepoint.
+ * 
+ * return:
+ * The decoded codepoint.
+ * 
+ */
+utf32_t utf16_decode_next(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index);
+
+/*
+ * An iterator over the codepoints of a UTF-8 string, which decodes them one at a time
+ * without converting the string to another buffer.
+ * Invalid sequences are returned as U+FFFD, exactly as in utf8_to_utf32.
+ * 
+ * Iterators don't allocate any memory, and can be declared on the stack.
+ * 'index' is the index of the next codepoint on the string, and can be read to find where
+ * every codepoint starts and ends. The other fields are private.
+ * 
+ */
+typedef struct
+{
+    utf8_t const* utf8;
+    size_t utf8_len;
+    size_t index;
+} utf8_iterator;
+
+/*
+ * Prepares an iterator to start at the first codepoint of a UTF-8 string.
+ * 
+ * iterator:
+ * The iterator to initialize.
+ * 
+ * utf8: 
+ * The UTF-8 string, not null-terminated.
+ * 
+ * utf8_len: 
+ * The length of the UTF-8 string, in 8-bit characters.
+ * 
+ */
+static inline void utf8_iterator_init(utf8_iterator* iterator, utf8_t const* utf8, size_t utf8_len)
+{
+    iterator->utf8 = utf8;
+    iterator->utf8_len = utf8_len;
+    iterator->index = 0;
+}
+
+/*
+ * Gets the next codepoint of a UTF-8 string and advances the iterator past it.
+ * ASCII characters are decoded inline, everything else with utf8_decode_next.
+ * 
+ * iterator:
+ * The iterator.
+ * 
+ * codepoint:
+ * Pointer to a variable that will receive the codepoint. Left unchanged at the end of the string.
+ * 
+ * return:
+ * If there was a codepoint, false at the end of the string.
+ * 
+ */
+static inline bool utf8_iterator_next(utf8_iterator* iterator, utf32_t* codepoint)
+{
+    if (iterator->index >= iterator->utf8_len)
+        return false;
+
+    utf8_t leading = iterator->utf8[iterator->index];
+    if (leading < 0x80)
+    {
+        *codepoint = leading;
+        iterator->index++;
+        return true;
+    }
+
+    *codepoint = utf8_decode_next(iterator->utf8, iterator->utf8_len, &iterator->index);
+    return true;
+}
+
+/*
+ * Gets the next codepoint of a UTF-8 string without advancing the iterator.
+ * The same as utf8_iterator_next otherwise.
+ * 
+ */
+static inline bool utf8_iterator_peek(utf8_iterator const* iterator, utf32_t* codepoint)
+{
+    utf8_iterator copy = *iterator;
+    return utf8_iterator_next(&copy, codepoint);
+}
+
+/*
+ * Gets the next codepoints of a UTF-8 string and advances the iterator past them.
+ * 
+ * iterator:
+ * The iterator.
+ * 
+ * codepoints:
+ * The buffer where the codepoints will be stored.
+ * 
+ * codepoints_len:
+ * The maximum number of codepoints to get, usually the length of the buffer.
+ * 
+ * return:
+ * The number of codepoints stored in the buffer.
+ * If this is less than codepoints_len, the iterator reached the end of the string.
+ * 
+ */
+size_t utf8_iterator_next_n(utf8_iterator* iterator, utf32_t* codepoints, size_t codepoints_len);
+
+/*
+ * Advances the iterator past a run of ASCII characters, checking them in bulk.
+ * 
+ * iterator:
+ * The iterator.
+ * 
+ * return:
+ * The number of ASCII characters that were skipped, which can be 0.
+ * Afterwards, the iterator is either at a non-ASCII character or at the end of the string.
+ * 
+ */
+size_t utf8_iterator_skip_ascii(utf8_iterator* iterator);
+
+/*
+ * An iterator over the codepoints of a UTF-16 string, which decodes them one at a time
+ * without converting the string to another buffer.
+ * Unpaired surrogates are returned as U+FFFD, exactly as in utf16_to_utf32.
+ * 
+ * Iterators don't allocate any memory, and can be declared on the stack.
+ * 'index' is the index of the next codepoint on the string, and can be read to find where
+ * every codepoint starts and ends. The other fields are private.
+ * 
+ */
+typedef struct
+{
+    utf16_t const* utf16;
+    size_t utf16_len;
+    size_t index;
+} utf16_iterator;
+
+/*
+ * Prepares an iterator to start at the first codepoint of a UTF-16 string.
+ * The same as utf8_iterator_init.
+ * 
+ */
+static inline void utf16_iterator_init(utf16_iterator* iterator, utf16_t const* utf16, size_t utf16_len)
+{
+    iterator->utf16 = utf16;
+    iterator->utf16_len = utf16_len;
+    iterator->index = 0;
+}
+
+/*
+ * Gets the next codepoint of a UTF-16 string and advances the iterator past it.
+ * Characters that aren't surrogates are decoded inline, surrogates with utf16_decode_next.
+ * The same as utf8_iterator_next otherwise.
+ * 
+ */
+static inline bool utf16_iterator_next(utf16_iterator* iterator, utf32_t* codepoint)
+{
+    if (iterator->index >= iterator->utf16_len)
+        return false;
+
+    utf16_t character = iterator->utf16[iterator->index];
+    if ((character & 0xF800) != 0xD800)
+    {
+        *codepoint = character;
+        iterator->index++;
+        return true;
+    }
+
+    *codepoint = utf16_decode_next(iterator->utf16, iterator->utf16_len, &iterator->index);
+    return true;
+}
+
+/*
+ * Gets the next codepoint of a UTF-16 string without advancing the iterator.
+ * The same as utf16_iterator_next otherwise.
+ * 
+ */
+static inline bool utf16_iterator_peek(utf16_iterator const* iterator, utf32_t* codepoint)
+{
+    utf16_iterator copy = *iterator;
+    return utf16_iterator_next(&copy, codepoint);
+}
+
+/*
+ * Gets the next codepoints of a UTF-16 string and advances the iterator past them.
+ * The same as utf8_iterator_next_n.
+ * 
+ */
+size_t utf16_iterator_next_n(utf16_iterator* iterator, utf32_t* codepoints, size_t codepoints_len);
+
+/*
+ * Advances the iterator past a run of ASCII characters, checking them in bulk.
+ * The same as utf8_iterator_skip_ascii.
+ * 
+ */
+size_t utf16_iterator_skip_ascii(utf16_iterator* iterator);
+
+/*
+ * A UTF-8 string that is part of a batch.
+ * 
+ */
+typedef struct
+{
+    utf8_t const* utf8;
+    size_t utf8_len;
+} utf8_span;
+
+/*
+ * A UTF-16 string that is part of a batch.
+ * 
+ */
+typedef struct
+{
+    utf16_t const* utf16;
+    size_t utf16_len;
+} utf16_span;
+
+/*
+ * Calculates an upper bound for the size of a UTF-16 buffer that can hold the conversion
+ * of a batch of UTF-8 strings, from their lengths alone.
+ * 
+ * strings:
+ * The UTF-8 strings.
+ * 
+ * count:
+ * The number of strings.
+ * 
+ * return:
+ * A buffer size, in 16-bit characters, that is always large enough for utf8_to_utf16_batch
+ * to convert every string.
+ * 
+ */
+size_t utf8_to_utf16_batch_bound(utf8_span const* strings, size_t count);
+
+/*
+ * Converts a batch of UTF-8 strings to UTF-16, one after the other in a single buffer.
+ * Every string is converted on its own, with the same result as utf8_to_utf16.
+ * 
+ * Converting many short strings with a single call avoids the overhead of converting them
+ * one by one, and no sizing pass is needed.
+ * Strings that follow each other in memory, like the values of a column, are also converted
+ * together while they're ASCII, so short strings still get the throughput of the vectorized code.
+ * 
+ * strings:
+ * The UTF-8 strings.
+ * 
+ * count:
+ * The number of strings.
+ * 
+ * utf16:
+ * The buffer where the resulting UTF-16 strings will be stored.
+ * 
+ * utf16_len:
+ * The length of the UTF-16 buffer, in 16-bit characters.
+ * Every string is converted if this is at least utf8_to_utf16_batch_bound(strings, count).
+ * 
+ * offsets:
+ * An array of at least count + 1 elements that will receive the offsets of the strings in
+ * the UTF-16 buffer, in 16-bit characters.
+ * The string N is converted to the characters from offsets[N] up to offsets[N + 1].
+ * 
+ * return:
+ * The number of strings that were converted, from the first one.
+ * Conversion stops before the first string that doesn't fit in the rest of the buffer,
+ * so it can be resumed from there with another buffer.
+ * An ASCII string fits if its own length does, and any other string only fits if its
+ * upper bound does.
+ * Only the offsets up to the returned index are set.
+ * 
+ */
+size_t utf8_to_utf16_batch(
+    utf8_span const* strings, size_t count,
+    utf16_t* utf16,           size_t utf16_len,
+    size_t* offsets
+);
+
+/*
+ * Calculates an upper bound for the size of a UTF-8 buffer that can hold the conversion
+ * of a batch of UTF-16 strings, from their lengths alone.
+ * The same as utf8_to_utf16_batch_bound.
+ * 
+ */
+size_t utf16_to_utf8_batch_bound(utf16_span const* strings, size_t count);
+
+/*
+ * Converts a batch of UTF-16 strings to UTF-8, one after the other in a single buffer.
+ * Every string is converted on its own, with the same result as utf16_to_utf8.
+ * The same as utf8_to_utf16_batch.
+ * 
+ */
+size_t utf16_to_utf8_batch(
+    utf16_span const* strings, size_t count,
+    utf8_t* utf8,              size_t utf8_len,
+    size_t* offsets
+);
+
+/*
+ * A codepoint boundary of a UTF-8 string, with its offset in the string and in its conversion
+ * to UTF-16.
+ * 
+ */
+typedef struct
+{
+    size_t utf8_offset;
+    size_t utf16_offset;
+} utf_offset_checkpoint;
+
+/*
+ * An index of checkpoints over a UTF-8 string, used to translate offsets between the string
+ * and its conversion to UTF-16 without converting everything before them.
+ * 
+ * The fields should only be read. Use utf_offset_index_init, utf_offset_index_reserve and
+ * utf_offset_index_append to change them.
+ * 
+ */
+typedef struct
+{
+    // The checkpoints, sorted by offset. The first one is always at the start of the string.
+    utf_offset_checkpoint* checkpoints;
+    // The number of elements of the checkpoint array
+    size_t capacity;
+    // The number of checkpoints in use
+    size_t count;
+    // The minimum distance between checkpoints, in 8-bit characters
+    size_t stride;
+    // The length of the indexed UTF-8 string, in 8-bit characters
+    size_t utf8_len;
+    // The length of its conversion to UTF-16, in 16-bit characters
+    size_t utf16_len;
+} utf_offset_index;
+
+/*
+ * Calculates how many checkpoints an index needs to cover a UTF-8 string of a given length.
+ * 
+ * utf8_len:
+ * The length of the UTF-8 string, in 8-bit characters.
+ * 
+ * stride:
+ * The minimum distance between checkpoints, in 8-bit characters, or 0 for the default of 4096.
+ * 
+ * return:
+ * The number of checkpoints that are always enough for utf_offset_index_append.
+ * 
+ */
+size_t utf_offset_index_capacity(size_t utf8_len, size_t stride);
+
+/*
+ * Prepares an empty offset index, which covers an empty string.
+ * 
+ * index:
+ * The index to initialize.
+ * 
+ * checkpoints:
+ * The array where the checkpoints will be stored.
+ * It must not be freed while the index is in use.
+ * 
+ * capacity:
+ * The number of elements of the checkpoint array, at least 1.
+ * If the index runs out of checkpoints, translations stay correct but scan further,
+ * until utf_offset_index_reserve gives it more.
+ * 
+ * stride:
+ * The minimum distance between checkpoints, in 8-bit characters, or 0 for the default of 4096.
+ * Smaller strides make translations faster and use more checkpoints.
+ * 
+ */
+void utf_offset_index_init(utf_offset_index* index, utf_offset_checkpoint* checkpoints, size_t capacity, size_t stride);
+
+/*
+ * Moves the checkpoints of an offset index to a larger array, so it can keep adding
+ * checkpoints as the string grows past the length its first array was sized for.
+ * 
+ * The next call to utf_offset_index_append adds the checkpoints that didn't fit before.
+ * 
+ * index:
+ * The index.
+ * 
+ * checkpoints:
+ * The new array of checkpoints, which receives a copy of the ones in use, so the current
+ * array must still be valid: allocate a new one instead of using realloc.
+ * The previous array isn't used anymore afterwards and may be freed.
+ * 
+ * capacity:
+ * The number of elements of the new array, at least the number of checkpoints in use.
+ * 
+ */
+void utf_offset_index_reserve(utf_offset_index* index, utf_offset_checkpoint* checkpoints, size_t capacity);
+
+/*
+ * Extends an offset index to cover a UTF-8 string that grew at its end.
+ * 
+ * Only the part of the string after the last checkpoint is read, so a string can be indexed
+ * as it is appended to, in a single pass over it.
+ * 
+ * index:
+ * The index.
+ * 
+ * utf8:
+ * The whole UTF-8 string, from its start.
+ * Everything that was indexed before must be the same, but the string may have moved.
+ * 
+ * utf8_len:
+ * The length of the UTF-8 string, in 8-bit characters.
+ * Must not be less than the length indexed before.
+ * 
+ */
+void utf_offset_index_append(utf_offset_index* index, utf8_t const* utf8, size_t utf8_len);
+
+/*
+ * Translates an offset of an indexed UTF-8 string to the offset of the same position in its
+ * conversion to UTF-16.
+ * 
+ * index:
+ * The index of the UTF-8 string.
+ * 
+ * utf8:
+ * The indexed UTF-8 string.
+ * 
+ * utf8_offset:
+ * The offset in the UTF-8 string, in 8-bit characters.
+ * Should be at a codepoint boundary.
+ * 
+ * return:
+ * The offset in the UTF-16 string, in 16-bit characters.
+ * This is the same as the length of the conversion of everything before the UTF-8 offset.
+ * Offsets past the end of the string are translated to the end of the UTF-16 string.
+ * 
+ */
+size_t utf_offset_utf8_to_utf16(utf_offset_index const* index, utf8_t const* utf8, size_t utf8_offset);
+
+/*
+ * Translates an offset of the conversion of an indexed UTF-8 string to UTF-16 to the offset
+ * of the same position in the UTF-8 string.
+ * 
+ * index:
+ * The index of the UTF-8 string.
+ * 
+ * utf8:
+ * The indexed UTF-8 string.
+ * 
+ * utf16_offset:
+ * The offset in the UTF-16 string, in 16-bit characters.
+ * 
+ * return:
+ * The offset in the UTF-8 string, in 8-bit characters.
+ * Offsets between the two characters of a surrogate pair are translated to the start
+ * of their codepoint, and offsets past the end of the string are translated to its end.
+ * 
+ */
+size_t utf_offset_utf16_to_utf8(utf_offset_index const* index, utf8_t const* utf8, size_t utf16_offset);
+
+/*
+ * An allocator for the buffers returned by the allocating conversions.
+ * 
+ * Every function receives the context of the allocator as its first argument, along with
+ * the size of the buffer whenever it already exists, so allocators don't need to keep it.
+ * 
+ */
+typedef struct
+{
+    // Allocates a buffer of a size, in bytes. Returns NULL if it can't.
+    void* (*allocate)(void* context, size_t size);
+
+    // Resizes a buffer, moving it if needed, and returns its new address.
+    // Returns NULL and keeps the buffer as is if it can't.
+    // May be NULL, in which case buffers are never resized.
+    void* (*reallocate)(void* context, void* buffer, size_t old_size, size_t new_size);
+
+    // Gives a buffer back to the allocator.
+    // May be NULL, in which case buffers are never given back one by one.
+    void (*deallocate)(void* context, void* buffer, size_t size);
+
+    void* context;
+} utf_allocator;
+
+/*
+ * Converts a UTF-16 string to a UTF-8 string in a buffer allocated for it.
+ * The result is the same as utf16_to_utf8.
+ * 
+ * Short strings are converted in a single pass into a buffer sized with utf16_to_utf8_bound,
+ * which is then shrunk to the size of the result, instead of calculating the size first.
+ * 
+ * utf16, utf16_len:
+ * The same as utf16_to_utf8.
+ * 
+ * allocator:
+ * The allocator for the UTF-8 buffer, or NULL to use malloc.
+ * 
+ * utf8_len:
+ * A pointer to a variable that will receive the length of the UTF-8 string, in 8-bit characters.
+ * May be NULL.
+ * 
+ * return:
+ * The UTF-8 string, followed by a null terminator that isn't part of its length,
+ * or NULL if the buffer couldn't be allocated.
+ * Must be freed with utf8_free and the same allocator.
+ * 
+ */
+utf8_t* utf16_to_utf8_alloc(
+    utf16_t const* utf16, size_t utf16_len,
+    utf_allocator const* allocator,
+    size_t* utf8_len
+);
+
+/*
+ * Frees a UTF-8 string returned by an allocating conversion.
+ * 
+ * utf8:
+ * The UTF-8 string. If NULL, nothing happens.
+ * 
+ * utf8_len:
+ * The length of the UTF-8 string, in 8-bit characters, as returned by the conversion.
+ * 
+ * allocator:
+ * The allocator given to the conversion.
+ * 
+ */
+void utf8_free(utf8_t* utf8, size_t utf8_len, utf_allocator const* allocator);
+
+/*
+ * Converts a UTF-8 string to a UTF-16 string in a buffer allocated for it.
+ * The same as utf16_to_utf8_alloc.
+ * 
+ */
+utf16_t* utf8_to_utf16_alloc(
+    utf8_t const* utf8, size_t utf8_len,
+    utf_allocator const* allocator,
+    size_t* utf16_len
+);
+
+/*
+ * Frees a UTF-16 string returned by an allocating conversion.
+ * The same as utf8_free.
+ * 
+ */
+void utf16_free(utf16_t* utf16, size_t utf16_len, utf_allocator const* allocator);
+
+/*
+ * A bump allocator that hands out consecutive parts of a single buffer.
+ * 
+ * Allocating only moves an offset forward, and everything is given back at once with
+ * utf_arena_reset, so many conversions, like all the ones of a request, don't need
+ * a heap allocation each.
+ * Only the last allocation can be freed or resized in place, which is what the
+ * allocating conversions do when they shrink their result.
+ * 
+ * The arena doesn't own its buffer, and never grows: allocations fail once it's full.
+ * 
+ */
+typedef struct
+{
+    uint8_t* buffer;
+    size_t capacity;
+    // The number of bytes of the buffer in use
+    size_t used;
+    // The offset of the last allocation
+    size_t last;
+} utf_arena;
+
+/*
+ * Initializes an empty arena.
+ * 
+ * arena:
+ * The arena.
+ * 
+ * buffer:
+ * The memory handed out by the arena, which must stay valid while the arena is in use.
+ * 
+ * capacity:
+ * The size of the buffer, in bytes.
+ * 
+ */
+void utf_arena_init(utf_arena* arena, void* buffer, size_t capacity);
+
+/*
+ * Gives everything allocated from an arena back at once.
+ * Nothing allocated before can be used anymore.
+ * 
+ * arena:
+ * The arena.
+ * 
+ */
+void utf_arena_reset(utf_arena* arena);
+
+/*
+ * Creates an allocator that allocates from an arena.
+ * Every allocation is aligned to 16 bytes.
+ * 
+ * arena:
+ * The arena, which must stay valid while the allocator is in use.
+ * 
+ * return:
+ * The allocator.
+ * 
+ */
+utf_allocator utf_arena_allocator(utf_arena* arena);
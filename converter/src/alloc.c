@@ -0,0 +1,194 @@
+#include <converter.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The allocating conversions size their buffer with the upper bound of the conversion and
+// convert in a single pass, then give back the unused part of the buffer.
+// The bound is up to three times the converted size, so longer strings are measured first instead,
+// which costs a second pass but never holds on to more memory than needed.
+// Shrinking the last allocation of an arena is free, so both are cheap with arenas.
+
+// The longest input, in input characters, that is converted into a buffer sized with the
+// upper bound of the conversion
+#define ALLOC_SINGLE_PASS_MAX_LEN 4096
+
+// The alignment of every allocation of an arena, enough for any character type
+#define ARENA_ALIGNMENT 16
+
+static void* alloc_default(void* context, size_t size)
+{
+    (void)context;
+    return malloc(size);
+}
+
+static void* realloc_default(void* context, void* buffer, size_t old_size, size_t new_size)
+{
+    (void)context;
+    (void)old_size;
+    return realloc(buffer, new_size);
+}
+
+static void free_default(void* context, void* buffer, size_t size)
+{
+    (void)context;
+    (void)size;
+    free(buffer);
+}
+
+// The allocator used when none is given, which uses the standard library
+static utf_allocator const default_allocator = { alloc_default, realloc_default, free_default, NULL };
+
+// Shrinks a buffer returned by the allocator to the size of its contents.
+// The buffer is kept as is if it can't be shrunk, since it's still large enough.
+//
+// allocator: The allocator that returned the buffer
+// buffer: The buffer
+// old_size: The size of the buffer, in bytes
+// new_size: The size of its contents, in bytes
+//
+// return: The shrunk buffer
+static void* shrink_buffer(utf_allocator const* allocator, void* buffer, size_t old_size, size_t new_size)
+{
+    if (new_size == old_size || allocator->reallocate == NULL)
+        return buffer;
+
+    void* shrunk = allocator->reallocate(allocator->context, buffer, old_size, new_size);
+    return shrunk != NULL ? shrunk : buffer;
+}
+
+utf8_t* utf16_to_utf8_alloc(
+    utf16_t const* utf16, size_t utf16_len,
+    utf_allocator const* allocator,
+    size_t* utf8_len)
+{
+    if (allocator == NULL)
+        allocator = &default_allocator;
+
+    bool single_pass = utf16_len <= ALLOC_SINGLE_PASS_MAX_LEN;
+    size_t capacity = single_pass ? utf16_to_utf8_bound(utf16_len) : utf16_to_utf8(utf16, utf16_len, NULL, 0);
+
+    // Room for the null terminator
+    utf8_t* utf8 = allocator->allocate(allocator->context, (capacity + 1) * sizeof(utf8_t));
+    if (utf8 == NULL)
+        return NULL;
+
+    size_t len = utf16_to_utf8(utf16, utf16_len, utf8, capacity);
+    utf8[len] = 0;
+
+    utf8 = shrink_buffer(allocator, utf8, (capacity + 1) * sizeof(utf8_t), (len + 1) * sizeof(utf8_t));
+
+    if (utf8_len != NULL)
+        *utf8_len = len;
+
+    return utf8;
+}
+
+void utf8_free(utf8_t* utf8, size_t utf8_len, utf_allocator const* allocator)
+{
+    if (allocator == NULL)
+        allocator = &default_allocator;
+
+    if (utf8 != NULL && allocator->deallocate != NULL)
+        allocator->deallocate(allocator->context, utf8, (utf8_len + 1) * sizeof(utf8_t));
+}
+
+utf16_t* utf8_to_utf16_alloc(
+    utf8_t const* utf8, size_t utf8_len,
+    utf_allocator const* allocator,
+    size_t* utf16_len)
+{
+    if (allocator == NULL)
+        allocator = &default_allocator;
+
+    bool single_pass = utf8_len <= ALLOC_SINGLE_PASS_MAX_LEN;
+    size_t capacity = single_pass ? utf8_to_utf16_bound(utf8_len) : utf8_to_utf16(utf8, utf8_len, NULL, 0);
+
+    // Room for the null terminator
+    utf16_t* utf16 = allocator->allocate(allocator->context, (capacity + 1) * sizeof(utf16_t));
+    if (utf16 == NULL)
+        return NULL;
+
+    size_t len = utf8_to_utf16(utf8, utf8_len, utf16, capacity);
+    utf16[len] = 0;
+
+    utf16 = shrink_buffer(allocator, utf16, (capacity + 1) * sizeof(utf16_t), (len + 1) * sizeof(utf16_t));
+
+    if (utf16_len != NULL)
+        *utf16_len = len;
+
+    return utf16;
+}
+
+void utf16_free(utf16_t* utf16, size_t utf16_len, utf_allocator const* allocator)
+{
+    if (allocator == NULL)
+        allocator = &default_allocator;
+
+    if (utf16 != NULL && allocator->deallocate != NULL)
+        allocator->deallocate(allocator->context, utf16, (utf16_len + 1) * sizeof(utf16_t));
+}
+
+void utf_arena_init(utf_arena* arena, void* buffer, size_t capacity)
+{
+    arena->buffer = buffer;
+    arena->capacity = capacity;
+    arena->used = 0;
+    arena->last = 0;
+}
+
+void utf_arena_reset(utf_arena* arena)
+{
+    arena->used = 0;
+    arena->last = 0;
+}
+
+static void* arena_alloc(void* context, size_t size)
+{
+    utf_arena* arena = context;
+
+    // The buffer itself may not be aligned, so the address is aligned instead of the offset
+    uintptr_t address = (uintptr_t)(arena->buffer + arena->used);
+    size_t padding = (size_t)((ARENA_ALIGNMENT - address % ARENA_ALIGNMENT) % ARENA_ALIGNMENT);
+
+    if (padding > arena->capacity - arena->used || size > arena->capacity - arena->used - padding)
+        return NULL;
+
+    arena->last = arena->used + padding;
+    arena->used = arena->last + size;
+    return arena->buffer + arena->last;
+}
+
+static void* arena_realloc(void* context, void* buffer, size_t old_size, size_t new_size)
+{
+    utf_arena* arena = context;
+
+    // The last allocation is resized in place, since nothing comes after it
+    if ((uint8_t*)buffer == arena->buffer + arena->last && new_size <= arena->capacity - arena->last)
+    {
+        arena->used = arena->last + new_size;
+        return buffer;
+    }
+
+    void* moved = arena_alloc(context, new_size);
+    if (moved != NULL)
+        memcpy(moved, buffer, old_size < new_size ? old_size : new_size);
+
+    return moved;
+}
+
+static void arena_free(void* context, void* buffer, size_t size)
+{
+    utf_arena* arena = context;
+    (void)size;
+
+    // Only the last allocation can be given back, everything else waits for the reset
+    if ((uint8_t*)buffer == arena->buffer + arena->last)
+        arena->used = arena->last;
+}
+
+utf_allocator utf_arena_allocator(utf_arena* arena)
+{
+    utf_allocator allocator = { arena_alloc, arena_realloc, arena_free, arena };
+    return allocator;
+}
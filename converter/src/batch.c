@@ -0,0 +1,249 @@
+#include <converter.h>
+#include <stdbool.h>
+#include "simd.h"
+#include "unicode.h"
+
+// Batch conversion converts every string in a single pass into one output buffer, without
+// calculating its size first: an ASCII string is converted if its own length fits in the rest
+// of the buffer, and any other string only if its upper bound fits. Both always happen if the
+// buffer was sized with the batch bound.
+//
+// Columns of short strings are usually stored one after the other in memory, so strings that
+// follow each other are grouped in runs. The ASCII prefix of a run is found and widened or narrowed
+// by the vectorized kernels across string boundaries, since every ASCII character is converted
+// to exactly one character and the offsets of the strings in it don't change.
+// Only the strings with non-ASCII characters are converted one by one.
+
+// Counts the strings starting at an index that follow each other in memory.
+// Empty strings are always part of the run, wherever they point to.
+//
+// strings: The strings
+// count: The number of strings
+// index: The index of the first string of the run
+// run_len: A pointer to a variable that will receive the total length of the run, in input characters
+//
+// return: The index after the last string of the run
+static size_t find_utf8_run(utf8_span const* strings, size_t count, size_t index, size_t* run_len)
+{
+    utf8_t const* start = strings[index].utf8;
+    size_t len = strings[index].utf8_len;
+    size_t end = index + 1;
+
+    while (end < count && (strings[end].utf8_len == 0 || strings[end].utf8 == start + len))
+    {
+        len += strings[end].utf8_len;
+        end++;
+    }
+
+    *run_len = len;
+    return end;
+}
+
+// Counts the ASCII characters at the start of a UTF-8 string
+static size_t count_ascii_utf8(simd_kernels const* kernels, utf8_t const* utf8, size_t utf8_len)
+{
+    size_t index = 0;
+    kernels->utf8_skip_ascii(utf8, utf8_len, &index);
+
+    while (index < utf8_len && utf8[index] <= UTF8_1_MAX)
+        index++;
+
+    return index;
+}
+
+size_t utf8_to_utf16_batch_bound(utf8_span const* strings, size_t count)
+{
+    size_t bound = 0;
+    for (size_t i = 0; i < count; i++)
+        bound += utf8_to_utf16_bound(strings[i].utf8_len);
+
+    return bound;
+}
+
+size_t utf8_to_utf16_batch(
+    utf8_span const* strings, size_t count,
+    utf16_t* utf16,           size_t utf16_len,
+    size_t* offsets)
+{
+    simd_kernels const* kernels = simd_get_kernels();
+
+    size_t utf16_index = 0;
+    size_t index = 0;
+    offsets[0] = 0;
+
+    // The rest of the current run, which is only found again once it's done, so every string is
+    // looked at a constant number of times
+    utf8_t const* run = NULL;
+    size_t run_len = 0;
+    size_t run_end = 0;
+
+    while (index < count)
+    {
+        if (index == run_end)
+        {
+            run = strings[index].utf8;
+            run_end = find_utf8_run(strings, count, index, &run_len);
+        }
+
+        // Only whole strings are converted, so the ASCII prefix is cut at the last string that fits in it
+        size_t ascii_len = count_ascii_utf8(kernels, run, run_len);
+        if (ascii_len > utf16_len - utf16_index)
+            ascii_len = utf16_len - utf16_index;
+
+        size_t ascii_end = index;
+        size_t ascii_strings_len = 0;
+        while (ascii_end < run_end && ascii_strings_len + strings[ascii_end].utf8_len <= ascii_len)
+        {
+            ascii_strings_len += strings[ascii_end].utf8_len;
+            offsets[ascii_end + 1] = utf16_index + ascii_strings_len;
+            ascii_end++;
+        }
+
+        if (ascii_strings_len > 0)
+        {
+            utf8_t const* utf8 = run;
+            size_t utf8_index = 0;
+            size_t written = utf16_index;
+            kernels->utf8_to_utf16(utf8, ascii_strings_len, &utf8_index, utf16, utf16_len, &written);
+
+            // The kernel may leave the end of the last block behind
+            for (; utf8_index < ascii_strings_len; utf8_index++, written++)
+                utf16[written] = utf8[utf8_index];
+
+            utf16_index = written;
+        }
+
+        index = ascii_end;
+        run += ascii_strings_len;
+        run_len -= ascii_strings_len;
+
+        // The first string that isn't all ASCII, if any, is converted on its own
+        if (index < run_end)
+        {
+            size_t bound = utf8_to_utf16_bound(strings[index].utf8_len);
+            if (bound > utf16_len - utf16_index)
+                break;
+
+            utf16_index += utf8_to_utf16_bounded(strings[index].utf8, strings[index].utf8_len, utf16 + utf16_index);
+            offsets[index + 1] = utf16_index;
+            run += strings[index].utf8_len;
+            run_len -= strings[index].utf8_len;
+            index++;
+        }
+    }
+
+    return index;
+}
+
+// Counts the strings starting at an index that follow each other in memory, as find_utf8_run
+static size_t find_utf16_run(utf16_span const* strings, size_t count, size_t index, size_t* run_len)
+{
+    utf16_t const* start = strings[index].utf16;
+    size_t len = strings[index].utf16_len;
+    size_t end = index + 1;
+
+    while (end < count && (strings[end].utf16_len == 0 || strings[end].utf16 == start + len))
+    {
+        len += strings[end].utf16_len;
+        end++;
+    }
+
+    *run_len = len;
+    return end;
+}
+
+// Counts the ASCII characters at the start of a UTF-16 string
+static size_t count_ascii_utf16(simd_kernels const* kernels, utf16_t const* utf16, size_t utf16_len)
+{
+    size_t index = 0;
+    kernels->utf16_skip_ascii(utf16, utf16_len, &index);
+
+    while (index < utf16_len && utf16[index] <= UTF8_1_MAX)
+        index++;
+
+    return index;
+}
+
+size_t utf16_to_utf8_batch_bound(utf16_span const* strings, size_t count)
+{
+    size_t bound = 0;
+    for (size_t i = 0; i < count; i++)
+        bound += utf16_to_utf8_bound(strings[i].utf16_len);
+
+    return bound;
+}
+
+size_t utf16_to_utf8_batch(
+    utf16_span const* strings, size_t count,
+    utf8_t* utf8,              size_t utf8_len,
+    size_t* offsets)
+{
+    simd_kernels const* kernels = simd_get_kernels();
+
+    size_t utf8_index = 0;
+    size_t index = 0;
+    offsets[0] = 0;
+
+    // The rest of the current run, which is only found again once it's done, so every string is
+    // looked at a constant number of times
+    utf16_t const* run = NULL;
+    size_t run_len = 0;
+    size_t run_end = 0;
+
+    while (index < count)
+    {
+        if (index == run_end)
+        {
+            run = strings[index].utf16;
+            run_end = find_utf16_run(strings, count, index, &run_len);
+        }
+
+        // Only whole strings are converted, so the ASCII prefix is cut at the last string that fits in it
+        size_t ascii_len = count_ascii_utf16(kernels, run, run_len);
+        if (ascii_len > utf8_len - utf8_index)
+            ascii_len = utf8_len - utf8_index;
+
+        size_t ascii_end = index;
+        size_t ascii_strings_len = 0;
+        while (ascii_end < run_end && ascii_strings_len + strings[ascii_end].utf16_len <= ascii_len)
+        {
+            ascii_strings_len += strings[ascii_end].utf16_len;
+            offsets[ascii_end + 1] = utf8_index + ascii_strings_len;
+            ascii_end++;
+        }
+
+        if (ascii_strings_len > 0)
+        {
+            utf16_t const* utf16 = run;
+            size_t utf16_index = 0;
+            size_t written = utf8_index;
+            kernels->utf16_to_utf8(utf16, ascii_strings_len, &utf16_index, utf8, utf8_len, &written);
+
+            // The kernel may leave the end of the last block behind
+            for (; utf16_index < ascii_strings_len; utf16_index++, written++)
+                utf8[written] = (utf8_t)utf16[utf16_index];
+
+            utf8_index = written;
+        }
+
+        index = ascii_end;
+        run += ascii_strings_len;
+        run_len -= ascii_strings_len;
+
+        // The first string that isn't all ASCII, if any, is converted on its own
+        if (index < run_end)
+        {
+            size_t bound = utf16_to_utf8_bound(strings[index].utf16_len);
+            if (bound > utf8_len - utf8_index)
+                break;
+
+            utf8_index += utf16_to_utf8_bounded(strings[index].utf16, strings[index].utf16_len, utf8 + utf8_index);
+            offsets[index + 1] = utf8_index;
+            run += strings[index].utf16_len;
+            run_len -= strings[index].utf16_len;
+            index++;
+        }
+    }
+
+    return index;
+}
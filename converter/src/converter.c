@@ -1,54 +1,22 @@
 #include <converter.h>
 #include <stdbool.h>
+#include <string.h>
+#include "simd.h"
+#include "unicode.h"
 
-// The type of a single Unicode codepoint
-typedef uint32_t codepoint_t;
-
-// The last codepoint of the Basic Multilingual Plane, which is the part of Unicode that
-// UTF-16 can encode without surrogates
-#define BMP_END 0xFFFF
-
-// The highest valid Unicode codepoint
-#define UNICODE_MAX 0x10FFFF
-
-// The codepoint that is used to replace invalid encodings
-#define INVALID_CODEPOINT 0xFFFD
-
-// If a character, masked with GENERIC_SURROGATE_MASK, matches this value, it is a surrogate.
-#define GENERIC_SURROGATE_VALUE 0xD800
-// The mask to apply to a character before testing it against GENERIC_SURROGATE_VALUE
-#define GENERIC_SURROGATE_MASK 0xF800
-
-// If a character, masked with SURROGATE_MASK, matches this value, it is a high surrogate.
-#define HIGH_SURROGATE_VALUE 0xD800
-// If a character, masked with SURROGATE_MASK, matches this value, it is a low surrogate.
-#define LOW_SURROGATE_VALUE 0xDC00
-// The mask to apply to a character before testing it against HIGH_SURROGATE_VALUE or LOW_SURROGATE_VALUE
-#define SURROGATE_MASK 0xFC00
-
-// The value that is subtracted from a codepoint before encoding it in a surrogate pair
-#define SURROGATE_CODEPOINT_OFFSET 0x10000
-// A mask that can be applied to a surrogate to extract the codepoint value contained in it
-#define SURROGATE_CODEPOINT_MASK 0x03FF
-// The number of bits of SURROGATE_CODEPOINT_MASK
-#define SURROGATE_CODEPOINT_BITS 10
-
-
-// The highest codepoint that can be encoded with 1 byte in UTF-8
-#define UTF8_1_MAX 0x7F
-// The highest codepoint that can be encoded with 2 bytes in UTF-8
-#define UTF8_2_MAX 0x7FF
-// The highest codepoint that can be encoded with 3 bytes in UTF-8
-#define UTF8_3_MAX 0xFFFF
-// The highest codepoint that can be encoded with 4 bytes in UTF-8
-#define UTF8_4_MAX 0x10FFFF
-
-// If a character, masked with UTF8_CONTINUATION_MASK, matches this value, it is a UTF-8 continuation byte
-#define UTF8_CONTINUATION_VALUE 0x80
-// The mask to a apply to a character before testing it against UTF8_CONTINUATION_VALUE
-#define UTF8_CONTINUATION_MASK 0xC0
-// The number of bits of a codepoint that are contained in a UTF-8 continuation byte
-#define UTF8_CONTINUATION_CODEPOINT_BITS 6
+// How many characters to convert with the scalar code after the vectorized kernels fail to make
+// significant progress, before trying them again
+#define KERNEL_RETRY_DISTANCE 32
+
+// The maximum number of UTF-8 characters that a single UTF-16 character can be converted to.
+// A BMP character (or U+FFFD replacing an invalid one) takes at most 3 UTF-8 characters,
+// and a surrogate pair takes 4 UTF-8 characters for 2 UTF-16 characters.
+#define UTF8_MAX_LEN_PER_UTF16 3
+
+// The maximum number of UTF-16 characters that a single UTF-8 character can be converted to.
+// Every valid sequence takes at most as many UTF-16 characters as UTF-8 characters,
+// and every invalid sequence is replaced by a single U+FFFD.
+#define UTF16_MAX_LEN_PER_UTF8 1
 
 // Represents a UTF-8 bit pattern that can be set or verified
 typedef struct
@@ -70,9 +38,22 @@ static const utf8_pattern utf8_leading_bytes[] =
     { 0xF8, 0xF0 }  // 11110xxx
 };
 
-// The number of elements in utf8_leading_bytes
-#define UTF8_LEADING_BYTES_LEN 4
 
+// Checks if the CPU stores UTF-16 characters in little endian.
+// Compilers fold this to a constant.
+static inline bool is_native_little_endian(void)
+{
+    utf16_t one = 1;
+    utf8_t first;
+    memcpy(&first, &one, sizeof first);
+    return first == 1;
+}
+
+// Checks if a byte order isn't the native byte order of the CPU, so its characters must be swapped
+static inline bool is_swapped(utf16_byte_order order)
+{
+    return (order == UTF16_LITTLE_ENDIAN) != is_native_little_endian();
+}
 
 // Gets a codepoint from a UTF-16 string
 // utf16: The UTF-16 string
@@ -82,9 +63,10 @@ static const utf8_pattern utf8_leading_bytes[] =
 // When the function returns, this will be left at the index of the last character
 // that composes the returned codepoint.
 // For surrogate pairs, this means the index will be left at the low surrogate.
-static codepoint_t decode_utf16(utf16_t const* utf16, size_t len, size_t* index)
+// swap: If the characters of the string have their bytes swapped
+static inline codepoint_t decode_utf16(utf16_t const* utf16, size_t len, size_t* index, bool swap)
 {
-    utf16_t high = utf16[*index];
+    utf16_t high = swap ? swap_utf16(utf16[*index]) : utf16[*index];
 
     // BMP character
     if ((high & GENERIC_SURROGATE_MASK) != GENERIC_SURROGATE_VALUE)
@@ -98,7 +80,7 @@ static codepoint_t decode_utf16(utf16_t const* utf16, size_t len, size_t* index)
     if (*index == len - 1)
         return INVALID_CODEPOINT;
     
-    utf16_t low = utf16[*index + 1];
+    utf16_t low = swap ? swap_utf16(utf16[*index + 1]) : utf16[*index + 1];
 
     // Unmatched high surrogate, invalid
     if ((low & SURROGATE_MASK) != LOW_SURROGATE_VALUE)
@@ -176,15 +158,168 @@ static size_t encode_utf8(codepoint_t codepoint, utf8_t* utf8, size_t len, size_
     return size;
 }
 
-size_t utf16_to_utf8(utf16_t const* utf16, size_t utf16_len, utf8_t* utf8, size_t utf8_len)
+// Lets the vectorized kernel convert as much as it can from a UTF-16 string to a UTF-8 string,
+// before the caller falls back to converting codepoints one by one.
+// If the UTF-8 string is NULL, the kernel only counts the UTF-8 characters instead.
+//
+// kernels: The kernels to use
+// utf16_index: A pointer to the current index on the UTF-16 string, advanced past the converted characters
+// utf8_index: A pointer to the first empty index on the UTF-8 string, advanced past the written characters
+// kernel_index:
+// A pointer to the UTF-16 index where the kernel should be tried again.
+// The kernel is only called if utf16_index has reached it.
+// swap: If the characters of the UTF-16 string have their bytes swapped
+static inline void run_utf16_to_utf8_kernel(
+    simd_kernels const* kernels,
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index,
+    size_t* kernel_index, bool swap)
+{
+    if (*utf16_index < *kernel_index)
+        return;
+
+    // Copies are given to the kernel so the indexes can stay in registers
+    size_t kernel_utf16_index = *utf16_index;
+    size_t kernel_utf8_index = *utf8_index;
+    if (utf8 == NULL && swap)
+        kernels->utf16_swapped_to_utf8_len(utf16, utf16_len, &kernel_utf16_index, &kernel_utf8_index);
+    else if (utf8 == NULL)
+        kernels->utf16_to_utf8_len(utf16, utf16_len, &kernel_utf16_index, &kernel_utf8_index);
+    else if (swap)
+        kernels->utf16_swapped_to_utf8(utf16, utf16_len, &kernel_utf16_index, utf8, utf8_len, &kernel_utf8_index);
+    else
+        kernels->utf16_to_utf8(utf16, utf16_len, &kernel_utf16_index, utf8, utf8_len, &kernel_utf8_index);
+
+    // If the kernel could barely do anything, the input is probably not suited for it,
+    // so don't waste time calling it again for every following codepoint
+    if (kernel_utf16_index - *utf16_index < KERNEL_RETRY_DISTANCE)
+        *kernel_index = kernel_utf16_index + KERNEL_RETRY_DISTANCE;
+
+    *utf16_index = kernel_utf16_index;
+    *utf8_index = kernel_utf8_index;
+}
+
+// Counts a valid codepoint in the statistics, by the length of its UTF-8 encoding
+static void count_codepoint(codepoint_t codepoint, conversion_stats* stats)
+{
+    switch (calculate_utf8_len(codepoint))
+    {
+    case 1: stats->ascii++; break;
+    case 2: stats->two_byte++; break;
+    case 3: stats->three_byte++; break;
+    default: stats->four_byte++; stats->surrogate_pairs++; break;
+    }
+}
+
+// Counts the codepoints of a part of a UTF-16 string converted by a vectorized kernel in the statistics.
+// Kernels only convert valid characters, so every high surrogate starts a pair.
+//
+// utf16: The UTF-16 string
+// start: The index of the first character converted by the kernel
+// end: The index after the last character converted by the kernel
+// swap: If the characters of the string have their bytes swapped
+// stats: The statistics
+static void count_utf16_fast_path(utf16_t const* utf16, size_t start, size_t end, bool swap, conversion_stats* stats)
+{
+    for (size_t i = start; i < end; i++)
+    {
+        utf16_t character = swap ? swap_utf16(utf16[i]) : utf16[i];
+
+        // The low surrogate was counted along with the high surrogate
+        if ((character & SURROGATE_MASK) == LOW_SURROGATE_VALUE)
+            continue;
+
+        if (is_high_surrogate(character))
+            count_codepoint(SURROGATE_CODEPOINT_OFFSET, stats);
+        else
+            count_codepoint(character, stats);
+    }
+
+    stats->fast_path_len += end - start;
+}
+
+// Checks if a U+FFFD returned by decode_utf16 replaced an unpaired surrogate,
+// rather than being a valid U+FFFD in the string
+// utf16: The UTF-16 string
+// start: The index of the first character of the codepoint
+// swap: If the characters of the string have their bytes swapped
+static bool is_utf16_error(utf16_t const* utf16, size_t start, bool swap)
+{
+    utf16_t character = swap ? swap_utf16(utf16[start]) : utf16[start];
+    return character != INVALID_CODEPOINT;
+}
+
+// Converts a UTF-16 string to a UTF-8 string, as utf16_to_utf8
+// swap: If the characters of the UTF-16 string have their bytes swapped
+// wtf8:
+// If unpaired surrogates should be encoded like any other codepoint, as WTF-8 does, instead of being errors.
+// Must be a constant, so the regular conversion doesn't check it for every codepoint.
+// policy:
+// What to do with unpaired surrogates.
+// Must be a constant, so every policy gets its own loop without checking it for every codepoint.
+// error_index:
+// A pointer to a variable that will receive the index of the first unpaired surrogate,
+// or utf16_len if there is none. May be NULL, in which case errors aren't tracked for CONVERSION_REPLACE.
+// stats:
+// The statistics to add the conversion to. May be NULL, in which case nothing is counted.
+// Must be a constant NULL when they're not wanted, so the counting is removed from the loop.
+static ALWAYS_INLINE size_t convert_utf16_to_utf8(
+    utf16_t const* utf16, size_t utf16_len,
+    utf8_t* utf8,         size_t utf8_len,
+    bool swap, bool wtf8, conversion_error_policy policy, size_t* error_index,
+    conversion_stats* stats)
 {
     // The next codepoint that will be written in the UTF-8 string
     // or the size of the required buffer if utf8 is NULL
     size_t utf8_index = 0;
+    size_t first_error = utf16_len;
+
+    simd_kernels const* kernels = simd_get_kernels();
+    // The index where the vectorized kernel should be tried again
+    size_t kernel_index = 0;
 
     for (size_t utf16_index = 0; utf16_index < utf16_len; utf16_index++)
     {
-        codepoint_t codepoint = decode_utf16(utf16, utf16_len, &utf16_index);
+        size_t kernel_start = utf16_index;
+        run_utf16_to_utf8_kernel(kernels, utf16, utf16_len, &utf16_index, utf8, utf8_len, &utf8_index, &kernel_index, swap);
+        if (stats != NULL)
+            count_utf16_fast_path(utf16, kernel_start, utf16_index, swap, stats);
+        if (utf16_index >= utf16_len)
+            break;
+
+        size_t start = utf16_index;
+        codepoint_t codepoint = decode_utf16(utf16, utf16_len, &utf16_index, swap);
+
+        if (stats != NULL)
+            stats->slow_path_len += utf16_index - start + 1;
+
+        // Only a U+FFFD can be an error, so the other policies cost nothing on valid strings
+        bool check_errors = wtf8 || policy != CONVERSION_REPLACE || error_index != NULL || stats != NULL;
+        bool error = check_errors && codepoint == INVALID_CODEPOINT && is_utf16_error(utf16, start, swap);
+
+        // WTF-8 encodes the unpaired surrogate itself, which is never an error
+        if (wtf8 && error)
+        {
+            codepoint = swap ? swap_utf16(utf16[start]) : utf16[start];
+            error = false;
+        }
+
+        if (stats != NULL && error)
+            stats->unpaired_surrogates++;
+        else if (stats != NULL)
+            count_codepoint(codepoint, stats);
+
+        if (error)
+        {
+            if (first_error == utf16_len)
+                first_error = start;
+
+            if (policy == CONVERSION_STOP)
+                break;
+
+            if (policy == CONVERSION_SKIP)
+                continue;
+        }
 
         if (utf8 == NULL)
             utf8_index += calculate_utf8_len(codepoint);
@@ -192,9 +327,294 @@ size_t utf16_to_utf8(utf16_t const* utf16, size_t utf16_len, utf8_t* utf8, size_
             utf8_index += encode_utf8(codepoint, utf8, utf8_len, utf8_index);
     }
 
+    if (error_index != NULL)
+        *error_index = first_error;
+
+    return utf8_index;
+}
+
+size_t utf16_to_utf8(utf16_t const* utf16, size_t utf16_len, utf8_t* utf8, size_t utf8_len)
+{
+    return convert_utf16_to_utf8(utf16, utf16_len, utf8, utf8_len, false, false, CONVERSION_REPLACE, NULL, NULL);
+}
+
+size_t utf16le_to_utf8(utf16_t const* utf16, size_t utf16_len, utf8_t* utf8, size_t utf8_len)
+{
+    return convert_utf16_to_utf8(utf16, utf16_len, utf8, utf8_len, is_swapped(UTF16_LITTLE_ENDIAN), false, CONVERSION_REPLACE, NULL, NULL);
+}
+
+size_t utf16be_to_utf8(utf16_t const* utf16, size_t utf16_len, utf8_t* utf8, size_t utf8_len)
+{
+    return convert_utf16_to_utf8(utf16, utf16_len, utf8, utf8_len, is_swapped(UTF16_BIG_ENDIAN), false, CONVERSION_REPLACE, NULL, NULL);
+}
+
+size_t utf16_to_utf8_with_policy(
+    utf16_t const* utf16, size_t utf16_len,
+    utf8_t* utf8,         size_t utf8_len,
+    conversion_error_policy policy, size_t* error_index)
+{
+    // Every call has a constant policy, so each one is specialized
+    switch (policy)
+    {
+    case CONVERSION_STOP:
+        return convert_utf16_to_utf8(utf16, utf16_len, utf8, utf8_len, false, false, CONVERSION_STOP, error_index, NULL);
+    case CONVERSION_SKIP:
+        return convert_utf16_to_utf8(utf16, utf16_len, utf8, utf8_len, false, false, CONVERSION_SKIP, error_index, NULL);
+    default:
+        return convert_utf16_to_utf8(utf16, utf16_len, utf8, utf8_len, false, false, CONVERSION_REPLACE, error_index, NULL);
+    }
+}
+
+size_t utf16_to_utf8_with_stats(utf16_t const* utf16, size_t utf16_len, utf8_t* utf8, size_t utf8_len, conversion_stats* stats)
+{
+    return convert_utf16_to_utf8(utf16, utf16_len, utf8, utf8_len, false, false, CONVERSION_REPLACE, NULL, stats);
+}
+
+size_t utf16_to_wtf8(utf16_t const* utf16, size_t utf16_len, utf8_t* wtf8, size_t wtf8_len)
+{
+    return convert_utf16_to_utf8(utf16, utf16_len, wtf8, wtf8_len, false, true, CONVERSION_REPLACE, NULL, NULL);
+}
+
+size_t utf16_to_utf8_partial(utf16_t const* utf16, size_t utf16_len, utf8_t* utf8, size_t utf8_len, size_t* utf16_read)
+{
+    size_t utf16_index = 0;
+    size_t utf8_index = 0;
+
+    simd_kernels const* kernels = simd_get_kernels();
+    size_t kernel_index = 0;
+
+    while (utf16_index < utf16_len)
+    {
+        run_utf16_to_utf8_kernel(kernels, utf16, utf16_len, &utf16_index, utf8, utf8_len, &utf8_index, &kernel_index, false);
+        if (utf16_index >= utf16_len)
+            break;
+
+        size_t last_index = utf16_index;
+        codepoint_t codepoint = decode_utf16(utf16, utf16_len, &last_index, false);
+
+        // Stop at the first codepoint that doesn't fit, so the caller can resume from it
+        size_t written = encode_utf8(codepoint, utf8, utf8_len, utf8_index);
+        if (written == 0)
+            break;
+
+        utf8_index += written;
+        utf16_index = last_index + 1;
+    }
+
+    *utf16_read = utf16_index;
+    return utf8_index;
+}
+
+// Lets the vectorized kernel skip as much as it can of a UTF-16 string that is being validated,
+// before the caller falls back to checking codepoints one by one
+//
+// kernels: The kernels to use
+// utf16_index: A pointer to the current index on the UTF-16 string, advanced past the valid characters
+// kernel_index:
+// A pointer to the UTF-16 index where the kernel should be tried again.
+// The kernel is only called if utf16_index has reached it.
+static inline void run_utf16_validate_kernel(
+    simd_kernels const* kernels,
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    size_t* kernel_index)
+{
+    if (*utf16_index < *kernel_index)
+        return;
+
+    size_t kernel_utf16_index = *utf16_index;
+    kernels->utf16_validate(utf16, utf16_len, &kernel_utf16_index);
+
+    if (kernel_utf16_index - *utf16_index < KERNEL_RETRY_DISTANCE)
+        *kernel_index = kernel_utf16_index + KERNEL_RETRY_DISTANCE;
+
+    *utf16_index = kernel_utf16_index;
+}
+
+bool utf16_validate(utf16_t const* utf16, size_t utf16_len, size_t* error_index)
+{
+    size_t utf16_index = 0;
+
+    simd_kernels const* kernels = simd_get_kernels();
+    size_t kernel_index = 0;
+
+    while (utf16_index < utf16_len)
+    {
+        run_utf16_validate_kernel(kernels, utf16, utf16_len, &utf16_index, &kernel_index);
+        if (utf16_index >= utf16_len)
+            break;
+
+        // A valid U+FFFD can't be told apart from a replaced character by the codepoint alone,
+        // but only surrogates are ever replaced, and only when they aren't decoded as a pair
+        size_t last_index = utf16_index;
+        decode_utf16(utf16, utf16_len, &last_index, false);
+
+        bool surrogate = (utf16[utf16_index] & GENERIC_SURROGATE_MASK) == GENERIC_SURROGATE_VALUE;
+        if (surrogate && last_index == utf16_index)
+            break;
+
+        utf16_index = last_index + 1;
+    }
+
+    if (error_index != NULL)
+        *error_index = utf16_index;
+
+    return utf16_index >= utf16_len;
+}
+
+size_t utf16_to_utf8_bound(size_t utf16_len)
+{
+    return utf16_len * UTF8_MAX_LEN_PER_UTF16;
+}
+
+size_t utf16_to_utf8_bounded(utf16_t const* utf16, size_t utf16_len, utf8_t* utf8)
+{
+    return utf16_to_utf8(utf16, utf16_len, utf8, utf16_to_utf8_bound(utf16_len));
+}
+
+size_t utf16_to_utf8_unchecked(utf16_t const* utf16, size_t utf16_len, utf8_t* utf8)
+{
+    size_t utf8_index = 0;
+    // The kernels still need a length, and the bound is always enough
+    size_t utf8_len = utf16_to_utf8_bound(utf16_len);
+
+    simd_kernels const* kernels = simd_get_kernels();
+    size_t kernel_index = 0;
+
+    for (size_t utf16_index = 0; utf16_index < utf16_len; utf16_index++)
+    {
+        run_utf16_to_utf8_kernel(kernels, utf16, utf16_len, &utf16_index, utf8, utf8_len, &utf8_index, &kernel_index, false);
+        if (utf16_index >= utf16_len)
+            break;
+
+        // Every high surrogate is known to be followed by a low surrogate
+        codepoint_t codepoint = utf16[utf16_index];
+        if ((codepoint & SURROGATE_MASK) == HIGH_SURROGATE_VALUE)
+        {
+            codepoint = (codepoint & SURROGATE_CODEPOINT_MASK) << SURROGATE_CODEPOINT_BITS;
+            codepoint |= utf16[utf16_index + 1] & SURROGATE_CODEPOINT_MASK;
+            codepoint += SURROGATE_CODEPOINT_OFFSET;
+            utf16_index++;
+        }
+
+        // The buffer is known to be large enough, so the encoding is written without checking its length
+        int size = calculate_utf8_len(codepoint);
+        for (int cont_index = size - 1; cont_index > 0; cont_index--)
+        {
+            utf8[utf8_index + cont_index] = (utf8_t)((codepoint & ~UTF8_CONTINUATION_MASK) | UTF8_CONTINUATION_VALUE);
+            codepoint >>= UTF8_CONTINUATION_CODEPOINT_BITS;
+        }
+
+        utf8_pattern pattern = utf8_leading_bytes[size - 1];
+        utf8[utf8_index] = (utf8_t)((codepoint & ~pattern.mask) | pattern.value);
+        utf8_index += size;
+    }
+
     return utf8_index;
 }
 
+// UTF-8 is decoded by a state machine, driven by the class of every character.
+// The leading byte moves the machine to a state that expects a number of continuation bytes,
+// and each continuation byte moves it closer to being done, checking the ranges that would
+// cause an overlong encoding, a surrogate or a codepoint above UNICODE_MAX on the way.
+// Invalid sequences still consume all of their continuation bytes,
+// so they're replaced by a single U+FFFD just like valid ones become a single codepoint.
+
+// The classes of UTF-8 characters
+enum
+{
+    UTF8_CLASS_ASCII,      // 00..7F
+    UTF8_CLASS_CONT_LOW,   // 80..8F
+    UTF8_CLASS_CONT_MID,   // 90..9F
+    UTF8_CLASS_CONT_HIGH,  // A0..BF
+    UTF8_CLASS_OVERLONG_2, // C0..C1, 2-byte sequence that is always overlong
+    UTF8_CLASS_LEAD_2,     // C2..DF
+    UTF8_CLASS_E0,         // E0, 3-byte sequence that is overlong below E0 A0
+    UTF8_CLASS_LEAD_3,     // E1..EC, EE..EF
+    UTF8_CLASS_ED,         // ED, 3-byte sequence that is a surrogate from ED A0
+    UTF8_CLASS_F0,         // F0, 4-byte sequence that is overlong below F0 90
+    UTF8_CLASS_LEAD_4,     // F1..F3
+    UTF8_CLASS_F4,         // F4, 4-byte sequence that is above UNICODE_MAX from F4 90
+    UTF8_CLASS_TOO_HIGH_4, // F5..F7, 4-byte sequence that is always above UNICODE_MAX
+    UTF8_CLASS_INVALID,    // F8..FF
+    UTF8_CLASS_COUNT
+};
+
+// The class of every UTF-8 character
+static const uint8_t utf8_classes[256] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 00..0F
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 10..1F
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 20..2F
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 30..3F
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 40..4F
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 50..5F
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 60..6F
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 70..7F
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 80..8F
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, // 90..9F
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, // A0..AF
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, // B0..BF
+    4, 4, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, // C0..CF
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, // D0..DF
+    6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 7, // E0..EF
+    9, 10, 10, 10, 11, 12, 12, 12, 13, 13, 13, 13, 13, 13, 13, 13 // F0..FF
+};
+
+// The states of the UTF-8 decoder.
+// Every state is the index of its row in utf8_transitions, so the next state
+// can be found by adding the class of the character to it.
+enum
+{
+    UTF8_VALID = 0 * UTF8_CLASS_COUNT,     // Decoded a valid codepoint. Also the initial state.
+    UTF8_INVALID = 1 * UTF8_CLASS_COUNT,   // The sequence is invalid, whatever comes next
+    UTF8_NEED_1 = 2 * UTF8_CLASS_COUNT,    // Needs 1 more continuation byte
+    UTF8_NEED_2 = 3 * UTF8_CLASS_COUNT,    // Needs 2 more continuation bytes
+    UTF8_NEED_3 = 4 * UTF8_CLASS_COUNT,    // Needs 3 more continuation bytes
+    UTF8_E0_NEED_2 = 5 * UTF8_CLASS_COUNT, // Needs 2 more continuation bytes, after E0
+    UTF8_ED_NEED_2 = 6 * UTF8_CLASS_COUNT, // Needs 2 more continuation bytes, after ED
+    UTF8_F0_NEED_3 = 7 * UTF8_CLASS_COUNT, // Needs 3 more continuation bytes, after F0
+    UTF8_F4_NEED_3 = 8 * UTF8_CLASS_COUNT, // Needs 3 more continuation bytes, after F4
+    UTF8_TRANSITIONS_LEN = 9 * UTF8_CLASS_COUNT
+};
+
+// Abbreviations to keep the transition table readable
+#define V_ UTF8_VALID
+#define I_ UTF8_INVALID
+#define N1 UTF8_NEED_1
+#define N2 UTF8_NEED_2
+#define N3 UTF8_NEED_3
+#define E0 UTF8_E0_NEED_2
+#define ED UTF8_ED_NEED_2
+#define F0 UTF8_F0_NEED_3
+#define F4 UTF8_F4_NEED_3
+
+// The next state of the UTF-8 decoder, for every state and character class.
+// Characters that aren't continuation bytes only matter as leading bytes, since a sequence
+// that is interrupted by one is left before it reaches the state machine.
+static const uint8_t utf8_transitions[UTF8_TRANSITIONS_LEN] =
+{
+    //       ASCII 80..8F 90..9F A0..BF C0..C1 C2..DF E0  E1..EF ED  F0  F1..F3 F4  F5..F7 F8..FF
+    /* V_ */ V_,   I_,    I_,    I_,    I_,    N1,    E0, N2,    ED, F0, N3,    F4, I_,    I_,
+    /* I_ */ I_,   I_,    I_,    I_,    I_,    I_,    I_, I_,    I_, I_, I_,    I_, I_,    I_,
+    /* N1 */ I_,   V_,    V_,    V_,    I_,    I_,    I_, I_,    I_, I_, I_,    I_, I_,    I_,
+    /* N2 */ I_,   N1,    N1,    N1,    I_,    I_,    I_, I_,    I_, I_, I_,    I_, I_,    I_,
+    /* N3 */ I_,   N2,    N2,    N2,    I_,    I_,    I_, I_,    I_, I_, I_,    I_, I_,    I_,
+    /* E0 */ I_,   I_,    I_,    N1,    I_,    I_,    I_, I_,    I_, I_, I_,    I_, I_,    I_,
+    /* ED */ I_,   N1,    N1,    I_,    I_,    I_,    I_, I_,    I_, I_, I_,    I_, I_,    I_,
+    /* F0 */ I_,   I_,    N2,    N2,    I_,    I_,    I_, I_,    I_, I_, I_,    I_, I_,    I_,
+    /* F4 */ I_,   N2,    I_,    I_,    I_,    I_,    I_, I_,    I_, I_, I_,    I_, I_,    I_,
+};
+
+#undef V_
+#undef I_
+#undef N1
+#undef N2
+#undef N3
+#undef E0
+#undef ED
+#undef F0
+#undef F4
+
 // Gets a codepoint from a UTF-8 string
 // utf8: The UTF-8 string
 // len: The length of the UTF-8 string, in UTF-8 characters
@@ -203,70 +623,155 @@ size_t utf16_to_utf8(utf16_t const* utf16, size_t utf16_len, utf8_t* utf8, size_
 // When the function returns, this will be left at the index of the last character
 // that composes the returned codepoint.
 // For example, for a 3-byte codepoint, the index will be left at the third character.
-static codepoint_t decode_utf8(utf8_t const* utf8, size_t len, size_t* index)
+static inline codepoint_t decode_utf8(utf8_t const* utf8, size_t len, size_t* index)
 {
     utf8_t leading = utf8[*index];
 
-    // The number of bytes that are used to encode the codepoint
-    int encoding_len = 0;
-    // The pattern of the leading byte
-    utf8_pattern leading_pattern;
-    // If the leading byte matches the current leading pattern
-    bool matches = false;
-    
-    do
+    // Most text is ASCII, so skip the state machine for it
+    if (leading <= UTF8_1_MAX)
+        return leading;
+
+    // The number of continuation bytes is found by comparing the leading byte rather than
+    // through the tables, so the loop below can be predicted as early as possible.
+    // Leading bytes that are always invalid still take the continuation bytes of the sequence
+    // they look like, while rogue continuation bytes and F8..FF take none.
+    int continuation_count;
+    if (leading >= 0xF8)
+        continuation_count = 0;
+    else if (leading >= 0xF0)
+        continuation_count = 3;
+    else if (leading >= 0xE0)
+        continuation_count = 2;
+    else if (leading >= 0xC0)
+        continuation_count = 1;
+    else
+        continuation_count = 0;
+
+    // String ended before all continuation bytes were found
+    // Invalid encoding, made of all the continuation bytes that are there
+    if (*index + continuation_count >= len)
     {
-        encoding_len++;
-        leading_pattern = utf8_leading_bytes[encoding_len - 1];
-
-        matches = (leading & leading_pattern.mask) == leading_pattern.value;
-
-    } while (!matches && encoding_len < UTF8_LEADING_BYTES_LEN);
+        while (*index + 1 < len && is_utf8_continuation(utf8[*index + 1]))
+            (*index)++;
 
-    // Leading byte doesn't match any known pattern, consider it invalid
-    if (!matches)
         return INVALID_CODEPOINT;
+    }
 
-    codepoint_t codepoint = leading & ~leading_pattern.mask;
+    int state = utf8_transitions[UTF8_VALID + utf8_classes[leading]];
+    // The leading byte starts with one set bit per byte of the sequence, followed by a 0
+    codepoint_t codepoint = leading & (0xFF >> (continuation_count + 2));
 
-    for (int i = 0; i < encoding_len - 1; i++)
+    for (int remaining = continuation_count; remaining > 0; remaining--)
     {
-        // String ended before all continuation bytes were found
-        // Invalid encoding
-        if (*index + 1 >= len)
-            return INVALID_CODEPOINT;
-
         utf8_t continuation = utf8[*index + 1];
 
         // Number of continuation bytes not the same as advertised on the leading byte
-        // Invalid encoding
+        // Invalid encoding, and the character is left to be decoded on its own
         if ((continuation & UTF8_CONTINUATION_MASK) != UTF8_CONTINUATION_VALUE)
             return INVALID_CODEPOINT;
 
+        state = utf8_transitions[state + utf8_classes[continuation]];
+
         codepoint <<= UTF8_CONTINUATION_CODEPOINT_BITS;
         codepoint |= continuation & ~UTF8_CONTINUATION_MASK;
 
         (*index)++;
     }
 
-    int proper_len = calculate_utf8_len(codepoint);
-
-    // Overlong encoding: too many bytes were used to encode a short codepoint
-    // Invalid encoding
-    if (proper_len != encoding_len)
+    // Overlong encodings, surrogates and codepoints above UNICODE_MAX all end up here
+    if (state != UTF8_VALID)
         return INVALID_CODEPOINT;
 
-    // Surrogates are invalid Unicode codepoints, and should only be used in UTF-16
-    // Invalid encoding
-    if (codepoint < BMP_END && (codepoint & GENERIC_SURROGATE_MASK) == GENERIC_SURROGATE_VALUE)
-        return INVALID_CODEPOINT;
+    return codepoint;
+}
 
-    // UTF-8 can encode codepoints larger than the Unicode standard allows
-    // Invalid encoding
-    if (codepoint > UNICODE_MAX)
-        return INVALID_CODEPOINT;
+// Checks if a UTF-8 string has a valid codepoint encoding at an index
+// utf8: The UTF-8 string
+// len: The length of the UTF-8 string, in UTF-8 characters
+// index: The index of the leading byte of the encoding
+//
+// return: The number of UTF-8 characters in the encoding, or 0 if it is invalid.
+static int validate_utf8(utf8_t const* utf8, size_t len, size_t index)
+{
+    // Unlike decode_utf8, the codepoint isn't needed, so the state machine can check
+    // interruptions by leading bytes and ASCII on its own
+    int state = UTF8_VALID;
+    size_t end = index;
 
-    return codepoint;
+    do
+    {
+        // String ended before all continuation bytes were found
+        if (end >= len)
+            return 0;
+
+        state = utf8_transitions[state + utf8_classes[utf8[end]]];
+        end++;
+
+        if (state == UTF8_INVALID)
+            return 0;
+
+    } while (state != UTF8_VALID);
+
+    return (int)(end - index);
+}
+
+// Counts the codepoints of a part of a UTF-8 string converted by a vectorized kernel in the statistics.
+// Kernels only convert valid sequences, so only the leading bytes need to be looked at.
+//
+// utf8: The UTF-8 string
+// start: The index of the first character converted by the kernel
+// end: The index after the last character converted by the kernel
+// stats: The statistics
+static void count_utf8_fast_path(utf8_t const* utf8, size_t start, size_t end, conversion_stats* stats)
+{
+    for (size_t i = start; i < end; i++)
+    {
+        switch (utf8_sequence_len(utf8[i]))
+        {
+        case 1: stats->ascii++; break;
+        case 2: stats->two_byte++; break;
+        case 3: stats->three_byte++; break;
+        case 4: stats->four_byte++; stats->surrogate_pairs++; break;
+        default: break;
+        }
+    }
+
+    stats->fast_path_len += end - start;
+}
+
+// Counts an invalid UTF-8 sequence in the statistics, by the reason it is invalid
+//
+// utf8: The UTF-8 string
+// start: The index of the first character of the sequence
+// end: The index of the last character of the sequence, as left by decode_utf8
+// stats: The statistics
+static void count_utf8_error(utf8_t const* utf8, size_t start, size_t end, conversion_stats* stats)
+{
+    int len = utf8_sequence_len(utf8[start]);
+    if (len == 0)
+    {
+        stats->invalid_bytes++;
+        return;
+    }
+
+    // The string ended or a continuation byte was missing
+    if (end - start + 1 < (size_t)len)
+    {
+        stats->truncated++;
+        return;
+    }
+
+    // All the continuation bytes are there, so the codepoint itself is invalid
+    codepoint_t codepoint = utf8[start] & (0xFF >> (len + 1));
+    for (size_t i = start + 1; i <= end; i++)
+        codepoint = (codepoint << UTF8_CONTINUATION_CODEPOINT_BITS) | (utf8[i] & ~UTF8_CONTINUATION_MASK);
+
+    if (codepoint > UNICODE_MAX)
+        stats->out_of_range++;
+    else if (calculate_utf8_len(codepoint) < len)
+        stats->overlong++;
+    else
+        stats->surrogates++;
 }
 
 // Calculates the number of UTF-16 characters it would take to encode a codepoint
@@ -286,9 +791,10 @@ static int calculate_utf16_len(codepoint_t codepoint)
 // utf16: The UTF-16 string
 // len: The length of the UTF-16 string, in UTF-16 characters
 // index: The first empty index on the string.
+// swap: If the characters should be written with their bytes swapped
 //
 // return: The number of characters written to the string.
-static size_t encode_utf16(codepoint_t codepoint, utf16_t* utf16, size_t len, size_t index)
+static inline size_t encode_utf16(codepoint_t codepoint, utf16_t* utf16, size_t len, size_t index, bool swap)
 {
     // Not enough space on the string
     if (index >= len)
@@ -296,7 +802,7 @@ static size_t encode_utf16(codepoint_t codepoint, utf16_t* utf16, size_t len, si
 
     if (codepoint <= BMP_END)
     {
-        utf16[index] = codepoint;
+        utf16[index] = swap ? swap_utf16((utf16_t)codepoint) : (utf16_t)codepoint;
         return 1;
     }
 
@@ -314,28 +820,957 @@ static size_t encode_utf16(codepoint_t codepoint, utf16_t* utf16, size_t len, si
     utf16_t high = HIGH_SURROGATE_VALUE;
     high |= codepoint & SURROGATE_CODEPOINT_MASK;
 
-    utf16[index] = high;
-    utf16[index + 1] = low;
+    utf16[index] = swap ? swap_utf16(high) : high;
+    utf16[index + 1] = swap ? swap_utf16(low) : low;
 
     return 2;
 }
 
 
-size_t utf8_to_utf16(utf8_t const* utf8, size_t utf8_len, utf16_t* utf16, size_t utf16_len)
+// Decodes a surrogate encoded in a UTF-8 string like any other codepoint in the BMP,
+// which is invalid UTF-8 but how WTF-8 stores unpaired surrogates
+// utf8: The UTF-8 string
+// len: The length of the UTF-8 string, in UTF-8 characters
+// index: The index of the leading byte of the encoding
+//
+// return: The surrogate, or INVALID_CODEPOINT if there's no encoded surrogate at the index.
+static codepoint_t decode_wtf8_surrogate(utf8_t const* utf8, size_t len, size_t index)
+{
+    // Surrogates are exactly the 3-byte sequences from ED A0 80 to ED BF BF
+    if (index + 2 >= len || utf8[index] != 0xED || (utf8[index + 1] & 0xE0) != 0xA0 || !is_utf8_continuation(utf8[index + 2]))
+        return INVALID_CODEPOINT;
+
+    codepoint_t codepoint = utf8[index] & 0x0F;
+    codepoint = (codepoint << UTF8_CONTINUATION_CODEPOINT_BITS) | (utf8[index + 1] & ~UTF8_CONTINUATION_MASK);
+    codepoint = (codepoint << UTF8_CONTINUATION_CODEPOINT_BITS) | (utf8[index + 2] & ~UTF8_CONTINUATION_MASK);
+    return codepoint;
+}
+
+// Lets the vectorized kernel convert as much as it can from a UTF-8 string to a UTF-16 string,
+// before the caller falls back to converting codepoints one by one.
+// If the UTF-16 string is NULL, the kernel only counts the UTF-16 characters instead.
+//
+// kernels: The kernels to use
+// utf8_index: A pointer to the current index on the UTF-8 string, advanced past the converted characters
+// utf16_index: A pointer to the first empty index on the UTF-16 string, advanced past the written characters
+// kernel_index:
+// A pointer to the UTF-8 index where the kernel should be tried again.
+// The kernel is only called if utf8_index has reached it.
+// swap: If the characters of the UTF-16 string should be written with their bytes swapped
+static inline void run_utf8_to_utf16_kernel(
+    simd_kernels const* kernels,
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    utf16_t* utf16,     size_t utf16_len, size_t* utf16_index,
+    size_t* kernel_index, bool swap)
+{
+    if (*utf8_index < *kernel_index)
+        return;
+
+    // Copies are given to the kernel so the indexes can stay in registers
+    size_t kernel_utf8_index = *utf8_index;
+    size_t kernel_utf16_index = *utf16_index;
+    if (utf16 == NULL)
+        kernels->utf8_to_utf16_len(utf8, utf8_len, &kernel_utf8_index, &kernel_utf16_index);
+    else if (swap)
+        kernels->utf8_to_utf16_swapped(utf8, utf8_len, &kernel_utf8_index, utf16, utf16_len, &kernel_utf16_index);
+    else
+        kernels->utf8_to_utf16(utf8, utf8_len, &kernel_utf8_index, utf16, utf16_len, &kernel_utf16_index);
+
+    // If the kernel could barely do anything, the input is probably not suited for it,
+    // so don't waste time calling it again for every following codepoint
+    if (kernel_utf8_index - *utf8_index < KERNEL_RETRY_DISTANCE)
+        *kernel_index = kernel_utf8_index + KERNEL_RETRY_DISTANCE;
+
+    *utf8_index = kernel_utf8_index;
+    *utf16_index = kernel_utf16_index;
+}
+
+// Converts a UTF-8 string to a UTF-16 string, as utf8_to_utf16
+// swap: If the characters of the UTF-16 string should be written with their bytes swapped
+// wtf8:
+// If encoded surrogates should be decoded like any other codepoint, as WTF-8 does, instead of being errors.
+// Must be a constant, so the regular conversion doesn't check it for every codepoint.
+// policy:
+// What to do with invalid sequences.
+// Must be a constant, so every policy gets its own loop without checking it for every codepoint.
+// error_index:
+// A pointer to a variable that will receive the index of the first invalid sequence,
+// or utf8_len if there is none. May be NULL, in which case errors aren't tracked for CONVERSION_REPLACE.
+// stats:
+// The statistics to add the conversion to. May be NULL, in which case nothing is counted.
+// Must be a constant NULL when they're not wanted, so the counting is removed from the loop.
+static ALWAYS_INLINE size_t convert_utf8_to_utf16(
+    utf8_t const* utf8, size_t utf8_len,
+    utf16_t* utf16,     size_t utf16_len,
+    bool swap, bool wtf8, conversion_error_policy policy, size_t* error_index,
+    conversion_stats* stats)
 {
     // The next codepoint that will be written in the UTF-16 string
     // or the size of the required buffer if utf16 is NULL
     size_t utf16_index = 0;
+    size_t first_error = utf8_len;
+
+    simd_kernels const* kernels = simd_get_kernels();
+    // The index where the vectorized kernel should be tried again
+    size_t kernel_index = 0;
 
     for (size_t utf8_index = 0; utf8_index < utf8_len; utf8_index++)
     {
+        size_t kernel_start = utf8_index;
+        run_utf8_to_utf16_kernel(kernels, utf8, utf8_len, &utf8_index, utf16, utf16_len, &utf16_index, &kernel_index, swap);
+        if (stats != NULL)
+            count_utf8_fast_path(utf8, kernel_start, utf8_index, stats);
+        if (utf8_index >= utf8_len)
+            break;
+
+        size_t start = utf8_index;
         codepoint_t codepoint = decode_utf8(utf8, utf8_len, &utf8_index);
 
+        if (stats != NULL)
+            stats->slow_path_len += utf8_index - start + 1;
+
+        // Only a U+FFFD can be an error, so the other policies cost nothing on valid strings.
+        // A valid U+FFFD is told apart from a replaced sequence by validating it.
+        bool check_errors = wtf8 || policy != CONVERSION_REPLACE || error_index != NULL || stats != NULL;
+        bool error = check_errors && codepoint == INVALID_CODEPOINT && validate_utf8(utf8, utf8_len, start) == 0;
+
+        // WTF-8 decodes encoded surrogates, which decode_utf8 has already consumed as an invalid sequence
+        if (wtf8 && error)
+        {
+            codepoint_t surrogate = decode_wtf8_surrogate(utf8, utf8_len, start);
+            if (surrogate != INVALID_CODEPOINT)
+            {
+                codepoint = surrogate;
+                error = false;
+            }
+        }
+
+        if (stats != NULL && error)
+            count_utf8_error(utf8, start, utf8_index, stats);
+        else if (stats != NULL)
+            count_codepoint(codepoint, stats);
+
+        if (error)
+        {
+            if (first_error == utf8_len)
+                first_error = start;
+
+            if (policy == CONVERSION_STOP)
+                break;
+
+            if (policy == CONVERSION_SKIP)
+                continue;
+        }
+
         if (utf16 == NULL)
             utf16_index += calculate_utf16_len(codepoint);
         else
-            utf16_index += encode_utf16(codepoint, utf16, utf16_len, utf16_index);
+            utf16_index += encode_utf16(codepoint, utf16, utf16_len, utf16_index, swap);
+    }
+
+    if (error_index != NULL)
+        *error_index = first_error;
+
+    return utf16_index;
+}
+
+size_t utf8_to_utf16(utf8_t const* utf8, size_t utf8_len, utf16_t* utf16, size_t utf16_len)
+{
+    return convert_utf8_to_utf16(utf8, utf8_len, utf16, utf16_len, false, false, CONVERSION_REPLACE, NULL, NULL);
+}
+
+size_t utf8_to_utf16le(utf8_t const* utf8, size_t utf8_len, utf16_t* utf16, size_t utf16_len)
+{
+    return convert_utf8_to_utf16(utf8, utf8_len, utf16, utf16_len, is_swapped(UTF16_LITTLE_ENDIAN), false, CONVERSION_REPLACE, NULL, NULL);
+}
+
+size_t utf8_to_utf16be(utf8_t const* utf8, size_t utf8_len, utf16_t* utf16, size_t utf16_len)
+{
+    return convert_utf8_to_utf16(utf8, utf8_len, utf16, utf16_len, is_swapped(UTF16_BIG_ENDIAN), false, CONVERSION_REPLACE, NULL, NULL);
+}
+
+size_t utf8_to_utf16_with_policy(
+    utf8_t const* utf8, size_t utf8_len,
+    utf16_t* utf16,     size_t utf16_len,
+    conversion_error_policy policy, size_t* error_index)
+{
+    // Every call has a constant policy, so each one is specialized
+    switch (policy)
+    {
+    case CONVERSION_STOP:
+        return convert_utf8_to_utf16(utf8, utf8_len, utf16, utf16_len, false, false, CONVERSION_STOP, error_index, NULL);
+    case CONVERSION_SKIP:
+        return convert_utf8_to_utf16(utf8, utf8_len, utf16, utf16_len, false, false, CONVERSION_SKIP, error_index, NULL);
+    default:
+        return convert_utf8_to_utf16(utf8, utf8_len, utf16, utf16_len, false, false, CONVERSION_REPLACE, error_index, NULL);
+    }
+}
+
+size_t utf8_to_utf16_with_stats(utf8_t const* utf8, size_t utf8_len, utf16_t* utf16, size_t utf16_len, conversion_stats* stats)
+{
+    return convert_utf8_to_utf16(utf8, utf8_len, utf16, utf16_len, false, false, CONVERSION_REPLACE, NULL, stats);
+}
+
+size_t wtf8_to_utf16(utf8_t const* wtf8, size_t wtf8_len, utf16_t* utf16, size_t utf16_len)
+{
+    return convert_utf8_to_utf16(wtf8, wtf8_len, utf16, utf16_len, false, true, CONVERSION_REPLACE, NULL, NULL);
+}
+
+size_t utf8_to_utf16_partial(utf8_t const* utf8, size_t utf8_len, utf16_t* utf16, size_t utf16_len, size_t* utf8_read)
+{
+    size_t utf8_index = 0;
+    size_t utf16_index = 0;
+
+    simd_kernels const* kernels = simd_get_kernels();
+    size_t kernel_index = 0;
+
+    while (utf8_index < utf8_len)
+    {
+        run_utf8_to_utf16_kernel(kernels, utf8, utf8_len, &utf8_index, utf16, utf16_len, &utf16_index, &kernel_index, false);
+        if (utf8_index >= utf8_len)
+            break;
+
+        size_t last_index = utf8_index;
+        codepoint_t codepoint = decode_utf8(utf8, utf8_len, &last_index);
+
+        // Stop at the first codepoint that doesn't fit, so the caller can resume from it
+        size_t written = encode_utf16(codepoint, utf16, utf16_len, utf16_index, false);
+        if (written == 0)
+            break;
+
+        utf16_index += written;
+        utf8_index = last_index + 1;
+    }
+
+    *utf8_read = utf8_index;
+    return utf16_index;
+}
+
+// Lets the vectorized kernel skip as much as it can of a UTF-8 string that is being validated,
+// before the caller falls back to checking codepoints one by one
+//
+// kernels: The kernels to use
+// utf8_index: A pointer to the current index on the UTF-8 string, advanced past the valid characters
+// kernel_index:
+// A pointer to the UTF-8 index where the kernel should be tried again.
+// The kernel is only called if utf8_index has reached it.
+static inline void run_utf8_validate_kernel(
+    simd_kernels const* kernels,
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    size_t* kernel_index)
+{
+    if (*utf8_index < *kernel_index)
+        return;
+
+    size_t kernel_utf8_index = *utf8_index;
+    kernels->utf8_validate(utf8, utf8_len, &kernel_utf8_index);
+
+    if (kernel_utf8_index - *utf8_index < KERNEL_RETRY_DISTANCE)
+        *kernel_index = kernel_utf8_index + KERNEL_RETRY_DISTANCE;
+
+    *utf8_index = kernel_utf8_index;
+}
+
+bool utf8_validate(utf8_t const* utf8, size_t utf8_len, size_t* error_index)
+{
+    size_t utf8_index = 0;
+
+    simd_kernels const* kernels = simd_get_kernels();
+    size_t kernel_index = 0;
+
+    while (utf8_index < utf8_len)
+    {
+        run_utf8_validate_kernel(kernels, utf8, utf8_len, &utf8_index, &kernel_index);
+        if (utf8_index >= utf8_len)
+            break;
+
+        int len = validate_utf8(utf8, utf8_len, utf8_index);
+        if (len == 0)
+            break;
+
+        utf8_index += len;
+    }
+
+    if (error_index != NULL)
+        *error_index = utf8_index;
+
+    return utf8_index >= utf8_len;
+}
+
+size_t utf8_to_utf16_bound(size_t utf8_len)
+{
+    return utf8_len * UTF16_MAX_LEN_PER_UTF8;
+}
+
+size_t utf8_to_utf16_bounded(utf8_t const* utf8, size_t utf8_len, utf16_t* utf16)
+{
+    return utf8_to_utf16(utf8, utf8_len, utf16, utf8_to_utf16_bound(utf8_len));
+}
+
+size_t utf8_to_utf16_unchecked(utf8_t const* utf8, size_t utf8_len, utf16_t* utf16)
+{
+    size_t utf16_index = 0;
+    // The kernels still need a length, and the bound is always enough
+    size_t utf16_len = utf8_to_utf16_bound(utf8_len);
+
+    simd_kernels const* kernels = simd_get_kernels();
+    size_t kernel_index = 0;
+
+    for (size_t utf8_index = 0; utf8_index < utf8_len; utf8_index++)
+    {
+        run_utf8_to_utf16_kernel(kernels, utf8, utf8_len, &utf8_index, utf16, utf16_len, &utf16_index, &kernel_index, false);
+        if (utf8_index >= utf8_len)
+            break;
+
+        // The sequence is known to be valid, so its length comes from the leading byte alone
+        // and the continuation bytes are taken without checking them
+        utf8_t leading = utf8[utf8_index];
+        codepoint_t codepoint;
+        if (leading <= UTF8_1_MAX)
+        {
+            codepoint = leading;
+        }
+        else if (leading < 0xE0)
+        {
+            codepoint = (leading & 0x1F) << UTF8_CONTINUATION_CODEPOINT_BITS;
+            codepoint |= utf8[utf8_index + 1] & ~UTF8_CONTINUATION_MASK;
+            utf8_index += 1;
+        }
+        else if (leading < 0xF0)
+        {
+            codepoint = (leading & 0x0F) << (2 * UTF8_CONTINUATION_CODEPOINT_BITS);
+            codepoint |= (utf8[utf8_index + 1] & ~UTF8_CONTINUATION_MASK) << UTF8_CONTINUATION_CODEPOINT_BITS;
+            codepoint |= utf8[utf8_index + 2] & ~UTF8_CONTINUATION_MASK;
+            utf8_index += 2;
+        }
+        else
+        {
+            codepoint = (leading & 0x07) << (3 * UTF8_CONTINUATION_CODEPOINT_BITS);
+            codepoint |= (utf8[utf8_index + 1] & ~UTF8_CONTINUATION_MASK) << (2 * UTF8_CONTINUATION_CODEPOINT_BITS);
+            codepoint |= (utf8[utf8_index + 2] & ~UTF8_CONTINUATION_MASK) << UTF8_CONTINUATION_CODEPOINT_BITS;
+            codepoint |= utf8[utf8_index + 3] & ~UTF8_CONTINUATION_MASK;
+            utf8_index += 3;
+        }
+
+        // The buffer is known to be large enough, so the characters are written without checking its length
+        if (codepoint <= BMP_END)
+        {
+            utf16[utf16_index] = (utf16_t)codepoint;
+            utf16_index += 1;
+        }
+        else
+        {
+            codepoint -= SURROGATE_CODEPOINT_OFFSET;
+            utf16[utf16_index] = (utf16_t)(HIGH_SURROGATE_VALUE | (codepoint >> SURROGATE_CODEPOINT_BITS));
+            utf16[utf16_index + 1] = (utf16_t)(LOW_SURROGATE_VALUE | (codepoint & SURROGATE_CODEPOINT_MASK));
+            utf16_index += 2;
+        }
+    }
+
+    return utf16_index;
+}
+
+size_t utf16_detect_bom(utf16_t const* utf16, size_t utf16_len, utf16_byte_order* order)
+{
+    if (utf16_len == 0)
+        return 0;
+
+    // A BOM read in the wrong byte order looks like SWAPPED_BYTE_ORDER_MARK
+    bool native_little_endian = is_native_little_endian();
+    if (utf16[0] == BYTE_ORDER_MARK)
+        *order = native_little_endian ? UTF16_LITTLE_ENDIAN : UTF16_BIG_ENDIAN;
+    else if (utf16[0] == SWAPPED_BYTE_ORDER_MARK)
+        *order = native_little_endian ? UTF16_BIG_ENDIAN : UTF16_LITTLE_ENDIAN;
+    else
+        return 0;
+
+    return 1;
+}
+
+size_t utf16_write_bom(utf16_t* utf16, size_t utf16_len, utf16_byte_order order)
+{
+    if (utf16 == NULL)
+        return 1;
+
+    if (utf16_len == 0)
+        return 0;
+
+    utf16[0] = is_swapped(order) ? SWAPPED_BYTE_ORDER_MARK : BYTE_ORDER_MARK;
+    return 1;
+}
+
+// Gets a codepoint from a UTF-32 string
+// utf32: The UTF-32 string
+// index: The index of the character on the string
+//
+// return: The codepoint, or INVALID_CODEPOINT if the character is a surrogate or above UNICODE_MAX.
+static inline codepoint_t decode_utf32(utf32_t const* utf32, size_t index)
+{
+    codepoint_t codepoint = utf32[index];
+
+    if (codepoint > UNICODE_MAX)
+        return INVALID_CODEPOINT;
+
+    // Surrogates are below BMP_END, so their high half is zero
+    if (codepoint <= BMP_END && (codepoint & GENERIC_SURROGATE_MASK) == GENERIC_SURROGATE_VALUE)
+        return INVALID_CODEPOINT;
+
+    return codepoint;
+}
+
+// Lets the vectorized kernel convert as much as it can from a UTF-8 string to a UTF-32 string,
+// as run_utf8_to_utf16_kernel.
+// If the UTF-32 string is NULL, the kernel only counts the UTF-32 characters instead.
+static inline void run_utf8_to_utf32_kernel(
+    simd_kernels const* kernels,
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    utf32_t* utf32,     size_t utf32_len, size_t* utf32_index,
+    size_t* kernel_index)
+{
+    if (*utf8_index < *kernel_index)
+        return;
+
+    size_t kernel_utf8_index = *utf8_index;
+    size_t kernel_utf32_index = *utf32_index;
+    if (utf32 == NULL)
+        kernels->utf8_to_utf32_len(utf8, utf8_len, &kernel_utf8_index, &kernel_utf32_index);
+    else
+        kernels->utf8_to_utf32(utf8, utf8_len, &kernel_utf8_index, utf32, utf32_len, &kernel_utf32_index);
+
+    if (kernel_utf8_index - *utf8_index < KERNEL_RETRY_DISTANCE)
+        *kernel_index = kernel_utf8_index + KERNEL_RETRY_DISTANCE;
+
+    *utf8_index = kernel_utf8_index;
+    *utf32_index = kernel_utf32_index;
+}
+
+size_t utf8_to_utf32(utf8_t const* utf8, size_t utf8_len, utf32_t* utf32, size_t utf32_len)
+{
+    size_t utf32_index = 0;
+
+    simd_kernels const* kernels = simd_get_kernels();
+    size_t kernel_index = 0;
+
+    for (size_t utf8_index = 0; utf8_index < utf8_len; utf8_index++)
+    {
+        run_utf8_to_utf32_kernel(kernels, utf8, utf8_len, &utf8_index, utf32, utf32_len, &utf32_index, &kernel_index);
+        if (utf8_index >= utf8_len)
+            break;
+
+        // Every codepoint takes a single UTF-32 character
+        if (utf32 != NULL && utf32_index >= utf32_len)
+            break;
+
+        codepoint_t codepoint = decode_utf8(utf8, utf8_len, &utf8_index);
+
+        if (utf32 != NULL)
+            utf32[utf32_index] = codepoint;
+        utf32_index++;
+    }
+
+    return utf32_index;
+}
+
+// Lets the vectorized kernel convert as much as it can from a UTF-16 string to a UTF-32 string,
+// as run_utf16_to_utf8_kernel.
+// If the UTF-32 string is NULL, the kernel only counts the UTF-32 characters instead.
+static inline void run_utf16_to_utf32_kernel(
+    simd_kernels const* kernels,
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf32_t* utf32,       size_t utf32_len, size_t* utf32_index,
+    size_t* kernel_index)
+{
+    if (*utf16_index < *kernel_index)
+        return;
+
+    size_t kernel_utf16_index = *utf16_index;
+    size_t kernel_utf32_index = *utf32_index;
+    if (utf32 == NULL)
+        kernels->utf16_to_utf32_len(utf16, utf16_len, &kernel_utf16_index, &kernel_utf32_index);
+    else
+        kernels->utf16_to_utf32(utf16, utf16_len, &kernel_utf16_index, utf32, utf32_len, &kernel_utf32_index);
+
+    if (kernel_utf16_index - *utf16_index < KERNEL_RETRY_DISTANCE)
+        *kernel_index = kernel_utf16_index + KERNEL_RETRY_DISTANCE;
+
+    *utf16_index = kernel_utf16_index;
+    *utf32_index = kernel_utf32_index;
+}
+
+size_t utf16_to_utf32(utf16_t const* utf16, size_t utf16_len, utf32_t* utf32, size_t utf32_len)
+{
+    size_t utf32_index = 0;
+
+    simd_kernels const* kernels = simd_get_kernels();
+    size_t kernel_index = 0;
+
+    for (size_t utf16_index = 0; utf16_index < utf16_len; utf16_index++)
+    {
+        run_utf16_to_utf32_kernel(kernels, utf16, utf16_len, &utf16_index, utf32, utf32_len, &utf32_index, &kernel_index);
+        if (utf16_index >= utf16_len)
+            break;
+
+        // Every codepoint takes a single UTF-32 character
+        if (utf32 != NULL && utf32_index >= utf32_len)
+            break;
+
+        codepoint_t codepoint = decode_utf16(utf16, utf16_len, &utf16_index, false);
+
+        if (utf32 != NULL)
+            utf32[utf32_index] = codepoint;
+        utf32_index++;
+    }
+
+    return utf32_index;
+}
+
+// Lets the vectorized kernel convert as much as it can from a UTF-32 string to a UTF-8 string,
+// as run_utf16_to_utf8_kernel.
+// There's no length kernel, since the length is cheap to calculate, so nothing is done
+// if the UTF-8 string is NULL.
+static inline void run_utf32_to_utf8_kernel(
+    simd_kernels const* kernels,
+    utf32_t const* utf32, size_t utf32_len, size_t* utf32_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index,
+    size_t* kernel_index)
+{
+    if (utf8 == NULL || *utf32_index < *kernel_index)
+        return;
+
+    size_t kernel_utf32_index = *utf32_index;
+    size_t kernel_utf8_index = *utf8_index;
+    kernels->utf32_to_utf8(utf32, utf32_len, &kernel_utf32_index, utf8, utf8_len, &kernel_utf8_index);
+
+    if (kernel_utf32_index - *utf32_index < KERNEL_RETRY_DISTANCE)
+        *kernel_index = kernel_utf32_index + KERNEL_RETRY_DISTANCE;
+
+    *utf32_index = kernel_utf32_index;
+    *utf8_index = kernel_utf8_index;
+}
+
+size_t utf32_to_utf8(utf32_t const* utf32, size_t utf32_len, utf8_t* utf8, size_t utf8_len)
+{
+    size_t utf8_index = 0;
+
+    simd_kernels const* kernels = simd_get_kernels();
+    size_t kernel_index = 0;
+
+    for (size_t utf32_index = 0; utf32_index < utf32_len; utf32_index++)
+    {
+        run_utf32_to_utf8_kernel(kernels, utf32, utf32_len, &utf32_index, utf8, utf8_len, &utf8_index, &kernel_index);
+        if (utf32_index >= utf32_len)
+            break;
+
+        codepoint_t codepoint = decode_utf32(utf32, utf32_index);
+
+        if (utf8 == NULL)
+        {
+            utf8_index += calculate_utf8_len(codepoint);
+            continue;
+        }
+
+        size_t written = encode_utf8(codepoint, utf8, utf8_len, utf8_index);
+        if (written == 0)
+            break;
+
+        utf8_index += written;
+    }
+
+    return utf8_index;
+}
+
+// Lets the vectorized kernel convert as much as it can from a UTF-32 string to a UTF-16 string,
+// as run_utf8_to_utf16_kernel.
+// There's no length kernel, since the length is cheap to calculate, so nothing is done
+// if the UTF-16 string is NULL.
+static inline void run_utf32_to_utf16_kernel(
+    simd_kernels const* kernels,
+    utf32_t const* utf32, size_t utf32_len, size_t* utf32_index,
+    utf16_t* utf16,       size_t utf16_len, size_t* utf16_index,
+    size_t* kernel_index)
+{
+    if (utf16 == NULL || *utf32_index < *kernel_index)
+        return;
+
+    size_t kernel_utf32_index = *utf32_index;
+    size_t kernel_utf16_index = *utf16_index;
+    kernels->utf32_to_utf16(utf32, utf32_len, &kernel_utf32_index, utf16, utf16_len, &kernel_utf16_index);
+
+    if (kernel_utf32_index - *utf32_index < KERNEL_RETRY_DISTANCE)
+        *kernel_index = kernel_utf32_index + KERNEL_RETRY_DISTANCE;
+
+    *utf32_index = kernel_utf32_index;
+    *utf16_index = kernel_utf16_index;
+}
+
+size_t utf32_to_utf16(utf32_t const* utf32, size_t utf32_len, utf16_t* utf16, size_t utf16_len)
+{
+    size_t utf16_index = 0;
+
+    simd_kernels const* kernels = simd_get_kernels();
+    size_t kernel_index = 0;
+
+    for (size_t utf32_index = 0; utf32_index < utf32_len; utf32_index++)
+    {
+        run_utf32_to_utf16_kernel(kernels, utf32, utf32_len, &utf32_index, utf16, utf16_len, &utf16_index, &kernel_index);
+        if (utf32_index >= utf32_len)
+            break;
+
+        codepoint_t codepoint = decode_utf32(utf32, utf32_index);
+
+        if (utf16 == NULL)
+        {
+            utf16_index += calculate_utf16_len(codepoint);
+            continue;
+        }
+
+        size_t written = encode_utf16(codepoint, utf16, utf16_len, utf16_index, false);
+        if (written == 0)
+            break;
+
+        utf16_index += written;
     }
 
     return utf16_index;
 }
+
+// Encodes a codepoint as a Latin-1 character, replacing it if Latin-1 can't encode it
+static inline latin1_t encode_latin1(codepoint_t codepoint)
+{
+    return codepoint <= LATIN1_MAX ? (latin1_t)codepoint : LATIN1_REPLACEMENT;
+}
+
+// Lets the vectorized kernel convert as much as it can from a UTF-8 string to a Latin-1 string,
+// as run_utf8_to_utf16_kernel.
+// If the Latin-1 string is NULL, the kernel only counts the Latin-1 characters instead, which is
+// one for every codepoint, exactly like UTF-32.
+static inline void run_utf8_to_latin1_kernel(
+    simd_kernels const* kernels,
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    latin1_t* latin1,   size_t latin1_len, size_t* latin1_index,
+    size_t* kernel_index)
+{
+    if (*utf8_index < *kernel_index)
+        return;
+
+    size_t kernel_utf8_index = *utf8_index;
+    size_t kernel_latin1_index = *latin1_index;
+    if (latin1 == NULL)
+        kernels->utf8_to_utf32_len(utf8, utf8_len, &kernel_utf8_index, &kernel_latin1_index);
+    else
+        kernels->utf8_to_latin1(utf8, utf8_len, &kernel_utf8_index, latin1, latin1_len, &kernel_latin1_index);
+
+    if (kernel_utf8_index - *utf8_index < KERNEL_RETRY_DISTANCE)
+        *kernel_index = kernel_utf8_index + KERNEL_RETRY_DISTANCE;
+
+    *utf8_index = kernel_utf8_index;
+    *latin1_index = kernel_latin1_index;
+}
+
+size_t utf8_to_latin1(utf8_t const* utf8, size_t utf8_len, latin1_t* latin1, size_t latin1_len)
+{
+    size_t latin1_index = 0;
+
+    simd_kernels const* kernels = simd_get_kernels();
+    size_t kernel_index = 0;
+
+    for (size_t utf8_index = 0; utf8_index < utf8_len; utf8_index++)
+    {
+        run_utf8_to_latin1_kernel(kernels, utf8, utf8_len, &utf8_index, latin1, latin1_len, &latin1_index, &kernel_index);
+        if (utf8_index >= utf8_len)
+            break;
+
+        // Every codepoint takes a single Latin-1 character
+        if (latin1 != NULL && latin1_index >= latin1_len)
+            break;
+
+        codepoint_t codepoint = decode_utf8(utf8, utf8_len, &utf8_index);
+
+        if (latin1 != NULL)
+            latin1[latin1_index] = encode_latin1(codepoint);
+        latin1_index++;
+    }
+
+    return latin1_index;
+}
+
+// Lets the vectorized kernel convert as much as it can from a UTF-16 string to a Latin-1 string,
+// as run_utf16_to_utf8_kernel.
+// If the Latin-1 string is NULL, the kernel only counts the Latin-1 characters instead, which is
+// one for every codepoint, exactly like UTF-32.
+static inline void run_utf16_to_latin1_kernel(
+    simd_kernels const* kernels,
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    latin1_t* latin1,     size_t latin1_len, size_t* latin1_index,
+    size_t* kernel_index)
+{
+    if (*utf16_index < *kernel_index)
+        return;
+
+    size_t kernel_utf16_index = *utf16_index;
+    size_t kernel_latin1_index = *latin1_index;
+    if (latin1 == NULL)
+        kernels->utf16_to_utf32_len(utf16, utf16_len, &kernel_utf16_index, &kernel_latin1_index);
+    else
+        kernels->utf16_to_latin1(utf16, utf16_len, &kernel_utf16_index, latin1, latin1_len, &kernel_latin1_index);
+
+    if (kernel_utf16_index - *utf16_index < KERNEL_RETRY_DISTANCE)
+        *kernel_index = kernel_utf16_index + KERNEL_RETRY_DISTANCE;
+
+    *utf16_index = kernel_utf16_index;
+    *latin1_index = kernel_latin1_index;
+}
+
+size_t utf16_to_latin1(utf16_t const* utf16, size_t utf16_len, latin1_t* latin1, size_t latin1_len)
+{
+    size_t latin1_index = 0;
+
+    simd_kernels const* kernels = simd_get_kernels();
+    size_t kernel_index = 0;
+
+    for (size_t utf16_index = 0; utf16_index < utf16_len; utf16_index++)
+    {
+        run_utf16_to_latin1_kernel(kernels, utf16, utf16_len, &utf16_index, latin1, latin1_len, &latin1_index, &kernel_index);
+        if (utf16_index >= utf16_len)
+            break;
+
+        // Every codepoint takes a single Latin-1 character
+        if (latin1 != NULL && latin1_index >= latin1_len)
+            break;
+
+        codepoint_t codepoint = decode_utf16(utf16, utf16_len, &utf16_index, false);
+
+        if (latin1 != NULL)
+            latin1[latin1_index] = encode_latin1(codepoint);
+        latin1_index++;
+    }
+
+    return latin1_index;
+}
+
+// Lets the vectorized kernel convert as much as it can from a Latin-1 string to a UTF-8 string,
+// as run_utf16_to_utf8_kernel.
+// If the UTF-8 string is NULL, the kernel only counts the UTF-8 characters instead.
+static inline void run_latin1_to_utf8_kernel(
+    simd_kernels const* kernels,
+    latin1_t const* latin1, size_t latin1_len, size_t* latin1_index,
+    utf8_t* utf8,           size_t utf8_len,   size_t* utf8_index,
+    size_t* kernel_index)
+{
+    if (*latin1_index < *kernel_index)
+        return;
+
+    size_t kernel_latin1_index = *latin1_index;
+    size_t kernel_utf8_index = *utf8_index;
+    if (utf8 == NULL)
+        kernels->latin1_to_utf8_len(latin1, latin1_len, &kernel_latin1_index, &kernel_utf8_index);
+    else
+        kernels->latin1_to_utf8(latin1, latin1_len, &kernel_latin1_index, utf8, utf8_len, &kernel_utf8_index);
+
+    if (kernel_latin1_index - *latin1_index < KERNEL_RETRY_DISTANCE)
+        *kernel_index = kernel_latin1_index + KERNEL_RETRY_DISTANCE;
+
+    *latin1_index = kernel_latin1_index;
+    *utf8_index = kernel_utf8_index;
+}
+
+size_t latin1_to_utf8(latin1_t const* latin1, size_t latin1_len, utf8_t* utf8, size_t utf8_len)
+{
+    size_t utf8_index = 0;
+
+    simd_kernels const* kernels = simd_get_kernels();
+    size_t kernel_index = 0;
+
+    for (size_t latin1_index = 0; latin1_index < latin1_len; latin1_index++)
+    {
+        run_latin1_to_utf8_kernel(kernels, latin1, latin1_len, &latin1_index, utf8, utf8_len, &utf8_index, &kernel_index);
+        if (latin1_index >= latin1_len)
+            break;
+
+        // Every Latin-1 character is the codepoint itself
+        codepoint_t codepoint = latin1[latin1_index];
+
+        if (utf8 == NULL)
+        {
+            utf8_index += calculate_utf8_len(codepoint);
+            continue;
+        }
+
+        size_t written = encode_utf8(codepoint, utf8, utf8_len, utf8_index);
+        if (written == 0)
+            break;
+
+        utf8_index += written;
+    }
+
+    return utf8_index;
+}
+
+size_t latin1_to_utf16(latin1_t const* latin1, size_t latin1_len, utf16_t* utf16, size_t utf16_len)
+{
+    // Every Latin-1 character takes a single UTF-16 character
+    if (utf16 == NULL)
+        return latin1_len;
+
+    size_t len = latin1_len < utf16_len ? latin1_len : utf16_len;
+
+    // Nothing ever stops the kernel, so it only leaves the end of its last block behind
+    size_t latin1_index = 0;
+    size_t utf16_index = 0;
+    simd_get_kernels()->latin1_to_utf16(latin1, len, &latin1_index, utf16, len, &utf16_index);
+
+    for (; latin1_index < len; latin1_index++)
+        utf16[latin1_index] = latin1[latin1_index];
+
+    return len;
+}
+
+bool utf8_fits_latin1(utf8_t const* utf8, size_t utf8_len)
+{
+    simd_kernels const* kernels = simd_get_kernels();
+    size_t kernel_index = 0;
+
+    for (size_t utf8_index = 0; utf8_index < utf8_len; utf8_index++)
+    {
+        if (utf8_index >= kernel_index)
+        {
+            size_t kernel_utf8_index = utf8_index;
+            kernels->utf8_skip_latin1(utf8, utf8_len, &kernel_utf8_index);
+
+            if (kernel_utf8_index - utf8_index < KERNEL_RETRY_DISTANCE)
+                kernel_index = kernel_utf8_index + KERNEL_RETRY_DISTANCE;
+
+            utf8_index = kernel_utf8_index;
+            if (utf8_index >= utf8_len)
+                break;
+        }
+
+        // Invalid sequences are decoded as INVALID_CODEPOINT, which doesn't fit either
+        if (decode_utf8(utf8, utf8_len, &utf8_index) > LATIN1_MAX)
+            return false;
+    }
+
+    return true;
+}
+
+bool utf16_fits_latin1(utf16_t const* utf16, size_t utf16_len)
+{
+    size_t utf16_index = 0;
+    simd_get_kernels()->utf16_skip_latin1(utf16, utf16_len, &utf16_index);
+
+    // The kernel only stops early at a character that doesn't fit, which is always close.
+    // Surrogates are above U+00FF, so there's no need to decode pairs.
+    for (; utf16_index < utf16_len; utf16_index++)
+    {
+        if (utf16[utf16_index] > LATIN1_MAX)
+            return false;
+    }
+
+    return true;
+}
+
+bool utf8_is_ascii(utf8_t const* utf8, size_t utf8_len)
+{
+    size_t utf8_index = 0;
+    simd_get_kernels()->utf8_skip_ascii(utf8, utf8_len, &utf8_index);
+
+    // The kernel only stops early at a character that isn't ASCII, which is always close
+    for (; utf8_index < utf8_len; utf8_index++)
+    {
+        if (utf8[utf8_index] > UTF8_1_MAX)
+            return false;
+    }
+
+    return true;
+}
+
+bool utf16_is_ascii(utf16_t const* utf16, size_t utf16_len)
+{
+    size_t utf16_index = 0;
+    simd_get_kernels()->utf16_skip_ascii(utf16, utf16_len, &utf16_index);
+
+    // The kernel only stops early at a character that isn't ASCII, which is always close
+    for (; utf16_index < utf16_len; utf16_index++)
+    {
+        if (utf16[utf16_index] > UTF8_1_MAX)
+            return false;
+    }
+
+    return true;
+}
+
+utf32_t utf8_decode_next(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index)
+{
+    // decode_utf8 leaves the index at the last character of the codepoint
+    codepoint_t codepoint = decode_utf8(utf8, utf8_len, utf8_index);
+    (*utf8_index)++;
+    return codepoint;
+}
+
+utf32_t utf16_decode_next(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index)
+{
+    // decode_utf16 leaves the index at the last character of the codepoint
+    codepoint_t codepoint = decode_utf16(utf16, utf16_len, utf16_index, false);
+    (*utf16_index)++;
+    return codepoint;
+}
+
+size_t utf8_iterator_next_n(utf8_iterator* iterator, utf32_t* codepoints, size_t codepoints_len)
+{
+    // Working on copies lets the compiler keep them in registers
+    utf8_t const* utf8 = iterator->utf8;
+    size_t utf8_len = iterator->utf8_len;
+    size_t utf8_index = iterator->index;
+
+    size_t count = 0;
+    for (; count < codepoints_len && utf8_index < utf8_len; count++, utf8_index++)
+        codepoints[count] = decode_utf8(utf8, utf8_len, &utf8_index);
+
+    iterator->index = utf8_index;
+    return count;
+}
+
+size_t utf8_iterator_skip_ascii(utf8_iterator* iterator)
+{
+    size_t start = iterator->index;
+    size_t utf8_index = start;
+
+    simd_get_kernels()->utf8_skip_ascii(iterator->utf8, iterator->utf8_len, &utf8_index);
+
+    // The kernel may stop at the last block before the end of the string
+    while (utf8_index < iterator->utf8_len && iterator->utf8[utf8_index] <= UTF8_1_MAX)
+        utf8_index++;
+
+    iterator->index = utf8_index;
+    return utf8_index - start;
+}
+
+size_t utf16_iterator_next_n(utf16_iterator* iterator, utf32_t* codepoints, size_t codepoints_len)
+{
+    // Working on copies lets the compiler keep them in registers
+    utf16_t const* utf16 = iterator->utf16;
+    size_t utf16_len = iterator->utf16_len;
+    size_t utf16_index = iterator->index;
+
+    size_t count = 0;
+    for (; count < codepoints_len && utf16_index < utf16_len; count++, utf16_index++)
+        codepoints[count] = decode_utf16(utf16, utf16_len, &utf16_index, false);
+
+    iterator->index = utf16_index;
+    return count;
+}
+
+size_t utf16_iterator_skip_ascii(utf16_iterator* iterator)
+{
+    size_t start = iterator->index;
+    size_t utf16_index = start;
+
+    simd_get_kernels()->utf16_skip_ascii(iterator->utf16, iterator->utf16_len, &utf16_index);
+
+    // The kernel may stop at the last block before the end of the string
+    while (utf16_index < iterator->utf16_len && iterator->utf16[utf16_index] <= UTF8_1_MAX)
+        utf16_index++;
+
+    iterator->index = utf16_index;
+    return utf16_index - start;
+}
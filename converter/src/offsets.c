@@ -0,0 +1,142 @@
+#include <converter.h>
+#include <stdbool.h>
+#include <string.h>
+#include "unicode.h"
+
+// The offset index keeps the UTF-8 and UTF-16 offsets of codepoint boundaries spread through
+// the UTF-8 string, so a translation only needs to look at the part of the string after
+// the closest checkpoint.
+// Decoding from a codepoint boundary gives the same result as decoding the whole string,
+// so the length of every part between checkpoints is calculated with the regular conversion
+// functions, and appending to the string only changes the part after the last checkpoint.
+
+// The number of UTF-8 characters between checkpoints if no stride is given.
+// Translations scan at most this many characters after the binary search.
+#define OFFSET_INDEX_DEFAULT_STRIDE 4096
+
+size_t utf_offset_index_capacity(size_t utf8_len, size_t stride)
+{
+    if (stride == 0)
+        stride = OFFSET_INDEX_DEFAULT_STRIDE;
+
+    // Checkpoints are at least one stride apart, plus the one at the start of the string
+    return utf8_len / stride + 1;
+}
+
+void utf_offset_index_init(utf_offset_index* index, utf_offset_checkpoint* checkpoints, size_t capacity, size_t stride)
+{
+    index->checkpoints = checkpoints;
+    index->capacity = capacity;
+    index->stride = stride > 0 ? stride : OFFSET_INDEX_DEFAULT_STRIDE;
+    index->utf8_len = 0;
+    index->utf16_len = 0;
+
+    checkpoints[0].utf8_offset = 0;
+    checkpoints[0].utf16_offset = 0;
+    index->count = 1;
+}
+
+void utf_offset_index_reserve(utf_offset_index* index, utf_offset_checkpoint* checkpoints, size_t capacity)
+{
+    if (checkpoints != index->checkpoints)
+        memcpy(checkpoints, index->checkpoints, index->count * sizeof(utf_offset_checkpoint));
+
+    index->checkpoints = checkpoints;
+    index->capacity = capacity;
+}
+
+void utf_offset_index_append(utf_offset_index* index, utf8_t const* utf8, size_t utf8_len)
+{
+    // The last codepoint before the append may have been cut off, so everything after the
+    // last checkpoint is indexed again
+    utf_offset_checkpoint last = index->checkpoints[index->count - 1];
+
+    while (index->count < index->capacity)
+    {
+        size_t next = find_utf8_boundary(utf8, utf8_len, last.utf8_offset + index->stride);
+        if (next >= utf8_len)
+            break;
+
+        last.utf16_offset += utf8_to_utf16(utf8 + last.utf8_offset, next - last.utf8_offset, NULL, 0);
+        last.utf8_offset = next;
+
+        index->checkpoints[index->count] = last;
+        index->count++;
+    }
+
+    index->utf8_len = utf8_len;
+    index->utf16_len = last.utf16_offset + utf8_to_utf16(utf8 + last.utf8_offset, utf8_len - last.utf8_offset, NULL, 0);
+}
+
+// Finds the last checkpoint whose UTF-8 offset is at most a value, or whose UTF-16 offset is
+// at most a value if 'by_utf16' is set
+static utf_offset_checkpoint find_checkpoint(utf_offset_index const* index, size_t offset, bool by_utf16)
+{
+    size_t low = 0;
+    size_t high = index->count;
+
+    // Checkpoint 0 is always at the start, so there's always a match
+    while (high - low > 1)
+    {
+        size_t middle = low + (high - low) / 2;
+        utf_offset_checkpoint checkpoint = index->checkpoints[middle];
+        size_t checkpoint_offset = by_utf16 ? checkpoint.utf16_offset : checkpoint.utf8_offset;
+
+        if (checkpoint_offset <= offset)
+            low = middle;
+        else
+            high = middle;
+    }
+
+    return index->checkpoints[low];
+}
+
+size_t utf_offset_utf8_to_utf16(utf_offset_index const* index, utf8_t const* utf8, size_t utf8_offset)
+{
+    if (utf8_offset >= index->utf8_len)
+        return index->utf16_len;
+
+    utf_offset_checkpoint checkpoint = find_checkpoint(index, utf8_offset, false);
+    return checkpoint.utf16_offset + utf8_to_utf16(utf8 + checkpoint.utf8_offset, utf8_offset - checkpoint.utf8_offset, NULL, 0);
+}
+
+size_t utf_offset_utf16_to_utf8(utf_offset_index const* index, utf8_t const* utf8, size_t utf16_offset)
+{
+    if (utf16_offset >= index->utf16_len)
+        return index->utf8_len;
+
+    utf_offset_checkpoint checkpoint = find_checkpoint(index, utf16_offset, true);
+
+    utf8_iterator iterator;
+    utf8_iterator_init(&iterator, utf8, index->utf8_len);
+    iterator.index = checkpoint.utf8_offset;
+    size_t utf16_index = checkpoint.utf16_offset;
+
+    while (utf16_index < utf16_offset)
+    {
+        // ASCII characters take one character in both encodings, so they're skipped in bulk,
+        // but never past the target
+        utf8_iterator ascii = iterator;
+        size_t ascii_end = iterator.index + (utf16_offset - utf16_index);
+        if (ascii_end < ascii.utf8_len)
+            ascii.utf8_len = ascii_end;
+
+        size_t skipped = utf8_iterator_skip_ascii(&ascii);
+        iterator.index += skipped;
+        utf16_index += skipped;
+        if (utf16_index >= utf16_offset)
+            break;
+
+        size_t start = iterator.index;
+        utf32_t codepoint;
+        if (!utf8_iterator_next(&iterator, &codepoint))
+            break;
+        utf16_index += codepoint > BMP_END ? 2 : 1;
+
+        // The offset is in the middle of a surrogate pair
+        if (utf16_index > utf16_offset)
+            return start;
+    }
+
+    return iterator.index;
+}
@@ -0,0 +1,263 @@
+#include <converter.h>
+#include <stdbool.h>
+#include "unicode.h"
+
+#ifdef CONVERTER_HAS_THREADS
+#include <threads.h>
+#endif
+
+// Parallel conversion splits the input in chunks that start at codepoint boundaries, calculates
+// the converted size of every chunk in parallel, and then converts every chunk in parallel
+// to its own part of the output, found by adding up the sizes of the chunks before it.
+// The decoders only look at the characters of the codepoint they're decoding, so converting
+// the chunks separately gives exactly the same output as converting the whole input at once.
+
+// The maximum number of chunks the input is split in
+#define PARALLEL_MAX_CHUNKS 64
+
+// The minimum length of a chunk, in input characters.
+// Smaller chunks aren't worth the overhead of running them in parallel.
+#define PARALLEL_MIN_CHUNK_LEN (64 * 1024)
+
+// A chunk of the input that is converted in parallel with the others
+typedef struct
+{
+    // The index of the first character of the chunk in the input
+    size_t input_index;
+    // The length of the chunk, in input characters
+    size_t input_len;
+    // The index where the converted chunk starts in the output
+    size_t output_index;
+    // The length of the converted chunk, in output characters
+    size_t output_len;
+} parallel_chunk;
+
+// The state shared by all tasks of a parallel conversion
+typedef struct
+{
+    void const* input;
+    void* output;
+    parallel_chunk chunks[PARALLEL_MAX_CHUNKS];
+} parallel_conversion;
+
+#ifdef CONVERTER_HAS_THREADS
+
+// The arguments of a task that runs on its own thread
+typedef struct
+{
+    utf_task task;
+    void* context;
+    size_t index;
+} thread_task;
+
+static int run_thread_task(void* arg)
+{
+    thread_task* task = arg;
+    task->task(task->context, task->index);
+    return 0;
+}
+
+// Runs every task on its own thread, with the first one running on the calling thread
+static void run_tasks_in_threads(void* runner_context, utf_task task, void* task_context, size_t task_count)
+{
+    (void)runner_context;
+
+    thrd_t threads[PARALLEL_MAX_CHUNKS];
+    thread_task tasks[PARALLEL_MAX_CHUNKS];
+    bool started[PARALLEL_MAX_CHUNKS];
+
+    for (size_t index = 1; index < task_count; index++)
+    {
+        tasks[index].task = task;
+        tasks[index].context = task_context;
+        tasks[index].index = index;
+
+        started[index] = thrd_create(&threads[index], run_thread_task, &tasks[index]) == thrd_success;
+
+        // Couldn't start a thread, so just run the task here
+        if (!started[index])
+            task(task_context, index);
+    }
+
+    task(task_context, 0);
+
+    for (size_t index = 1; index < task_count; index++)
+    {
+        if (started[index])
+            thrd_join(threads[index], NULL);
+    }
+}
+
+#define run_tasks_default run_tasks_in_threads
+
+#else
+
+// Runs every task one after the other, for when no threads are available
+static void run_tasks_sequentially(void* runner_context, utf_task task, void* task_context, size_t task_count)
+{
+    (void)runner_context;
+
+    for (size_t index = 0; index < task_count; index++)
+        task(task_context, index);
+}
+
+#define run_tasks_default run_tasks_sequentially
+
+#endif
+
+// Calculates how many chunks an input should be split in
+//
+// input_len: The length of the input, in characters
+// thread_count: The number of threads requested by the caller
+static size_t get_chunk_count(size_t input_len, size_t thread_count)
+{
+    size_t count = input_len / PARALLEL_MIN_CHUNK_LEN;
+
+    if (count > thread_count)
+        count = thread_count;
+
+    if (count > PARALLEL_MAX_CHUNKS)
+        count = PARALLEL_MAX_CHUNKS;
+
+    return count;
+}
+
+static void size_utf8_to_utf16_chunk(void* context, size_t index)
+{
+    parallel_conversion* conversion = context;
+    parallel_chunk* chunk = &conversion->chunks[index];
+    utf8_t const* utf8 = conversion->input;
+
+    chunk->output_len = utf8_to_utf16(utf8 + chunk->input_index, chunk->input_len, NULL, 0);
+}
+
+static void convert_utf8_to_utf16_chunk(void* context, size_t index)
+{
+    parallel_conversion* conversion = context;
+    parallel_chunk* chunk = &conversion->chunks[index];
+    utf8_t const* utf8 = conversion->input;
+    utf16_t* utf16 = conversion->output;
+
+    utf8_to_utf16(utf8 + chunk->input_index, chunk->input_len, utf16 + chunk->output_index, chunk->output_len);
+}
+
+static void size_utf16_to_utf8_chunk(void* context, size_t index)
+{
+    parallel_conversion* conversion = context;
+    parallel_chunk* chunk = &conversion->chunks[index];
+    utf16_t const* utf16 = conversion->input;
+
+    chunk->output_len = utf16_to_utf8(utf16 + chunk->input_index, chunk->input_len, NULL, 0);
+}
+
+static void convert_utf16_to_utf8_chunk(void* context, size_t index)
+{
+    parallel_conversion* conversion = context;
+    parallel_chunk* chunk = &conversion->chunks[index];
+    utf16_t const* utf16 = conversion->input;
+    utf8_t* utf8 = conversion->output;
+
+    utf16_to_utf8(utf16 + chunk->input_index, chunk->input_len, utf8 + chunk->output_index, chunk->output_len);
+}
+
+// Sets the output index of every chunk from the sizes of the chunks before it
+//
+// return: The total size of the output
+static size_t place_chunks(parallel_conversion* conversion, size_t chunk_count)
+{
+    size_t output_index = 0;
+
+    for (size_t index = 0; index < chunk_count; index++)
+    {
+        conversion->chunks[index].output_index = output_index;
+        output_index += conversion->chunks[index].output_len;
+    }
+
+    return output_index;
+}
+
+size_t utf8_to_utf16_parallel(
+    utf8_t const* utf8, size_t utf8_len,
+    utf16_t* utf16,     size_t utf16_len,
+    size_t thread_count, utf_task_runner runner, void* runner_context)
+{
+    size_t chunk_count = get_chunk_count(utf8_len, thread_count);
+    if (chunk_count <= 1)
+        return utf8_to_utf16(utf8, utf8_len, utf16, utf16_len);
+
+    if (runner == NULL)
+        runner = run_tasks_default;
+
+    parallel_conversion conversion;
+    conversion.input = utf8;
+    conversion.output = utf16;
+
+    size_t start = 0;
+    for (size_t index = 0; index < chunk_count; index++)
+    {
+        size_t end = index == chunk_count - 1 ? utf8_len : find_utf8_boundary(utf8, utf8_len, utf8_len / chunk_count * (index + 1));
+        if (end < start)
+            end = start;
+
+        conversion.chunks[index].input_index = start;
+        conversion.chunks[index].input_len = end - start;
+        start = end;
+    }
+
+    runner(runner_context, size_utf8_to_utf16_chunk, &conversion, chunk_count);
+    size_t required_len = place_chunks(&conversion, chunk_count);
+
+    if (utf16 == NULL)
+        return required_len;
+
+    // Let the regular conversion handle buffers that are too small, so that exactly
+    // the same characters are written
+    if (required_len > utf16_len)
+        return utf8_to_utf16(utf8, utf8_len, utf16, utf16_len);
+
+    runner(runner_context, convert_utf8_to_utf16_chunk, &conversion, chunk_count);
+    return required_len;
+}
+
+size_t utf16_to_utf8_parallel(
+    utf16_t const* utf16, size_t utf16_len,
+    utf8_t* utf8,         size_t utf8_len,
+    size_t thread_count, utf_task_runner runner, void* runner_context)
+{
+    size_t chunk_count = get_chunk_count(utf16_len, thread_count);
+    if (chunk_count <= 1)
+        return utf16_to_utf8(utf16, utf16_len, utf8, utf8_len);
+
+    if (runner == NULL)
+        runner = run_tasks_default;
+
+    parallel_conversion conversion;
+    conversion.input = utf16;
+    conversion.output = utf8;
+
+    size_t start = 0;
+    for (size_t index = 0; index < chunk_count; index++)
+    {
+        size_t end = index == chunk_count - 1 ? utf16_len : find_utf16_boundary(utf16, utf16_len, utf16_len / chunk_count * (index + 1));
+        if (end < start)
+            end = start;
+
+        conversion.chunks[index].input_index = start;
+        conversion.chunks[index].input_len = end - start;
+        start = end;
+    }
+
+    runner(runner_context, size_utf16_to_utf8_chunk, &conversion, chunk_count);
+    size_t required_len = place_chunks(&conversion, chunk_count);
+
+    if (utf8 == NULL)
+        return required_len;
+
+    // Let the regular conversion handle buffers that are too small, so that exactly
+    // the same characters are written
+    if (required_len > utf8_len)
+        return utf16_to_utf8(utf16, utf16_len, utf8, utf8_len);
+
+    runner(runner_context, convert_utf16_to_utf8_chunk, &conversion, chunk_count);
+    return required_len;
+}
@@ -0,0 +1,3046 @@
+#include "simd.h"
+#include "unicode.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#define SIMD_HAS_ATOMICS
+#include <stdatomic.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// Enables an instruction set for a single function, so the rest of the library can still
+// run on CPUs that don't support it. MSVC allows any intrinsic anywhere, so it needs nothing.
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_SSE41 __attribute__((target("sse4.1,popcnt")))
+#define TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#else
+#define TARGET_SSE2
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+// The number of characters handled at once by the portable scalar kernels
+#define SCALAR_BLOCK_LEN 8
+// If a block of SCALAR_BLOCK_LEN UTF-8 characters, masked with this value, is not zero, it has non-ASCII characters
+#define SCALAR_ASCII_MASK UINT64_C(0x8080808080808080)
+// The number of UTF-16 characters that fit in the same 64 bits as SCALAR_BLOCK_LEN UTF-8 characters
+#define SCALAR_UTF16_BLOCK_LEN 4
+// If a block of SCALAR_UTF16_BLOCK_LEN UTF-16 characters, masked with this value, is not zero, it has non-ASCII characters
+#define SCALAR_UTF16_ASCII_MASK UINT64_C(0xFF80FF80FF80FF80)
+// SCALAR_UTF16_ASCII_MASK for blocks of byte-swapped UTF-16 characters
+#define SCALAR_SWAPPED_UTF16_ASCII_MASK UINT64_C(0x80FF80FF80FF80FF)
+// If a UTF-16 character in a block of SCALAR_UTF16_BLOCK_LEN, masked with this value, matches SCALAR_SURROGATE_VALUE, it is a surrogate
+#define SCALAR_SURROGATE_MASK UINT64_C(0xF800F800F800F800)
+// The value that every surrogate in a block of SCALAR_UTF16_BLOCK_LEN UTF-16 characters has after applying SCALAR_SURROGATE_MASK
+#define SCALAR_SURROGATE_VALUE UINT64_C(0xD800D800D800D800)
+// The lowest bit of every UTF-16 character in a block of SCALAR_UTF16_BLOCK_LEN
+#define SCALAR_UTF16_LOW_BITS UINT64_C(0x0001000100010001)
+// The highest bit of every UTF-16 character in a block of SCALAR_UTF16_BLOCK_LEN
+#define SCALAR_UTF16_HIGH_BITS UINT64_C(0x8000800080008000)
+// The number of UTF-32 characters that fit in the same 64 bits as SCALAR_BLOCK_LEN UTF-8 characters
+#define SCALAR_UTF32_BLOCK_LEN 2
+// If a block of SCALAR_UTF32_BLOCK_LEN UTF-32 characters, masked with this value, is not zero, it has non-ASCII characters
+#define SCALAR_UTF32_ASCII_MASK UINT64_C(0xFFFFFF80FFFFFF80)
+// If a block of SCALAR_UTF32_BLOCK_LEN UTF-32 characters, masked with this value, is not zero, it has characters outside of the BMP
+#define SCALAR_UTF32_BMP_MASK UINT64_C(0xFFFF0000FFFF0000)
+// If a block of SCALAR_UTF16_BLOCK_LEN UTF-16 characters, masked with this value, is not zero, it has characters above U+00FF
+#define SCALAR_UTF16_LATIN1_MASK UINT64_C(0xFF00FF00FF00FF00)
+// The lowest bit of every byte in a block of SCALAR_BLOCK_LEN
+#define SCALAR_BYTE_LOW_BITS UINT64_C(0x0101010101010101)
+
+#if defined(_MSC_VER) && !defined(__clang__)
+// Counts the number of set bits in a value
+static int count_bits(uint32_t value) { return (int)__popcnt(value); }
+// Counts the number of unset bits below the lowest set bit of a value, which must not be zero
+static int count_trailing_zeros(uint32_t value) { unsigned long index; _BitScanForward(&index, value); return (int)index; }
+#else
+// Counts the number of set bits in a value
+#define count_bits(value) __builtin_popcount(value)
+// Counts the number of unset bits below the lowest set bit of a value, which must not be zero
+#define count_trailing_zeros(value) __builtin_ctz(value)
+#endif
+
+
+// Scalar
+//
+// Every kernel that reads or writes UTF-16 has an implementation that takes a 'swap' flag,
+// set if the UTF-16 characters are stored with their bytes swapped, so the byte-swapped kernels
+// are the same code with the swap fused into the loads and stores.
+
+static ALWAYS_INLINE void utf8_to_utf16_scalar_impl(
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    utf16_t* utf16,     size_t utf16_len, size_t* utf16_index,
+    bool swap)
+{
+    size_t in = *utf8_index;
+    size_t out = *utf16_index;
+
+    // Widen whole blocks of ASCII characters, checking them all at once
+    while (in + SCALAR_BLOCK_LEN <= utf8_len && out + SCALAR_BLOCK_LEN <= utf16_len)
+    {
+        uint64_t block;
+        memcpy(&block, utf8 + in, sizeof block);
+
+        if ((block & SCALAR_ASCII_MASK) != 0)
+            break;
+
+        for (int i = 0; i < SCALAR_BLOCK_LEN; i++)
+            utf16[out + i] = swap ? (utf16_t)(utf8[in + i] << 8) : utf8[in + i];
+
+        in += SCALAR_BLOCK_LEN;
+        out += SCALAR_BLOCK_LEN;
+    }
+
+    *utf8_index = in;
+    *utf16_index = out;
+}
+
+static void utf8_to_utf16_scalar(
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    utf16_t* utf16,     size_t utf16_len, size_t* utf16_index)
+{
+    utf8_to_utf16_scalar_impl(utf8, utf8_len, utf8_index, utf16, utf16_len, utf16_index, false);
+}
+
+static void utf8_to_utf16_swapped_scalar(
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    utf16_t* utf16,     size_t utf16_len, size_t* utf16_index)
+{
+    utf8_to_utf16_scalar_impl(utf8, utf8_len, utf8_index, utf16, utf16_len, utf16_index, true);
+}
+
+static ALWAYS_INLINE void utf16_to_utf8_scalar_impl(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index,
+    bool swap)
+{
+    size_t in = *utf16_index;
+    size_t out = *utf8_index;
+    uint64_t const ascii_mask = swap ? SCALAR_SWAPPED_UTF16_ASCII_MASK : SCALAR_UTF16_ASCII_MASK;
+
+    // Narrow whole blocks of ASCII characters, checking them all at once
+    while (in + SCALAR_UTF16_BLOCK_LEN <= utf16_len && out + SCALAR_UTF16_BLOCK_LEN <= utf8_len)
+    {
+        uint64_t block;
+        memcpy(&block, utf16 + in, sizeof block);
+
+        if ((block & ascii_mask) != 0)
+            break;
+
+        for (int i = 0; i < SCALAR_UTF16_BLOCK_LEN; i++)
+            utf8[out + i] = (utf8_t)(swap ? utf16[in + i] >> 8 : utf16[in + i]);
+
+        in += SCALAR_UTF16_BLOCK_LEN;
+        out += SCALAR_UTF16_BLOCK_LEN;
+    }
+
+    *utf16_index = in;
+    *utf8_index = out;
+}
+
+static void utf16_to_utf8_scalar(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index)
+{
+    utf16_to_utf8_scalar_impl(utf16, utf16_len, utf16_index, utf8, utf8_len, utf8_index, false);
+}
+
+static void utf16_swapped_to_utf8_scalar(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index)
+{
+    utf16_to_utf8_scalar_impl(utf16, utf16_len, utf16_index, utf8, utf8_len, utf8_index, true);
+}
+
+static void utf8_to_utf16_len_scalar(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index, size_t* utf16_index)
+{
+    size_t in = *utf8_index;
+
+    // Count whole blocks of ASCII characters, checking them all at once
+    while (in + SCALAR_BLOCK_LEN <= utf8_len)
+    {
+        uint64_t block;
+        memcpy(&block, utf8 + in, sizeof block);
+
+        if ((block & SCALAR_ASCII_MASK) != 0)
+            break;
+
+        in += SCALAR_BLOCK_LEN;
+    }
+
+    *utf16_index += in - *utf8_index;
+    *utf8_index = in;
+}
+
+static ALWAYS_INLINE void utf16_to_utf8_len_scalar_impl(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index, size_t* utf8_index, bool swap)
+{
+    size_t in = *utf16_index;
+    uint64_t const ascii_mask = swap ? SCALAR_SWAPPED_UTF16_ASCII_MASK : SCALAR_UTF16_ASCII_MASK;
+
+    // Count whole blocks of ASCII characters, checking them all at once
+    while (in + SCALAR_UTF16_BLOCK_LEN <= utf16_len)
+    {
+        uint64_t block;
+        memcpy(&block, utf16 + in, sizeof block);
+
+        if ((block & ascii_mask) != 0)
+            break;
+
+        in += SCALAR_UTF16_BLOCK_LEN;
+    }
+
+    *utf8_index += in - *utf16_index;
+    *utf16_index = in;
+}
+
+static void utf16_to_utf8_len_scalar(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index, size_t* utf8_index)
+{
+    utf16_to_utf8_len_scalar_impl(utf16, utf16_len, utf16_index, utf8_index, false);
+}
+
+static void utf16_swapped_to_utf8_len_scalar(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index, size_t* utf8_index)
+{
+    utf16_to_utf8_len_scalar_impl(utf16, utf16_len, utf16_index, utf8_index, true);
+}
+
+// Checks if any of the 16-bit lanes of a block is a UTF-16 surrogate
+static inline bool has_surrogates_scalar(uint64_t block)
+{
+    // Surrogates become zero, and subtracting one from a zero character sets its highest bit
+    uint64_t surrogates = (block & SCALAR_SURROGATE_MASK) ^ SCALAR_SURROGATE_VALUE;
+    return ((surrogates - SCALAR_UTF16_LOW_BITS) & ~surrogates & SCALAR_UTF16_HIGH_BITS) != 0;
+}
+
+static void utf16_validate_scalar(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index)
+{
+    size_t in = *utf16_index;
+
+    // Skip whole blocks without surrogates, checking them all at once
+    while (in + SCALAR_UTF16_BLOCK_LEN <= utf16_len)
+    {
+        uint64_t block;
+        memcpy(&block, utf16 + in, sizeof block);
+
+        if (has_surrogates_scalar(block))
+            break;
+
+        in += SCALAR_UTF16_BLOCK_LEN;
+    }
+
+    *utf16_index = in;
+}
+
+static void utf8_validate_scalar(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index)
+{
+    size_t in = *utf8_index;
+
+    // Skip whole blocks of ASCII characters, checking them all at once
+    while (in + SCALAR_BLOCK_LEN <= utf8_len)
+    {
+        uint64_t block;
+        memcpy(&block, utf8 + in, sizeof block);
+
+        if ((block & SCALAR_ASCII_MASK) != 0)
+            break;
+
+        in += SCALAR_BLOCK_LEN;
+    }
+
+    *utf8_index = in;
+}
+
+static void utf8_to_utf32_scalar(
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    utf32_t* utf32,     size_t utf32_len, size_t* utf32_index)
+{
+    size_t in = *utf8_index;
+    size_t out = *utf32_index;
+
+    // Widen whole blocks of ASCII characters, checking them all at once
+    while (in + SCALAR_BLOCK_LEN <= utf8_len && out + SCALAR_BLOCK_LEN <= utf32_len)
+    {
+        uint64_t block;
+        memcpy(&block, utf8 + in, sizeof block);
+
+        if ((block & SCALAR_ASCII_MASK) != 0)
+            break;
+
+        for (int i = 0; i < SCALAR_BLOCK_LEN; i++)
+            utf32[out + i] = utf8[in + i];
+
+        in += SCALAR_BLOCK_LEN;
+        out += SCALAR_BLOCK_LEN;
+    }
+
+    *utf8_index = in;
+    *utf32_index = out;
+}
+
+static void utf16_to_utf32_scalar(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf32_t* utf32,       size_t utf32_len, size_t* utf32_index)
+{
+    size_t in = *utf16_index;
+    size_t out = *utf32_index;
+
+    // Widen whole blocks without surrogates, checking them all at once
+    while (in + SCALAR_UTF16_BLOCK_LEN <= utf16_len && out + SCALAR_UTF16_BLOCK_LEN <= utf32_len)
+    {
+        uint64_t block;
+        memcpy(&block, utf16 + in, sizeof block);
+
+        if (has_surrogates_scalar(block))
+            break;
+
+        for (int i = 0; i < SCALAR_UTF16_BLOCK_LEN; i++)
+            utf32[out + i] = utf16[in + i];
+
+        in += SCALAR_UTF16_BLOCK_LEN;
+        out += SCALAR_UTF16_BLOCK_LEN;
+    }
+
+    *utf16_index = in;
+    *utf32_index = out;
+}
+
+static void utf16_to_utf32_len_scalar(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index, size_t* utf32_index)
+{
+    size_t in = *utf16_index;
+
+    // Count whole blocks without surrogates, checking them all at once
+    while (in + SCALAR_UTF16_BLOCK_LEN <= utf16_len)
+    {
+        uint64_t block;
+        memcpy(&block, utf16 + in, sizeof block);
+
+        if (has_surrogates_scalar(block))
+            break;
+
+        in += SCALAR_UTF16_BLOCK_LEN;
+    }
+
+    *utf32_index += in - *utf16_index;
+    *utf16_index = in;
+}
+
+static void utf32_to_utf8_scalar(
+    utf32_t const* utf32, size_t utf32_len, size_t* utf32_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index)
+{
+    size_t in = *utf32_index;
+    size_t out = *utf8_index;
+
+    // Narrow whole blocks of ASCII characters, checking them all at once
+    while (in + SCALAR_UTF32_BLOCK_LEN <= utf32_len && out + SCALAR_UTF32_BLOCK_LEN <= utf8_len)
+    {
+        uint64_t block;
+        memcpy(&block, utf32 + in, sizeof block);
+
+        if ((block & SCALAR_UTF32_ASCII_MASK) != 0)
+            break;
+
+        for (int i = 0; i < SCALAR_UTF32_BLOCK_LEN; i++)
+            utf8[out + i] = (utf8_t)utf32[in + i];
+
+        in += SCALAR_UTF32_BLOCK_LEN;
+        out += SCALAR_UTF32_BLOCK_LEN;
+    }
+
+    *utf32_index = in;
+    *utf8_index = out;
+}
+
+static void utf32_to_utf16_scalar(
+    utf32_t const* utf32, size_t utf32_len, size_t* utf32_index,
+    utf16_t* utf16,       size_t utf16_len, size_t* utf16_index)
+{
+    size_t in = *utf32_index;
+    size_t out = *utf16_index;
+
+    // Narrow whole blocks of BMP characters, checking them all at once.
+    // The high halves of BMP characters are zero, so they never look like surrogates.
+    while (in + SCALAR_UTF32_BLOCK_LEN <= utf32_len && out + SCALAR_UTF32_BLOCK_LEN <= utf16_len)
+    {
+        uint64_t block;
+        memcpy(&block, utf32 + in, sizeof block);
+
+        if ((block & SCALAR_UTF32_BMP_MASK) != 0 || has_surrogates_scalar(block))
+            break;
+
+        for (int i = 0; i < SCALAR_UTF32_BLOCK_LEN; i++)
+            utf16[out + i] = (utf16_t)utf32[in + i];
+
+        in += SCALAR_UTF32_BLOCK_LEN;
+        out += SCALAR_UTF32_BLOCK_LEN;
+    }
+
+    *utf32_index = in;
+    *utf16_index = out;
+}
+
+static void utf16_skip_ascii_scalar(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index)
+{
+    size_t in = *utf16_index;
+
+    // Skip whole blocks of ASCII characters, checking them all at once
+    while (in + SCALAR_UTF16_BLOCK_LEN <= utf16_len)
+    {
+        uint64_t block;
+        memcpy(&block, utf16 + in, sizeof block);
+
+        if ((block & SCALAR_UTF16_ASCII_MASK) != 0)
+            break;
+
+        in += SCALAR_UTF16_BLOCK_LEN;
+    }
+
+    *utf16_index = in;
+}
+
+// Copies whole blocks of ASCII characters between UTF-8 and Latin-1, which encode them the same way
+static void copy_ascii_scalar(
+    uint8_t const* input, size_t input_len,  size_t* input_index,
+    uint8_t* output,      size_t output_len, size_t* output_index)
+{
+    size_t in = *input_index;
+    size_t out = *output_index;
+
+    while (in + SCALAR_BLOCK_LEN <= input_len && out + SCALAR_BLOCK_LEN <= output_len)
+    {
+        uint64_t block;
+        memcpy(&block, input + in, sizeof block);
+
+        if ((block & SCALAR_ASCII_MASK) != 0)
+            break;
+
+        memcpy(output + out, &block, sizeof block);
+
+        in += SCALAR_BLOCK_LEN;
+        out += SCALAR_BLOCK_LEN;
+    }
+
+    *input_index = in;
+    *output_index = out;
+}
+
+static void utf16_to_latin1_scalar(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    latin1_t* latin1,     size_t latin1_len, size_t* latin1_index)
+{
+    size_t in = *utf16_index;
+    size_t out = *latin1_index;
+
+    // Narrow whole blocks of characters up to U+00FF, checking them all at once
+    while (in + SCALAR_UTF16_BLOCK_LEN <= utf16_len && out + SCALAR_UTF16_BLOCK_LEN <= latin1_len)
+    {
+        uint64_t block;
+        memcpy(&block, utf16 + in, sizeof block);
+
+        if ((block & SCALAR_UTF16_LATIN1_MASK) != 0)
+            break;
+
+        for (int i = 0; i < SCALAR_UTF16_BLOCK_LEN; i++)
+            latin1[out + i] = (latin1_t)utf16[in + i];
+
+        in += SCALAR_UTF16_BLOCK_LEN;
+        out += SCALAR_UTF16_BLOCK_LEN;
+    }
+
+    *utf16_index = in;
+    *latin1_index = out;
+}
+
+static void latin1_to_utf8_len_scalar(latin1_t const* latin1, size_t latin1_len, size_t* latin1_index, size_t* utf8_index)
+{
+    size_t in = *latin1_index;
+    size_t out = *utf8_index;
+
+    // Every character above U+007F takes one more byte. Their highest bits are moved to the lowest
+    // bit of every byte and summed into the highest byte by the multiplication.
+    while (in + SCALAR_BLOCK_LEN <= latin1_len)
+    {
+        uint64_t block;
+        memcpy(&block, latin1 + in, sizeof block);
+
+        uint64_t non_ascii = (block & SCALAR_ASCII_MASK) >> 7;
+        out += SCALAR_BLOCK_LEN + (size_t)((non_ascii * SCALAR_BYTE_LOW_BITS) >> 56);
+
+        in += SCALAR_BLOCK_LEN;
+    }
+
+    *latin1_index = in;
+    *utf8_index = out;
+}
+
+static void latin1_to_utf16_scalar(
+    latin1_t const* latin1, size_t latin1_len, size_t* latin1_index,
+    utf16_t* utf16,         size_t utf16_len,  size_t* utf16_index)
+{
+    size_t in = *latin1_index;
+    size_t out = *utf16_index;
+
+    // Every Latin-1 character is widened as is, so there's nothing left to check
+    for (; in < latin1_len && out < utf16_len; in++, out++)
+        utf16[out] = latin1[in];
+
+    *latin1_index = in;
+    *utf16_index = out;
+}
+
+static void utf16_skip_latin1_scalar(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index)
+{
+    size_t in = *utf16_index;
+
+    // Skip whole blocks of characters up to U+00FF, checking them all at once
+    while (in + SCALAR_UTF16_BLOCK_LEN <= utf16_len)
+    {
+        uint64_t block;
+        memcpy(&block, utf16 + in, sizeof block);
+
+        if ((block & SCALAR_UTF16_LATIN1_MASK) != 0)
+            break;
+
+        in += SCALAR_UTF16_BLOCK_LEN;
+    }
+
+    *utf16_index = in;
+}
+
+static simd_kernels const scalar_kernels =
+{
+    "scalar",
+    utf8_to_utf16_scalar,
+    utf16_to_utf8_scalar,
+    utf8_to_utf16_len_scalar,
+    utf16_to_utf8_len_scalar,
+    utf16_validate_scalar,
+    utf8_validate_scalar,
+    utf8_to_utf16_swapped_scalar,
+    utf16_swapped_to_utf8_scalar,
+    utf16_swapped_to_utf8_len_scalar,
+    utf8_to_utf32_scalar,
+    // ASCII characters are counted the same way for UTF-16 and UTF-32
+    utf8_to_utf16_len_scalar,
+    utf16_to_utf32_scalar,
+    utf16_to_utf32_len_scalar,
+    utf32_to_utf8_scalar,
+    utf32_to_utf16_scalar,
+    // The scalar validation only skips ASCII characters
+    utf8_validate_scalar,
+    utf16_skip_ascii_scalar,
+    // ASCII is the same in UTF-8 and Latin-1, and it's all that the scalar kernels handle
+    copy_ascii_scalar,
+    utf16_to_latin1_scalar,
+    copy_ascii_scalar,
+    latin1_to_utf8_len_scalar,
+    latin1_to_utf16_scalar,
+    utf8_validate_scalar,
+    utf16_skip_latin1_scalar
+};
+
+#ifdef SIMD_X86
+
+// Counts the number of set bits in a value, without needing the POPCNT instruction
+static int count_bits_portable(uint32_t value)
+{
+    value = value - ((value >> 1) & 0x55555555);
+    value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
+    value = (value + (value >> 4)) & 0x0F0F0F0F;
+    return (int)((value * 0x01010101) >> 24);
+}
+
+// Counts the UTF-16 characters at the start of a block that are known to be valid.
+// Every high surrogate must be followed by a low surrogate and every low surrogate must follow
+// a high surrogate, except for a high surrogate at the end of the block, which is left to the next one.
+//
+// high: The mask of high surrogates in the block, with 2 bits per character
+// low: The mask of low surrogates in the block, with 2 bits per character
+// len: The number of characters in the block, at most 16
+//
+// return: The length of the block, one less if it ends with a high surrogate, or 0 if it has unpaired surrogates.
+static int count_valid_utf16(unsigned high, unsigned low, int len)
+{
+    unsigned all = (unsigned)((UINT64_C(1) << (2 * len)) - 1);
+    unsigned last = 3u << (2 * (len - 1));
+
+    if (((high << 2) & all) != low)
+        return 0;
+
+    if ((high & last) != 0)
+        return len - 1;
+
+    return len;
+}
+
+// Counts the UTF-8 characters that the valid UTF-16 characters at the start of a block are converted to.
+// Every character takes one UTF-8 character, plus one if it isn't ASCII and another one if it's
+// above UTF8_2_MAX, but surrogates in a pair only take 2 UTF-8 characters each.
+//
+// non_ascii: The mask of characters above UTF8_1_MAX in the block, with 2 bits per character
+// above_2_bytes: The mask of characters above UTF8_2_MAX in the block, with 2 bits per character
+// high: The mask of high surrogates in the block, with 2 bits per character
+// low: The mask of low surrogates in the block, with 2 bits per character
+// len: The number of characters in the block, at most 16
+// utf8_len: A pointer to the number of UTF-8 characters counted so far, increased by the counted characters
+//
+// return: The number of UTF-16 characters that were counted, as returned by count_valid_utf16.
+static int count_utf8_len_of_utf16(unsigned non_ascii, unsigned above_2_bytes, unsigned high, unsigned low, int len, size_t* utf8_len)
+{
+    int valid = count_valid_utf16(high, low, len);
+    unsigned counted = (unsigned)((UINT64_C(1) << (2 * valid)) - 1);
+
+    // Also used by the SSE2 kernels, which can't rely on POPCNT
+    int extra = count_bits_portable(non_ascii & counted) + count_bits_portable(above_2_bytes & counted) - count_bits_portable((high | low) & counted);
+    *utf8_len += valid + extra / 2;
+
+    return valid;
+}
+
+// SSE2
+
+// The number of characters in an SSE2 register
+#define SSE2_UTF8_LEN 16
+
+// Swaps the bytes of every UTF-16 character of a register.
+// SSE2 has no byte shuffles, so the bytes are swapped with shifts.
+TARGET_SSE2 static ALWAYS_INLINE __m128i swap_utf16_sse2(__m128i chunk)
+{
+    return _mm_or_si128(_mm_slli_epi16(chunk, 8), _mm_srli_epi16(chunk, 8));
+}
+
+TARGET_SSE2 static ALWAYS_INLINE void utf8_to_utf16_sse2_impl(
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    utf16_t* utf16,     size_t utf16_len, size_t* utf16_index,
+    bool swap)
+{
+    size_t in = *utf8_index;
+    size_t out = *utf16_index;
+
+    __m128i const zero = _mm_setzero_si128();
+
+    // SSE2 has no byte shuffles, so only ASCII is converted here.
+    while (in + SSE2_UTF8_LEN <= utf8_len && out + SSE2_UTF8_LEN <= utf16_len)
+    {
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf8 + in));
+
+        // The highest bit of every byte is only set outside of ASCII
+        if (_mm_movemask_epi8(chunk) != 0)
+            break;
+
+        // Interleaving the zeros first puts the ASCII characters in the high byte instead
+        if (swap)
+        {
+            _mm_storeu_si128((__m128i*)(utf16 + out), _mm_unpacklo_epi8(zero, chunk));
+            _mm_storeu_si128((__m128i*)(utf16 + out + 8), _mm_unpackhi_epi8(zero, chunk));
+        }
+        else
+        {
+            _mm_storeu_si128((__m128i*)(utf16 + out), _mm_unpacklo_epi8(chunk, zero));
+            _mm_storeu_si128((__m128i*)(utf16 + out + 8), _mm_unpackhi_epi8(chunk, zero));
+        }
+
+        in += SSE2_UTF8_LEN;
+        out += SSE2_UTF8_LEN;
+    }
+
+    *utf8_index = in;
+    *utf16_index = out;
+
+    utf8_to_utf16_scalar_impl(utf8, utf8_len, utf8_index, utf16, utf16_len, utf16_index, swap);
+}
+
+TARGET_SSE2 static void utf8_to_utf16_sse2(
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    utf16_t* utf16,     size_t utf16_len, size_t* utf16_index)
+{
+    utf8_to_utf16_sse2_impl(utf8, utf8_len, utf8_index, utf16, utf16_len, utf16_index, false);
+}
+
+TARGET_SSE2 static void utf8_to_utf16_swapped_sse2(
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    utf16_t* utf16,     size_t utf16_len, size_t* utf16_index)
+{
+    utf8_to_utf16_sse2_impl(utf8, utf8_len, utf8_index, utf16, utf16_len, utf16_index, true);
+}
+
+// The number of UTF-16 characters in an SSE2 register
+#define SSE2_UTF16_LEN 8
+
+TARGET_SSE2 static ALWAYS_INLINE void utf16_to_utf8_sse2_impl(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index,
+    bool swap)
+{
+    size_t in = *utf16_index;
+    size_t out = *utf8_index;
+
+    __m128i const non_ascii = _mm_set1_epi16((short)0xFF80);
+    __m128i const zero = _mm_setzero_si128();
+
+    // SSE2 has no byte shuffles, so only ASCII is converted here.
+    while (in + SSE2_UTF16_LEN <= utf16_len && out + SSE2_UTF16_LEN <= utf8_len)
+    {
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf16 + in));
+        if (swap)
+            chunk = swap_utf16_sse2(chunk);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(chunk, non_ascii), zero)) != 0xFFFF)
+            break;
+
+        _mm_storel_epi64((__m128i*)(utf8 + out), _mm_packus_epi16(chunk, chunk));
+
+        in += SSE2_UTF16_LEN;
+        out += SSE2_UTF16_LEN;
+    }
+
+    *utf16_index = in;
+    *utf8_index = out;
+
+    utf16_to_utf8_scalar_impl(utf16, utf16_len, utf16_index, utf8, utf8_len, utf8_index, swap);
+}
+
+TARGET_SSE2 static void utf16_to_utf8_sse2(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index)
+{
+    utf16_to_utf8_sse2_impl(utf16, utf16_len, utf16_index, utf8, utf8_len, utf8_index, false);
+}
+
+TARGET_SSE2 static void utf16_swapped_to_utf8_sse2(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index)
+{
+    utf16_to_utf8_sse2_impl(utf16, utf16_len, utf16_index, utf8, utf8_len, utf8_index, true);
+}
+
+TARGET_SSE2 static void utf8_to_utf16_len_sse2(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index, size_t* utf16_index)
+{
+    size_t in = *utf8_index;
+
+    while (in + SSE2_UTF8_LEN <= utf8_len)
+    {
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf8 + in));
+
+        if (_mm_movemask_epi8(chunk) != 0)
+            break;
+
+        in += SSE2_UTF8_LEN;
+    }
+
+    *utf16_index += in - *utf8_index;
+    *utf8_index = in;
+
+    utf8_to_utf16_len_scalar(utf8, utf8_len, utf8_index, utf16_index);
+}
+
+TARGET_SSE2 static ALWAYS_INLINE void utf16_to_utf8_len_sse2_impl(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index, size_t* utf8_index, bool swap)
+{
+    size_t in = *utf16_index;
+    size_t out = *utf8_index;
+
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const non_ascii = _mm_set1_epi16((short)0xFF80);
+    __m128i const above_2_bytes = _mm_set1_epi16((short)0xF800);
+    __m128i const surrogate_mask = _mm_set1_epi16((short)SURROGATE_MASK);
+
+    // Every character is counted at once, with only unpaired surrogates left for the scalar code
+    while (in + SSE2_UTF16_LEN <= utf16_len)
+    {
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf16 + in));
+        if (swap)
+            chunk = swap_utf16_sse2(chunk);
+
+        unsigned ascii_mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(chunk, non_ascii), zero));
+        unsigned short_mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(chunk, above_2_bytes), zero));
+
+        __m128i masked = _mm_and_si128(chunk, surrogate_mask);
+        unsigned high = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(masked, _mm_set1_epi16((short)HIGH_SURROGATE_VALUE)));
+        unsigned low = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(masked, _mm_set1_epi16((short)LOW_SURROGATE_VALUE)));
+
+        int counted = count_utf8_len_of_utf16(~ascii_mask & 0xFFFF, ~short_mask & 0xFFFF, high, low, SSE2_UTF16_LEN, &out);
+        if (counted == 0)
+            break;
+
+        in += counted;
+    }
+
+    *utf16_index = in;
+    *utf8_index = out;
+
+    utf16_to_utf8_len_scalar_impl(utf16, utf16_len, utf16_index, utf8_index, swap);
+}
+
+TARGET_SSE2 static void utf16_to_utf8_len_sse2(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index, size_t* utf8_index)
+{
+    utf16_to_utf8_len_sse2_impl(utf16, utf16_len, utf16_index, utf8_index, false);
+}
+
+TARGET_SSE2 static void utf16_swapped_to_utf8_len_sse2(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index, size_t* utf8_index)
+{
+    utf16_to_utf8_len_sse2_impl(utf16, utf16_len, utf16_index, utf8_index, true);
+}
+
+// Counts the UTF-16 characters at the start of a register that are known to be valid
+TARGET_SSE2 static ALWAYS_INLINE int count_valid_utf16_sse2(__m128i chunk)
+{
+    __m128i masked = _mm_and_si128(chunk, _mm_set1_epi16((short)SURROGATE_MASK));
+    unsigned high = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(masked, _mm_set1_epi16((short)HIGH_SURROGATE_VALUE)));
+    unsigned low = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(masked, _mm_set1_epi16((short)LOW_SURROGATE_VALUE)));
+
+    return count_valid_utf16(high, low, SSE2_UTF16_LEN);
+}
+
+TARGET_SSE2 static void utf16_validate_sse2(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index)
+{
+    size_t in = *utf16_index;
+
+    // Surrogate pairs are checked in the register too, so only unpaired surrogates stop the kernel
+    while (in + SSE2_UTF16_LEN <= utf16_len)
+    {
+        int valid = count_valid_utf16_sse2(_mm_loadu_si128((__m128i const*)(utf16 + in)));
+        if (valid == 0)
+            break;
+
+        in += valid;
+    }
+
+    *utf16_index = in;
+
+    utf16_validate_scalar(utf16, utf16_len, utf16_index);
+}
+
+TARGET_SSE2 static void utf8_validate_sse2(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index)
+{
+    size_t in = *utf8_index;
+
+    while (in + SSE2_UTF8_LEN <= utf8_len)
+    {
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf8 + in));
+
+        if (_mm_movemask_epi8(chunk) != 0)
+            break;
+
+        in += SSE2_UTF8_LEN;
+    }
+
+    *utf8_index = in;
+
+    utf8_validate_scalar(utf8, utf8_len, utf8_index);
+}
+
+TARGET_SSE2 static void utf8_to_utf32_sse2(
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    utf32_t* utf32,     size_t utf32_len, size_t* utf32_index)
+{
+    size_t in = *utf8_index;
+    size_t out = *utf32_index;
+
+    __m128i const zero = _mm_setzero_si128();
+
+    while (in + SSE2_UTF8_LEN <= utf8_len && out + SSE2_UTF8_LEN <= utf32_len)
+    {
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf8 + in));
+
+        if (_mm_movemask_epi8(chunk) != 0)
+            break;
+
+        // Widened to 16 bits, then to 32 bits
+        __m128i low = _mm_unpacklo_epi8(chunk, zero);
+        __m128i high = _mm_unpackhi_epi8(chunk, zero);
+        _mm_storeu_si128((__m128i*)(utf32 + out), _mm_unpacklo_epi16(low, zero));
+        _mm_storeu_si128((__m128i*)(utf32 + out + 4), _mm_unpackhi_epi16(low, zero));
+        _mm_storeu_si128((__m128i*)(utf32 + out + 8), _mm_unpacklo_epi16(high, zero));
+        _mm_storeu_si128((__m128i*)(utf32 + out + 12), _mm_unpackhi_epi16(high, zero));
+
+        in += SSE2_UTF8_LEN;
+        out += SSE2_UTF8_LEN;
+    }
+
+    *utf8_index = in;
+    *utf32_index = out;
+
+    utf8_to_utf32_scalar(utf8, utf8_len, utf8_index, utf32, utf32_len, utf32_index);
+}
+
+// Returns a mask with the UTF-16 characters of a register that are surrogates, with 2 bits per character
+TARGET_SSE2 static ALWAYS_INLINE unsigned surrogates_sse2(__m128i chunk)
+{
+    __m128i masked = _mm_and_si128(chunk, _mm_set1_epi16((short)GENERIC_SURROGATE_MASK));
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(masked, _mm_set1_epi16((short)GENERIC_SURROGATE_VALUE)));
+}
+
+TARGET_SSE2 static void utf16_to_utf32_sse2(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf32_t* utf32,       size_t utf32_len, size_t* utf32_index)
+{
+    size_t in = *utf16_index;
+    size_t out = *utf32_index;
+
+    __m128i const zero = _mm_setzero_si128();
+
+    // Surrogate pairs are left for the scalar code
+    while (in + SSE2_UTF16_LEN <= utf16_len && out + SSE2_UTF16_LEN <= utf32_len)
+    {
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf16 + in));
+
+        if (surrogates_sse2(chunk) != 0)
+            break;
+
+        _mm_storeu_si128((__m128i*)(utf32 + out), _mm_unpacklo_epi16(chunk, zero));
+        _mm_storeu_si128((__m128i*)(utf32 + out + 4), _mm_unpackhi_epi16(chunk, zero));
+
+        in += SSE2_UTF16_LEN;
+        out += SSE2_UTF16_LEN;
+    }
+
+    *utf16_index = in;
+    *utf32_index = out;
+
+    utf16_to_utf32_scalar(utf16, utf16_len, utf16_index, utf32, utf32_len, utf32_index);
+}
+
+TARGET_SSE2 static void utf16_to_utf32_len_sse2(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index, size_t* utf32_index)
+{
+    size_t in = *utf16_index;
+    size_t out = *utf32_index;
+
+    __m128i const surrogate_mask = _mm_set1_epi16((short)SURROGATE_MASK);
+
+    // Every character takes one UTF-32 character, except for surrogate pairs, which take one for both
+    while (in + SSE2_UTF16_LEN <= utf16_len)
+    {
+        __m128i masked = _mm_and_si128(_mm_loadu_si128((__m128i const*)(utf16 + in)), surrogate_mask);
+        unsigned high = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(masked, _mm_set1_epi16((short)HIGH_SURROGATE_VALUE)));
+        unsigned low = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(masked, _mm_set1_epi16((short)LOW_SURROGATE_VALUE)));
+
+        int valid = count_valid_utf16(high, low, SSE2_UTF16_LEN);
+        if (valid == 0)
+            break;
+
+        unsigned counted = (unsigned)((UINT64_C(1) << (2 * valid)) - 1);
+        out += valid - count_bits_portable(low & counted) / 2;
+        in += valid;
+    }
+
+    *utf16_index = in;
+    *utf32_index = out;
+
+    utf16_to_utf32_len_scalar(utf16, utf16_len, utf16_index, utf32_index);
+}
+
+// The number of UTF-32 characters in an SSE2 register
+#define SSE2_UTF32_LEN 4
+
+TARGET_SSE2 static void utf32_to_utf8_sse2(
+    utf32_t const* utf32, size_t utf32_len, size_t* utf32_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index)
+{
+    size_t in = *utf32_index;
+    size_t out = *utf8_index;
+
+    __m128i const non_ascii = _mm_set1_epi32((int)0xFFFFFF80);
+    __m128i const zero = _mm_setzero_si128();
+
+    // Two registers are narrowed at once, to fill 8 bytes
+    while (in + 2 * SSE2_UTF32_LEN <= utf32_len && out + 2 * SSE2_UTF32_LEN <= utf8_len)
+    {
+        __m128i low = _mm_loadu_si128((__m128i const*)(utf32 + in));
+        __m128i high = _mm_loadu_si128((__m128i const*)(utf32 + in + SSE2_UTF32_LEN));
+
+        __m128i non_ascii_bits = _mm_and_si128(_mm_or_si128(low, high), non_ascii);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(non_ascii_bits, zero)) != 0xFFFF)
+            break;
+
+        __m128i narrow = _mm_packs_epi32(low, high);
+        _mm_storel_epi64((__m128i*)(utf8 + out), _mm_packus_epi16(narrow, narrow));
+
+        in += 2 * SSE2_UTF32_LEN;
+        out += 2 * SSE2_UTF32_LEN;
+    }
+
+    *utf32_index = in;
+    *utf8_index = out;
+
+    utf32_to_utf8_scalar(utf32, utf32_len, utf32_index, utf8, utf8_len, utf8_index);
+}
+
+// Returns if all UTF-32 characters of a register are in the BMP and aren't surrogates
+TARGET_SSE2 static ALWAYS_INLINE bool is_bmp_sse2(__m128i chunk)
+{
+    __m128i high_bits = _mm_and_si128(chunk, _mm_set1_epi32((int)0xFFFF0000));
+    __m128i masked = _mm_and_si128(chunk, _mm_set1_epi32(GENERIC_SURROGATE_MASK));
+
+    unsigned bmp = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi32(high_bits, _mm_setzero_si128()));
+    unsigned surrogates = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi32(masked, _mm_set1_epi32(GENERIC_SURROGATE_VALUE)));
+    return bmp == 0xFFFF && surrogates == 0;
+}
+
+TARGET_SSE2 static void utf32_to_utf16_sse2(
+    utf32_t const* utf32, size_t utf32_len, size_t* utf32_index,
+    utf16_t* utf16,       size_t utf16_len, size_t* utf16_index)
+{
+    size_t in = *utf32_index;
+    size_t out = *utf16_index;
+
+    // Characters outside of the BMP are left for the scalar code
+    while (in + 2 * SSE2_UTF32_LEN <= utf32_len && out + 2 * SSE2_UTF32_LEN <= utf16_len)
+    {
+        __m128i low = _mm_loadu_si128((__m128i const*)(utf32 + in));
+        __m128i high = _mm_loadu_si128((__m128i const*)(utf32 + in + SSE2_UTF32_LEN));
+
+        if (!is_bmp_sse2(low) || !is_bmp_sse2(high))
+            break;
+
+        // SSE2 can only pack with signed saturation, so the characters are sign-extended first
+        low = _mm_srai_epi32(_mm_slli_epi32(low, 16), 16);
+        high = _mm_srai_epi32(_mm_slli_epi32(high, 16), 16);
+        _mm_storeu_si128((__m128i*)(utf16 + out), _mm_packs_epi32(low, high));
+
+        in += 2 * SSE2_UTF32_LEN;
+        out += 2 * SSE2_UTF32_LEN;
+    }
+
+    *utf32_index = in;
+    *utf16_index = out;
+
+    utf32_to_utf16_scalar(utf32, utf32_len, utf32_index, utf16, utf16_len, utf16_index);
+}
+
+TARGET_SSE2 static void utf8_skip_ascii_sse2(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index)
+{
+    size_t in = *utf8_index;
+
+    while (in + SSE2_UTF8_LEN <= utf8_len)
+    {
+        unsigned non_ascii = (unsigned)_mm_movemask_epi8(_mm_loadu_si128((__m128i const*)(utf8 + in)));
+
+        // The exact position of the first non-ASCII character is known, so there's nothing left to the scalar code
+        if (non_ascii != 0)
+        {
+            *utf8_index = in + count_trailing_zeros(non_ascii);
+            return;
+        }
+
+        in += SSE2_UTF8_LEN;
+    }
+
+    *utf8_index = in;
+
+    utf8_validate_scalar(utf8, utf8_len, utf8_index);
+}
+
+TARGET_SSE2 static void utf16_skip_ascii_sse2(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index)
+{
+    size_t in = *utf16_index;
+
+    __m128i const non_ascii_mask = _mm_set1_epi16((short)0xFF80);
+
+    while (in + SSE2_UTF16_LEN <= utf16_len)
+    {
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf16 + in));
+        unsigned non_ascii = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(chunk, non_ascii_mask), _mm_setzero_si128())) & 0xFFFF;
+
+        if (non_ascii != 0)
+        {
+            *utf16_index = in + count_trailing_zeros(non_ascii) / 2;
+            return;
+        }
+
+        in += SSE2_UTF16_LEN;
+    }
+
+    *utf16_index = in;
+
+    utf16_skip_ascii_scalar(utf16, utf16_len, utf16_index);
+}
+
+TARGET_SSE2 static void copy_ascii_sse2(
+    uint8_t const* input, size_t input_len,  size_t* input_index,
+    uint8_t* output,      size_t output_len, size_t* output_index)
+{
+    size_t in = *input_index;
+    size_t out = *output_index;
+
+    while (in + SSE2_UTF8_LEN <= input_len && out + SSE2_UTF8_LEN <= output_len)
+    {
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(input + in));
+
+        if (_mm_movemask_epi8(chunk) != 0)
+            break;
+
+        _mm_storeu_si128((__m128i*)(output + out), chunk);
+
+        in += SSE2_UTF8_LEN;
+        out += SSE2_UTF8_LEN;
+    }
+
+    *input_index = in;
+    *output_index = out;
+
+    copy_ascii_scalar(input, input_len, input_index, output, output_len, output_index);
+}
+
+TARGET_SSE2 static void utf16_to_latin1_sse2(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    latin1_t* latin1,     size_t latin1_len, size_t* latin1_index)
+{
+    size_t in = *utf16_index;
+    size_t out = *latin1_index;
+
+    __m128i const above_latin1 = _mm_set1_epi16((short)0xFF00);
+    __m128i const zero = _mm_setzero_si128();
+
+    // Two registers are narrowed at once, to fill 16 bytes
+    while (in + 2 * SSE2_UTF16_LEN <= utf16_len && out + 2 * SSE2_UTF16_LEN <= latin1_len)
+    {
+        __m128i low = _mm_loadu_si128((__m128i const*)(utf16 + in));
+        __m128i high = _mm_loadu_si128((__m128i const*)(utf16 + in + SSE2_UTF16_LEN));
+
+        __m128i above_bits = _mm_and_si128(_mm_or_si128(low, high), above_latin1);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(above_bits, zero)) != 0xFFFF)
+            break;
+
+        _mm_storeu_si128((__m128i*)(latin1 + out), _mm_packus_epi16(low, high));
+
+        in += 2 * SSE2_UTF16_LEN;
+        out += 2 * SSE2_UTF16_LEN;
+    }
+
+    *utf16_index = in;
+    *latin1_index = out;
+
+    utf16_to_latin1_scalar(utf16, utf16_len, utf16_index, latin1, latin1_len, latin1_index);
+}
+
+TARGET_SSE2 static void latin1_to_utf8_len_sse2(latin1_t const* latin1, size_t latin1_len, size_t* latin1_index, size_t* utf8_index)
+{
+    size_t in = *latin1_index;
+    size_t out = *utf8_index;
+
+    // Every character above U+007F takes one more byte
+    while (in + SSE2_UTF8_LEN <= latin1_len)
+    {
+        unsigned non_ascii = (unsigned)_mm_movemask_epi8(_mm_loadu_si128((__m128i const*)(latin1 + in)));
+        out += SSE2_UTF8_LEN + count_bits_portable(non_ascii);
+
+        in += SSE2_UTF8_LEN;
+    }
+
+    *latin1_index = in;
+    *utf8_index = out;
+
+    latin1_to_utf8_len_scalar(latin1, latin1_len, latin1_index, utf8_index);
+}
+
+TARGET_SSE2 static void latin1_to_utf16_sse2(
+    latin1_t const* latin1, size_t latin1_len, size_t* latin1_index,
+    utf16_t* utf16,         size_t utf16_len,  size_t* utf16_index)
+{
+    size_t in = *latin1_index;
+    size_t out = *utf16_index;
+
+    __m128i const zero = _mm_setzero_si128();
+
+    while (in + SSE2_UTF8_LEN <= latin1_len && out + SSE2_UTF8_LEN <= utf16_len)
+    {
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(latin1 + in));
+
+        _mm_storeu_si128((__m128i*)(utf16 + out), _mm_unpacklo_epi8(chunk, zero));
+        _mm_storeu_si128((__m128i*)(utf16 + out + 8), _mm_unpackhi_epi8(chunk, zero));
+
+        in += SSE2_UTF8_LEN;
+        out += SSE2_UTF8_LEN;
+    }
+
+    *latin1_index = in;
+    *utf16_index = out;
+
+    latin1_to_utf16_scalar(latin1, latin1_len, latin1_index, utf16, utf16_len, utf16_index);
+}
+
+// Checks if a block of UTF-8 characters is valid and only has codepoints up to U+00FF,
+// none of them continuing past the end of the block.
+// Those are ASCII characters and the 2-byte sequences led by C2 and C3.
+//
+// non_ascii: The mask of characters of the block above 7F
+// lead: The mask of characters of the block that are C2 or C3
+// continuation: The mask of continuation bytes of the block
+// last: The bit of the last character of the block
+static inline bool is_latin1_utf8_block(uint32_t non_ascii, uint32_t lead, uint32_t continuation, uint32_t last)
+{
+    // Every leading byte must be followed by a continuation byte, and no other characters can appear
+    return (lead & last) == 0 && (lead << 1) == continuation && (lead | continuation) == non_ascii;
+}
+
+TARGET_SSE2 static void utf8_skip_latin1_sse2(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index)
+{
+    size_t in = *utf8_index;
+
+    while (in + SSE2_UTF8_LEN <= utf8_len)
+    {
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf8 + in));
+
+        unsigned non_ascii = (unsigned)_mm_movemask_epi8(chunk);
+        if (non_ascii != 0)
+        {
+            __m128i continuation = _mm_and_si128(chunk, _mm_set1_epi8((char)UTF8_CONTINUATION_MASK));
+            __m128i lead = _mm_and_si128(chunk, _mm_set1_epi8((char)0xFE));
+            unsigned continuation_mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(continuation, _mm_set1_epi8((char)UTF8_CONTINUATION_VALUE)));
+            unsigned lead_mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(lead, _mm_set1_epi8((char)0xC2)));
+
+            if (!is_latin1_utf8_block(non_ascii, lead_mask, continuation_mask, 1u << (SSE2_UTF8_LEN - 1)))
+                break;
+        }
+
+        in += SSE2_UTF8_LEN;
+    }
+
+    *utf8_index = in;
+
+    utf8_validate_scalar(utf8, utf8_len, utf8_index);
+}
+
+TARGET_SSE2 static void utf16_skip_latin1_sse2(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index)
+{
+    size_t in = *utf16_index;
+
+    __m128i const above_latin1 = _mm_set1_epi16((short)0xFF00);
+
+    while (in + SSE2_UTF16_LEN <= utf16_len)
+    {
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf16 + in));
+        unsigned above = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(chunk, above_latin1), _mm_setzero_si128())) & 0xFFFF;
+
+        // The exact position of the first character above U+00FF is known, so there's nothing left to the scalar code
+        if (above != 0)
+        {
+            *utf16_index = in + count_trailing_zeros(above) / 2;
+            return;
+        }
+
+        in += SSE2_UTF16_LEN;
+    }
+
+    *utf16_index = in;
+
+    utf16_skip_latin1_scalar(utf16, utf16_len, utf16_index);
+}
+
+static simd_kernels const sse2_kernels =
+{
+    "sse2",
+    utf8_to_utf16_sse2,
+    utf16_to_utf8_sse2,
+    utf8_to_utf16_len_sse2,
+    utf16_to_utf8_len_sse2,
+    utf16_validate_sse2,
+    utf8_validate_sse2,
+    utf8_to_utf16_swapped_sse2,
+    utf16_swapped_to_utf8_sse2,
+    utf16_swapped_to_utf8_len_sse2,
+    utf8_to_utf32_sse2,
+    // ASCII characters are counted the same way for UTF-16 and UTF-32
+    utf8_to_utf16_len_sse2,
+    utf16_to_utf32_sse2,
+    utf16_to_utf32_len_sse2,
+    utf32_to_utf8_sse2,
+    utf32_to_utf16_sse2,
+    utf8_skip_ascii_sse2,
+    utf16_skip_ascii_sse2,
+    // ASCII is the same in UTF-8 and Latin-1, and SSE2 has no byte shuffles to handle anything else
+    copy_ascii_sse2,
+    utf16_to_latin1_sse2,
+    copy_ascii_sse2,
+    latin1_to_utf8_len_sse2,
+    latin1_to_utf16_sse2,
+    utf8_skip_latin1_sse2,
+    utf16_skip_latin1_sse2
+};
+
+
+// SSE4.1
+
+// The maximum number of UTF-8 characters written when encoding a register of UTF-16 characters,
+// including the garbage left after the encoded characters
+#define SSE41_UTF8_MAX_LEN 32
+
+// Shuffles that move the bytes of a register down, read 16 bytes from 'shift' bytes after the middle.
+// Bytes that would come from outside of the register are zero.
+static int8_t const shift_bytes_table[48] =
+{
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+// Masks of the bytes below a length, read 16 bytes from 'length' bytes before the middle
+static int8_t const bytes_below_table[32] =
+{
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+// Shuffles the bytes of a register down by 'shift' bytes, between -16 and 16.
+// Bytes that would come from outside of the register are zero.
+TARGET_SSE41 static ALWAYS_INLINE __m128i shift_bytes_down_sse41(__m128i chunk, int shift)
+{
+    return _mm_shuffle_epi8(chunk, _mm_loadu_si128((__m128i const*)(shift_bytes_table + 16 + shift)));
+}
+
+// Selects the bytes of 'first' below 'len', between 0 and 16, and the bytes of 'second' from there on
+TARGET_SSE41 static ALWAYS_INLINE __m128i select_bytes_below_sse41(__m128i first, __m128i second, int len)
+{
+    return _mm_blendv_epi8(second, first, _mm_loadu_si128((__m128i const*)(bytes_below_table + 16 - len)));
+}
+
+// Stores the first 'first_len' bytes of a register followed by the first 'second_len' bytes of another,
+// without writing anything after them, so the output past what a conversion returns is never touched.
+// Stores of a fixed size that overlap each other are used instead of a store for each byte.
+//
+// out: Where to write the bytes. Must have room for first_len + second_len bytes.
+// first: The first register
+// first_len: The number of bytes of the first register to write, at most 16
+// second: The second register
+// second_len: The number of bytes of the second register to write, at most 16
+TARGET_SSE41 static ALWAYS_INLINE void store_joined_sse41(void* out, __m128i first, int first_len, __m128i second, int second_len)
+{
+    uint8_t* bytes = out;
+    int len = first_len + second_len;
+
+    if (len >= 16)
+    {
+        // The last 16 bytes overlap the unused bytes of the first register, so it's stored whole
+        int start = len - 16;
+        __m128i last = select_bytes_below_sse41(
+            shift_bytes_down_sse41(first, start),
+            shift_bytes_down_sse41(second, start - first_len),
+            first_len - start);
+
+        _mm_storeu_si128((__m128i*)bytes, first);
+        _mm_storeu_si128((__m128i*)(bytes + start), last);
+        return;
+    }
+
+    // The first 16 bytes, with the second register moved right after the end of the first
+    __m128i joined = select_bytes_below_sse41(first, shift_bytes_down_sse41(second, -first_len), first_len);
+
+    if (len >= 8)
+    {
+        _mm_storel_epi64((__m128i*)bytes, joined);
+        _mm_storel_epi64((__m128i*)(bytes + len - 8), shift_bytes_down_sse41(joined, len - 8));
+    }
+    else if (len >= 4)
+    {
+        uint32_t head = (uint32_t)_mm_cvtsi128_si32(joined);
+        uint32_t tail = (uint32_t)_mm_cvtsi128_si32(shift_bytes_down_sse41(joined, len - 4));
+        memcpy(bytes, &head, sizeof(head));
+        memcpy(bytes + len - 4, &tail, sizeof(tail));
+    }
+    else
+    {
+        uint32_t head = (uint32_t)_mm_cvtsi128_si32(joined);
+        for (int i = 0; i < len; i++)
+            bytes[i] = (uint8_t)(head >> (8 * i));
+    }
+}
+
+// For every combination of UTF-8 lengths of four characters, the shuffle that packs their encodings.
+// The index is the sum of (length - 1) * 3^N for every character N, and each character is expected
+// as the 32-bit lane [leading byte, 0, second-to-last byte, last byte].
+static uint8_t const utf8_encode_shuffle_table[81][16] =
+{
+    { 0, 4, 8, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 1 1 1
+    { 0, 3, 4, 8, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 1 1 1
+    { 0, 2, 3, 4, 8, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 1 1 1
+    { 0, 4, 7, 8, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 2 1 1
+    { 0, 3, 4, 7, 8, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 2 1 1
+    { 0, 2, 3, 4, 7, 8, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 2 1 1
+    { 0, 4, 6, 7, 8, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 3 1 1
+    { 0, 3, 4, 6, 7, 8, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 3 1 1
+    { 0, 2, 3, 4, 6, 7, 8, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 3 1 1
+    { 0, 4, 8, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 1 2 1
+    { 0, 3, 4, 8, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 1 2 1
+    { 0, 2, 3, 4, 8, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 1 2 1
+    { 0, 4, 7, 8, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 2 2 1
+    { 0, 3, 4, 7, 8, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 2 2 1
+    { 0, 2, 3, 4, 7, 8, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 2 2 1
+    { 0, 4, 6, 7, 8, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 3 2 1
+    { 0, 3, 4, 6, 7, 8, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 3 2 1
+    { 0, 2, 3, 4, 6, 7, 8, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 3 2 1
+    { 0, 4, 8, 10, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 1 3 1
+    { 0, 3, 4, 8, 10, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 1 3 1
+    { 0, 2, 3, 4, 8, 10, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 1 3 1
+    { 0, 4, 7, 8, 10, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 2 3 1
+    { 0, 3, 4, 7, 8, 10, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 2 3 1
+    { 0, 2, 3, 4, 7, 8, 10, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 2 3 1
+    { 0, 4, 6, 7, 8, 10, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 3 3 1
+    { 0, 3, 4, 6, 7, 8, 10, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 3 3 1
+    { 0, 2, 3, 4, 6, 7, 8, 10, 11, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 3 3 1
+    { 0, 4, 8, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 1 1 2
+    { 0, 3, 4, 8, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 1 1 2
+    { 0, 2, 3, 4, 8, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 1 1 2
+    { 0, 4, 7, 8, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 2 1 2
+    { 0, 3, 4, 7, 8, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 2 1 2
+    { 0, 2, 3, 4, 7, 8, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 2 1 2
+    { 0, 4, 6, 7, 8, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 3 1 2
+    { 0, 3, 4, 6, 7, 8, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 3 1 2
+    { 0, 2, 3, 4, 6, 7, 8, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 3 1 2
+    { 0, 4, 8, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 1 2 2
+    { 0, 3, 4, 8, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 1 2 2
+    { 0, 2, 3, 4, 8, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 1 2 2
+    { 0, 4, 7, 8, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 2 2 2
+    { 0, 3, 4, 7, 8, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 2 2 2
+    { 0, 2, 3, 4, 7, 8, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 2 2 2
+    { 0, 4, 6, 7, 8, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 3 2 2
+    { 0, 3, 4, 6, 7, 8, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 3 2 2
+    { 0, 2, 3, 4, 6, 7, 8, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 3 2 2
+    { 0, 4, 8, 10, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 1 3 2
+    { 0, 3, 4, 8, 10, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 1 3 2
+    { 0, 2, 3, 4, 8, 10, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 1 3 2
+    { 0, 4, 7, 8, 10, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 2 3 2
+    { 0, 3, 4, 7, 8, 10, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 2 3 2
+    { 0, 2, 3, 4, 7, 8, 10, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 2 3 2
+    { 0, 4, 6, 7, 8, 10, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 3 3 2
+    { 0, 3, 4, 6, 7, 8, 10, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 3 3 2
+    { 0, 2, 3, 4, 6, 7, 8, 10, 11, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 3 3 2
+    { 0, 4, 8, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 1 1 3
+    { 0, 3, 4, 8, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 1 1 3
+    { 0, 2, 3, 4, 8, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 1 1 3
+    { 0, 4, 7, 8, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 2 1 3
+    { 0, 3, 4, 7, 8, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 2 1 3
+    { 0, 2, 3, 4, 7, 8, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 2 1 3
+    { 0, 4, 6, 7, 8, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 3 1 3
+    { 0, 3, 4, 6, 7, 8, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 3 1 3
+    { 0, 2, 3, 4, 6, 7, 8, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 3 1 3
+    { 0, 4, 8, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 1 2 3
+    { 0, 3, 4, 8, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 1 2 3
+    { 0, 2, 3, 4, 8, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 1 2 3
+    { 0, 4, 7, 8, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 2 2 3
+    { 0, 3, 4, 7, 8, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 2 2 3
+    { 0, 2, 3, 4, 7, 8, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 2 2 3
+    { 0, 4, 6, 7, 8, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 3 2 3
+    { 0, 3, 4, 6, 7, 8, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 3 2 3
+    { 0, 2, 3, 4, 6, 7, 8, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 3 2 3
+    { 0, 4, 8, 10, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 1 3 3
+    { 0, 3, 4, 8, 10, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 1 3 3
+    { 0, 2, 3, 4, 8, 10, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 1 3 3
+    { 0, 4, 7, 8, 10, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 2 3 3
+    { 0, 3, 4, 7, 8, 10, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 2 3 3
+    { 0, 2, 3, 4, 7, 8, 10, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 3 2 3 3
+    { 0, 4, 6, 7, 8, 10, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 1 3 3 3
+    { 0, 3, 4, 6, 7, 8, 10, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80 }, // 2 3 3 3
+    { 0, 2, 3, 4, 6, 7, 8, 10, 11, 12, 14, 15, 0x80, 0x80, 0x80, 0x80 }  // 3 3 3 3
+};
+
+// For every 4-bit mask, the sum of 3^N for every set bit N
+static uint8_t const base3_table[16] = { 0, 1, 3, 4, 9, 10, 12, 13, 27, 28, 30, 31, 36, 37, 39, 40 };
+
+// Encodes a register of UTF-16 characters as UTF-8. None of them can be surrogates.
+//
+// chunk: The UTF-16 characters
+// utf8: Where to write the UTF-8 characters. Must have room for SSE41_UTF8_MAX_LEN characters.
+// exact:
+// If only the encoded characters may be written. Otherwise, up to 12 characters
+// of garbage are left after them, which is faster but only allowed if the caller is sure to
+// write at least as many characters after them.
+//
+// return: The number of UTF-8 characters that were written.
+TARGET_SSE41 static ALWAYS_INLINE int utf16_to_utf8_sse41_bmp(__m128i chunk, utf8_t* utf8, bool exact)
+{
+    __m128i const value_mask = _mm_set1_epi16(0x3F);
+    __m128i const continuation = _mm_set1_epi16(UTF8_CONTINUATION_VALUE);
+
+    __m128i needs2 = _mm_cmpeq_epi16(_mm_max_epu16(chunk, _mm_set1_epi16(UTF8_1_MAX + 1)), chunk);
+    __m128i needs3 = _mm_cmpeq_epi16(_mm_max_epu16(chunk, _mm_set1_epi16(UTF8_2_MAX + 1)), chunk);
+
+    // The leading byte of every length, picked according to the real length
+    __m128i lead2 = _mm_or_si128(_mm_srli_epi16(chunk, 6), _mm_set1_epi16(0xC0));
+    __m128i lead3 = _mm_or_si128(_mm_srli_epi16(chunk, 12), _mm_set1_epi16(0xE0));
+    __m128i lead = _mm_blendv_epi8(chunk, lead2, needs2);
+    lead = _mm_blendv_epi8(lead, lead3, needs3);
+
+    // The second-to-last and last bytes, packed in a 16-bit lane
+    __m128i middle = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(chunk, 6), value_mask), continuation);
+    __m128i last = _mm_or_si128(_mm_and_si128(chunk, value_mask), continuation);
+    __m128i tail = _mm_or_si128(middle, _mm_slli_epi16(last, 8));
+
+    unsigned mask2 = (unsigned)_mm_movemask_epi8(_mm_packs_epi16(needs2, needs2)) & 0xFF;
+    unsigned mask3 = (unsigned)_mm_movemask_epi8(_mm_packs_epi16(needs3, needs3)) & 0xFF;
+
+    // Encode each half of the register separately, so that each fits in 16 bytes
+    __m128i low = _mm_unpacklo_epi16(lead, tail);
+    __m128i high = _mm_unpackhi_epi16(lead, tail);
+
+    unsigned low_index = base3_table[mask2 & 0xF] + base3_table[mask3 & 0xF];
+    unsigned high_index = base3_table[mask2 >> 4] + base3_table[mask3 >> 4];
+
+    int low_len = 4 + count_bits(mask2 & 0xF) + count_bits(mask3 & 0xF);
+    int high_len = 4 + count_bits(mask2 >> 4) + count_bits(mask3 >> 4);
+
+    __m128i low_shuffle = _mm_loadu_si128((__m128i const*)utf8_encode_shuffle_table[low_index]);
+    __m128i high_shuffle = _mm_loadu_si128((__m128i const*)utf8_encode_shuffle_table[high_index]);
+
+    __m128i low_encoded = _mm_shuffle_epi8(low, low_shuffle);
+    __m128i high_encoded = _mm_shuffle_epi8(high, high_shuffle);
+
+    if (exact)
+    {
+        store_joined_sse41(utf8, low_encoded, low_len, high_encoded, high_len);
+    }
+    else
+    {
+        _mm_storeu_si128((__m128i*)utf8, low_encoded);
+        _mm_storeu_si128((__m128i*)(utf8 + low_len), high_encoded);
+    }
+
+    return low_len + high_len;
+}
+
+// Returns if any of the UTF-16 characters of a register is a surrogate
+TARGET_SSE41 static ALWAYS_INLINE bool has_surrogates(__m128i chunk)
+{
+    __m128i masked = _mm_and_si128(chunk, _mm_set1_epi16((short)GENERIC_SURROGATE_MASK));
+    __m128i surrogates = _mm_cmpeq_epi16(masked, _mm_set1_epi16((short)GENERIC_SURROGATE_VALUE));
+    return !_mm_testz_si128(surrogates, surrogates);
+}
+
+// Swaps the bytes of every UTF-16 character of a register
+TARGET_SSE41 static ALWAYS_INLINE __m128i swap_utf16_sse41(__m128i chunk)
+{
+    return _mm_shuffle_epi8(chunk, _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+}
+
+// The most UTF-16 characters that are checked for surrogates before encoding them,
+// so they're still cached when they're encoded
+#define UTF16_SURROGATE_SCAN_LEN 512
+
+// Finds how many of the UTF-16 characters starting at an index have no surrogates, a register at a time,
+// checking at most UTF16_SURROGATE_SCAN_LEN characters
+//
+// utf16: The UTF-16 characters
+// utf16_len: The number of UTF-16 characters
+// index: The index to start checking at
+// swap: If the bytes of every UTF-16 character are swapped
+//
+// return: The index after the registers that have no surrogates
+TARGET_SSE41 static ALWAYS_INLINE size_t skip_surrogate_free_sse41(utf16_t const* utf16, size_t utf16_len, size_t index, bool swap)
+{
+    size_t end = index;
+    while (end + SSE2_UTF16_LEN <= utf16_len && end - index < UTF16_SURROGATE_SCAN_LEN)
+    {
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf16 + end));
+        if (swap)
+            chunk = swap_utf16_sse41(chunk);
+
+        if (has_surrogates(chunk))
+            break;
+
+        end += SSE2_UTF16_LEN;
+    }
+
+    return end;
+}
+
+// Encodes a register of UTF-16 characters without surrogates to UTF-8
+//
+// chunk: The UTF-16 characters, in the native byte order
+// utf8: Where to write the UTF-8 characters. Must have room for SSE41_UTF8_MAX_LEN characters.
+// exact: If only the encoded characters may be written, as with utf16_to_utf8_sse41_bmp
+//
+// return: The number of UTF-8 characters that were written, which is at least SSE2_UTF16_LEN
+TARGET_SSE41 static ALWAYS_INLINE int utf16_to_utf8_sse41_block(__m128i chunk, utf8_t* utf8, bool exact)
+{
+    if (_mm_testz_si128(chunk, _mm_set1_epi16((short)0xFF80)))
+    {
+        _mm_storel_epi64((__m128i*)utf8, _mm_packus_epi16(chunk, chunk));
+        return SSE2_UTF16_LEN;
+    }
+
+    return utf16_to_utf8_sse41_bmp(chunk, utf8, exact);
+}
+
+TARGET_SSE41 static ALWAYS_INLINE void utf16_to_utf8_sse41_impl(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index,
+    bool swap)
+{
+    size_t in = *utf16_index;
+    size_t out = *utf8_index;
+
+    while (in + SSE2_UTF16_LEN <= utf16_len && out + SSE41_UTF8_MAX_LEN <= utf8_len)
+    {
+        // Surrogates are left for the scalar code
+        size_t end = skip_surrogate_free_sse41(utf16, utf16_len, in, swap);
+        if (end == in)
+            break;
+
+        // The garbage left by a register is overwritten by the next two, which write at least 8 characters each,
+        // so only the last two registers before a surrogate or the end of the output are encoded exactly
+        while (in + 3 * SSE2_UTF16_LEN <= end && out + 3 * SSE41_UTF8_MAX_LEN <= utf8_len)
+        {
+            __m128i chunk = _mm_loadu_si128((__m128i const*)(utf16 + in));
+            if (swap)
+                chunk = swap_utf16_sse41(chunk);
+
+            out += utf16_to_utf8_sse41_block(chunk, utf8 + out, false);
+            in += SSE2_UTF16_LEN;
+        }
+
+        while (in + SSE2_UTF16_LEN <= end && out + SSE41_UTF8_MAX_LEN <= utf8_len)
+        {
+            __m128i chunk = _mm_loadu_si128((__m128i const*)(utf16 + in));
+            if (swap)
+                chunk = swap_utf16_sse41(chunk);
+
+            out += utf16_to_utf8_sse41_block(chunk, utf8 + out, true);
+            in += SSE2_UTF16_LEN;
+        }
+    }
+
+    *utf16_index = in;
+    *utf8_index = out;
+
+    utf16_to_utf8_scalar_impl(utf16, utf16_len, utf16_index, utf8, utf8_len, utf8_index, swap);
+}
+
+TARGET_SSE41 static void utf16_to_utf8_sse41(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index)
+{
+    utf16_to_utf8_sse41_impl(utf16, utf16_len, utf16_index, utf8, utf8_len, utf8_index, false);
+}
+
+TARGET_SSE41 static void utf16_swapped_to_utf8_sse41(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index)
+{
+    utf16_to_utf8_sse41_impl(utf16, utf16_len, utf16_index, utf8, utf8_len, utf8_index, true);
+}
+
+TARGET_SSE41 static void latin1_to_utf8_sse41(
+    latin1_t const* latin1, size_t latin1_len, size_t* latin1_index,
+    utf8_t* utf8,           size_t utf8_len,   size_t* utf8_index)
+{
+    size_t in = *latin1_index;
+    size_t out = *utf8_index;
+
+    while (in + SSE2_UTF8_LEN <= latin1_len && out + 2 * SSE41_UTF8_MAX_LEN <= utf8_len)
+    {
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(latin1 + in));
+
+        if (_mm_movemask_epi8(chunk) == 0)
+        {
+            _mm_storeu_si128((__m128i*)(utf8 + out), chunk);
+
+            in += SSE2_UTF8_LEN;
+            out += SSE2_UTF8_LEN;
+            continue;
+        }
+
+        // Every Latin-1 character is a codepoint below any surrogate,
+        // so each half is widened and encoded like UTF-16.
+        // The garbage of the low half is overwritten by the high half when it leaves garbage too,
+        // and the garbage of the high half by the next register, which writes at least 16 characters,
+        // as long as it's encoded here as well.
+        __m128i low = _mm_cvtepu8_epi16(chunk);
+        __m128i high = _mm_cvtepu8_epi16(_mm_srli_si128(chunk, 8));
+        if (in + 2 * SSE2_UTF8_LEN <= latin1_len && out + 3 * SSE41_UTF8_MAX_LEN <= utf8_len)
+        {
+            out += utf16_to_utf8_sse41_bmp(low, utf8 + out, false);
+            out += utf16_to_utf8_sse41_bmp(high, utf8 + out, false);
+        }
+        else
+        {
+            out += utf16_to_utf8_sse41_bmp(low, utf8 + out, true);
+            out += utf16_to_utf8_sse41_bmp(high, utf8 + out, true);
+        }
+
+        in += SSE2_UTF8_LEN;
+    }
+
+    *latin1_index = in;
+    *utf8_index = out;
+
+    copy_ascii_sse2(latin1, latin1_len, latin1_index, utf8, utf8_len, utf8_index);
+}
+
+static simd_kernels const sse41_kernels =
+{
+    "sse4.1",
+    utf8_to_utf16_sse2,
+    utf16_to_utf8_sse41,
+    utf8_to_utf16_len_sse2,
+    utf16_to_utf8_len_sse2,
+    utf16_validate_sse2,
+    utf8_validate_sse2,
+    utf8_to_utf16_swapped_sse2,
+    utf16_swapped_to_utf8_sse41,
+    utf16_swapped_to_utf8_len_sse2,
+    utf8_to_utf32_sse2,
+    utf8_to_utf16_len_sse2,
+    utf16_to_utf32_sse2,
+    utf16_to_utf32_len_sse2,
+    utf32_to_utf8_sse2,
+    utf32_to_utf16_sse2,
+    utf8_skip_ascii_sse2,
+    utf16_skip_ascii_sse2,
+    copy_ascii_sse2,
+    utf16_to_latin1_sse2,
+    latin1_to_utf8_sse41,
+    latin1_to_utf8_len_sse2,
+    latin1_to_utf16_sse2,
+    utf8_skip_latin1_sse2,
+    utf16_skip_latin1_sse2
+};
+
+
+// AVX2
+
+// The number of characters in an AVX2 register
+#define AVX2_UTF8_LEN 32
+// The number of UTF-8 characters handled at once when decoding 2 and 3 byte sequences
+#define AVX2_MIXED_LEN 16
+
+// For every 8-bit mask, the indexes of its set bits, in ascending order.
+// Used to pack the 16-bit lanes selected by the mask to the start of a register.
+static uint8_t const pack_lanes_table[256][8] =
+{
+    { 0, 0, 0, 0, 0, 0, 0, 0 }, { 0, 0, 0, 0, 0, 0, 0, 0 }, { 1, 0, 0, 0, 0, 0, 0, 0 }, { 0, 1, 0, 0, 0, 0, 0, 0 },
+    { 2, 0, 0, 0, 0, 0, 0, 0 }, { 0, 2, 0, 0, 0, 0, 0, 0 }, { 1, 2, 0, 0, 0, 0, 0, 0 }, { 0, 1, 2, 0, 0, 0, 0, 0 },
+    { 3, 0, 0, 0, 0, 0, 0, 0 }, { 0, 3, 0, 0, 0, 0, 0, 0 }, { 1, 3, 0, 0, 0, 0, 0, 0 }, { 0, 1, 3, 0, 0, 0, 0, 0 },
+    { 2, 3, 0, 0, 0, 0, 0, 0 }, { 0, 2, 3, 0, 0, 0, 0, 0 }, { 1, 2, 3, 0, 0, 0, 0, 0 }, { 0, 1, 2, 3, 0, 0, 0, 0 },
+    { 4, 0, 0, 0, 0, 0, 0, 0 }, { 0, 4, 0, 0, 0, 0, 0, 0 }, { 1, 4, 0, 0, 0, 0, 0, 0 }, { 0, 1, 4, 0, 0, 0, 0, 0 },
+    { 2, 4, 0, 0, 0, 0, 0, 0 }, { 0, 2, 4, 0, 0, 0, 0, 0 }, { 1, 2, 4, 0, 0, 0, 0, 0 }, { 0, 1, 2, 4, 0, 0, 0, 0 },
+    { 3, 4, 0, 0, 0, 0, 0, 0 }, { 0, 3, 4, 0, 0, 0, 0, 0 }, { 1, 3, 4, 0, 0, 0, 0, 0 }, { 0, 1, 3, 4, 0, 0, 0, 0 },
+    { 2, 3, 4, 0, 0, 0, 0, 0 }, { 0, 2, 3, 4, 0, 0, 0, 0 }, { 1, 2, 3, 4, 0, 0, 0, 0 }, { 0, 1, 2, 3, 4, 0, 0, 0 },
+    { 5, 0, 0, 0, 0, 0, 0, 0 }, { 0, 5, 0, 0, 0, 0, 0, 0 }, { 1, 5, 0, 0, 0, 0, 0, 0 }, { 0, 1, 5, 0, 0, 0, 0, 0 },
+    { 2, 5, 0, 0, 0, 0, 0, 0 }, { 0, 2, 5, 0, 0, 0, 0, 0 }, { 1, 2, 5, 0, 0, 0, 0, 0 }, { 0, 1, 2, 5, 0, 0, 0, 0 },
+    { 3, 5, 0, 0, 0, 0, 0, 0 }, { 0, 3, 5, 0, 0, 0, 0, 0 }, { 1, 3, 5, 0, 0, 0, 0, 0 }, { 0, 1, 3, 5, 0, 0, 0, 0 },
+    { 2, 3, 5, 0, 0, 0, 0, 0 }, { 0, 2, 3, 5, 0, 0, 0, 0 }, { 1, 2, 3, 5, 0, 0, 0, 0 }, { 0, 1, 2, 3, 5, 0, 0, 0 },
+    { 4, 5, 0, 0, 0, 0, 0, 0 }, { 0, 4, 5, 0, 0, 0, 0, 0 }, { 1, 4, 5, 0, 0, 0, 0, 0 }, { 0, 1, 4, 5, 0, 0, 0, 0 },
+    { 2, 4, 5, 0, 0, 0, 0, 0 }, { 0, 2, 4, 5, 0, 0, 0, 0 }, { 1, 2, 4, 5, 0, 0, 0, 0 }, { 0, 1, 2, 4, 5, 0, 0, 0 },
+    { 3, 4, 5, 0, 0, 0, 0, 0 }, { 0, 3, 4, 5, 0, 0, 0, 0 }, { 1, 3, 4, 5, 0, 0, 0, 0 }, { 0, 1, 3, 4, 5, 0, 0, 0 },
+    { 2, 3, 4, 5, 0, 0, 0, 0 }, { 0, 2, 3, 4, 5, 0, 0, 0 }, { 1, 2, 3, 4, 5, 0, 0, 0 }, { 0, 1, 2, 3, 4, 5, 0, 0 },
+    { 6, 0, 0, 0, 0, 0, 0, 0 }, { 0, 6, 0, 0, 0, 0, 0, 0 }, { 1, 6, 0, 0, 0, 0, 0, 0 }, { 0, 1, 6, 0, 0, 0, 0, 0 },
+    { 2, 6, 0, 0, 0, 0, 0, 0 }, { 0, 2, 6, 0, 0, 0, 0, 0 }, { 1, 2, 6, 0, 0, 0, 0, 0 }, { 0, 1, 2, 6, 0, 0, 0, 0 },
+    { 3, 6, 0, 0, 0, 0, 0, 0 }, { 0, 3, 6, 0, 0, 0, 0, 0 }, { 1, 3, 6, 0, 0, 0, 0, 0 }, { 0, 1, 3, 6, 0, 0, 0, 0 },
+    { 2, 3, 6, 0, 0, 0, 0, 0 }, { 0, 2, 3, 6, 0, 0, 0, 0 }, { 1, 2, 3, 6, 0, 0, 0, 0 }, { 0, 1, 2, 3, 6, 0, 0, 0 },
+    { 4, 6, 0, 0, 0, 0, 0, 0 }, { 0, 4, 6, 0, 0, 0, 0, 0 }, { 1, 4, 6, 0, 0, 0, 0, 0 }, { 0, 1, 4, 6, 0, 0, 0, 0 },
+    { 2, 4, 6, 0, 0, 0, 0, 0 }, { 0, 2, 4, 6, 0, 0, 0, 0 }, { 1, 2, 4, 6, 0, 0, 0, 0 }, { 0, 1, 2, 4, 6, 0, 0, 0 },
+    { 3, 4, 6, 0, 0, 0, 0, 0 }, { 0, 3, 4, 6, 0, 0, 0, 0 }, { 1, 3, 4, 6, 0, 0, 0, 0 }, { 0, 1, 3, 4, 6, 0, 0, 0 },
+    { 2, 3, 4, 6, 0, 0, 0, 0 }, { 0, 2, 3, 4, 6, 0, 0, 0 }, { 1, 2, 3, 4, 6, 0, 0, 0 }, { 0, 1, 2, 3, 4, 6, 0, 0 },
+    { 5, 6, 0, 0, 0, 0, 0, 0 }, { 0, 5, 6, 0, 0, 0, 0, 0 }, { 1, 5, 6, 0, 0, 0, 0, 0 }, { 0, 1, 5, 6, 0, 0, 0, 0 },
+    { 2, 5, 6, 0, 0, 0, 0, 0 }, { 0, 2, 5, 6, 0, 0, 0, 0 }, { 1, 2, 5, 6, 0, 0, 0, 0 }, { 0, 1, 2, 5, 6, 0, 0, 0 },
+    { 3, 5, 6, 0, 0, 0, 0, 0 }, { 0, 3, 5, 6, 0, 0, 0, 0 }, { 1, 3, 5, 6, 0, 0, 0, 0 }, { 0, 1, 3, 5, 6, 0, 0, 0 },
+    { 2, 3, 5, 6, 0, 0, 0, 0 }, { 0, 2, 3, 5, 6, 0, 0, 0 }, { 1, 2, 3, 5, 6, 0, 0, 0 }, { 0, 1, 2, 3, 5, 6, 0, 0 },
+    { 4, 5, 6, 0, 0, 0, 0, 0 }, { 0, 4, 5, 6, 0, 0, 0, 0 }, { 1, 4, 5, 6, 0, 0, 0, 0 }, { 0, 1, 4, 5, 6, 0, 0, 0 },
+    { 2, 4, 5, 6, 0, 0, 0, 0 }, { 0, 2, 4, 5, 6, 0, 0, 0 }, { 1, 2, 4, 5, 6, 0, 0, 0 }, { 0, 1, 2, 4, 5, 6, 0, 0 },
+    { 3, 4, 5, 6, 0, 0, 0, 0 }, { 0, 3, 4, 5, 6, 0, 0, 0 }, { 1, 3, 4, 5, 6, 0, 0, 0 }, { 0, 1, 3, 4, 5, 6, 0, 0 },
+    { 2, 3, 4, 5, 6, 0, 0, 0 }, { 0, 2, 3, 4, 5, 6, 0, 0 }, { 1, 2, 3, 4, 5, 6, 0, 0 }, { 0, 1, 2, 3, 4, 5, 6, 0 },
+    { 7, 0, 0, 0, 0, 0, 0, 0 }, { 0, 7, 0, 0, 0, 0, 0, 0 }, { 1, 7, 0, 0, 0, 0, 0, 0 }, { 0, 1, 7, 0, 0, 0, 0, 0 },
+    { 2, 7, 0, 0, 0, 0, 0, 0 }, { 0, 2, 7, 0, 0, 0, 0, 0 }, { 1, 2, 7, 0, 0, 0, 0, 0 }, { 0, 1, 2, 7, 0, 0, 0, 0 },
+    { 3, 7, 0, 0, 0, 0, 0, 0 }, { 0, 3, 7, 0, 0, 0, 0, 0 }, { 1, 3, 7, 0, 0, 0, 0, 0 }, { 0, 1, 3, 7, 0, 0, 0, 0 },
+    { 2, 3, 7, 0, 0, 0, 0, 0 }, { 0, 2, 3, 7, 0, 0, 0, 0 }, { 1, 2, 3, 7, 0, 0, 0, 0 }, { 0, 1, 2, 3, 7, 0, 0, 0 },
+    { 4, 7, 0, 0, 0, 0, 0, 0 }, { 0, 4, 7, 0, 0, 0, 0, 0 }, { 1, 4, 7, 0, 0, 0, 0, 0 }, { 0, 1, 4, 7, 0, 0, 0, 0 },
+    { 2, 4, 7, 0, 0, 0, 0, 0 }, { 0, 2, 4, 7, 0, 0, 0, 0 }, { 1, 2, 4, 7, 0, 0, 0, 0 }, { 0, 1, 2, 4, 7, 0, 0, 0 },
+    { 3, 4, 7, 0, 0, 0, 0, 0 }, { 0, 3, 4, 7, 0, 0, 0, 0 }, { 1, 3, 4, 7, 0, 0, 0, 0 }, { 0, 1, 3, 4, 7, 0, 0, 0 },
+    { 2, 3, 4, 7, 0, 0, 0, 0 }, { 0, 2, 3, 4, 7, 0, 0, 0 }, { 1, 2, 3, 4, 7, 0, 0, 0 }, { 0, 1, 2, 3, 4, 7, 0, 0 },
+    { 5, 7, 0, 0, 0, 0, 0, 0 }, { 0, 5, 7, 0, 0, 0, 0, 0 }, { 1, 5, 7, 0, 0, 0, 0, 0 }, { 0, 1, 5, 7, 0, 0, 0, 0 },
+    { 2, 5, 7, 0, 0, 0, 0, 0 }, { 0, 2, 5, 7, 0, 0, 0, 0 }, { 1, 2, 5, 7, 0, 0, 0, 0 }, { 0, 1, 2, 5, 7, 0, 0, 0 },
+    { 3, 5, 7, 0, 0, 0, 0, 0 }, { 0, 3, 5, 7, 0, 0, 0, 0 }, { 1, 3, 5, 7, 0, 0, 0, 0 }, { 0, 1, 3, 5, 7, 0, 0, 0 },
+    { 2, 3, 5, 7, 0, 0, 0, 0 }, { 0, 2, 3, 5, 7, 0, 0, 0 }, { 1, 2, 3, 5, 7, 0, 0, 0 }, { 0, 1, 2, 3, 5, 7, 0, 0 },
+    { 4, 5, 7, 0, 0, 0, 0, 0 }, { 0, 4, 5, 7, 0, 0, 0, 0 }, { 1, 4, 5, 7, 0, 0, 0, 0 }, { 0, 1, 4, 5, 7, 0, 0, 0 },
+    { 2, 4, 5, 7, 0, 0, 0, 0 }, { 0, 2, 4, 5, 7, 0, 0, 0 }, { 1, 2, 4, 5, 7, 0, 0, 0 }, { 0, 1, 2, 4, 5, 7, 0, 0 },
+    { 3, 4, 5, 7, 0, 0, 0, 0 }, { 0, 3, 4, 5, 7, 0, 0, 0 }, { 1, 3, 4, 5, 7, 0, 0, 0 }, { 0, 1, 3, 4, 5, 7, 0, 0 },
+    { 2, 3, 4, 5, 7, 0, 0, 0 }, { 0, 2, 3, 4, 5, 7, 0, 0 }, { 1, 2, 3, 4, 5, 7, 0, 0 }, { 0, 1, 2, 3, 4, 5, 7, 0 },
+    { 6, 7, 0, 0, 0, 0, 0, 0 }, { 0, 6, 7, 0, 0, 0, 0, 0 }, { 1, 6, 7, 0, 0, 0, 0, 0 }, { 0, 1, 6, 7, 0, 0, 0, 0 },
+    { 2, 6, 7, 0, 0, 0, 0, 0 }, { 0, 2, 6, 7, 0, 0, 0, 0 }, { 1, 2, 6, 7, 0, 0, 0, 0 }, { 0, 1, 2, 6, 7, 0, 0, 0 },
+    { 3, 6, 7, 0, 0, 0, 0, 0 }, { 0, 3, 6, 7, 0, 0, 0, 0 }, { 1, 3, 6, 7, 0, 0, 0, 0 }, { 0, 1, 3, 6, 7, 0, 0, 0 },
+    { 2, 3, 6, 7, 0, 0, 0, 0 }, { 0, 2, 3, 6, 7, 0, 0, 0 }, { 1, 2, 3, 6, 7, 0, 0, 0 }, { 0, 1, 2, 3, 6, 7, 0, 0 },
+    { 4, 6, 7, 0, 0, 0, 0, 0 }, { 0, 4, 6, 7, 0, 0, 0, 0 }, { 1, 4, 6, 7, 0, 0, 0, 0 }, { 0, 1, 4, 6, 7, 0, 0, 0 },
+    { 2, 4, 6, 7, 0, 0, 0, 0 }, { 0, 2, 4, 6, 7, 0, 0, 0 }, { 1, 2, 4, 6, 7, 0, 0, 0 }, { 0, 1, 2, 4, 6, 7, 0, 0 },
+    { 3, 4, 6, 7, 0, 0, 0, 0 }, { 0, 3, 4, 6, 7, 0, 0, 0 }, { 1, 3, 4, 6, 7, 0, 0, 0 }, { 0, 1, 3, 4, 6, 7, 0, 0 },
+    { 2, 3, 4, 6, 7, 0, 0, 0 }, { 0, 2, 3, 4, 6, 7, 0, 0 }, { 1, 2, 3, 4, 6, 7, 0, 0 }, { 0, 1, 2, 3, 4, 6, 7, 0 },
+    { 5, 6, 7, 0, 0, 0, 0, 0 }, { 0, 5, 6, 7, 0, 0, 0, 0 }, { 1, 5, 6, 7, 0, 0, 0, 0 }, { 0, 1, 5, 6, 7, 0, 0, 0 },
+    { 2, 5, 6, 7, 0, 0, 0, 0 }, { 0, 2, 5, 6, 7, 0, 0, 0 }, { 1, 2, 5, 6, 7, 0, 0, 0 }, { 0, 1, 2, 5, 6, 7, 0, 0 },
+    { 3, 5, 6, 7, 0, 0, 0, 0 }, { 0, 3, 5, 6, 7, 0, 0, 0 }, { 1, 3, 5, 6, 7, 0, 0, 0 }, { 0, 1, 3, 5, 6, 7, 0, 0 },
+    { 2, 3, 5, 6, 7, 0, 0, 0 }, { 0, 2, 3, 5, 6, 7, 0, 0 }, { 1, 2, 3, 5, 6, 7, 0, 0 }, { 0, 1, 2, 3, 5, 6, 7, 0 },
+    { 4, 5, 6, 7, 0, 0, 0, 0 }, { 0, 4, 5, 6, 7, 0, 0, 0 }, { 1, 4, 5, 6, 7, 0, 0, 0 }, { 0, 1, 4, 5, 6, 7, 0, 0 },
+    { 2, 4, 5, 6, 7, 0, 0, 0 }, { 0, 2, 4, 5, 6, 7, 0, 0 }, { 1, 2, 4, 5, 6, 7, 0, 0 }, { 0, 1, 2, 4, 5, 6, 7, 0 },
+    { 3, 4, 5, 6, 7, 0, 0, 0 }, { 0, 3, 4, 5, 6, 7, 0, 0 }, { 1, 3, 4, 5, 6, 7, 0, 0 }, { 0, 1, 3, 4, 5, 6, 7, 0 },
+    { 2, 3, 4, 5, 6, 7, 0, 0 }, { 0, 2, 3, 4, 5, 6, 7, 0 }, { 1, 2, 3, 4, 5, 6, 7, 0 }, { 0, 1, 2, 3, 4, 5, 6, 7 }
+};
+
+// Builds a shuffle that moves the 16-bit lanes selected by a mask to the start of a register
+TARGET_AVX2 static __m128i pack_lanes_shuffle(unsigned mask)
+{
+    __m128i lanes = _mm_loadl_epi64((__m128i const*)pack_lanes_table[mask]);
+
+    // Lane N is made of bytes 2N and 2N + 1
+    __m128i bytes = _mm_unpacklo_epi8(lanes, lanes);
+    bytes = _mm_add_epi8(bytes, bytes);
+    return _mm_add_epi8(bytes, _mm_set1_epi16(0x0100));
+}
+
+// Returns a mask with the bytes of a vector that are greater than or equal to a value
+TARGET_AVX2 static unsigned bytes_at_least(__m128i chunk, int value)
+{
+    __m128i max = _mm_max_epu8(chunk, _mm_set1_epi8((char)value));
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(max, chunk));
+}
+
+// Returns a mask with the bytes of a vector that, masked with 'mask', are equal to 'value'
+TARGET_AVX2 static unsigned bytes_matching(__m128i chunk, int mask, int value)
+{
+    __m128i masked = _mm_and_si128(chunk, _mm_set1_epi8((char)mask));
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(masked, _mm_set1_epi8((char)value)));
+}
+
+// Checks a block of UTF-8 characters made of 1, 2 and 3 byte sequences, and optionally 4 byte sequences.
+// Checking stops before the first sequence that isn't handled or continues past the block.
+//
+// chunk: The UTF-8 characters
+// four_bytes: If 4-byte sequences should be checked too
+// continuation_mask: A pointer to a variable that will receive the mask of continuation bytes that were checked
+// lead4_mask: A pointer to a variable that will receive the mask of leading bytes of 4-byte sequences that were checked
+//
+// return: The number of UTF-8 characters that were checked, or 0 if any of them is invalid.
+TARGET_AVX2 static ALWAYS_INLINE int utf8_avx2_mixed_len(__m128i chunk, bool four_bytes, unsigned* continuation_mask, unsigned* lead4_mask)
+{
+    unsigned continuation = bytes_matching(chunk, 0xC0, 0x80);
+    unsigned lead2 = bytes_matching(chunk, 0xE0, 0xC0);
+    unsigned lead3 = bytes_matching(chunk, 0xF0, 0xE0);
+    // F5 to F7 are always above UNICODE_MAX, so they're left out like the leading bytes that match no pattern
+    unsigned lead4 = four_bytes ? bytes_at_least(chunk, 0xF0) & ~bytes_at_least(chunk, 0xF5) : 0;
+
+    // 4-byte sequences (unless requested), leading bytes that match no pattern
+    // and overlong 2-byte sequences (C0 and C1) are left for the scalar code
+    unsigned unhandled = bytes_at_least(chunk, four_bytes ? 0xF5 : 0xF0) | bytes_matching(chunk, 0xFE, 0xC0);
+    // Sequences that continue past the block
+    unsigned truncated = (lead2 & 0x8000) | (lead3 & 0xC000) | (lead4 & 0xE000);
+
+    int end = count_trailing_zeros(unhandled | truncated | (1u << AVX2_MIXED_LEN));
+    unsigned window = (1u << end) - 1;
+
+    lead2 &= window;
+    lead3 &= window;
+    lead4 &= window;
+    continuation &= window;
+
+    // Every leading byte must be followed by exactly as many continuation bytes as it advertises,
+    // and no continuation byte can appear anywhere else
+    unsigned expected_continuation = (lead2 << 1) | (lead3 << 1) | (lead3 << 2) | (lead4 << 1) | (lead4 << 2) | (lead4 << 3);
+    if (end == 0 || expected_continuation != continuation)
+        return 0;
+
+    // E0 followed by anything below A0 is an overlong encoding,
+    // and ED followed by anything from A0 upwards is a surrogate
+    unsigned from_a0 = bytes_at_least(chunk, 0xA0);
+    unsigned e0 = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8((char)0xE0))) & window;
+    unsigned ed = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8((char)0xED))) & window;
+    if (((e0 << 1) & ~from_a0) != 0 || ((ed << 1) & from_a0) != 0)
+        return 0;
+
+    // F0 followed by anything below 90 is an overlong encoding,
+    // and F4 followed by anything from 90 upwards is above UNICODE_MAX
+    if (lead4 != 0)
+    {
+        unsigned from_90 = bytes_at_least(chunk, 0x90);
+        unsigned f0 = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8((char)0xF0))) & window;
+        unsigned f4 = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8((char)0xF4))) & window;
+        if (((f0 << 1) & ~from_90) != 0 || ((f4 << 1) & from_90) != 0)
+            return 0;
+    }
+
+    *continuation_mask = continuation;
+    *lead4_mask = lead4;
+    return end;
+}
+
+// Decodes a block of UTF-8 characters made of 1, 2 and 3 byte sequences.
+// Decoding stops before the first 4-byte sequence or sequence that continues past the block,
+// and nothing is decoded if any of the sequences before that is invalid.
+//
+// chunk: The UTF-8 characters
+// utf16: Where to write the UTF-16 characters. Must have room for AVX2_MIXED_LEN characters,
+//        but only the ones decoded are written.
+// written: A pointer to a variable that will receive the number of UTF-16 characters written.
+// swap: If the UTF-16 characters should be written with their bytes swapped
+//
+// return: The number of UTF-8 characters that were decoded.
+TARGET_AVX2 static ALWAYS_INLINE int utf8_to_utf16_avx2_mixed(__m128i chunk, utf16_t* utf16, int* written, bool swap)
+{
+    unsigned continuation;
+    unsigned lead4;
+    int end = utf8_avx2_mixed_len(chunk, false, &continuation, &lead4);
+    if (end == 0)
+        return 0;
+
+    unsigned window = (1u << end) - 1;
+
+    // Decode a codepoint starting at every position, as if every byte was a leading byte
+    __m256i byte0 = _mm256_cvtepu8_epi16(chunk);
+    __m256i byte1 = _mm256_cvtepu8_epi16(_mm_srli_si128(chunk, 1));
+    __m256i byte2 = _mm256_cvtepu8_epi16(_mm_srli_si128(chunk, 2));
+
+    __m256i const value_mask = _mm256_set1_epi16(0x3F);
+    __m256i bits1 = _mm256_slli_epi16(_mm256_and_si256(byte1, value_mask), 6);
+    __m256i bits2 = _mm256_and_si256(byte2, value_mask);
+
+    __m256i decoded2 = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(byte0, _mm256_set1_epi16(0x1F)), 6), _mm256_and_si256(byte1, value_mask));
+    // The top 4 bits of the leading byte are shifted out of the 16-bit lane
+    __m256i decoded3 = _mm256_or_si256(_mm256_slli_epi16(byte0, 12), _mm256_or_si256(bits1, bits2));
+
+    __m256i is_lead2 = _mm256_cmpeq_epi16(_mm256_and_si256(byte0, _mm256_set1_epi16(0xE0)), _mm256_set1_epi16(0xC0));
+    __m256i is_lead3 = _mm256_cmpeq_epi16(_mm256_and_si256(byte0, _mm256_set1_epi16(0xF0)), _mm256_set1_epi16(0xE0));
+
+    __m256i decoded = _mm256_blendv_epi8(byte0, decoded2, is_lead2);
+    decoded = _mm256_blendv_epi8(decoded, decoded3, is_lead3);
+
+    // Keep only the codepoints that really started at a leading byte
+    unsigned leading = window & ~continuation;
+    unsigned leading_low = leading & 0xFF;
+    unsigned leading_high = leading >> 8;
+
+    __m128i low = _mm_shuffle_epi8(_mm256_castsi256_si128(decoded), pack_lanes_shuffle(leading_low));
+    __m128i high = _mm_shuffle_epi8(_mm256_extracti128_si256(decoded, 1), pack_lanes_shuffle(leading_high));
+
+    if (swap)
+    {
+        low = swap_utf16_sse41(low);
+        high = swap_utf16_sse41(high);
+    }
+
+    int low_len = count_bits(leading_low);
+    int high_len = count_bits(leading_high);
+    store_joined_sse41(utf16, low, low_len * (int)sizeof(utf16_t), high, high_len * (int)sizeof(utf16_t));
+
+    *written = low_len + high_len;
+    return end;
+}
+
+// Widens ASCII characters to UTF-16, swapping their bytes if requested
+TARGET_AVX2 static ALWAYS_INLINE __m256i widen_ascii_avx2(__m128i chunk, bool swap)
+{
+    __m256i wide = _mm256_cvtepu8_epi16(chunk);
+    return swap ? _mm256_slli_epi16(wide, 8) : wide;
+}
+
+TARGET_AVX2 static ALWAYS_INLINE void utf8_to_utf16_avx2_impl(
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    utf16_t* utf16,     size_t utf16_len, size_t* utf16_index,
+    bool swap)
+{
+    size_t in = *utf8_index;
+    size_t out = *utf16_index;
+
+    for (;;)
+    {
+        if (in + AVX2_UTF8_LEN <= utf8_len && out + AVX2_UTF8_LEN <= utf16_len)
+        {
+            __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf8 + in));
+
+            if (_mm256_movemask_epi8(chunk) == 0)
+            {
+                _mm256_storeu_si256((__m256i*)(utf16 + out), widen_ascii_avx2(_mm256_castsi256_si128(chunk), swap));
+                _mm256_storeu_si256((__m256i*)(utf16 + out + 16), widen_ascii_avx2(_mm256_extracti128_si256(chunk, 1), swap));
+
+                in += AVX2_UTF8_LEN;
+                out += AVX2_UTF8_LEN;
+                continue;
+            }
+        }
+
+        if (in + AVX2_MIXED_LEN > utf8_len || out + AVX2_MIXED_LEN > utf16_len)
+            break;
+
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf8 + in));
+
+        if (_mm_movemask_epi8(chunk) == 0)
+        {
+            _mm256_storeu_si256((__m256i*)(utf16 + out), widen_ascii_avx2(chunk, swap));
+
+            in += AVX2_MIXED_LEN;
+            out += AVX2_MIXED_LEN;
+            continue;
+        }
+
+        int written;
+        int consumed = utf8_to_utf16_avx2_mixed(chunk, utf16 + out, &written, swap);
+        if (consumed == 0)
+            break;
+
+        in += consumed;
+        out += written;
+    }
+
+    *utf8_index = in;
+    *utf16_index = out;
+
+    utf8_to_utf16_scalar_impl(utf8, utf8_len, utf8_index, utf16, utf16_len, utf16_index, swap);
+}
+
+TARGET_AVX2 static void utf8_to_utf16_avx2(
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    utf16_t* utf16,     size_t utf16_len, size_t* utf16_index)
+{
+    utf8_to_utf16_avx2_impl(utf8, utf8_len, utf8_index, utf16, utf16_len, utf16_index, false);
+}
+
+TARGET_AVX2 static void utf8_to_utf16_swapped_avx2(
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    utf16_t* utf16,     size_t utf16_len, size_t* utf16_index)
+{
+    utf8_to_utf16_avx2_impl(utf8, utf8_len, utf8_index, utf16, utf16_len, utf16_index, true);
+}
+
+// The number of UTF-16 characters in an AVX2 register
+#define AVX2_UTF16_LEN 16
+
+// Swaps the bytes of every UTF-16 character of a register
+TARGET_AVX2 static ALWAYS_INLINE __m256i swap_utf16_avx2(__m256i chunk)
+{
+    __m256i const shuffle = _mm256_setr_epi8(
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    return _mm256_shuffle_epi8(chunk, shuffle);
+}
+
+// Finds how many of the UTF-16 characters starting at an index have no surrogates,
+// checking at most UTF16_SURROGATE_SCAN_LEN characters
+//
+// utf16: The UTF-16 characters
+// utf16_len: The number of UTF-16 characters
+// index: The index to start checking at
+// swap: If the bytes of every UTF-16 character are swapped
+//
+// return: The index after the registers that have no surrogates
+TARGET_AVX2 static ALWAYS_INLINE size_t skip_surrogate_free_avx2(utf16_t const* utf16, size_t utf16_len, size_t index, bool swap)
+{
+    // Swapped characters are masked with swapped values instead of being swapped themselves
+    __m256i const mask = _mm256_set1_epi16((short)(swap ? 0x00F8 : GENERIC_SURROGATE_MASK));
+    __m256i const value = _mm256_set1_epi16((short)(swap ? 0x00D8 : GENERIC_SURROGATE_VALUE));
+
+    size_t end = index;
+
+    // Four registers are checked at once, and the one with surrogates is found below
+    while (end + 4 * AVX2_UTF16_LEN <= utf16_len && end - index < UTF16_SURROGATE_SCAN_LEN)
+    {
+        __m256i any = _mm256_setzero_si256();
+        for (size_t offset = 0; offset < 4 * AVX2_UTF16_LEN; offset += AVX2_UTF16_LEN)
+        {
+            __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf16 + end + offset));
+            any = _mm256_or_si256(any, _mm256_cmpeq_epi16(_mm256_and_si256(chunk, mask), value));
+        }
+
+        if (!_mm256_testz_si256(any, any))
+            break;
+
+        end += 4 * AVX2_UTF16_LEN;
+    }
+
+    while (end + AVX2_UTF16_LEN <= utf16_len && end - index < UTF16_SURROGATE_SCAN_LEN)
+    {
+        __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf16 + end));
+        __m256i surrogates = _mm256_cmpeq_epi16(_mm256_and_si256(chunk, mask), value);
+        if (!_mm256_testz_si256(surrogates, surrogates))
+            break;
+
+        end += AVX2_UTF16_LEN;
+    }
+
+    return end;
+}
+
+// Encodes a register of UTF-16 characters without surrogates to UTF-8
+//
+// chunk: The UTF-16 characters, in the native byte order
+// utf8: Where to write the UTF-8 characters. Must have room for 2 * SSE41_UTF8_MAX_LEN characters.
+// exact: If only the encoded characters may be written, as with utf16_to_utf8_sse41_bmp
+//
+// return: The number of UTF-8 characters that were written, which is at least AVX2_UTF16_LEN
+TARGET_AVX2 static ALWAYS_INLINE int utf16_to_utf8_avx2_block(__m256i chunk, utf8_t* utf8, bool exact)
+{
+    if (_mm256_testz_si256(chunk, _mm256_set1_epi16((short)0xFF80)))
+    {
+        __m128i narrow = _mm_packus_epi16(_mm256_castsi256_si128(chunk), _mm256_extracti128_si256(chunk, 1));
+        _mm_storeu_si128((__m128i*)utf8, narrow);
+        return AVX2_UTF16_LEN;
+    }
+
+    // The garbage of the low half is overwritten by the high half when the high half leaves garbage too,
+    // since it then writes 16 characters
+    int written = utf16_to_utf8_sse41_bmp(_mm256_castsi256_si128(chunk), utf8, exact);
+    return written + utf16_to_utf8_sse41_bmp(_mm256_extracti128_si256(chunk, 1), utf8 + written, exact);
+}
+
+TARGET_AVX2 static ALWAYS_INLINE void utf16_to_utf8_avx2_impl(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index,
+    bool swap)
+{
+    size_t in = *utf16_index;
+    size_t out = *utf8_index;
+
+    while (in + AVX2_UTF16_LEN <= utf16_len && out + 2 * SSE41_UTF8_MAX_LEN <= utf8_len)
+    {
+        size_t end = skip_surrogate_free_avx2(utf16, utf16_len, in, swap);
+        if (end == in)
+        {
+            // Each half is encoded on its own, so a surrogate on the high half
+            // still lets the low half be encoded
+            __m128i low = _mm_loadu_si128((__m128i const*)(utf16 + in));
+            if (swap)
+                low = swap_utf16_sse41(low);
+
+            if (!has_surrogates(low))
+            {
+                out += utf16_to_utf8_sse41_bmp(low, utf8 + out, true);
+                in += SSE2_UTF16_LEN;
+            }
+
+            break;
+        }
+
+        // The garbage left by a register is overwritten by the next one, which writes at least 16 characters,
+        // so only the last register before a surrogate or the end of the output is encoded exactly
+        while (in + 2 * AVX2_UTF16_LEN <= end && out + 4 * SSE41_UTF8_MAX_LEN <= utf8_len)
+        {
+            __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf16 + in));
+            if (swap)
+                chunk = swap_utf16_avx2(chunk);
+
+            out += utf16_to_utf8_avx2_block(chunk, utf8 + out, false);
+            in += AVX2_UTF16_LEN;
+        }
+
+        while (in + AVX2_UTF16_LEN <= end && out + 2 * SSE41_UTF8_MAX_LEN <= utf8_len)
+        {
+            __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf16 + in));
+            if (swap)
+                chunk = swap_utf16_avx2(chunk);
+
+            out += utf16_to_utf8_avx2_block(chunk, utf8 + out, true);
+            in += AVX2_UTF16_LEN;
+        }
+    }
+
+    *utf16_index = in;
+    *utf8_index = out;
+
+    utf16_to_utf8_sse41_impl(utf16, utf16_len, utf16_index, utf8, utf8_len, utf8_index, swap);
+}
+
+TARGET_AVX2 static void utf16_to_utf8_avx2(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index)
+{
+    utf16_to_utf8_avx2_impl(utf16, utf16_len, utf16_index, utf8, utf8_len, utf8_index, false);
+}
+
+TARGET_AVX2 static void utf16_swapped_to_utf8_avx2(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index)
+{
+    utf16_to_utf8_avx2_impl(utf16, utf16_len, utf16_index, utf8, utf8_len, utf8_index, true);
+}
+
+TARGET_AVX2 static void utf8_to_utf16_len_avx2(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index, size_t* utf16_index)
+{
+    size_t in = *utf8_index;
+    size_t out = *utf16_index;
+
+    for (;;)
+    {
+        if (in + AVX2_UTF8_LEN <= utf8_len)
+        {
+            __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf8 + in));
+
+            if (_mm256_movemask_epi8(chunk) == 0)
+            {
+                in += AVX2_UTF8_LEN;
+                out += AVX2_UTF8_LEN;
+                continue;
+            }
+        }
+
+        if (in + AVX2_MIXED_LEN > utf8_len)
+            break;
+
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf8 + in));
+
+        if (_mm_movemask_epi8(chunk) == 0)
+        {
+            in += AVX2_MIXED_LEN;
+            out += AVX2_MIXED_LEN;
+            continue;
+        }
+
+        // Every sequence becomes one UTF-16 character, except for 4-byte sequences, which become a surrogate pair
+        unsigned continuation;
+        unsigned lead4;
+        int counted = utf8_avx2_mixed_len(chunk, true, &continuation, &lead4);
+        if (counted == 0)
+            break;
+
+        in += counted;
+        out += counted - count_bits(continuation) + count_bits(lead4);
+    }
+
+    *utf8_index = in;
+    *utf16_index = out;
+
+    utf8_to_utf16_len_scalar(utf8, utf8_len, utf8_index, utf16_index);
+}
+
+TARGET_AVX2 static ALWAYS_INLINE void utf16_to_utf8_len_avx2_impl(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index, size_t* utf8_index, bool swap)
+{
+    size_t in = *utf16_index;
+    size_t out = *utf8_index;
+
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i const non_ascii = _mm256_set1_epi16((short)0xFF80);
+    __m256i const above_2_bytes = _mm256_set1_epi16((short)0xF800);
+    __m256i const surrogate_mask = _mm256_set1_epi16((short)SURROGATE_MASK);
+    __m256i const high_value = _mm256_set1_epi16((short)HIGH_SURROGATE_VALUE);
+    __m256i const low_value = _mm256_set1_epi16((short)LOW_SURROGATE_VALUE);
+
+    while (in + AVX2_UTF16_LEN <= utf16_len)
+    {
+        __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf16 + in));
+        if (swap)
+            chunk = swap_utf16_avx2(chunk);
+
+        if (_mm256_testz_si256(chunk, non_ascii))
+        {
+            in += AVX2_UTF16_LEN;
+            out += AVX2_UTF16_LEN;
+            continue;
+        }
+
+        unsigned ascii_mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(chunk, non_ascii), zero));
+        unsigned short_mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(chunk, above_2_bytes), zero));
+
+        __m256i masked = _mm256_and_si256(chunk, surrogate_mask);
+        unsigned high = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(masked, high_value));
+        unsigned low = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(masked, low_value));
+
+        int counted = count_utf8_len_of_utf16(~ascii_mask, ~short_mask, high, low, AVX2_UTF16_LEN, &out);
+        if (counted == 0)
+            break;
+
+        in += counted;
+    }
+
+    *utf16_index = in;
+    *utf8_index = out;
+
+    utf16_to_utf8_len_sse2_impl(utf16, utf16_len, utf16_index, utf8_index, swap);
+}
+
+TARGET_AVX2 static void utf16_to_utf8_len_avx2(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index, size_t* utf8_index)
+{
+    utf16_to_utf8_len_avx2_impl(utf16, utf16_len, utf16_index, utf8_index, false);
+}
+
+TARGET_AVX2 static void utf16_swapped_to_utf8_len_avx2(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index, size_t* utf8_index)
+{
+    utf16_to_utf8_len_avx2_impl(utf16, utf16_len, utf16_index, utf8_index, true);
+}
+
+TARGET_AVX2 static void utf16_validate_avx2(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index)
+{
+    size_t in = *utf16_index;
+
+    __m256i const surrogate_mask = _mm256_set1_epi16((short)SURROGATE_MASK);
+    __m256i const high_value = _mm256_set1_epi16((short)HIGH_SURROGATE_VALUE);
+    __m256i const low_value = _mm256_set1_epi16((short)LOW_SURROGATE_VALUE);
+
+    while (in + AVX2_UTF16_LEN <= utf16_len)
+    {
+        __m256i masked = _mm256_and_si256(_mm256_loadu_si256((__m256i const*)(utf16 + in)), surrogate_mask);
+        unsigned high = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(masked, high_value));
+        unsigned low = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(masked, low_value));
+
+        int valid = count_valid_utf16(high, low, AVX2_UTF16_LEN);
+        if (valid == 0)
+            break;
+
+        in += valid;
+    }
+
+    *utf16_index = in;
+
+    utf16_validate_sse2(utf16, utf16_len, utf16_index);
+}
+
+TARGET_AVX2 static void utf8_validate_avx2(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index)
+{
+    size_t in = *utf8_index;
+
+    for (;;)
+    {
+        if (in + AVX2_UTF8_LEN <= utf8_len)
+        {
+            __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf8 + in));
+
+            if (_mm256_movemask_epi8(chunk) == 0)
+            {
+                in += AVX2_UTF8_LEN;
+                continue;
+            }
+        }
+
+        if (in + AVX2_MIXED_LEN > utf8_len)
+            break;
+
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf8 + in));
+
+        if (_mm_movemask_epi8(chunk) == 0)
+        {
+            in += AVX2_MIXED_LEN;
+            continue;
+        }
+
+        unsigned continuation;
+        unsigned lead4;
+        int checked = utf8_avx2_mixed_len(chunk, true, &continuation, &lead4);
+        if (checked == 0)
+            break;
+
+        in += checked;
+    }
+
+    *utf8_index = in;
+
+    utf8_validate_scalar(utf8, utf8_len, utf8_index);
+}
+
+// Widens UTF-16 characters without surrogates to UTF-32, without writing anything after them
+//
+// utf16: The UTF-16 characters
+// len: The number of UTF-16 characters, up to AVX2_MIXED_LEN
+// utf32: Where to write the UTF-32 characters
+TARGET_AVX2 static ALWAYS_INLINE void widen_utf16_avx2(utf16_t const* utf16, int len, utf32_t* utf32)
+{
+    // The last characters are widened again from where they start, so the two stores overlap
+    if (len >= 8)
+    {
+        _mm256_storeu_si256((__m256i*)utf32, _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i const*)utf16)));
+        _mm256_storeu_si256((__m256i*)(utf32 + len - 8), _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i const*)(utf16 + len - 8))));
+    }
+    else if (len >= 4)
+    {
+        _mm_storeu_si128((__m128i*)utf32, _mm_cvtepu16_epi32(_mm_loadl_epi64((__m128i const*)utf16)));
+        _mm_storeu_si128((__m128i*)(utf32 + len - 4), _mm_cvtepu16_epi32(_mm_loadl_epi64((__m128i const*)(utf16 + len - 4))));
+    }
+    else
+    {
+        for (int i = 0; i < len; i++)
+            utf32[i] = utf16[i];
+    }
+}
+
+TARGET_AVX2 static void utf8_to_utf32_avx2(
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    utf32_t* utf32,     size_t utf32_len, size_t* utf32_index)
+{
+    size_t in = *utf8_index;
+    size_t out = *utf32_index;
+
+    for (;;)
+    {
+        if (in + AVX2_UTF8_LEN <= utf8_len && out + AVX2_UTF8_LEN <= utf32_len)
+        {
+            __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf8 + in));
+
+            if (_mm256_movemask_epi8(chunk) == 0)
+            {
+                __m128i low = _mm256_castsi256_si128(chunk);
+                __m128i high = _mm256_extracti128_si256(chunk, 1);
+                _mm256_storeu_si256((__m256i*)(utf32 + out), _mm256_cvtepu8_epi32(low));
+                _mm256_storeu_si256((__m256i*)(utf32 + out + 8), _mm256_cvtepu8_epi32(_mm_srli_si128(low, 8)));
+                _mm256_storeu_si256((__m256i*)(utf32 + out + 16), _mm256_cvtepu8_epi32(high));
+                _mm256_storeu_si256((__m256i*)(utf32 + out + 24), _mm256_cvtepu8_epi32(_mm_srli_si128(high, 8)));
+
+                in += AVX2_UTF8_LEN;
+                out += AVX2_UTF8_LEN;
+                continue;
+            }
+        }
+
+        if (in + AVX2_MIXED_LEN > utf8_len || out + AVX2_MIXED_LEN > utf32_len)
+            break;
+
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf8 + in));
+
+        if (_mm_movemask_epi8(chunk) == 0)
+        {
+            _mm256_storeu_si256((__m256i*)(utf32 + out), _mm256_cvtepu8_epi32(chunk));
+            _mm256_storeu_si256((__m256i*)(utf32 + out + 8), _mm256_cvtepu8_epi32(_mm_srli_si128(chunk, 8)));
+
+            in += AVX2_MIXED_LEN;
+            out += AVX2_MIXED_LEN;
+            continue;
+        }
+
+        // 2 and 3 byte sequences never become surrogates, so they're decoded
+        // to UTF-16 first and then just widened
+        utf16_t decoded[AVX2_MIXED_LEN];
+        int written;
+        int consumed = utf8_to_utf16_avx2_mixed(chunk, decoded, &written, false);
+        if (consumed == 0)
+            break;
+
+        widen_utf16_avx2(decoded, written, utf32 + out);
+
+        in += consumed;
+        out += written;
+    }
+
+    *utf8_index = in;
+    *utf32_index = out;
+
+    utf8_to_utf32_scalar(utf8, utf8_len, utf8_index, utf32, utf32_len, utf32_index);
+}
+
+TARGET_AVX2 static void utf8_to_utf32_len_avx2(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index, size_t* utf32_index)
+{
+    size_t in = *utf8_index;
+    size_t out = *utf32_index;
+
+    for (;;)
+    {
+        if (in + AVX2_UTF8_LEN <= utf8_len)
+        {
+            __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf8 + in));
+
+            if (_mm256_movemask_epi8(chunk) == 0)
+            {
+                in += AVX2_UTF8_LEN;
+                out += AVX2_UTF8_LEN;
+                continue;
+            }
+        }
+
+        if (in + AVX2_MIXED_LEN > utf8_len)
+            break;
+
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf8 + in));
+
+        if (_mm_movemask_epi8(chunk) == 0)
+        {
+            in += AVX2_MIXED_LEN;
+            out += AVX2_MIXED_LEN;
+            continue;
+        }
+
+        // Every sequence becomes one UTF-32 character
+        unsigned continuation;
+        unsigned lead4;
+        int counted = utf8_avx2_mixed_len(chunk, true, &continuation, &lead4);
+        if (counted == 0)
+            break;
+
+        in += counted;
+        out += counted - count_bits(continuation);
+    }
+
+    *utf8_index = in;
+    *utf32_index = out;
+
+    utf8_to_utf16_len_scalar(utf8, utf8_len, utf8_index, utf32_index);
+}
+
+TARGET_AVX2 static void utf16_to_utf32_avx2(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    utf32_t* utf32,       size_t utf32_len, size_t* utf32_index)
+{
+    size_t in = *utf16_index;
+    size_t out = *utf32_index;
+
+    __m256i const surrogate_mask = _mm256_set1_epi16((short)GENERIC_SURROGATE_MASK);
+    __m256i const surrogate_value = _mm256_set1_epi16((short)GENERIC_SURROGATE_VALUE);
+
+    // Surrogate pairs are left for the scalar code
+    while (in + AVX2_UTF16_LEN <= utf16_len && out + AVX2_UTF16_LEN <= utf32_len)
+    {
+        __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf16 + in));
+
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(chunk, surrogate_mask), surrogate_value)) != 0)
+            break;
+
+        _mm256_storeu_si256((__m256i*)(utf32 + out), _mm256_cvtepu16_epi32(_mm256_castsi256_si128(chunk)));
+        _mm256_storeu_si256((__m256i*)(utf32 + out + 8), _mm256_cvtepu16_epi32(_mm256_extracti128_si256(chunk, 1)));
+
+        in += AVX2_UTF16_LEN;
+        out += AVX2_UTF16_LEN;
+    }
+
+    *utf16_index = in;
+    *utf32_index = out;
+
+    utf16_to_utf32_sse2(utf16, utf16_len, utf16_index, utf32, utf32_len, utf32_index);
+}
+
+TARGET_AVX2 static void utf16_to_utf32_len_avx2(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index, size_t* utf32_index)
+{
+    size_t in = *utf16_index;
+    size_t out = *utf32_index;
+
+    __m256i const surrogate_mask = _mm256_set1_epi16((short)SURROGATE_MASK);
+    __m256i const high_value = _mm256_set1_epi16((short)HIGH_SURROGATE_VALUE);
+    __m256i const low_value = _mm256_set1_epi16((short)LOW_SURROGATE_VALUE);
+
+    while (in + AVX2_UTF16_LEN <= utf16_len)
+    {
+        __m256i masked = _mm256_and_si256(_mm256_loadu_si256((__m256i const*)(utf16 + in)), surrogate_mask);
+        unsigned high = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(masked, high_value));
+        unsigned low = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(masked, low_value));
+
+        int valid = count_valid_utf16(high, low, AVX2_UTF16_LEN);
+        if (valid == 0)
+            break;
+
+        unsigned counted = (unsigned)((UINT64_C(1) << (2 * valid)) - 1);
+        out += valid - count_bits(low & counted) / 2;
+        in += valid;
+    }
+
+    *utf16_index = in;
+    *utf32_index = out;
+
+    utf16_to_utf32_len_sse2(utf16, utf16_len, utf16_index, utf32_index);
+}
+
+// The number of UTF-32 characters in an AVX2 register
+#define AVX2_UTF32_LEN 8
+
+TARGET_AVX2 static void utf32_to_utf8_avx2(
+    utf32_t const* utf32, size_t utf32_len, size_t* utf32_index,
+    utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index)
+{
+    size_t in = *utf32_index;
+    size_t out = *utf8_index;
+
+    __m256i const non_ascii = _mm256_set1_epi32((int)0xFFFFFF80);
+
+    while (in + AVX2_UTF32_LEN <= utf32_len && out + AVX2_UTF32_LEN <= utf8_len)
+    {
+        __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf32 + in));
+
+        if (!_mm256_testz_si256(chunk, non_ascii))
+            break;
+
+        __m128i narrow = _mm_packs_epi32(_mm256_castsi256_si128(chunk), _mm256_extracti128_si256(chunk, 1));
+        _mm_storel_epi64((__m128i*)(utf8 + out), _mm_packus_epi16(narrow, narrow));
+
+        in += AVX2_UTF32_LEN;
+        out += AVX2_UTF32_LEN;
+    }
+
+    *utf32_index = in;
+    *utf8_index = out;
+
+    utf32_to_utf8_sse2(utf32, utf32_len, utf32_index, utf8, utf8_len, utf8_index);
+}
+
+TARGET_AVX2 static void utf32_to_utf16_avx2(
+    utf32_t const* utf32, size_t utf32_len, size_t* utf32_index,
+    utf16_t* utf16,       size_t utf16_len, size_t* utf16_index)
+{
+    size_t in = *utf32_index;
+    size_t out = *utf16_index;
+
+    __m256i const high_bits = _mm256_set1_epi32((int)0xFFFF0000);
+    __m256i const surrogate_mask = _mm256_set1_epi32(GENERIC_SURROGATE_MASK);
+    __m256i const surrogate_value = _mm256_set1_epi32(GENERIC_SURROGATE_VALUE);
+
+    // Characters outside of the BMP are left for the scalar code
+    while (in + AVX2_UTF32_LEN <= utf32_len && out + AVX2_UTF32_LEN <= utf16_len)
+    {
+        __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf32 + in));
+
+        if (!_mm256_testz_si256(chunk, high_bits))
+            break;
+
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(chunk, surrogate_mask), surrogate_value)) != 0)
+            break;
+
+        __m128i narrow = _mm_packus_epi32(_mm256_castsi256_si128(chunk), _mm256_extracti128_si256(chunk, 1));
+        _mm_storeu_si128((__m128i*)(utf16 + out), narrow);
+
+        in += AVX2_UTF32_LEN;
+        out += AVX2_UTF32_LEN;
+    }
+
+    *utf32_index = in;
+    *utf16_index = out;
+
+    utf32_to_utf16_sse2(utf32, utf32_len, utf32_index, utf16, utf16_len, utf16_index);
+}
+
+TARGET_AVX2 static void utf8_skip_ascii_avx2(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index)
+{
+    size_t in = *utf8_index;
+
+    while (in + AVX2_UTF8_LEN <= utf8_len)
+    {
+        unsigned non_ascii = (unsigned)_mm256_movemask_epi8(_mm256_loadu_si256((__m256i const*)(utf8 + in)));
+
+        // The exact position of the first non-ASCII character is known, so there's nothing left to the SSE2 code
+        if (non_ascii != 0)
+        {
+            *utf8_index = in + count_trailing_zeros(non_ascii);
+            return;
+        }
+
+        in += AVX2_UTF8_LEN;
+    }
+
+    *utf8_index = in;
+
+    utf8_skip_ascii_sse2(utf8, utf8_len, utf8_index);
+}
+
+TARGET_AVX2 static void utf16_skip_ascii_avx2(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index)
+{
+    size_t in = *utf16_index;
+
+    __m256i const non_ascii_mask = _mm256_set1_epi16((short)0xFF80);
+
+    while (in + AVX2_UTF16_LEN <= utf16_len)
+    {
+        __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf16 + in));
+        unsigned non_ascii = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(chunk, non_ascii_mask), _mm256_setzero_si256()));
+
+        if (non_ascii != 0)
+        {
+            *utf16_index = in + count_trailing_zeros(non_ascii) / 2;
+            return;
+        }
+
+        in += AVX2_UTF16_LEN;
+    }
+
+    *utf16_index = in;
+
+    utf16_skip_ascii_sse2(utf16, utf16_len, utf16_index);
+}
+
+// Decodes a block of UTF-8 characters made of ASCII characters and 2-byte sequences up to U+00FF.
+// Decoding stops before the first sequence that isn't handled or continues past the block,
+// and nothing is decoded if any of the sequences before that is invalid.
+//
+// chunk: The UTF-8 characters
+// latin1: Where to write the Latin-1 characters. Must have room for AVX2_MIXED_LEN characters.
+// written: A pointer to a variable that will receive the number of Latin-1 characters written.
+//
+// return: The number of UTF-8 characters that were decoded.
+TARGET_AVX2 static ALWAYS_INLINE int utf8_to_latin1_avx2_mixed(__m128i chunk, latin1_t* latin1, int* written)
+{
+    unsigned non_ascii = (unsigned)_mm_movemask_epi8(chunk);
+    unsigned continuation = bytes_matching(chunk, UTF8_CONTINUATION_MASK, UTF8_CONTINUATION_VALUE);
+    unsigned lead = bytes_matching(chunk, 0xFE, 0xC2);
+
+    // Every other leading byte and sequences that continue past the block are left for the scalar code
+    unsigned unhandled = non_ascii & ~continuation & ~lead;
+    int end = count_trailing_zeros(unhandled | (lead & 0x8000) | (1u << AVX2_MIXED_LEN));
+    if (end == 0)
+        return 0;
+
+    unsigned window = (1u << end) - 1;
+    continuation &= window;
+    if (!is_latin1_utf8_block(non_ascii & window, lead & window, continuation, 1u << (end - 1)))
+        return 0;
+
+    // Decode a codepoint starting at every position, as if every byte was a leading byte.
+    // The two bits of C2 and C3 that are shifted stay in their byte.
+    __m128i next = _mm_srli_si128(chunk, 1);
+    __m128i lead_bits = _mm_slli_epi16(_mm_and_si128(chunk, _mm_set1_epi8(0x03)), 6);
+    __m128i decoded2 = _mm_or_si128(lead_bits, _mm_and_si128(next, _mm_set1_epi8(0x3F)));
+    __m128i is_lead = _mm_cmpeq_epi8(_mm_and_si128(chunk, _mm_set1_epi8((char)0xFE)), _mm_set1_epi8((char)0xC2));
+    __m128i decoded = _mm_blendv_epi8(chunk, decoded2, is_lead);
+
+    // Keep only the characters that really started at a leading byte.
+    // The lane indexes of the table are byte indexes within each half of the register.
+    unsigned leading = window & ~continuation;
+    unsigned leading_low = leading & 0xFF;
+    unsigned leading_high = leading >> 8;
+
+    __m128i low = _mm_shuffle_epi8(decoded, _mm_loadl_epi64((__m128i const*)pack_lanes_table[leading_low]));
+    __m128i high = _mm_shuffle_epi8(_mm_srli_si128(decoded, 8), _mm_loadl_epi64((__m128i const*)pack_lanes_table[leading_high]));
+
+    int low_len = count_bits(leading_low);
+    int high_len = count_bits(leading_high);
+    store_joined_sse41(latin1, low, low_len, high, high_len);
+
+    *written = low_len + high_len;
+    return end;
+}
+
+TARGET_AVX2 static void utf8_to_latin1_avx2(
+    utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+    latin1_t* latin1,   size_t latin1_len, size_t* latin1_index)
+{
+    size_t in = *utf8_index;
+    size_t out = *latin1_index;
+
+    for (;;)
+    {
+        if (in + AVX2_UTF8_LEN <= utf8_len && out + AVX2_UTF8_LEN <= latin1_len)
+        {
+            __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf8 + in));
+
+            if (_mm256_movemask_epi8(chunk) == 0)
+            {
+                _mm256_storeu_si256((__m256i*)(latin1 + out), chunk);
+
+                in += AVX2_UTF8_LEN;
+                out += AVX2_UTF8_LEN;
+                continue;
+            }
+        }
+
+        if (in + AVX2_MIXED_LEN > utf8_len || out + AVX2_MIXED_LEN > latin1_len)
+            break;
+
+        __m128i chunk = _mm_loadu_si128((__m128i const*)(utf8 + in));
+
+        if (_mm_movemask_epi8(chunk) == 0)
+        {
+            _mm_storeu_si128((__m128i*)(latin1 + out), chunk);
+
+            in += AVX2_MIXED_LEN;
+            out += AVX2_MIXED_LEN;
+            continue;
+        }
+
+        int written;
+        int consumed = utf8_to_latin1_avx2_mixed(chunk, latin1 + out, &written);
+        if (consumed == 0)
+            break;
+
+        in += consumed;
+        out += written;
+    }
+
+    *utf8_index = in;
+    *latin1_index = out;
+
+    copy_ascii_sse2(utf8, utf8_len, utf8_index, latin1, latin1_len, latin1_index);
+}
+
+TARGET_AVX2 static void utf16_to_latin1_avx2(
+    utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+    latin1_t* latin1,     size_t latin1_len, size_t* latin1_index)
+{
+    size_t in = *utf16_index;
+    size_t out = *latin1_index;
+
+    __m256i const above_latin1 = _mm256_set1_epi16((short)0xFF00);
+
+    while (in + AVX2_UTF16_LEN <= utf16_len && out + AVX2_UTF16_LEN <= latin1_len)
+    {
+        __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf16 + in));
+
+        if (!_mm256_testz_si256(chunk, above_latin1))
+            break;
+
+        __m128i narrow = _mm_packus_epi16(_mm256_castsi256_si128(chunk), _mm256_extracti128_si256(chunk, 1));
+        _mm_storeu_si128((__m128i*)(latin1 + out), narrow);
+
+        in += AVX2_UTF16_LEN;
+        out += AVX2_UTF16_LEN;
+    }
+
+    *utf16_index = in;
+    *latin1_index = out;
+
+    utf16_to_latin1_sse2(utf16, utf16_len, utf16_index, latin1, latin1_len, latin1_index);
+}
+
+TARGET_AVX2 static void latin1_to_utf8_avx2(
+    latin1_t const* latin1, size_t latin1_len, size_t* latin1_index,
+    utf8_t* utf8,           size_t utf8_len,   size_t* utf8_index)
+{
+    size_t in = *latin1_index;
+    size_t out = *utf8_index;
+
+    while (in + AVX2_UTF8_LEN <= latin1_len && out + 2 * SSE41_UTF8_MAX_LEN <= utf8_len)
+    {
+        __m256i chunk = _mm256_loadu_si256((__m256i const*)(latin1 + in));
+
+        if (_mm256_movemask_epi8(chunk) == 0)
+        {
+            _mm256_storeu_si256((__m256i*)(utf8 + out), chunk);
+
+            in += AVX2_UTF8_LEN;
+            out += AVX2_UTF8_LEN;
+            continue;
+        }
+
+        // Only the low half is encoded, as two registers of UTF-16 characters,
+        // so the high half can still be copied if it's ASCII.
+        // The garbage is always overwritten, since the 16 characters of the high half are still
+        // converted after it and there's room for at least 32 more characters.
+        __m128i low = _mm256_castsi256_si128(chunk);
+        out += utf16_to_utf8_sse41_bmp(_mm_cvtepu8_epi16(low), utf8 + out, false);
+        out += utf16_to_utf8_sse41_bmp(_mm_cvtepu8_epi16(_mm_srli_si128(low, 8)), utf8 + out, false);
+        in += AVX2_MIXED_LEN;
+    }
+
+    *latin1_index = in;
+    *utf8_index = out;
+
+    latin1_to_utf8_sse41(latin1, latin1_len, latin1_index, utf8, utf8_len, utf8_index);
+}
+
+TARGET_AVX2 static void latin1_to_utf8_len_avx2(latin1_t const* latin1, size_t latin1_len, size_t* latin1_index, size_t* utf8_index)
+{
+    size_t in = *latin1_index;
+    size_t out = *utf8_index;
+
+    // Every character above U+007F takes one more byte
+    while (in + AVX2_UTF8_LEN <= latin1_len)
+    {
+        unsigned non_ascii = (unsigned)_mm256_movemask_epi8(_mm256_loadu_si256((__m256i const*)(latin1 + in)));
+        out += AVX2_UTF8_LEN + count_bits(non_ascii);
+
+        in += AVX2_UTF8_LEN;
+    }
+
+    *latin1_index = in;
+    *utf8_index = out;
+
+    latin1_to_utf8_len_sse2(latin1, latin1_len, latin1_index, utf8_index);
+}
+
+TARGET_AVX2 static void latin1_to_utf16_avx2(
+    latin1_t const* latin1, size_t latin1_len, size_t* latin1_index,
+    utf16_t* utf16,         size_t utf16_len,  size_t* utf16_index)
+{
+    size_t in = *latin1_index;
+    size_t out = *utf16_index;
+
+    while (in + AVX2_UTF8_LEN <= latin1_len && out + AVX2_UTF8_LEN <= utf16_len)
+    {
+        __m256i chunk = _mm256_loadu_si256((__m256i const*)(latin1 + in));
+
+        _mm256_storeu_si256((__m256i*)(utf16 + out), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(chunk)));
+        _mm256_storeu_si256((__m256i*)(utf16 + out + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(chunk, 1)));
+
+        in += AVX2_UTF8_LEN;
+        out += AVX2_UTF8_LEN;
+    }
+
+    *latin1_index = in;
+    *utf16_index = out;
+
+    latin1_to_utf16_sse2(latin1, latin1_len, latin1_index, utf16, utf16_len, utf16_index);
+}
+
+TARGET_AVX2 static void utf8_skip_latin1_avx2(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index)
+{
+    size_t in = *utf8_index;
+
+    __m256i const continuation_mask = _mm256_set1_epi8((char)UTF8_CONTINUATION_MASK);
+    __m256i const continuation_value = _mm256_set1_epi8((char)UTF8_CONTINUATION_VALUE);
+    __m256i const lead_mask = _mm256_set1_epi8((char)0xFE);
+    __m256i const lead_value = _mm256_set1_epi8((char)0xC2);
+
+    while (in + AVX2_UTF8_LEN <= utf8_len)
+    {
+        __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf8 + in));
+
+        uint32_t non_ascii = (uint32_t)_mm256_movemask_epi8(chunk);
+        if (non_ascii != 0)
+        {
+            uint32_t continuation = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(chunk, continuation_mask), continuation_value));
+            uint32_t lead = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(chunk, lead_mask), lead_value));
+
+            if (!is_latin1_utf8_block(non_ascii, lead, continuation, UINT32_C(1) << (AVX2_UTF8_LEN - 1)))
+                break;
+        }
+
+        in += AVX2_UTF8_LEN;
+    }
+
+    *utf8_index = in;
+
+    utf8_skip_latin1_sse2(utf8, utf8_len, utf8_index);
+}
+
+TARGET_AVX2 static void utf16_skip_latin1_avx2(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index)
+{
+    size_t in = *utf16_index;
+
+    __m256i const above_latin1 = _mm256_set1_epi16((short)0xFF00);
+
+    while (in + AVX2_UTF16_LEN <= utf16_len)
+    {
+        __m256i chunk = _mm256_loadu_si256((__m256i const*)(utf16 + in));
+        unsigned above = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(chunk, above_latin1), _mm256_setzero_si256()));
+
+        if (above != 0)
+        {
+            *utf16_index = in + count_trailing_zeros(above) / 2;
+            return;
+        }
+
+        in += AVX2_UTF16_LEN;
+    }
+
+    *utf16_index = in;
+
+    utf16_skip_latin1_sse2(utf16, utf16_len, utf16_index);
+}
+
+static simd_kernels const avx2_kernels =
+{
+    "avx2",
+    utf8_to_utf16_avx2,
+    utf16_to_utf8_avx2,
+    utf8_to_utf16_len_avx2,
+    utf16_to_utf8_len_avx2,
+    utf16_validate_avx2,
+    utf8_validate_avx2,
+    utf8_to_utf16_swapped_avx2,
+    utf16_swapped_to_utf8_avx2,
+    utf16_swapped_to_utf8_len_avx2,
+    utf8_to_utf32_avx2,
+    utf8_to_utf32_len_avx2,
+    utf16_to_utf32_avx2,
+    utf16_to_utf32_len_avx2,
+    utf32_to_utf8_avx2,
+    utf32_to_utf16_avx2,
+    utf8_skip_ascii_avx2,
+    utf16_skip_ascii_avx2,
+    utf8_to_latin1_avx2,
+    utf16_to_latin1_avx2,
+    latin1_to_utf8_avx2,
+    latin1_to_utf8_len_avx2,
+    latin1_to_utf16_avx2,
+    utf8_skip_latin1_avx2,
+    utf16_skip_latin1_avx2
+};
+
+
+// CPU detection
+
+#if defined(_MSC_VER) && !defined(__clang__)
+
+static bool cpu_has_sse2(void)
+{
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+}
+
+static bool cpu_has_sse41(void)
+{
+    int info[4];
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    bool popcnt = (info[2] & (1 << 23)) != 0;
+    return sse41 && popcnt;
+}
+
+static bool cpu_has_avx2(void)
+{
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    // The OS must save the AVX registers on context switches
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    bool popcnt = (info[2] & (1 << 23)) != 0;
+    if (!osxsave || !avx || !popcnt || (_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+
+#else
+
+static bool cpu_has_sse2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+static bool cpu_has_sse41(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("popcnt");
+}
+
+static bool cpu_has_avx2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+}
+
+#endif
+
+#endif // SIMD_X86
+
+// Picks the best kernels for the current CPU
+static simd_kernels const* select_kernels(void)
+{
+#ifdef SIMD_X86
+    if (cpu_has_avx2())
+        return &avx2_kernels;
+
+    if (cpu_has_sse41())
+        return &sse41_kernels;
+
+    if (cpu_has_sse2())
+        return &sse2_kernels;
+#endif
+
+    return &scalar_kernels;
+}
+
+#if defined(SIMD_HAS_ATOMICS)
+
+// The kernels chosen for the current CPU, or NULL if they haven't been chosen yet.
+// Racing threads all pick the same kernels, and the kernel sets are constants, so relaxed
+// atomic accesses are enough to keep the first calls from several threads race-free.
+static _Atomic(simd_kernels const*) active_kernels = NULL;
+
+simd_kernels const* simd_get_kernels(void)
+{
+    simd_kernels const* kernels = atomic_load_explicit(&active_kernels, memory_order_relaxed);
+    if (kernels == NULL)
+    {
+        kernels = select_kernels();
+        atomic_store_explicit(&active_kernels, kernels, memory_order_relaxed);
+    }
+
+    return kernels;
+}
+
+#else
+
+// Without atomics, the kernels can't be shared between threads, so they're chosen every time
+simd_kernels const* simd_get_kernels(void)
+{
+    return select_kernels();
+}
+
+#endif
@@ -0,0 +1,271 @@
+#pragma once
+#include <converter.h>
+
+// Vectorized kernels used by the conversion and validation functions.
+//
+// Every kernel converts as much as it can from the start of the input in bulk, stopping
+// as soon as it finds something it can't handle (invalid or uncommon encodings, the end
+// of the input or not enough space left on the output).
+// The caller is then expected to convert the next codepoint with the regular scalar code
+// and call the kernel again, so the results are always exactly the same as the scalar
+// conversion, invalid sequences included.
+// Validation kernels work the same way, skipping over input that they know is valid,
+// and so do the length kernels, only counting the characters that would be written.
+//
+// The best implementation for the current CPU is chosen the first time the kernels are
+// requested, with a portable scalar implementation used as fallback.
+
+// Forces a function to be inlined.
+// Kernel helpers targeting an older instruction set are then compiled with the instruction set
+// of their callers instead of mixing encodings, and the conversion loops are specialized for
+// the constant flags of each caller.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define ALWAYS_INLINE __forceinline
+#else
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#endif
+
+// A set of kernels that target the same instruction set
+typedef struct
+{
+    // The name of the instruction set, for diagnostics
+    char const* name;
+
+    // Converts the longest prefix of a UTF-8 string that the kernel can handle to UTF-16.
+    //
+    // utf8: The UTF-8 string
+    // utf8_len: The length of the UTF-8 string, in UTF-8 characters
+    // utf8_index: A pointer to the first unconverted index of the UTF-8 string, advanced past the converted characters
+    // utf16: The UTF-16 string, not NULL
+    // utf16_len: The length of the UTF-16 string, in UTF-16 characters
+    // utf16_index: A pointer to the first empty index of the UTF-16 string, advanced past the written characters
+    void (*utf8_to_utf16)(
+        utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+        utf16_t* utf16,     size_t utf16_len, size_t* utf16_index
+    );
+
+    // Converts the longest prefix of a UTF-16 string that the kernel can handle to UTF-8.
+    //
+    // utf16: The UTF-16 string
+    // utf16_len: The length of the UTF-16 string, in UTF-16 characters
+    // utf16_index: A pointer to the first unconverted index of the UTF-16 string, advanced past the converted characters
+    // utf8: The UTF-8 string, not NULL
+    // utf8_len: The length of the UTF-8 string, in UTF-8 characters
+    // utf8_index: A pointer to the first empty index of the UTF-8 string, advanced past the written characters
+    void (*utf16_to_utf8)(
+        utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+        utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index
+    );
+
+    // Counts the UTF-16 characters that the longest prefix of a UTF-8 string that the kernel can handle converts to.
+    //
+    // utf8: The UTF-8 string
+    // utf8_len: The length of the UTF-8 string, in UTF-8 characters
+    // utf8_index: A pointer to the first uncounted index of the UTF-8 string, advanced past the counted characters
+    // utf16_index: A pointer to the number of UTF-16 characters counted so far, increased by the counted characters
+    void (*utf8_to_utf16_len)(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index, size_t* utf16_index);
+
+    // Counts the UTF-8 characters that the longest prefix of a UTF-16 string that the kernel can handle converts to.
+    //
+    // utf16: The UTF-16 string
+    // utf16_len: The length of the UTF-16 string, in UTF-16 characters
+    // utf16_index: A pointer to the first uncounted index of the UTF-16 string, advanced past the counted characters
+    // utf8_index: A pointer to the number of UTF-8 characters counted so far, increased by the counted characters
+    void (*utf16_to_utf8_len)(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index, size_t* utf8_index);
+
+    // Skips the longest prefix of a UTF-16 string that the kernel can tell is valid.
+    // The index is always left at a codepoint boundary.
+    //
+    // utf16: The UTF-16 string
+    // utf16_len: The length of the UTF-16 string, in UTF-16 characters
+    // utf16_index: A pointer to the first unchecked index of the UTF-16 string, at a codepoint boundary, advanced past the valid characters
+    void (*utf16_validate)(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index);
+
+    // Skips the longest prefix of a UTF-8 string that the kernel can tell is valid.
+    // The index is always left at a codepoint boundary.
+    //
+    // utf8: The UTF-8 string
+    // utf8_len: The length of the UTF-8 string, in UTF-8 characters
+    // utf8_index: A pointer to the first unchecked index of the UTF-8 string, at a codepoint boundary, advanced past the valid characters
+    void (*utf8_validate)(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index);
+
+    // The same as utf8_to_utf16, but writes every UTF-16 character with its bytes swapped.
+    // Used to write the byte order that isn't native to the CPU.
+    void (*utf8_to_utf16_swapped)(
+        utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+        utf16_t* utf16,     size_t utf16_len, size_t* utf16_index
+    );
+
+    // The same as utf16_to_utf8, but reads every UTF-16 character with its bytes swapped.
+    // Used to read the byte order that isn't native to the CPU.
+    void (*utf16_swapped_to_utf8)(
+        utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+        utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index
+    );
+
+    // The same as utf16_to_utf8_len, but reads every UTF-16 character with its bytes swapped.
+    // There's no swapped version of utf8_to_utf16_len, since the byte order doesn't change the length.
+    void (*utf16_swapped_to_utf8_len)(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index, size_t* utf8_index);
+
+    // Converts the longest prefix of a UTF-8 string that the kernel can handle to UTF-32.
+    //
+    // utf8: The UTF-8 string
+    // utf8_len: The length of the UTF-8 string, in UTF-8 characters
+    // utf8_index: A pointer to the first unconverted index of the UTF-8 string, advanced past the converted characters
+    // utf32: The UTF-32 string, not NULL
+    // utf32_len: The length of the UTF-32 string, in UTF-32 characters
+    // utf32_index: A pointer to the first empty index of the UTF-32 string, advanced past the written characters
+    void (*utf8_to_utf32)(
+        utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+        utf32_t* utf32,     size_t utf32_len, size_t* utf32_index
+    );
+
+    // Counts the UTF-32 characters that the longest prefix of a UTF-8 string that the kernel can handle converts to.
+    //
+    // utf8: The UTF-8 string
+    // utf8_len: The length of the UTF-8 string, in UTF-8 characters
+    // utf8_index: A pointer to the first uncounted index of the UTF-8 string, advanced past the counted characters
+    // utf32_index: A pointer to the number of UTF-32 characters counted so far, increased by the counted characters
+    void (*utf8_to_utf32_len)(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index, size_t* utf32_index);
+
+    // Converts the longest prefix of a UTF-16 string that the kernel can handle to UTF-32.
+    //
+    // utf16: The UTF-16 string
+    // utf16_len: The length of the UTF-16 string, in UTF-16 characters
+    // utf16_index: A pointer to the first unconverted index of the UTF-16 string, advanced past the converted characters
+    // utf32: The UTF-32 string, not NULL
+    // utf32_len: The length of the UTF-32 string, in UTF-32 characters
+    // utf32_index: A pointer to the first empty index of the UTF-32 string, advanced past the written characters
+    void (*utf16_to_utf32)(
+        utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+        utf32_t* utf32,       size_t utf32_len, size_t* utf32_index
+    );
+
+    // Counts the UTF-32 characters that the longest prefix of a UTF-16 string that the kernel can handle converts to.
+    //
+    // utf16: The UTF-16 string
+    // utf16_len: The length of the UTF-16 string, in UTF-16 characters
+    // utf16_index: A pointer to the first uncounted index of the UTF-16 string, advanced past the counted characters
+    // utf32_index: A pointer to the number of UTF-32 characters counted so far, increased by the counted characters
+    void (*utf16_to_utf32_len)(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index, size_t* utf32_index);
+
+    // Converts the longest prefix of a UTF-32 string that the kernel can handle to UTF-8.
+    //
+    // utf32: The UTF-32 string
+    // utf32_len: The length of the UTF-32 string, in UTF-32 characters
+    // utf32_index: A pointer to the first unconverted index of the UTF-32 string, advanced past the converted characters
+    // utf8: The UTF-8 string, not NULL
+    // utf8_len: The length of the UTF-8 string, in UTF-8 characters
+    // utf8_index: A pointer to the first empty index of the UTF-8 string, advanced past the written characters
+    void (*utf32_to_utf8)(
+        utf32_t const* utf32, size_t utf32_len, size_t* utf32_index,
+        utf8_t* utf8,         size_t utf8_len,  size_t* utf8_index
+    );
+
+    // Converts the longest prefix of a UTF-32 string that the kernel can handle to UTF-16.
+    //
+    // utf32: The UTF-32 string
+    // utf32_len: The length of the UTF-32 string, in UTF-32 characters
+    // utf32_index: A pointer to the first unconverted index of the UTF-32 string, advanced past the converted characters
+    // utf16: The UTF-16 string, not NULL
+    // utf16_len: The length of the UTF-16 string, in UTF-16 characters
+    // utf16_index: A pointer to the first empty index of the UTF-16 string, advanced past the written characters
+    void (*utf32_to_utf16)(
+        utf32_t const* utf32, size_t utf32_len, size_t* utf32_index,
+        utf16_t* utf16,       size_t utf16_len, size_t* utf16_index
+    );
+
+    // Skips the longest prefix of ASCII characters of a UTF-8 string that the kernel can find.
+    //
+    // utf8: The UTF-8 string
+    // utf8_len: The length of the UTF-8 string, in UTF-8 characters
+    // utf8_index: A pointer to the first unchecked index of the UTF-8 string, advanced past the ASCII characters
+    void (*utf8_skip_ascii)(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index);
+
+    // Skips the longest prefix of ASCII characters of a UTF-16 string that the kernel can find.
+    //
+    // utf16: The UTF-16 string
+    // utf16_len: The length of the UTF-16 string, in UTF-16 characters
+    // utf16_index: A pointer to the first unchecked index of the UTF-16 string, advanced past the ASCII characters
+    void (*utf16_skip_ascii)(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index);
+
+    // Converts the longest prefix of a UTF-8 string that the kernel can handle to Latin-1.
+    // Only codepoints up to U+00FF are converted, anything else is left for the scalar code.
+    //
+    // utf8: The UTF-8 string
+    // utf8_len: The length of the UTF-8 string, in UTF-8 characters
+    // utf8_index: A pointer to the first unconverted index of the UTF-8 string, advanced past the converted characters
+    // latin1: The Latin-1 string, not NULL
+    // latin1_len: The length of the Latin-1 string, in Latin-1 characters
+    // latin1_index: A pointer to the first empty index of the Latin-1 string, advanced past the written characters
+    void (*utf8_to_latin1)(
+        utf8_t const* utf8, size_t utf8_len, size_t* utf8_index,
+        latin1_t* latin1,   size_t latin1_len, size_t* latin1_index
+    );
+
+    // Converts the longest prefix of a UTF-16 string that the kernel can handle to Latin-1.
+    // Only characters up to U+00FF are converted, anything else is left for the scalar code.
+    //
+    // utf16: The UTF-16 string
+    // utf16_len: The length of the UTF-16 string, in UTF-16 characters
+    // utf16_index: A pointer to the first unconverted index of the UTF-16 string, advanced past the converted characters
+    // latin1: The Latin-1 string, not NULL
+    // latin1_len: The length of the Latin-1 string, in Latin-1 characters
+    // latin1_index: A pointer to the first empty index of the Latin-1 string, advanced past the written characters
+    void (*utf16_to_latin1)(
+        utf16_t const* utf16, size_t utf16_len, size_t* utf16_index,
+        latin1_t* latin1,     size_t latin1_len, size_t* latin1_index
+    );
+
+    // Converts the longest prefix of a Latin-1 string that the kernel can handle to UTF-8.
+    //
+    // latin1: The Latin-1 string
+    // latin1_len: The length of the Latin-1 string, in Latin-1 characters
+    // latin1_index: A pointer to the first unconverted index of the Latin-1 string, advanced past the converted characters
+    // utf8: The UTF-8 string, not NULL
+    // utf8_len: The length of the UTF-8 string, in UTF-8 characters
+    // utf8_index: A pointer to the first empty index of the UTF-8 string, advanced past the written characters
+    void (*latin1_to_utf8)(
+        latin1_t const* latin1, size_t latin1_len, size_t* latin1_index,
+        utf8_t* utf8,           size_t utf8_len,   size_t* utf8_index
+    );
+
+    // Counts the UTF-8 characters that the longest prefix of a Latin-1 string that the kernel can handle converts to.
+    //
+    // latin1: The Latin-1 string
+    // latin1_len: The length of the Latin-1 string, in Latin-1 characters
+    // latin1_index: A pointer to the first uncounted index of the Latin-1 string, advanced past the counted characters
+    // utf8_index: A pointer to the number of UTF-8 characters counted so far, increased by the counted characters
+    void (*latin1_to_utf8_len)(latin1_t const* latin1, size_t latin1_len, size_t* latin1_index, size_t* utf8_index);
+
+    // Converts the longest prefix of a Latin-1 string that the kernel can handle to UTF-16.
+    //
+    // latin1: The Latin-1 string
+    // latin1_len: The length of the Latin-1 string, in Latin-1 characters
+    // latin1_index: A pointer to the first unconverted index of the Latin-1 string, advanced past the converted characters
+    // utf16: The UTF-16 string, not NULL
+    // utf16_len: The length of the UTF-16 string, in UTF-16 characters
+    // utf16_index: A pointer to the first empty index of the UTF-16 string, advanced past the written characters
+    void (*latin1_to_utf16)(
+        latin1_t const* latin1, size_t latin1_len, size_t* latin1_index,
+        utf16_t* utf16,         size_t utf16_len,  size_t* utf16_index
+    );
+
+    // Skips the longest prefix of a UTF-8 string that the kernel can tell is valid and only
+    // has codepoints up to U+00FF. The index is always left at a codepoint boundary.
+    //
+    // utf8: The UTF-8 string
+    // utf8_len: The length of the UTF-8 string, in UTF-8 characters
+    // utf8_index: A pointer to the first unchecked index of the UTF-8 string, at a codepoint boundary, advanced past the checked characters
+    void (*utf8_skip_latin1)(utf8_t const* utf8, size_t utf8_len, size_t* utf8_index);
+
+    // Skips the longest prefix of characters up to U+00FF of a UTF-16 string that the kernel can find.
+    //
+    // utf16: The UTF-16 string
+    // utf16_len: The length of the UTF-16 string, in UTF-16 characters
+    // utf16_index: A pointer to the first unchecked index of the UTF-16 string, advanced past the checked characters
+    void (*utf16_skip_latin1)(utf16_t const* utf16, size_t utf16_len, size_t* utf16_index);
+} simd_kernels;
+
+// Gets the kernels that should be used on the current CPU
+simd_kernels const* simd_get_kernels(void);
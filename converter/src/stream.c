@@ -0,0 +1,150 @@
+#include <converter.h>
+#include <stdbool.h>
+#include "unicode.h"
+
+// Streaming conversion is built on top of the one-shot conversion functions.
+// Every chunk is converted all at once, except for a codepoint that is cut off at its end:
+// its characters are kept in the stream and completed with the start of the next chunk.
+// Since the decoders only look at the characters of the codepoint they're decoding,
+// this gives exactly the same output as converting the whole stream at once.
+
+void utf8_to_utf16_stream_init(utf8_to_utf16_stream* stream)
+{
+    stream->pending_len = 0;
+}
+
+size_t utf8_to_utf16_stream_bound(size_t utf8_len)
+{
+    // The pending characters of the last chunk are converted along with this one
+    return utf8_to_utf16_bound(utf8_len + UTF8_MAX_LEN - 1);
+}
+
+size_t utf8_to_utf16_stream_feed(
+    utf8_to_utf16_stream* stream,
+    utf8_t const* utf8, size_t utf8_len,
+    utf16_t* utf16,     size_t utf16_len)
+{
+    size_t utf8_index = 0;
+    size_t utf16_index = 0;
+
+    // Complete the codepoint that was cut off at the end of the last chunk
+    if (stream->pending_len > 0)
+    {
+        int encoding_len = utf8_sequence_len(stream->pending[0]);
+
+        while (stream->pending_len < encoding_len && utf8_index < utf8_len && is_utf8_continuation(utf8[utf8_index]))
+        {
+            stream->pending[stream->pending_len] = utf8[utf8_index];
+            stream->pending_len++;
+            utf8_index++;
+        }
+
+        // The whole chunk continues the codepoint, and it's still not complete
+        if (stream->pending_len < encoding_len && utf8_index == utf8_len)
+            return 0;
+
+        // Either complete or interrupted by a character that isn't a continuation byte,
+        // which makes it invalid just as if it had been converted in one go
+        utf16_index += utf8_to_utf16(stream->pending, stream->pending_len, utf16, utf16_len);
+        stream->pending_len = 0;
+    }
+
+    // Look for a codepoint that is cut off at the end of the chunk.
+    // Only the last UTF8_MAX_LEN - 1 characters can be part of one.
+    size_t end = utf8_len;
+    for (size_t index = utf8_len; index > utf8_index && utf8_len - index < UTF8_MAX_LEN - 1; )
+    {
+        index--;
+
+        if (is_utf8_continuation(utf8[index]))
+            continue;
+
+        // Every character that isn't a continuation byte starts a new codepoint
+        if (index + utf8_sequence_len(utf8[index]) > utf8_len)
+            end = index;
+
+        break;
+    }
+
+    utf16_index += utf8_to_utf16(utf8 + utf8_index, end - utf8_index, utf16 + utf16_index, utf16_len - utf16_index);
+
+    for (size_t index = end; index < utf8_len; index++)
+    {
+        stream->pending[stream->pending_len] = utf8[index];
+        stream->pending_len++;
+    }
+
+    return utf16_index;
+}
+
+size_t utf8_to_utf16_stream_finish(utf8_to_utf16_stream* stream, utf16_t* utf16, size_t utf16_len)
+{
+    // The stream ended in the middle of a codepoint, which is invalid
+    size_t written = utf8_to_utf16(stream->pending, stream->pending_len, utf16, utf16_len);
+    stream->pending_len = 0;
+
+    return written;
+}
+
+void utf16_to_utf8_stream_init(utf16_to_utf8_stream* stream)
+{
+    stream->pending_len = 0;
+}
+
+size_t utf16_to_utf8_stream_bound(size_t utf16_len)
+{
+    // The pending high surrogate of the last chunk is converted along with this one
+    return utf16_to_utf8_bound(utf16_len + 1);
+}
+
+size_t utf16_to_utf8_stream_feed(
+    utf16_to_utf8_stream* stream,
+    utf16_t const* utf16, size_t utf16_len,
+    utf8_t* utf8,         size_t utf8_len)
+{
+    size_t utf16_index = 0;
+    size_t utf8_index = 0;
+
+    if (utf16_len == 0)
+        return 0;
+
+    // Pair the high surrogate at the end of the last chunk with the start of this one
+    if (stream->pending_len > 0)
+    {
+        utf16_t pair[2] = { stream->pending, utf16[0] };
+
+        if ((utf16[0] & SURROGATE_MASK) == LOW_SURROGATE_VALUE)
+        {
+            utf8_index += utf16_to_utf8(pair, 2, utf8, utf8_len);
+            utf16_index++;
+        }
+        else
+        {
+            utf8_index += utf16_to_utf8(pair, 1, utf8, utf8_len);
+        }
+
+        stream->pending_len = 0;
+    }
+
+    // A high surrogate at the end of the chunk may be paired with the start of the next one
+    size_t end = utf16_len;
+    if (end > utf16_index && is_high_surrogate(utf16[end - 1]))
+    {
+        end--;
+        stream->pending = utf16[end];
+        stream->pending_len = 1;
+    }
+
+    utf8_index += utf16_to_utf8(utf16 + utf16_index, end - utf16_index, utf8 + utf8_index, utf8_len - utf8_index);
+
+    return utf8_index;
+}
+
+size_t utf16_to_utf8_stream_finish(utf16_to_utf8_stream* stream, utf8_t* utf8, size_t utf8_len)
+{
+    // The stream ended with an unmatched high surrogate, which is invalid
+    size_t written = utf16_to_utf8(&stream->pending, stream->pending_len, utf8, utf8_len);
+    stream->pending_len = 0;
+
+    return written;
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The type of a single Unicode codepoint
+typedef uint32_t codepoint_t;
+
+// The last codepoint of the Basic Multilingual Plane, which is the part of Unicode that
+// UTF-16 can encode without surrogates
+#define BMP_END 0xFFFF
+
+// The highest valid Unicode codepoint
+#define UNICODE_MAX 0x10FFFF
+
+// The codepoint that is used to replace invalid encodings
+#define INVALID_CODEPOINT 0xFFFD
+
+// The highest codepoint that can be encoded in Latin-1, where every character is the codepoint itself
+#define LATIN1_MAX 0xFF
+
+// The Latin-1 character that is used to replace codepoints that Latin-1 can't encode, '?'.
+// Latin-1 has no equivalent of INVALID_CODEPOINT, so this is the usual substitute.
+#define LATIN1_REPLACEMENT 0x3F
+
+// The codepoint of the byte order mark, which UTF-16 strings can start with to tell their byte order
+#define BYTE_ORDER_MARK 0xFEFF
+// What BYTE_ORDER_MARK looks like when its bytes are swapped, which is never a valid codepoint
+#define SWAPPED_BYTE_ORDER_MARK 0xFFFE
+
+// If a character, masked with GENERIC_SURROGATE_MASK, matches this value, it is a surrogate.
+#define GENERIC_SURROGATE_VALUE 0xD800
+// The mask to apply to a character before testing it against GENERIC_SURROGATE_VALUE
+#define GENERIC_SURROGATE_MASK 0xF800
+
+// If a character, masked with SURROGATE_MASK, matches this value, it is a high surrogate.
+#define HIGH_SURROGATE_VALUE 0xD800
+// If a character, masked with SURROGATE_MASK, matches this value, it is a low surrogate.
+#define LOW_SURROGATE_VALUE 0xDC00
+// The mask to apply to a character before testing it against HIGH_SURROGATE_VALUE or LOW_SURROGATE_VALUE
+#define SURROGATE_MASK 0xFC00
+
+// The value that is subtracted from a codepoint before encoding it in a surrogate pair
+#define SURROGATE_CODEPOINT_OFFSET 0x10000
+// A mask that can be applied to a surrogate to extract the codepoint value contained in it
+#define SURROGATE_CODEPOINT_MASK 0x03FF
+// The number of bits of SURROGATE_CODEPOINT_MASK
+#define SURROGATE_CODEPOINT_BITS 10
+
+
+// The highest codepoint that can be encoded with 1 byte in UTF-8
+#define UTF8_1_MAX 0x7F
+// The highest codepoint that can be encoded with 2 bytes in UTF-8
+#define UTF8_2_MAX 0x7FF
+// The highest codepoint that can be encoded with 3 bytes in UTF-8
+#define UTF8_3_MAX 0xFFFF
+// The highest codepoint that can be encoded with 4 bytes in UTF-8
+#define UTF8_4_MAX 0x10FFFF
+
+// If a character, masked with UTF8_CONTINUATION_MASK, matches this value, it is a UTF-8 continuation byte
+#define UTF8_CONTINUATION_VALUE 0x80
+// The mask to a apply to a character before testing it against UTF8_CONTINUATION_VALUE
+#define UTF8_CONTINUATION_MASK 0xC0
+// The number of bits of a codepoint that are contained in a UTF-8 continuation byte
+#define UTF8_CONTINUATION_CODEPOINT_BITS 6
+
+// The maximum number of UTF-8 characters in a single encoded codepoint
+#define UTF8_MAX_LEN 4
+
+// Gets the number of UTF-8 characters that a sequence advertises in its leading byte,
+// or 0 if the character can't start a sequence (continuation bytes, 0xF8 and above)
+static inline int utf8_sequence_len(uint8_t leading)
+{
+    if (leading < 0x80)
+        return 1;
+
+    if (leading < 0xC0)
+        return 0;
+
+    if (leading < 0xE0)
+        return 2;
+
+    if (leading < 0xF0)
+        return 3;
+
+    if (leading < 0xF8)
+        return 4;
+
+    return 0;
+}
+
+// Checks if a UTF-8 character is a continuation byte
+static inline bool is_utf8_continuation(uint8_t character)
+{
+    return (character & UTF8_CONTINUATION_MASK) == UTF8_CONTINUATION_VALUE;
+}
+
+// Checks if a UTF-16 character is a high surrogate
+static inline bool is_high_surrogate(uint16_t character)
+{
+    return (character & SURROGATE_MASK) == HIGH_SURROGATE_VALUE;
+}
+
+// Swaps the bytes of a UTF-16 character, converting it between little and big endian
+static inline uint16_t swap_utf16(uint16_t character)
+{
+    return (uint16_t)((character << 8) | (character >> 8));
+}
+
+// Finds the first codepoint boundary of a UTF-8 string at or after an index.
+//
+// Every character that isn't a continuation byte starts a codepoint, and since a codepoint
+// has at most UTF8_MAX_LEN - 1 continuation bytes, any continuation byte after that many others
+// is a rogue one that starts a codepoint of its own.
+static inline size_t find_utf8_boundary(uint8_t const* utf8, size_t len, size_t index)
+{
+    for (int skipped = 0; skipped < UTF8_MAX_LEN - 1 && index < len; skipped++)
+    {
+        if (!is_utf8_continuation(utf8[index]))
+            break;
+
+        index++;
+    }
+
+    return index;
+}
+
+// Finds the first codepoint boundary of a UTF-16 string at or after an index,
+// which is the index itself unless it would split a surrogate pair.
+static inline size_t find_utf16_boundary(uint16_t const* utf16, size_t len, size_t index)
+{
+    if (index > 0 && index < len && is_high_surrogate(utf16[index - 1]) && (utf16[index] & SURROGATE_MASK) == LOW_SURROGATE_VALUE)
+        index++;
+
+    return index;
+}
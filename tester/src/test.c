@@ -3,9 +3,6 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdint.h>
-#include <time.h>
-#include <math.h>
-#include <inttypes.h>
 
 #include "converter.h"
 
@@ -55,39 +52,6 @@ static void print_size(size_t size)
     printf("%zu %s", size, suffixes[suffix]);
 }
 
-// Prints a precise human-readable time to stdout
-// seconds: The time to print, in seconds
-static void print_time(double seconds)
-{
-    static char const* const suffixes[] =
-    {
-        "ns",
-        "us",
-        "ms",
-        "s"
-    };
-    static size_t const suffixes_len = sizeof suffixes / sizeof suffixes[0];
-
-    uint64_t nanos = (uint64_t)(seconds * 1e9);
-
-    bool any_printed = false;
-
-    size_t suffix = suffixes_len;
-    while (suffix-- > 0)
-    {
-        uint64_t unit = nanos / (uint64_t)pow(1000.0, suffix);
-
-        if (suffix < suffixes_len - 1)
-            unit %= 1000;
-
-        if (unit > 0 || (suffix == 0 && !any_printed))
-        {
-            any_printed = true;
-            printf("%"PRIu64"%s ", unit, suffixes[suffix]);
-        }
-    }
-}
-
 // Opens a file and reads its contents fully
 //
 // path: The path of the file to be read
@@ -181,6 +145,1309 @@ static bool write_file(char const* path, char const* buffer, size_t len)
     return true;
 }
 
+// The size of the output buffer used when testing resumable conversions, in characters.
+// Small enough to be filled many times, large enough to let the vectorized code run.
+#define PARTIAL_BUFFER_LEN 37
+
+// Converts a string again with the resumable conversion functions, flushing a small
+// output buffer every time it gets full, and checks that the result is the same
+//
+// is_utf8: If the input is in UTF-8
+// input: The input string
+// input_len: Length of 'input', in bytes
+// output: The result of converting the input all at once
+// output_len: Length of 'output', in bytes
+//
+// return: If the resumable conversion gave the same result
+static bool check_partial(bool is_utf8, char const* input, size_t input_len, char const* output, size_t output_len)
+{
+    size_t char_size = is_utf8 ? sizeof(utf16_t) : sizeof(utf8_t);
+    size_t input_char_size = is_utf8 ? sizeof(utf8_t) : sizeof(utf16_t);
+    size_t input_chars = input_len / input_char_size;
+
+    utf16_t buffer[PARTIAL_BUFFER_LEN];
+    size_t input_index = 0;
+    size_t output_index = 0;
+
+    while (input_index < input_chars)
+    {
+        size_t read;
+        size_t written;
+        if (is_utf8)
+            written = utf8_to_utf16_partial((utf8_t const*)input + input_index, input_chars - input_index, buffer, PARTIAL_BUFFER_LEN, &read);
+        else
+            written = utf16_to_utf8_partial((utf16_t const*)input + input_index, input_chars - input_index, (utf8_t*)buffer, PARTIAL_BUFFER_LEN, &read);
+
+        written *= char_size;
+        if (read == 0 || output_index + written > output_len || memcmp(output + output_index, buffer, written) != 0)
+        {
+            fprintf(stderr, "Resumable conversion differs from the full conversion at input index %zu", input_index);
+            return false;
+        }
+
+        input_index += read;
+        output_index += written;
+    }
+
+    if (output_index != output_len)
+    {
+        fprintf(stderr, "Resumable conversion wrote %zu bytes instead of %zu", output_index, output_len);
+        return false;
+    }
+
+    return true;
+}
+
+// The maximum size of the chunks fed to streams when testing streaming conversions, in characters.
+// Chunk sizes cycle from 1 up to this, so codepoints get cut off at every possible point.
+#define STREAM_MAX_CHUNK_LEN 7
+
+// Converts a string again with the streaming conversion functions, feeding it in small chunks,
+// and checks that the result is the same
+//
+// is_utf8: If the input is in UTF-8
+// input: The input string
+// input_len: Length of 'input', in bytes
+// output: The result of converting the input all at once
+// output_len: Length of 'output', in bytes
+//
+// return: If the streaming conversion gave the same result
+static bool check_stream(bool is_utf8, char const* input, size_t input_len, char const* output, size_t output_len)
+{
+    size_t char_size = is_utf8 ? sizeof(utf16_t) : sizeof(utf8_t);
+    size_t input_char_size = is_utf8 ? sizeof(utf8_t) : sizeof(utf16_t);
+    size_t input_chars = input_len / input_char_size;
+
+    utf8_to_utf16_stream utf8_stream;
+    utf16_to_utf8_stream utf16_stream;
+    utf8_to_utf16_stream_init(&utf8_stream);
+    utf16_to_utf8_stream_init(&utf16_stream);
+
+    utf16_t buffer[STREAM_MAX_CHUNK_LEN * 3 + 3];
+    size_t buffer_len = sizeof buffer / char_size;
+    size_t input_index = 0;
+    size_t output_index = 0;
+    size_t chunk_len = 0;
+
+    while (true)
+    {
+        bool finished = input_index >= input_chars;
+
+        chunk_len = chunk_len % STREAM_MAX_CHUNK_LEN + 1;
+        if (chunk_len > input_chars - input_index)
+            chunk_len = input_chars - input_index;
+
+        size_t written;
+        if (finished && is_utf8)
+            written = utf8_to_utf16_stream_finish(&utf8_stream, buffer, buffer_len);
+        else if (finished)
+            written = utf16_to_utf8_stream_finish(&utf16_stream, (utf8_t*)buffer, buffer_len);
+        else if (is_utf8)
+            written = utf8_to_utf16_stream_feed(&utf8_stream, (utf8_t const*)input + input_index, chunk_len, buffer, buffer_len);
+        else
+            written = utf16_to_utf8_stream_feed(&utf16_stream, (utf16_t const*)input + input_index, chunk_len, (utf8_t*)buffer, buffer_len);
+
+        written *= char_size;
+        if (output_index + written > output_len || memcmp(output + output_index, buffer, written) != 0)
+        {
+            fprintf(stderr, "Streaming conversion differs from the full conversion at input index %zu", input_index);
+            return false;
+        }
+
+        output_index += written;
+        input_index += chunk_len;
+
+        if (finished)
+            break;
+    }
+
+    if (output_index != output_len)
+    {
+        fprintf(stderr, "Streaming conversion wrote %zu bytes instead of %zu", output_index, output_len);
+        return false;
+    }
+
+    return true;
+}
+
+// The number of threads used when testing parallel conversions
+#define PARALLEL_THREAD_COUNT 4
+
+// Converts a string again with the parallel conversion functions, and checks that the result is the same
+//
+// is_utf8: If the input is in UTF-8
+// input: The input string
+// input_len: Length of 'input', in bytes
+// output: The result of converting the input sequentially
+// output_len: Length of 'output', in bytes
+//
+// return: If the parallel conversion gave the same result
+static bool check_parallel(bool is_utf8, char const* input, size_t input_len, char const* output, size_t output_len)
+{
+    char* parallel_output = malloc(output_len);
+    if (parallel_output == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory to test parallel conversion");
+        return false;
+    }
+
+    size_t parallel_len;
+    if (is_utf8)
+        parallel_len = sizeof(utf16_t) * utf8_to_utf16_parallel((utf8_t const*)input, input_len / sizeof(utf8_t), (utf16_t*)parallel_output, output_len / sizeof(utf16_t), PARALLEL_THREAD_COUNT, NULL, NULL);
+    else
+        parallel_len = sizeof(utf8_t) * utf16_to_utf8_parallel((utf16_t const*)input, input_len / sizeof(utf16_t), (utf8_t*)parallel_output, output_len / sizeof(utf8_t), PARALLEL_THREAD_COUNT, NULL, NULL);
+
+    bool success = parallel_len == output_len && memcmp(parallel_output, output, output_len) == 0;
+    free(parallel_output);
+
+    if (!success)
+        fprintf(stderr, "Parallel conversion differs from the sequential conversion");
+
+    return success;
+}
+
+// Validates a string, and checks that the result agrees with the conversion.
+// The input is well-formed exactly when converting the output back gives the input again,
+// since every replaced sequence is different from the U+FFFD that replaces it.
+//
+// is_utf8: If the input is in UTF-8
+// input: The input string
+// input_len: Length of 'input', in bytes
+// output: The result of converting the input
+// output_len: Length of 'output', in bytes
+//
+// return: If the validation agreed with the conversion
+static bool check_validate(bool is_utf8, char const* input, size_t input_len, char const* output, size_t output_len)
+{
+    char* round_trip = malloc(input_len);
+    if (round_trip == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory to test validation");
+        return false;
+    }
+
+    size_t round_trip_len;
+    size_t error_index;
+    size_t prefix_error_index;
+    bool valid;
+    bool prefix_valid;
+    if (is_utf8)
+    {
+        round_trip_len = sizeof(utf8_t) * utf16_to_utf8((utf16_t const*)output, output_len / sizeof(utf16_t), (utf8_t*)round_trip, input_len / sizeof(utf8_t));
+        valid = utf8_validate((utf8_t const*)input, input_len / sizeof(utf8_t), &error_index);
+        prefix_valid = utf8_validate((utf8_t const*)input, error_index, &prefix_error_index);
+    }
+    else
+    {
+        round_trip_len = sizeof(utf16_t) * utf8_to_utf16((utf8_t const*)output, output_len / sizeof(utf8_t), (utf16_t*)round_trip, input_len / sizeof(utf16_t));
+        valid = utf16_validate((utf16_t const*)input, input_len / sizeof(utf16_t), &error_index);
+        prefix_valid = utf16_validate((utf16_t const*)input, error_index, &prefix_error_index);
+    }
+
+    bool expected_valid = round_trip_len == input_len && memcmp(round_trip, input, input_len) == 0;
+    free(round_trip);
+
+    if (valid != expected_valid)
+    {
+        fprintf(stderr, "Validation says the input is %s, but the conversion says otherwise", valid ? "well-formed" : "ill-formed");
+        return false;
+    }
+
+    size_t input_chars = input_len / (is_utf8 ? sizeof(utf8_t) : sizeof(utf16_t));
+    if (valid != (error_index == input_chars) || !prefix_valid || prefix_error_index != error_index)
+    {
+        fprintf(stderr, "Validation reported an inconsistent error index %zu", error_index);
+        return false;
+    }
+
+    return true;
+}
+
+// Converts a well-formed input again with the unchecked conversion, which must give the same output.
+// Ill-formed inputs break the precondition of the unchecked conversion, so they're not checked.
+//
+// is_utf8: If the input is in UTF-8
+// input: The input string
+// input_len: Length of 'input', in bytes
+// output: The result of converting the input
+// output_len: Length of 'output', in bytes
+//
+// return: If the unchecked conversion gave the same result
+static bool check_unchecked(bool is_utf8, char const* input, size_t input_len, char const* output, size_t output_len)
+{
+    utf8_t const* utf8 = (utf8_t const*)input;
+    utf16_t const* utf16 = (utf16_t const*)input;
+    size_t utf8_len = input_len / sizeof(utf8_t);
+    size_t utf16_len = input_len / sizeof(utf16_t);
+
+    bool valid = is_utf8 ? utf8_validate(utf8, utf8_len, NULL) : utf16_validate(utf16, utf16_len, NULL);
+    if (!valid)
+        return true;
+
+    size_t bound = is_utf8 ? utf8_to_utf16_bound(utf8_len) * sizeof(utf16_t) : utf16_to_utf8_bound(utf16_len) * sizeof(utf8_t);
+    char* converted = malloc(bound + 1);
+    if (converted == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory to test the unchecked conversion");
+        return false;
+    }
+
+    size_t converted_len = is_utf8
+        ? utf8_to_utf16_unchecked(utf8, utf8_len, (utf16_t*)converted) * sizeof(utf16_t)
+        : utf16_to_utf8_unchecked(utf16, utf16_len, (utf8_t*)converted) * sizeof(utf8_t);
+
+    bool success = converted_len == output_len && memcmp(converted, output, output_len) == 0;
+    free(converted);
+
+    if (!success)
+        fprintf(stderr, "Unchecked conversion differs from the regular conversion");
+
+    return success;
+}
+
+// Converts the input again while counting statistics, and checks that the conversion is the same
+// and that the counts add up to the sizes of the input and the output
+//
+// is_utf8: If the input is in UTF-8
+// input: The input string
+// input_len: Length of 'input', in bytes
+// output: The result of converting the input
+// output_len: Length of 'output', in bytes
+//
+// return: If the statistics are consistent with the conversion
+static bool check_stats(bool is_utf8, char const* input, size_t input_len, char const* output, size_t output_len)
+{
+    char* converted = malloc(output_len + 1);
+    if (converted == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory to test statistics");
+        return false;
+    }
+
+    conversion_stats stats = { 0 };
+    size_t converted_len;
+    size_t input_chars;
+    if (is_utf8)
+    {
+        input_chars = input_len / sizeof(utf8_t);
+        converted_len = sizeof(utf16_t) * utf8_to_utf16_with_stats((utf8_t const*)input, input_chars, (utf16_t*)converted, output_len / sizeof(utf16_t), &stats);
+    }
+    else
+    {
+        input_chars = input_len / sizeof(utf16_t);
+        converted_len = sizeof(utf8_t) * utf16_to_utf8_with_stats((utf16_t const*)input, input_chars, (utf8_t*)converted, output_len / sizeof(utf8_t), &stats);
+    }
+
+    bool success = converted_len == output_len && memcmp(converted, output, output_len) == 0;
+    free(converted);
+
+    size_t utf8_errors = stats.truncated + stats.overlong + stats.surrogates + stats.out_of_range + stats.invalid_bytes;
+    size_t valid = stats.ascii + stats.two_byte + stats.three_byte + stats.four_byte;
+
+    // Every error is replaced by a U+FFFD, which takes 1 UTF-16 character or 3 UTF-8 characters
+    size_t expected_output_len = is_utf8
+        ? sizeof(utf16_t) * (valid + stats.four_byte + utf8_errors)
+        : sizeof(utf8_t) * (stats.ascii + 2 * stats.two_byte + 3 * stats.three_byte + 4 * stats.four_byte + 3 * stats.unpaired_surrogates);
+
+    success = success && stats.fast_path_len + stats.slow_path_len == input_chars;
+    success = success && stats.surrogate_pairs == stats.four_byte;
+    success = success && (is_utf8 ? stats.unpaired_surrogates == 0 : utf8_errors == 0);
+    success = success && expected_output_len == output_len;
+
+    bool valid_input = is_utf8
+        ? utf8_validate((utf8_t const*)input, input_chars, NULL)
+        : utf16_validate((utf16_t const*)input, input_chars, NULL);
+    success = success && valid_input == (utf8_errors + stats.unpaired_surrogates == 0);
+
+    if (!success)
+        fprintf(stderr, "Conversion statistics don't add up to the conversion");
+
+    return success;
+}
+
+// The lengths of the strings the input is split in to test batches, in input characters, used in a cycle
+static size_t const batch_string_lens[] = { 0, 1, 3, 17, 40, 120, 5, 64 };
+
+// Splits the input in strings and converts them with the batch conversion, in order and in reverse order,
+// and into a buffer that can only hold part of them.
+// Every string must be converted to the same output as converting it on its own.
+//
+// is_utf8: If the input is in UTF-8, otherwise it's in UTF-16
+// input: The input string
+// input_len: Length of 'input', in bytes
+//
+// return: If the batch conversion gave the same result as converting every string on its own
+static bool check_batch(bool is_utf8, char const* input, size_t input_len)
+{
+    size_t char_size = is_utf8 ? sizeof(utf8_t) : sizeof(utf16_t);
+    size_t output_char_size = is_utf8 ? sizeof(utf16_t) : sizeof(utf8_t);
+    size_t input_chars = input_len / char_size;
+
+    // Every string is at least one character long, except for the empty ones
+    size_t max_count = input_chars + input_chars / 2 + 2;
+    utf8_span* utf8_strings = malloc(max_count * sizeof(utf8_span));
+    utf16_span* utf16_strings = malloc(max_count * sizeof(utf16_span));
+    size_t* offsets = malloc((max_count + 1) * sizeof(size_t));
+    char* single = malloc(input_chars * 3 * output_char_size + 1);
+    if (utf8_strings == NULL || utf16_strings == NULL || offsets == NULL || single == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory to test batches");
+        free(utf8_strings);
+        free(utf16_strings);
+        free(offsets);
+        free(single);
+        return false;
+    }
+
+    size_t count = 0;
+    for (size_t start = 0; start < input_chars || count == 0; count++)
+    {
+        size_t len = batch_string_lens[count % (sizeof batch_string_lens / sizeof batch_string_lens[0])];
+        if (len > input_chars - start)
+            len = input_chars - start;
+
+        utf8_strings[count].utf8 = (utf8_t const*)input + start;
+        utf8_strings[count].utf8_len = len;
+        utf16_strings[count].utf16 = (utf16_t const*)input + start;
+        utf16_strings[count].utf16_len = len;
+        start += len;
+    }
+
+    bool success = true;
+    for (int pass = 0; pass < 3 && success; pass++)
+    {
+        // The second pass has the strings out of order, so they're never next to each other in memory
+        if (pass == 1)
+        {
+            for (size_t i = 0; i < count / 2; i++)
+            {
+                utf8_span utf8_string = utf8_strings[i];
+                utf8_strings[i] = utf8_strings[count - 1 - i];
+                utf8_strings[count - 1 - i] = utf8_string;
+
+                utf16_span utf16_string = utf16_strings[i];
+                utf16_strings[i] = utf16_strings[count - 1 - i];
+                utf16_strings[count - 1 - i] = utf16_string;
+            }
+        }
+
+        // The third pass only has room for half of the strings
+        size_t bound = is_utf8 ? utf8_to_utf16_batch_bound(utf8_strings, count) : utf16_to_utf8_batch_bound(utf16_strings, count);
+        size_t batch_len = pass == 2 ? bound / 2 : bound;
+
+        char* batch = malloc(bound * output_char_size + 1);
+        if (batch == NULL)
+        {
+            fprintf(stderr, "Unable to allocate enough memory to test batches");
+            success = false;
+            break;
+        }
+
+        size_t converted = is_utf8
+            ? utf8_to_utf16_batch(utf8_strings, count, (utf16_t*)batch, batch_len, offsets)
+            : utf16_to_utf8_batch(utf16_strings, count, (utf8_t*)batch, batch_len, offsets);
+
+        success = offsets[0] == 0 && (converted == count || pass == 2);
+        for (size_t i = 0; i < converted && success; i++)
+        {
+            size_t single_len = is_utf8
+                ? utf8_to_utf16(utf8_strings[i].utf8, utf8_strings[i].utf8_len, (utf16_t*)single, input_chars)
+                : utf16_to_utf8(utf16_strings[i].utf16, utf16_strings[i].utf16_len, (utf8_t*)single, input_chars * 3);
+
+            success = offsets[i + 1] - offsets[i] == single_len
+                && memcmp(batch + offsets[i] * output_char_size, single, single_len * output_char_size) == 0;
+        }
+
+        free(batch);
+    }
+
+    free(utf8_strings);
+    free(utf16_strings);
+    free(offsets);
+    free(single);
+
+    if (!success)
+        fprintf(stderr, "Batch conversion differs from converting every string on its own");
+
+    return success;
+}
+
+// The number of strings in the column of non-ASCII strings converted as a batch
+#define BATCH_COLUMN_COUNT 100000
+
+// The number of codepoints of every string in the column of non-ASCII strings
+#define BATCH_COLUMN_STRING_LEN 10
+
+// Converts a column of many non-ASCII strings that follow each other in memory with the batch
+// conversion, in both directions, which must convert every string on its own.
+// Every string ends the ASCII prefix of its run, so this is slow if the run is found again each time.
+//
+// return: If every string was converted correctly
+static bool check_batch_column(void)
+{
+    size_t len = BATCH_COLUMN_COUNT * BATCH_COLUMN_STRING_LEN;
+    // Room for the batch bound in both directions, which is what the conversions need to convert every string
+    utf8_t* utf8 = malloc(3 * len * sizeof(utf8_t));
+    utf16_t* utf16 = malloc(2 * len * sizeof(utf16_t));
+    utf8_span* utf8_strings = malloc(BATCH_COLUMN_COUNT * sizeof(utf8_span));
+    utf16_span* utf16_strings = malloc(BATCH_COLUMN_COUNT * sizeof(utf16_span));
+    size_t* offsets = malloc((BATCH_COLUMN_COUNT + 1) * sizeof(size_t));
+    if (utf8 == NULL || utf16 == NULL || utf8_strings == NULL || utf16_strings == NULL || offsets == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory to test batches");
+        free(utf8);
+        free(utf16);
+        free(utf8_strings);
+        free(utf16_strings);
+        free(offsets);
+        return false;
+    }
+
+    // Every string is made of U+00E9, which takes 2 UTF-8 characters
+    for (size_t i = 0; i < len; i++)
+    {
+        utf8[2 * i] = 0xC3;
+        utf8[2 * i + 1] = 0xA9;
+    }
+
+    for (size_t i = 0; i < BATCH_COLUMN_COUNT; i++)
+    {
+        utf8_strings[i].utf8 = utf8 + 2 * i * BATCH_COLUMN_STRING_LEN;
+        utf8_strings[i].utf8_len = 2 * BATCH_COLUMN_STRING_LEN;
+        utf16_strings[i].utf16 = utf16 + i * BATCH_COLUMN_STRING_LEN;
+        utf16_strings[i].utf16_len = BATCH_COLUMN_STRING_LEN;
+    }
+
+    bool success = utf8_to_utf16_batch(utf8_strings, BATCH_COLUMN_COUNT, utf16, 2 * len, offsets) == BATCH_COLUMN_COUNT;
+    for (size_t i = 0; success && i <= BATCH_COLUMN_COUNT; i++)
+        success = offsets[i] == i * BATCH_COLUMN_STRING_LEN;
+    for (size_t i = 0; success && i < len; i++)
+        success = utf16[i] == 0xE9;
+
+    memset(utf8, 0, 3 * len * sizeof(utf8_t));
+    success = success && utf16_to_utf8_batch(utf16_strings, BATCH_COLUMN_COUNT, utf8, 3 * len, offsets) == BATCH_COLUMN_COUNT;
+    for (size_t i = 0; success && i <= BATCH_COLUMN_COUNT; i++)
+        success = offsets[i] == 2 * i * BATCH_COLUMN_STRING_LEN;
+    for (size_t i = 0; success && i < len; i++)
+        success = utf8[2 * i] == 0xC3 && utf8[2 * i + 1] == 0xA9;
+
+    free(utf8);
+    free(utf16);
+    free(utf8_strings);
+    free(utf16_strings);
+    free(offsets);
+
+    if (!success)
+        fprintf(stderr, "Batch conversion of a column of non-ASCII strings is incorrect");
+
+    return success;
+}
+
+// Converts a string with an error policy
+//
+// is_utf8: If the input is in UTF-8, otherwise it's in UTF-16
+// input: The input string
+// input_len: Length of 'input', in bytes
+// output: The buffer for the converted string, or NULL to calculate its size
+// output_len: Length of 'output', in characters of the output encoding
+// policy: The error policy
+// error_index: Receives the index of the first error
+//
+// return: The number of characters written or required, in characters of the output encoding
+static size_t convert_with_policy(bool is_utf8, char const* input, size_t input_len, char* output, size_t output_len, conversion_error_policy policy, size_t* error_index)
+{
+    if (is_utf8)
+        return utf8_to_utf16_with_policy((utf8_t const*)input, input_len / sizeof(utf8_t), (utf16_t*)output, output_len, policy, error_index);
+
+    return utf16_to_utf8_with_policy((utf16_t const*)input, input_len / sizeof(utf16_t), (utf8_t*)output, output_len, policy, error_index);
+}
+
+// Converts a string again with every error policy, and checks that they agree with the regular
+// conversion and the validation:
+// replacing must give the same output, stopping must give the output up to the first error,
+// and skipping must give the same output only if there are no errors.
+// All of them must report the same error index as the validation.
+//
+// is_utf8: If the input is in UTF-8
+// input: The input string
+// input_len: Length of 'input', in bytes
+// output: The result of converting the input
+// output_len: Length of 'output', in bytes
+//
+// return: If every policy gave the expected result
+static bool check_policies(bool is_utf8, char const* input, size_t input_len, char const* output, size_t output_len)
+{
+    char* converted = malloc(output_len + 1);
+    if (converted == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory to test error policies");
+        return false;
+    }
+
+    size_t output_chars = output_len / (is_utf8 ? sizeof(utf16_t) : sizeof(utf8_t));
+    size_t char_size = is_utf8 ? sizeof(utf16_t) : sizeof(utf8_t);
+
+    size_t expected_error;
+    bool valid = is_utf8
+        ? utf8_validate((utf8_t const*)input, input_len / sizeof(utf8_t), &expected_error)
+        : utf16_validate((utf16_t const*)input, input_len / sizeof(utf16_t), &expected_error);
+
+    bool success = true;
+    conversion_error_policy const policies[] = { CONVERSION_REPLACE, CONVERSION_STOP, CONVERSION_SKIP };
+    for (size_t i = 0; i < sizeof policies / sizeof policies[0]; i++)
+    {
+        size_t sizing_error;
+        size_t error;
+        size_t required = convert_with_policy(is_utf8, input, input_len, NULL, 0, policies[i], &sizing_error);
+        size_t written = convert_with_policy(is_utf8, input, input_len, converted, output_chars, policies[i], &error);
+
+        success = success && required == written && sizing_error == expected_error && error == expected_error;
+        success = success && written <= output_chars && memcmp(converted, output, written * char_size) == 0;
+
+        if (policies[i] == CONVERSION_REPLACE)
+            success = success && written == output_chars;
+        else if (policies[i] == CONVERSION_SKIP)
+            success = success && (written == output_chars) == valid;
+    }
+
+    // Stopping must give exactly the conversion of the valid prefix
+    size_t prefix_len = is_utf8
+        ? utf8_to_utf16((utf8_t const*)input, expected_error, NULL, 0)
+        : utf16_to_utf8((utf16_t const*)input, expected_error, NULL, 0);
+    size_t error;
+    success = success && convert_with_policy(is_utf8, input, input_len, converted, output_chars, CONVERSION_STOP, &error) == prefix_len;
+
+    free(converted);
+
+    if (!success)
+        fprintf(stderr, "Conversion with an error policy differs from the regular conversion");
+
+    return success;
+}
+
+// Swaps the bytes of every character of a UTF-16 string into another buffer
+static void swap_utf16_bytes(utf16_t const* utf16, size_t utf16_len, utf16_t* swapped)
+{
+    for (size_t i = 0; i < utf16_len; i++)
+        swapped[i] = (utf16_t)((utf16[i] << 8) | (utf16[i] >> 8));
+}
+
+// Converts a string again with the little and big endian conversion functions, and checks that
+// the results are the same as the UTF-16LE conversion with the bytes of the UTF-16 side swapped
+// for big endian. The big endian UTF-16 string is also given a BOM, which must be detected and stripped.
+//
+// is_utf8: If the input is in UTF-8
+// input: The input string
+// input_len: Length of 'input', in bytes
+// output: The result of converting the input
+// output_len: Length of 'output', in bytes
+//
+// return: If every byte order gave the same result
+static bool check_byte_order(bool is_utf8, char const* input, size_t input_len, char const* output, size_t output_len)
+{
+    // The UTF-16 side of the conversion, in little endian
+    utf16_t const* utf16 = (utf16_t const*)(is_utf8 ? output : input);
+    size_t utf16_len = (is_utf8 ? output_len : input_len) / sizeof(utf16_t);
+
+    // The UTF-16 side in big endian, after a BOM
+    utf16_t* big_endian = malloc((utf16_len + 1) * sizeof(utf16_t));
+    // The result of converting with an explicit byte order
+    char* ordered_output = malloc(output_len + 1);
+    if (big_endian == NULL || ordered_output == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory to test byte orders");
+        free(big_endian);
+        free(ordered_output);
+        return false;
+    }
+
+    utf16_byte_order order = UTF16_LITTLE_ENDIAN;
+    size_t bom_len = utf16_write_bom(big_endian, utf16_len + 1, UTF16_BIG_ENDIAN);
+    bool success = bom_len == 1 && utf16_detect_bom(big_endian, utf16_len + 1, &order) == 1 && order == UTF16_BIG_ENDIAN;
+
+    if (is_utf8)
+    {
+        utf8_t const* utf8 = (utf8_t const*)input;
+        size_t utf8_len = input_len / sizeof(utf8_t);
+        utf16_t* ordered = (utf16_t*)ordered_output;
+
+        size_t le_len = utf8_to_utf16le(utf8, utf8_len, ordered, utf16_len);
+        success = success && le_len == utf16_len && memcmp(ordered, utf16, output_len) == 0;
+        success = success && utf8_to_utf16le(utf8, utf8_len, NULL, 0) == utf16_len;
+
+        // Written after the BOM, like a file with a BOM would be
+        size_t be_len = utf8_to_utf16be(utf8, utf8_len, big_endian + bom_len, utf16_len);
+        swap_utf16_bytes(big_endian + bom_len, be_len, ordered);
+        success = success && be_len == utf16_len && memcmp(ordered, utf16, output_len) == 0;
+        success = success && utf8_to_utf16be(utf8, utf8_len, NULL, 0) == utf16_len;
+    }
+    else
+    {
+        utf8_t* ordered = (utf8_t*)ordered_output;
+
+        size_t le_len = utf16le_to_utf8(utf16, utf16_len, ordered, output_len);
+        success = success && le_len == output_len && memcmp(ordered, output, output_len) == 0;
+        success = success && utf16le_to_utf8(utf16, utf16_len, NULL, 0) == output_len;
+
+        swap_utf16_bytes(utf16, utf16_len, big_endian + bom_len);
+        size_t be_len = utf16be_to_utf8(big_endian + bom_len, utf16_len, ordered, output_len);
+        success = success && be_len == output_len && memcmp(ordered, output, output_len) == 0;
+        success = success && utf16be_to_utf8(big_endian + bom_len, utf16_len, NULL, 0) == output_len;
+    }
+
+    free(big_endian);
+    free(ordered_output);
+
+    if (!success)
+        fprintf(stderr, "Conversion with an explicit byte order differs from the native conversion");
+
+    return success;
+}
+
+// Converts a UTF-8 or UTF-16 string to UTF-32, using the size calculated by the conversion itself
+//
+// is_utf8: If the string is in UTF-8, otherwise it's in UTF-16
+// str: The string
+// str_len: Length of 'str', in bytes
+// utf32_len: Pointer to a variable that will receive the length of the result, in UTF-32 characters
+//
+// return: The UTF-32 string, which must be freed, or NULL if it couldn't be allocated
+static utf32_t* to_utf32(bool is_utf8, char const* str, size_t str_len, size_t* utf32_len)
+{
+    size_t required_len = is_utf8
+        ? utf8_to_utf32((utf8_t const*)str, str_len / sizeof(utf8_t), NULL, 0)
+        : utf16_to_utf32((utf16_t const*)str, str_len / sizeof(utf16_t), NULL, 0);
+
+    utf32_t* utf32 = malloc((required_len + 1) * sizeof(utf32_t));
+    if (utf32 == NULL)
+        return NULL;
+
+    *utf32_len = is_utf8
+        ? utf8_to_utf32((utf8_t const*)str, str_len / sizeof(utf8_t), utf32, required_len)
+        : utf16_to_utf32((utf16_t const*)str, str_len / sizeof(utf16_t), utf32, required_len);
+
+    return utf32;
+}
+
+// Checks that converting through UTF-32 gives the same result as converting directly
+//
+// is_utf8: If the input is in UTF-8, otherwise it's in UTF-16
+// input: The input string
+// input_len: Length of 'input', in bytes
+// output: The converted input
+// output_len: Length of 'output', in bytes
+//
+// return: If the conversion through UTF-32 gave the same result
+static bool check_utf32(bool is_utf8, char const* input, size_t input_len, char const* output, size_t output_len)
+{
+    size_t input_utf32_len = 0;
+    size_t output_utf32_len = 0;
+    utf32_t* input_utf32 = to_utf32(is_utf8, input, input_len, &input_utf32_len);
+    utf32_t* output_utf32 = to_utf32(!is_utf8, output, output_len, &output_utf32_len);
+    // The output converted back from UTF-32
+    char* converted = malloc(output_len + 1);
+    if (input_utf32 == NULL || output_utf32 == NULL || converted == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory to test UTF-32");
+        free(input_utf32);
+        free(output_utf32);
+        free(converted);
+        return false;
+    }
+
+    // Invalid input was already replaced in the output, and must be replaced the same way in UTF-32
+    bool success = input_utf32_len == output_utf32_len
+        && memcmp(input_utf32, output_utf32, input_utf32_len * sizeof(utf32_t)) == 0;
+
+    size_t converted_len;
+    if (is_utf8)
+    {
+        success = success && utf32_to_utf16(output_utf32, output_utf32_len, NULL, 0) == output_len / sizeof(utf16_t);
+        converted_len = utf32_to_utf16(output_utf32, output_utf32_len, (utf16_t*)converted, output_len / sizeof(utf16_t)) * sizeof(utf16_t);
+    }
+    else
+    {
+        success = success && utf32_to_utf8(output_utf32, output_utf32_len, NULL, 0) == output_len / sizeof(utf8_t);
+        converted_len = utf32_to_utf8(output_utf32, output_utf32_len, (utf8_t*)converted, output_len / sizeof(utf8_t)) * sizeof(utf8_t);
+    }
+
+    success = success && converted_len == output_len && memcmp(converted, output, output_len) == 0;
+
+    free(input_utf32);
+    free(output_utf32);
+    free(converted);
+
+    if (!success)
+        fprintf(stderr, "Conversion through UTF-32 differs from the direct conversion");
+
+    return success;
+}
+
+// Converts a UTF-8 or UTF-16 string to Latin-1, allocating a buffer for it
+//
+// is_utf8: If the string is in UTF-8, otherwise it's in UTF-16
+// str: The string
+// str_len: Length of 'str', in bytes
+// latin1_len: A pointer to a variable that will receive the length of the Latin-1 string
+//
+// return: The Latin-1 string, which must be freed, or NULL if there's not enough memory
+static latin1_t* to_latin1(bool is_utf8, char const* str, size_t str_len, size_t* latin1_len)
+{
+    size_t required_len = is_utf8
+        ? utf8_to_latin1((utf8_t const*)str, str_len / sizeof(utf8_t), NULL, 0)
+        : utf16_to_latin1((utf16_t const*)str, str_len / sizeof(utf16_t), NULL, 0);
+
+    latin1_t* latin1 = malloc(required_len + 1);
+    if (latin1 == NULL)
+        return NULL;
+
+    *latin1_len = is_utf8
+        ? utf8_to_latin1((utf8_t const*)str, str_len / sizeof(utf8_t), latin1, required_len)
+        : utf16_to_latin1((utf16_t const*)str, str_len / sizeof(utf16_t), latin1, required_len);
+
+    return latin1;
+}
+
+// Checks that both sides convert to the same Latin-1 string, with every codepoint that Latin-1
+// can't encode replaced, and that the Latin-1 checks agree with it.
+// If nothing was replaced, converting the Latin-1 string back must give both sides again.
+//
+// is_utf8: If the input is in UTF-8, otherwise it's in UTF-16
+// input: The input string
+// input_len: Length of 'input', in bytes
+// output: The converted input
+// output_len: Length of 'output', in bytes
+//
+// return: If the conversions and checks agreed
+static bool check_latin1(bool is_utf8, char const* input, size_t input_len, char const* output, size_t output_len)
+{
+    size_t input_latin1_len = 0;
+    size_t output_latin1_len = 0;
+    size_t codepoints_len = 0;
+    latin1_t* input_latin1 = to_latin1(is_utf8, input, input_len, &input_latin1_len);
+    latin1_t* output_latin1 = to_latin1(!is_utf8, output, output_len, &output_latin1_len);
+    utf32_t* codepoints = to_utf32(is_utf8, input, input_len, &codepoints_len);
+
+    utf8_t const* utf8 = (utf8_t const*)(is_utf8 ? input : output);
+    size_t utf8_len = (is_utf8 ? input_len : output_len) / sizeof(utf8_t);
+    utf16_t const* utf16 = (utf16_t const*)(is_utf8 ? output : input);
+    size_t utf16_len = (is_utf8 ? output_len : input_len) / sizeof(utf16_t);
+
+    // Room for the longest conversion of the Latin-1 string, which is 2 UTF-8 characters per character
+    char* round_trip = malloc(2 * input_latin1_len + 1);
+
+    if (input_latin1 == NULL || output_latin1 == NULL || codepoints == NULL || round_trip == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory to test Latin-1");
+        free(input_latin1);
+        free(output_latin1);
+        free(codepoints);
+        free(round_trip);
+        return false;
+    }
+
+    // Invalid input is replaced by U+FFFD on the other side, so it never fits on either side
+    bool fits = is_utf8
+        ? utf8_validate(utf8, utf8_len, NULL)
+        : utf16_validate(utf16, utf16_len, NULL);
+
+    bool success = input_latin1_len == codepoints_len
+        && output_latin1_len == codepoints_len
+        && memcmp(input_latin1, output_latin1, codepoints_len) == 0;
+
+    for (size_t i = 0; success && i < codepoints_len; i++)
+    {
+        fits = fits && codepoints[i] <= 0xFF;
+        success = input_latin1[i] == (codepoints[i] <= 0xFF ? codepoints[i] : '?');
+    }
+
+    success = success
+        && utf8_fits_latin1(utf8, utf8_len) == fits
+        && utf16_fits_latin1(utf16, utf16_len) == fits
+        && utf8_is_ascii(utf8, utf8_len) == utf16_is_ascii(utf16, utf16_len);
+
+    if (success && fits)
+    {
+        size_t round_trip_len = latin1_to_utf8(input_latin1, input_latin1_len, NULL, 0);
+        success = round_trip_len == utf8_len
+            && latin1_to_utf8(input_latin1, input_latin1_len, (utf8_t*)round_trip, round_trip_len) == utf8_len
+            && memcmp(round_trip, utf8, utf8_len * sizeof(utf8_t)) == 0
+            && latin1_to_utf16(input_latin1, input_latin1_len, NULL, 0) == utf16_len
+            && latin1_to_utf16(input_latin1, input_latin1_len, (utf16_t*)round_trip, input_latin1_len) == utf16_len
+            && memcmp(round_trip, utf16, utf16_len * sizeof(utf16_t)) == 0;
+    }
+
+    if (!success)
+        fprintf(stderr, "Conversion to and from Latin-1 differs from the direct conversion");
+
+    free(input_latin1);
+    free(output_latin1);
+    free(codepoints);
+    free(round_trip);
+    return success;
+}
+
+// Checks that the UTF-16 side converts to WTF-8 and back without losing anything, even unpaired
+// surrogates, and that well-formed input converts to WTF-8 exactly like it converts to UTF-8
+//
+// is_utf8: If the input is in UTF-8, otherwise it's in UTF-16
+// input: The input string
+// input_len: Length of 'input', in bytes
+// output: The converted input
+// output_len: Length of 'output', in bytes
+//
+// return: If the WTF-8 conversions agreed
+static bool check_wtf8(bool is_utf8, char const* input, size_t input_len, char const* output, size_t output_len)
+{
+    utf8_t const* utf8 = (utf8_t const*)(is_utf8 ? input : output);
+    size_t utf8_len = (is_utf8 ? input_len : output_len) / sizeof(utf8_t);
+    utf16_t const* utf16 = (utf16_t const*)(is_utf8 ? output : input);
+    size_t utf16_len = (is_utf8 ? output_len : input_len) / sizeof(utf16_t);
+
+    size_t wtf8_len = utf16_to_wtf8(utf16, utf16_len, NULL, 0);
+    utf8_t* wtf8 = malloc(wtf8_len * sizeof(utf8_t) + 1);
+    utf16_t* round_trip = malloc(utf16_len * sizeof(utf16_t) + 1);
+
+    if (wtf8 == NULL || round_trip == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory to test WTF-8");
+        free(wtf8);
+        free(round_trip);
+        return false;
+    }
+
+    bool success = utf16_to_wtf8(utf16, utf16_len, wtf8, wtf8_len) == wtf8_len
+        && wtf8_to_utf16(wtf8, wtf8_len, NULL, 0) == utf16_len
+        && wtf8_to_utf16(wtf8, wtf8_len, round_trip, utf16_len) == utf16_len
+        && memcmp(round_trip, utf16, utf16_len * sizeof(utf16_t)) == 0;
+
+    // Only invalid input makes the two sides differ in what they encode
+    bool valid = is_utf8
+        ? utf8_validate(utf8, utf8_len, NULL)
+        : utf16_validate(utf16, utf16_len, NULL);
+
+    if (success && valid)
+    {
+        success = wtf8_len == utf8_len
+            && memcmp(wtf8, utf8, utf8_len * sizeof(utf8_t)) == 0
+            && wtf8_to_utf16(utf8, utf8_len, round_trip, utf16_len) == utf16_len
+            && memcmp(round_trip, utf16, utf16_len * sizeof(utf16_t)) == 0;
+    }
+
+    if (!success)
+        fprintf(stderr, "Conversion to and from WTF-8 differs from the direct conversion");
+
+    free(wtf8);
+    free(round_trip);
+    return success;
+}
+
+// The number of codepoints read at once with the iterators' next_n
+#define ITERATOR_BATCH_LEN 7
+
+// Checks that iterating over the codepoints of the input, alternating between every way of
+// advancing the iterator, gives the same codepoints as converting the input to UTF-32
+//
+// is_utf8: If the input is in UTF-8, otherwise it's in UTF-16
+// input: The input string
+// input_len: Length of 'input', in bytes
+//
+// return: If the iterator gave the same codepoints
+static bool check_iterator(bool is_utf8, char const* input, size_t input_len)
+{
+    size_t expected_len = 0;
+    utf32_t* expected = to_utf32(is_utf8, input, input_len, &expected_len);
+    if (expected == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory to test iterators");
+        return false;
+    }
+
+    utf8_iterator utf8_it;
+    utf16_iterator utf16_it;
+    utf8_iterator_init(&utf8_it, (utf8_t const*)input, input_len / sizeof(utf8_t));
+    utf16_iterator_init(&utf16_it, (utf16_t const*)input, input_len / sizeof(utf16_t));
+
+    bool success = true;
+    size_t expected_index = 0;
+    for (unsigned step = 0; success; step++)
+    {
+        utf32_t batch[ITERATOR_BATCH_LEN];
+        utf32_t peeked = 0;
+        utf32_t codepoint = 0;
+        size_t count;
+
+        switch (step % 3)
+        {
+        case 0:
+            count = is_utf8 ? utf8_iterator_skip_ascii(&utf8_it) : utf16_iterator_skip_ascii(&utf16_it);
+            for (size_t i = 0; i < count; i++)
+                success = success && expected_index + i < expected_len && expected[expected_index + i] < 0x80;
+            expected_index += count;
+            break;
+
+        case 1:
+            count = is_utf8
+                ? utf8_iterator_next_n(&utf8_it, batch, ITERATOR_BATCH_LEN)
+                : utf16_iterator_next_n(&utf16_it, batch, ITERATOR_BATCH_LEN);
+            success = count <= expected_len - expected_index
+                && memcmp(batch, expected + expected_index, count * sizeof(utf32_t)) == 0;
+            expected_index += count;
+            break;
+
+        default:
+            count = is_utf8
+                ? utf8_iterator_peek(&utf8_it, &peeked) && utf8_iterator_next(&utf8_it, &codepoint)
+                : utf16_iterator_peek(&utf16_it, &peeked) && utf16_iterator_next(&utf16_it, &codepoint);
+            success = count <= expected_len - expected_index
+                && (count == 0 || (peeked == codepoint && codepoint == expected[expected_index]));
+            expected_index += count;
+            break;
+        }
+
+        if (expected_index >= expected_len)
+            break;
+    }
+
+    bool at_end = is_utf8 ? utf8_it.index == utf8_it.utf8_len : utf16_it.index == utf16_it.utf16_len;
+    success = success && expected_index == expected_len && at_end;
+
+    free(expected);
+
+    if (!success)
+        fprintf(stderr, "Iterating over the codepoints differs from converting to UTF-32");
+
+    return success;
+}
+
+// The distance between the checkpoints of the offset index, small enough to have many of them
+#define OFFSET_INDEX_STRIDE 61
+
+// Checks that the offset index translates every codepoint boundary of the UTF-8 side between
+// its UTF-8 and UTF-16 offsets, after indexing it in two appends, with a checkpoint array
+// that only fits the first half and is grown before the second append
+//
+// is_utf8: If the input is in UTF-8, otherwise it's in UTF-16
+// input: The input string
+// input_len: Length of 'input', in bytes
+// output: The converted input
+// output_len: Length of 'output', in bytes
+//
+// return: If every offset was translated correctly
+static bool check_offsets(bool is_utf8, char const* input, size_t input_len, char const* output, size_t output_len)
+{
+    utf8_t const* utf8 = (utf8_t const*)(is_utf8 ? input : output);
+    size_t utf8_len = (is_utf8 ? input_len : output_len) / sizeof(utf8_t);
+
+    size_t half_capacity = utf_offset_index_capacity(utf8_len / 2, OFFSET_INDEX_STRIDE);
+    utf_offset_checkpoint* checkpoints = malloc(half_capacity * sizeof(utf_offset_checkpoint));
+    if (checkpoints == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory to test the offset index");
+        return false;
+    }
+
+    utf_offset_index index;
+    utf_offset_index_init(&index, checkpoints, half_capacity, OFFSET_INDEX_STRIDE);
+    utf_offset_index_append(&index, utf8, utf8_len / 2);
+
+    size_t capacity = utf_offset_index_capacity(utf8_len, OFFSET_INDEX_STRIDE);
+    utf_offset_checkpoint* grown = malloc(capacity * sizeof(utf_offset_checkpoint));
+    if (grown == NULL)
+    {
+        free(checkpoints);
+        fprintf(stderr, "Unable to allocate enough memory to test the offset index");
+        return false;
+    }
+
+    utf_offset_index_reserve(&index, grown, capacity);
+    free(checkpoints);
+    checkpoints = grown;
+
+    utf_offset_index_append(&index, utf8, utf8_len);
+
+    // The grown array must let the second append index the string to its end, so the last
+    // checkpoint is less than a stride and a codepoint away from it
+    size_t last_offset = index.checkpoints[index.count - 1].utf8_offset;
+    bool success = index.checkpoints == grown && utf8_len - last_offset < OFFSET_INDEX_STRIDE + 4;
+
+    success = success && index.utf16_len == utf8_to_utf16(utf8, utf8_len, NULL, 0);
+
+    utf8_iterator iterator;
+    utf8_iterator_init(&iterator, utf8, utf8_len);
+    size_t utf16_index = 0;
+    while (success)
+    {
+        size_t utf8_index = iterator.index;
+        success = utf_offset_utf8_to_utf16(&index, utf8, utf8_index) == utf16_index
+            && utf_offset_utf16_to_utf8(&index, utf8, utf16_index) == utf8_index;
+
+        utf32_t codepoint;
+        if (!utf8_iterator_next(&iterator, &codepoint))
+            break;
+
+        utf16_index += codepoint > 0xFFFF ? 2 : 1;
+
+        // Offsets inside a surrogate pair go back to the start of the codepoint
+        if (codepoint > 0xFFFF)
+            success = success && utf_offset_utf16_to_utf8(&index, utf8, utf16_index - 1) == utf8_index;
+    }
+
+    success = success && utf16_index == index.utf16_len;
+
+    free(checkpoints);
+
+    if (!success)
+        fprintf(stderr, "The offset index translated an offset incorrectly");
+
+    return success;
+}
+
+// The number of conversions kept alive in the arena at the same time
+#define ARENA_CONVERSIONS 3
+
+// Room an arena needs for each allocation besides its contents, for its alignment
+#define ARENA_PADDING 15
+
+// Converts the input with the allocating conversion
+//
+// is_utf8: If the input is in UTF-8, otherwise it's in UTF-16
+// input: The input string
+// input_len: Length of 'input', in bytes
+// allocator: The allocator for the output, or NULL to use malloc
+// output_len: A pointer to a variable that will receive the length of the output, in bytes
+//
+// return: The converted input, or NULL if it couldn't be allocated
+static char* convert_alloc(bool is_utf8, char const* input, size_t input_len, utf_allocator const* allocator, size_t* output_len)
+{
+    size_t len = 0;
+    char* output = is_utf8
+        ? (char*)utf8_to_utf16_alloc((utf8_t const*)input, input_len / sizeof(utf8_t), allocator, &len)
+        : (char*)utf16_to_utf8_alloc((utf16_t const*)input, input_len / sizeof(utf16_t), allocator, &len);
+
+    *output_len = len * (is_utf8 ? sizeof(utf16_t) : sizeof(utf8_t));
+    return output;
+}
+
+// Checks that the allocating conversions give the same output as the direct conversion,
+// both with malloc and with an arena, and that they only keep as much of the arena as they need
+//
+// is_utf8: If the input is in UTF-8, otherwise it's in UTF-16
+// input: The input string
+// input_len: Length of 'input', in bytes
+// output: The converted input
+// output_len: Length of 'output', in bytes
+//
+// return: If the allocating conversions gave the same output
+static bool check_alloc(bool is_utf8, char const* input, size_t input_len, char const* output, size_t output_len)
+{
+    size_t terminator_len = is_utf8 ? sizeof(utf16_t) : sizeof(utf8_t);
+    size_t bound_len = is_utf8
+        ? utf8_to_utf16_bound(input_len / sizeof(utf8_t)) * sizeof(utf16_t)
+        : utf16_to_utf8_bound(input_len / sizeof(utf16_t)) * sizeof(utf8_t);
+
+    // Every conversion but the last one must have given back the part of its bound it didn't use
+    size_t kept_len = output_len + terminator_len + ARENA_PADDING;
+    size_t arena_len = (ARENA_CONVERSIONS - 1) * kept_len + bound_len + terminator_len + ARENA_PADDING;
+    void* arena_buffer = malloc(arena_len);
+
+    size_t converted_len = 0;
+    char* converted = convert_alloc(is_utf8, input, input_len, NULL, &converted_len);
+
+    if (arena_buffer == NULL || converted == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory to test allocating conversions");
+        free(arena_buffer);
+        free(converted);
+        return false;
+    }
+
+    bool success = converted_len == output_len
+        && memcmp(converted, output, output_len) == 0
+        && memcmp(converted + output_len, "\0\0", terminator_len) == 0;
+
+    if (is_utf8)
+        utf16_free((utf16_t*)converted, converted_len / sizeof(utf16_t), NULL);
+    else
+        utf8_free((utf8_t*)converted, converted_len / sizeof(utf8_t), NULL);
+
+    utf_arena arena;
+    utf_arena_init(&arena, arena_buffer, arena_len);
+    utf_allocator allocator = utf_arena_allocator(&arena);
+
+    for (int i = 0; success && i < ARENA_CONVERSIONS; i++)
+    {
+        converted = convert_alloc(is_utf8, input, input_len, &allocator, &converted_len);
+        success = converted != NULL
+            && converted_len == output_len
+            && memcmp(converted, output, output_len) == 0
+            && arena.used <= (size_t)(i + 1) * kept_len;
+    }
+
+    // Freeing the last conversion gives it back, and resetting gives back everything
+    if (success)
+    {
+        size_t used_before = arena.used;
+        if (is_utf8)
+            utf16_free((utf16_t*)converted, converted_len / sizeof(utf16_t), &allocator);
+        else
+            utf8_free((utf8_t*)converted, converted_len / sizeof(utf8_t), &allocator);
+
+        success = arena.used == used_before - output_len - terminator_len;
+
+        utf_arena_reset(&arena);
+        success = success && arena.used == 0;
+    }
+
+    // An arena without room for the terminator can't hold the conversion
+    if (success)
+    {
+        utf_arena_init(&arena, arena_buffer, output_len);
+        success = convert_alloc(is_utf8, input, input_len, &allocator, &converted_len) == NULL;
+    }
+
+    free(arena_buffer);
+
+    if (!success)
+        fprintf(stderr, "Allocating conversion differs from the direct conversion");
+
+    return success;
+}
+
+// The number of runs of the input that checks for writes past the output of a conversion.
+// Run N is made of N ASCII characters followed by a 2, a 4 and a 3-byte sequence, so vectorized
+// conversions end their blocks at every point before those sequences.
+#define TAIL_RUN_COUNT 32
+
+// The 2, 4 and 3-byte sequences at the end of every run: U+00E9, U+1F600 and U+4E2D
+static utf8_t const tail_run_end[] = { 0xC3, 0xA9, 0xF0, 0x9F, 0x98, 0x80, 0xE4, 0xB8, 0xAD };
+
+// The length of the input of checks for writes past the output of a conversion, in characters
+#define TAIL_INPUT_LEN (TAIL_RUN_COUNT * (TAIL_RUN_COUNT - 1) / 2 + TAIL_RUN_COUNT * sizeof(tail_run_end))
+
+// The byte that output buffers are filled with, to find out what a conversion wrote
+#define TAIL_SENTINEL 0xA5
+
+// The output buffer of checks for writes past the output of a conversion, large enough for any
+// conversion of their input, with any character size
+static utf32_t tail_buffer[TAIL_INPUT_LEN];
+
+// Checks that nothing after the first 'written' bytes of the tail buffer changed since it was
+// filled with TAIL_SENTINEL, then fills it again for the next conversion
+static bool is_tail_untouched(size_t written)
+{
+    unsigned char const* bytes = (unsigned char const*)tail_buffer;
+    bool untouched = true;
+    for (size_t i = written; i < sizeof(tail_buffer); i++)
+        untouched = untouched && bytes[i] == TAIL_SENTINEL;
+
+    memset(tail_buffer, TAIL_SENTINEL, sizeof(tail_buffer));
+    return untouched;
+}
+
+// Converts a UTF-8 string into the tail buffer with every conversion from UTF-8
+//
+// utf8: The UTF-8 string
+// utf8_len: Length of 'utf8', in 8-bit characters
+// capacity: The capacity given to the conversions, in output characters
+//
+// return: If no conversion wrote past its output
+static bool check_utf8_tail(utf8_t const* utf8, size_t utf8_len, size_t capacity)
+{
+    bool success = is_tail_untouched(sizeof(utf16_t) * utf8_to_utf16(utf8, utf8_len, (utf16_t*)tail_buffer, capacity));
+    success = success && is_tail_untouched(sizeof(utf16_t) * utf8_to_utf16be(utf8, utf8_len, (utf16_t*)tail_buffer, capacity));
+    success = success && is_tail_untouched(sizeof(utf32_t) * utf8_to_utf32(utf8, utf8_len, tail_buffer, capacity));
+    success = success && is_tail_untouched(utf8_to_latin1(utf8, utf8_len, (latin1_t*)tail_buffer, capacity));
+    return success;
+}
+
+// Converts a UTF-16 string into the tail buffer with every conversion from UTF-16
+//
+// utf16: The UTF-16 string
+// swapped: 'utf16' with the bytes of every character swapped
+// utf16_len: Length of 'utf16', in 16-bit characters
+// capacity: The capacity given to the conversions, in output characters
+//
+// return: If no conversion wrote past its output
+static bool check_utf16_tail(utf16_t const* utf16, utf16_t const* swapped, size_t utf16_len, size_t capacity)
+{
+    bool success = is_tail_untouched(utf16_to_utf8(utf16, utf16_len, (utf8_t*)tail_buffer, capacity));
+    success = success && is_tail_untouched(utf16be_to_utf8(swapped, utf16_len, (utf8_t*)tail_buffer, capacity));
+    success = success && is_tail_untouched(utf16_to_wtf8(utf16, utf16_len, (utf8_t*)tail_buffer, capacity));
+    success = success && is_tail_untouched(sizeof(utf32_t) * utf16_to_utf32(utf16, utf16_len, tail_buffer, capacity));
+    success = success && is_tail_untouched(utf16_to_latin1(utf16, utf16_len, (latin1_t*)tail_buffer, capacity));
+    return success;
+}
+
+// Converts a Latin-1 string into the tail buffer with every conversion from Latin-1
+//
+// latin1: The Latin-1 string
+// latin1_len: Length of 'latin1', in 8-bit characters
+// capacity: The capacity given to the conversions, in output characters
+//
+// return: If no conversion wrote past its output
+static bool check_latin1_tail(latin1_t const* latin1, size_t latin1_len, size_t capacity)
+{
+    bool success = is_tail_untouched(latin1_to_utf8(latin1, latin1_len, (utf8_t*)tail_buffer, capacity));
+    success = success && is_tail_untouched(sizeof(utf16_t) * latin1_to_utf16(latin1, latin1_len, (utf16_t*)tail_buffer, capacity));
+    return success;
+}
+
+// Checks that converting every prefix of a string, and converting the string into output buffers
+// of every length, never writes anything past the characters that the conversion returns
+//
+// return: If no conversion wrote past its output
+static bool check_tail(void)
+{
+    utf8_t utf8[TAIL_INPUT_LEN];
+    size_t utf8_len = 0;
+    for (size_t run = 0; run < TAIL_RUN_COUNT; run++)
+    {
+        memset(utf8 + utf8_len, 'a', run);
+        utf8_len += run;
+
+        memcpy(utf8 + utf8_len, tail_run_end, sizeof(tail_run_end));
+        utf8_len += sizeof(tail_run_end);
+    }
+
+    utf16_t utf16[TAIL_INPUT_LEN];
+    utf16_t swapped[TAIL_INPUT_LEN];
+    size_t utf16_len = utf8_to_utf16(utf8, utf8_len, utf16, TAIL_INPUT_LEN);
+    swap_utf16_bytes(utf16, utf16_len, swapped);
+
+    // The characters above U+00FF become question marks
+    latin1_t latin1[TAIL_INPUT_LEN];
+    size_t latin1_len = utf8_to_latin1(utf8, utf8_len, latin1, TAIL_INPUT_LEN);
+
+    memset(tail_buffer, TAIL_SENTINEL, sizeof(tail_buffer));
+
+    // Every length is tried both as the length of the input, with room for all of its output,
+    // and as the capacity of the output, with the whole input
+    bool success = true;
+    for (size_t len = 0; success && len <= utf8_len; len++)
+    {
+        success = check_utf8_tail(utf8, len, TAIL_INPUT_LEN)
+            && check_utf8_tail(utf8, utf8_len, len);
+    }
+
+    for (size_t len = 0; success && len <= utf16_len; len++)
+    {
+        success = check_utf16_tail(utf16, swapped, len, TAIL_INPUT_LEN)
+            && check_utf16_tail(utf16, swapped, utf16_len, len);
+    }
+
+    for (size_t len = 0; success && len <= latin1_len; len++)
+    {
+        success = check_latin1_tail(latin1, len, TAIL_INPUT_LEN)
+            && check_latin1_tail(latin1, latin1_len, len);
+    }
+
+    if (!success)
+        fprintf(stderr, "A conversion wrote past the end of its output");
+
+    return success;
+}
+
 int main(int argc, char const* argv[]) 
 {
     if (argc < 4 || argc > 5)
@@ -210,10 +1477,17 @@ int main(int argc, char const* argv[])
     
     char* output;
     size_t output_len;
+    size_t required_len;
     if (is_utf8)
-        output_len = sizeof(utf16_t) * utf8_to_utf16(input, input_len / sizeof(utf8_t), NULL, 0);
+    {
+        output_len = sizeof(utf16_t) * utf8_to_utf16_bound(input_len / sizeof(utf8_t));
+        required_len = sizeof(utf16_t) * utf8_to_utf16((utf8_t const*)input, input_len / sizeof(utf8_t), NULL, 0);
+    }
     else
-        output_len = sizeof(utf8_t) * utf16_to_utf8(input, input_len / sizeof(utf16_t), NULL, 0);
+    {
+        output_len = sizeof(utf8_t) * utf16_to_utf8_bound(input_len / sizeof(utf16_t));
+        required_len = sizeof(utf8_t) * utf16_to_utf8((utf16_t const*)input, input_len / sizeof(utf16_t), NULL, 0);
+    }
 
     output = malloc(output_len);
     if (output == NULL)
@@ -223,19 +1497,70 @@ int main(int argc, char const* argv[])
     }
 
 
-    time_t time_start = time(NULL);
-    clock_t clock_start = clock();
-
     if (is_utf8)
-        utf8_to_utf16(input, input_len / sizeof(utf8_t), output, output_len / sizeof(utf16_t));
+        output_len = sizeof(utf16_t) * utf8_to_utf16_bounded((utf8_t const*)input, input_len / sizeof(utf8_t), (utf16_t*)output);
     else
-        utf16_to_utf8(input, input_len / sizeof(utf16_t), output, output_len / sizeof(utf8_t));
+        output_len = sizeof(utf8_t) * utf16_to_utf8_bounded((utf16_t const*)input, input_len / sizeof(utf16_t), (utf8_t*)output);
+
+    if (!check_partial(is_utf8, input, input_len, output, output_len))
+        return EXIT_FAILURE;
+
+    if (!check_stream(is_utf8, input, input_len, output, output_len))
+        return EXIT_FAILURE;
+
+    if (!check_parallel(is_utf8, input, input_len, output, output_len))
+        return EXIT_FAILURE;
+
+    if (!check_validate(is_utf8, input, input_len, output, output_len))
+        return EXIT_FAILURE;
+
+    if (!check_policies(is_utf8, input, input_len, output, output_len))
+        return EXIT_FAILURE;
+
+    if (!check_unchecked(is_utf8, input, input_len, output, output_len))
+        return EXIT_FAILURE;
+
+    if (!check_batch(is_utf8, input, input_len))
+        return EXIT_FAILURE;
+
+    if (!check_batch_column())
+        return EXIT_FAILURE;
+
+    if (!check_stats(is_utf8, input, input_len, output, output_len))
+        return EXIT_FAILURE;
+
+    if (!check_byte_order(is_utf8, input, input_len, output, output_len))
+        return EXIT_FAILURE;
+
+    if (!check_utf32(is_utf8, input, input_len, output, output_len))
+        return EXIT_FAILURE;
+
+    if (!check_latin1(is_utf8, input, input_len, output, output_len))
+        return EXIT_FAILURE;
+
+    if (!check_wtf8(is_utf8, input, input_len, output, output_len))
+        return EXIT_FAILURE;
+
+    if (!check_iterator(is_utf8, input, input_len))
+        return EXIT_FAILURE;
+
+    if (!check_offsets(is_utf8, input, input_len, output, output_len))
+        return EXIT_FAILURE;
+
+    if (!check_alloc(is_utf8, input, input_len, output, output_len))
+        return EXIT_FAILURE;
+
+    if (!check_tail())
+        return EXIT_FAILURE;
 
-    time_t time_end = time(NULL);
-    clock_t clock_end = clock();
-        
     free(input);
 
+    if (required_len != output_len)
+    {
+        fprintf(stderr, "Calculated size (%zu) is not the same as the converted size (%zu)", required_len, output_len);
+        return EXIT_FAILURE;
+    }
+
 
     if (argc >= 5 && !write_file(argv[4], output, output_len))
         return EXIT_FAILURE;
@@ -251,10 +1576,6 @@ int main(int argc, char const* argv[])
     else
         printf("FAILURE\n\n");
 
-    double time_seconds = difftime(time_end, time_start);
-    uint64_t clock_delta = (uint64_t)clock_end - clock_start;
-    double clock_seconds = ((double)clock_delta) / CLOCKS_PER_SEC;
-
     if (is_utf8)
         printf("UTF-8 to UTF-16");
     else
@@ -270,18 +1591,6 @@ int main(int argc, char const* argv[])
     print_size(output_len);
     printf("\n");
 
-    printf("\n");
-
-    printf("Real time: ");
-    print_time(time_seconds);
-    printf("\n");
-
-    printf("CPU time:  ");
-    print_time(clock_seconds);
-    printf("\n");
-
-    printf("CPU ticks: %"PRIu64"\n", clock_delta);
-
     if (success)
         return EXIT_SUCCESS;
 
@@ -0,0 +1,39 @@
+#include "conversion.h"
+
+void conversion_init(conversion* conversion, bool is_utf8)
+{
+    conversion->is_utf8 = is_utf8;
+    utf8_to_utf16_stream_init(&conversion->utf8_stream);
+    utf16_to_utf8_stream_init(&conversion->utf16_stream);
+
+    if (is_utf8)
+        conversion->output_len = sizeof(utf16_t) * utf8_to_utf16_stream_bound(CHUNK_LEN / sizeof(utf8_t));
+    else
+        conversion->output_len = sizeof(utf8_t) * utf16_to_utf8_stream_bound(CHUNK_LEN / sizeof(utf16_t));
+}
+
+bool conversion_feed(conversion* conversion, char const* chunk, size_t len, char* output, size_t* written)
+{
+    if (conversion->is_utf8)
+    {
+        *written = sizeof(utf16_t) * utf8_to_utf16_stream_feed(&conversion->utf8_stream,
+            (utf8_t const*)chunk, len / sizeof(utf8_t),
+            (utf16_t*)output, conversion->output_len / sizeof(utf16_t));
+
+        return true;
+    }
+
+    *written = sizeof(utf8_t) * utf16_to_utf8_stream_feed(&conversion->utf16_stream,
+        (utf16_t const*)chunk, len / sizeof(utf16_t),
+        (utf8_t*)output, conversion->output_len / sizeof(utf8_t));
+
+    return len % sizeof(utf16_t) == 0;
+}
+
+size_t conversion_finish(conversion* conversion, char* output)
+{
+    if (conversion->is_utf8)
+        return sizeof(utf16_t) * utf8_to_utf16_stream_finish(&conversion->utf8_stream, (utf16_t*)output, conversion->output_len / sizeof(utf16_t));
+
+    return sizeof(utf8_t) * utf16_to_utf8_stream_finish(&conversion->utf16_stream, (utf8_t*)output, conversion->output_len / sizeof(utf8_t));
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "converter.h"
+
+// The size of the chunks the input is converted in, in bytes.
+// Large enough to let the vectorized code run, small enough to keep the output buffer in cache.
+// Must be even, so that chunks never split a UTF-16 character.
+#define CHUNK_LEN (1024 * 1024)
+
+// The error shown when a UTF-16 input has a byte left over at its end
+#define CONVERSION_ODD_INPUT_MESSAGE "The input has an odd number of bytes, so its last byte can't be UTF-16 and was ignored"
+
+// A conversion of a whole input, one chunk at a time
+typedef struct
+{
+    // If the input is in UTF-8
+    bool is_utf8;
+    // The streams that carry codepoints cut off between chunks
+    utf8_to_utf16_stream utf8_stream;
+    utf16_to_utf8_stream utf16_stream;
+    // The size of a buffer that can hold the conversion of any chunk, in bytes
+    size_t output_len;
+} conversion;
+
+// Prepares a conversion
+//
+// is_utf8: If the input is in UTF-8
+void conversion_init(conversion* conversion, bool is_utf8);
+
+// Converts the next chunk of the input
+//
+// chunk: The chunk. It can end in the middle of a codepoint.
+// len: The length of the chunk, in bytes. At most CHUNK_LEN.
+// output: Where to write the converted chunk. Must be able to hold conversion->output_len bytes.
+// written: Pointer to a variable that will receive the number of bytes written to 'output'
+//
+// return: If the chunk was made of whole characters. Only the last chunk can have a byte left over.
+bool conversion_feed(conversion* conversion, char const* chunk, size_t len, char* output, size_t* written);
+
+// Finishes a conversion, converting any codepoint cut off at the end of the input
+//
+// output: Where to write the rest of the output. Must be able to hold conversion->output_len bytes.
+//
+// return: The number of bytes written to 'output'
+size_t conversion_finish(conversion* conversion, char* output);
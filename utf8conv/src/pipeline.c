@@ -0,0 +1,394 @@
+#include "pipeline.h"
+#include "conversion.h"
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef UTF8CONV_HAS_THREADS
+#include <threads.h>
+#endif
+
+// The number of buffers between each pair of stages.
+// Enough to absorb hiccups in either stage, small enough to stay in cache.
+#define PIPELINE_RING_LEN 4
+
+// Reads the current time, in seconds from an arbitrary point
+static double now_seconds(void)
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// A buffer passed from one stage to the next
+typedef struct
+{
+    char* data;
+    // The number of bytes used in 'data'
+    size_t len;
+} pipeline_buffer;
+
+// The state of a whole conversion, shared by all stages
+typedef struct pipeline pipeline;
+
+// Allocates the data of every buffer of an array
+//
+// return: If all buffers were allocated. If not, the ones that were must still be freed.
+static bool allocate_buffers(pipeline_buffer* buffers, size_t count, size_t capacity)
+{
+    bool success = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        buffers[i].data = malloc(capacity);
+        buffers[i].len = 0;
+        success = success && buffers[i].data != NULL;
+    }
+
+    return success;
+}
+
+// Frees the data of every buffer of an array
+static void free_buffers(pipeline_buffer* buffers, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        free(buffers[i].data);
+}
+
+// Reports the errors of a conversion
+//
+// return: If there were no errors
+static bool report_errors(bool read_failed, bool odd_input, bool write_failed, char const* input_name, char const* output_name)
+{
+    if (read_failed)
+        fprintf(stderr, "Unable to read %s\n", input_name);
+
+    if (odd_input)
+        fprintf(stderr, "%s\n", CONVERSION_ODD_INPUT_MESSAGE);
+
+    if (write_failed)
+        fprintf(stderr, "Unable to write to %s\n", output_name);
+
+    return !read_failed && !odd_input && !write_failed;
+}
+
+// Reads, converts and writes every chunk one after the other, for when no threads are available
+static bool convert_sequentially(bool is_utf8, FILE* input, char const* input_name, FILE* output, char const* output_name, pipeline_stats* stats)
+{
+    double start = now_seconds();
+
+    conversion conversion;
+    conversion_init(&conversion, is_utf8);
+
+    pipeline_buffer buffers[2];
+    if (!allocate_buffers(buffers, 1, CHUNK_LEN) | !allocate_buffers(buffers + 1, 1, conversion.output_len))
+    {
+        fprintf(stderr, "Unable to allocate enough memory for the conversion buffers\n");
+        free_buffers(buffers, 2);
+        return false;
+    }
+
+    bool odd_input = false;
+    bool write_failed = false;
+
+    size_t read;
+    do
+    {
+        read = fread(buffers[0].data, 1, CHUNK_LEN, input);
+        odd_input = !conversion_feed(&conversion, buffers[0].data, read, buffers[1].data, &buffers[1].len);
+        write_failed = fwrite(buffers[1].data, 1, buffers[1].len, output) != buffers[1].len;
+    } while (read == CHUNK_LEN && !odd_input && !write_failed);
+
+    buffers[1].len = conversion_finish(&conversion, buffers[1].data);
+    write_failed = write_failed || fwrite(buffers[1].data, 1, buffers[1].len, output) != buffers[1].len || fflush(output) != 0;
+
+    free_buffers(buffers, 2);
+
+    stats->threaded = false;
+    stats->reader_stall = 0;
+    stats->converter_input_stall = 0;
+    stats->converter_output_stall = 0;
+    stats->writer_stall = 0;
+    stats->total = now_seconds() - start;
+
+    return report_errors(ferror(input) != 0, odd_input, write_failed, input_name, output_name);
+}
+
+#ifdef UTF8CONV_HAS_THREADS
+
+// A ring of buffers passed from a producer stage to a consumer stage, in order.
+// The producer fills buffers while there are empty ones, and the consumer empties them while
+// there are full ones, so each buffer is only ever touched by one of them at a time.
+typedef struct
+{
+    pipeline_buffer buffers[PIPELINE_RING_LEN];
+    // The number of buffers filled by the producer, ever
+    size_t produced;
+    // The number of buffers emptied by the consumer, ever
+    size_t consumed;
+    // If the producer is done, and no more buffers will be filled
+    bool closed;
+    mtx_t lock;
+    cnd_t changed;
+} pipeline_ring;
+
+// Prepares a ring
+//
+// capacity: The size of each buffer, in bytes
+//
+// return: If the ring could be prepared. If not, it must still be destroyed.
+static bool ring_init(pipeline_ring* ring, size_t capacity)
+{
+    ring->produced = 0;
+    ring->consumed = 0;
+    ring->closed = false;
+
+    bool success = allocate_buffers(ring->buffers, PIPELINE_RING_LEN, capacity);
+    success = mtx_init(&ring->lock, mtx_plain) == thrd_success && success;
+    success = cnd_init(&ring->changed) == thrd_success && success;
+    return success;
+}
+
+static void ring_destroy(pipeline_ring* ring)
+{
+    free_buffers(ring->buffers, PIPELINE_RING_LEN);
+    mtx_destroy(&ring->lock);
+    cnd_destroy(&ring->changed);
+}
+
+// Waits for a buffer that the producer can fill
+//
+// stall: Pointer to a variable that is increased by the time spent waiting, in seconds
+static pipeline_buffer* ring_acquire_empty(pipeline_ring* ring, double* stall)
+{
+    mtx_lock(&ring->lock);
+
+    if (ring->produced - ring->consumed == PIPELINE_RING_LEN)
+    {
+        double start = now_seconds();
+        while (ring->produced - ring->consumed == PIPELINE_RING_LEN)
+            cnd_wait(&ring->changed, &ring->lock);
+        *stall += now_seconds() - start;
+    }
+
+    pipeline_buffer* buffer = &ring->buffers[ring->produced % PIPELINE_RING_LEN];
+    mtx_unlock(&ring->lock);
+    return buffer;
+}
+
+// Hands the buffer returned by ring_acquire_empty over to the consumer
+static void ring_push(pipeline_ring* ring)
+{
+    mtx_lock(&ring->lock);
+    ring->produced++;
+    cnd_broadcast(&ring->changed);
+    mtx_unlock(&ring->lock);
+}
+
+// Tells the consumer that no more buffers will be filled
+static void ring_close(pipeline_ring* ring)
+{
+    mtx_lock(&ring->lock);
+    ring->closed = true;
+    cnd_broadcast(&ring->changed);
+    mtx_unlock(&ring->lock);
+}
+
+// Waits for a buffer that the consumer can empty
+//
+// stall: Pointer to a variable that is increased by the time spent waiting, in seconds
+//
+// return: The buffer, or NULL if the ring was closed and all buffers were emptied
+static pipeline_buffer* ring_acquire_full(pipeline_ring* ring, double* stall)
+{
+    mtx_lock(&ring->lock);
+
+    if (ring->produced == ring->consumed && !ring->closed)
+    {
+        double start = now_seconds();
+        while (ring->produced == ring->consumed && !ring->closed)
+            cnd_wait(&ring->changed, &ring->lock);
+        *stall += now_seconds() - start;
+    }
+
+    pipeline_buffer* buffer = NULL;
+    if (ring->produced != ring->consumed)
+        buffer = &ring->buffers[ring->consumed % PIPELINE_RING_LEN];
+
+    mtx_unlock(&ring->lock);
+    return buffer;
+}
+
+// Hands the buffer returned by ring_acquire_full back to the producer
+static void ring_pop(pipeline_ring* ring)
+{
+    mtx_lock(&ring->lock);
+    ring->consumed++;
+    cnd_broadcast(&ring->changed);
+    mtx_unlock(&ring->lock);
+}
+
+struct pipeline
+{
+    FILE* input;
+    FILE* output;
+    // The ring between the reader and the converter
+    pipeline_ring inputs;
+    // The ring between the converter and the writer
+    pipeline_ring outputs;
+    // Each stage only writes its own fields, and they're only read after all stages finished
+    pipeline_stats stats;
+    bool read_failed;
+    bool write_failed;
+};
+
+// Reads the input into the input ring, until it ends
+static int run_reader(void* arg)
+{
+    pipeline* pipeline = arg;
+
+    size_t read;
+    do
+    {
+        pipeline_buffer* buffer = ring_acquire_empty(&pipeline->inputs, &pipeline->stats.reader_stall);
+
+        // fread only returns less than asked at the end of the input
+        read = fread(buffer->data, 1, CHUNK_LEN, pipeline->input);
+        buffer->len = read;
+
+        if (read > 0)
+            ring_push(&pipeline->inputs);
+    } while (read == CHUNK_LEN);
+
+    pipeline->read_failed = ferror(pipeline->input) != 0;
+    ring_close(&pipeline->inputs);
+    return 0;
+}
+
+// Writes the output ring out, until the converter is done
+static int run_writer(void* arg)
+{
+    pipeline* pipeline = arg;
+
+    pipeline_buffer* buffer;
+    while ((buffer = ring_acquire_full(&pipeline->outputs, &pipeline->stats.writer_stall)) != NULL)
+    {
+        // After an error, the rest of the output is still consumed so the converter never blocks
+        if (!pipeline->write_failed && fwrite(buffer->data, 1, buffer->len, pipeline->output) != buffer->len)
+            pipeline->write_failed = true;
+
+        ring_pop(&pipeline->outputs);
+    }
+
+    pipeline->write_failed = pipeline->write_failed || fflush(pipeline->output) != 0;
+    return 0;
+}
+
+bool convert_pipelined(bool is_utf8, FILE* input, char const* input_name, FILE* output, char const* output_name, pipeline_stats* stats)
+{
+    double start = now_seconds();
+
+    conversion conversion;
+    conversion_init(&conversion, is_utf8);
+
+    pipeline* pipeline = calloc(1, sizeof *pipeline);
+    if (pipeline == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory for the conversion buffers\n");
+        return false;
+    }
+
+    pipeline->input = input;
+    pipeline->output = output;
+
+    bool prepared = ring_init(&pipeline->inputs, CHUNK_LEN);
+    prepared = ring_init(&pipeline->outputs, conversion.output_len) && prepared;
+    if (!prepared)
+    {
+        fprintf(stderr, "Unable to allocate enough memory for the conversion buffers\n");
+        ring_destroy(&pipeline->inputs);
+        ring_destroy(&pipeline->outputs);
+        free(pipeline);
+        return false;
+    }
+
+    // The writer is started first, so nothing was read from the input yet if either thread can't start
+    thrd_t reader;
+    thrd_t writer;
+    bool writer_started = thrd_create(&writer, run_writer, pipeline) == thrd_success;
+    bool reader_started = writer_started && thrd_create(&reader, run_reader, pipeline) == thrd_success;
+
+    // Couldn't start the threads, so do everything here instead
+    if (!reader_started)
+    {
+        if (writer_started)
+        {
+            // The writer is stopped by closing its ring, which has nothing to write yet
+            ring_close(&pipeline->outputs);
+            thrd_join(writer, NULL);
+        }
+
+        ring_destroy(&pipeline->inputs);
+        ring_destroy(&pipeline->outputs);
+        free(pipeline);
+        return convert_sequentially(is_utf8, input, input_name, output, output_name, stats);
+    }
+
+    bool odd_input = false;
+
+    pipeline_buffer* chunk;
+    while ((chunk = ring_acquire_full(&pipeline->inputs, &pipeline->stats.converter_input_stall)) != NULL)
+    {
+        // After an error, the rest of the input is still consumed so the reader never blocks
+        if (!odd_input)
+        {
+            pipeline_buffer* converted = ring_acquire_empty(&pipeline->outputs, &pipeline->stats.converter_output_stall);
+            odd_input = !conversion_feed(&conversion, chunk->data, chunk->len, converted->data, &converted->len);
+            ring_push(&pipeline->outputs);
+        }
+
+        ring_pop(&pipeline->inputs);
+    }
+
+    pipeline_buffer* converted = ring_acquire_empty(&pipeline->outputs, &pipeline->stats.converter_output_stall);
+    converted->len = conversion_finish(&conversion, converted->data);
+    ring_push(&pipeline->outputs);
+    ring_close(&pipeline->outputs);
+
+    thrd_join(reader, NULL);
+    thrd_join(writer, NULL);
+
+    *stats = pipeline->stats;
+    stats->threaded = true;
+    stats->total = now_seconds() - start;
+
+    bool success = report_errors(pipeline->read_failed, odd_input, pipeline->write_failed, input_name, output_name);
+
+    ring_destroy(&pipeline->inputs);
+    ring_destroy(&pipeline->outputs);
+    free(pipeline);
+    return success;
+}
+
+#else
+
+bool convert_pipelined(bool is_utf8, FILE* input, char const* input_name, FILE* output, char const* output_name, pipeline_stats* stats)
+{
+    return convert_sequentially(is_utf8, input, input_name, output, output_name, stats);
+}
+
+#endif
+
+void pipeline_print_stats(pipeline_stats const* stats, FILE* file)
+{
+    if (!stats->threaded)
+    {
+        fprintf(file, "Converted in %.3f s on a single thread, since threads aren't available\n", stats->total);
+        return;
+    }
+
+    // A stage that barely stalls is the bottleneck: the others are waiting for it
+    fprintf(file, "Converted in %.3f s\n", stats->total);
+    fprintf(file, "Reader stalled    %.3f s waiting for the converter\n", stats->reader_stall);
+    fprintf(file, "Converter stalled %.3f s waiting for the reader\n", stats->converter_input_stall);
+    fprintf(file, "Converter stalled %.3f s waiting for the writer\n", stats->converter_output_stall);
+    fprintf(file, "Writer stalled    %.3f s waiting for the converter\n", stats->writer_stall);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <stdbool.h>
+#include <stdio.h>
+
+// Pipelined conversion reads, converts and writes on three threads at the same time.
+// The reader fills a small ring of fixed input buffers, the converter turns each of them
+// into a buffer of a second ring, and the writer writes those out in order.
+// Codepoints cut off between chunks are carried over by the streaming conversion functions,
+// so the output is exactly the same as converting the whole input at once.
+
+// How long each stage of a pipelined conversion spent waiting for the others, in seconds
+typedef struct
+{
+    // The reader waiting for the converter to free an input buffer
+    double reader_stall;
+    // The converter waiting for the reader to fill an input buffer
+    double converter_input_stall;
+    // The converter waiting for the writer to free an output buffer
+    double converter_output_stall;
+    // The writer waiting for the converter to fill an output buffer
+    double writer_stall;
+    // The whole conversion
+    double total;
+    // If the stages really ran on their own threads
+    bool threaded;
+} pipeline_stats;
+
+// Converts an input to an output, overlapping the conversion with reading and writing.
+// Falls back to doing everything on the calling thread if threads aren't available.
+//
+// is_utf8: If the input is in UTF-8
+// input: The file to read the input from, sequentially
+// input_name: The name of the input, for error messages
+// output: The file to write the converted output to
+// output_name: The name of the output, for error messages
+// stats: Pointer to a variable that will receive how long each stage stalled
+//
+// return: If the input was converted successfully
+bool convert_pipelined(bool is_utf8, FILE* input, char const* input_name, FILE* output, char const* output_name, pipeline_stats* stats);
+
+// Prints the stall times of a pipelined conversion
+//
+// stats: The stall times
+// file: Where to print them
+void pipeline_print_stats(pipeline_stats const* stats, FILE* file);
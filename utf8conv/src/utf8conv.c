@@ -0,0 +1,364 @@
+// madvise and MADV_SEQUENTIAL aren't declared in strict standard C modes
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "conversion.h"
+#include "pipeline.h"
+
+static int help(const char* base)
+{
+    printf("Usage: %s [--pipeline] [--stats] <mode> [<input> [<output>]] \n", base);
+    printf("\n");
+    printf("mode:\n");
+    printf("'utf8' to convert UTF-8 to UTF-16LE, 'utf16' to convert UTF-16LE to UTF-8. Case-sensitive.\n");
+    printf("\n");
+    printf("input:\n");
+    printf("Path of the file to be converted. If missing or '-', the input is read from stdin.\n");
+    printf("Files are memory-mapped when possible, so they're never copied into memory as a whole.\n");
+    printf("\n");
+    printf("output:\n");
+    printf("Path of the file where the converted output will be written. If missing or '-', the output is written to stdout.\n");
+    printf("\n");
+    printf("--pipeline:\n");
+    printf("Read, convert and write on separate threads, so that conversion overlaps with I/O.\n");
+    printf("The input is always read sequentially, even if it's a file.\n");
+    printf("\n");
+    printf("--stats:\n");
+    printf("With --pipeline, print how long each stage waited for the others to stderr.\n");
+    printf("\n");
+    printf("Invalid encodings are replaced by U+FFFD. No BOM is added or removed.\n");
+    printf("\n");
+    return EXIT_SUCCESS;
+}
+
+// A conversion that writes every converted chunk to a file from the same buffer
+typedef struct
+{
+    conversion conversion;
+    // The buffer every chunk is converted to before being written, reused for all chunks
+    char* buffer;
+    // Where the converted output is written
+    FILE* output;
+    // The name of the output, for error messages
+    char const* output_name;
+} file_conversion;
+
+// Prepares a conversion to a file
+//
+// return: If the conversion could be prepared
+static bool file_conversion_init(file_conversion* conversion, bool is_utf8, FILE* output, char const* output_name)
+{
+    conversion_init(&conversion->conversion, is_utf8);
+    conversion->output = output;
+    conversion->output_name = output_name;
+
+    conversion->buffer = malloc(conversion->conversion.output_len);
+    if (conversion->buffer == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory for the output buffer\n");
+        return false;
+    }
+
+    return true;
+}
+
+// Writes the converted characters in the buffer of a conversion to its output
+//
+// len: The number of bytes to write
+//
+// return: If they were written successfully
+static bool file_conversion_write(file_conversion* conversion, size_t len)
+{
+    if (fwrite(conversion->buffer, 1, len, conversion->output) != len)
+    {
+        fprintf(stderr, "Unable to write to %s\n", conversion->output_name);
+        return false;
+    }
+
+    return true;
+}
+
+// Converts the next chunk of the input and writes it out
+//
+// chunk: The chunk. It can end in the middle of a codepoint.
+// len: The length of the chunk, in bytes. At most CHUNK_LEN.
+//
+// return: If the chunk was converted and written successfully
+static bool file_conversion_feed(file_conversion* conversion, char const* chunk, size_t len)
+{
+    size_t written;
+    bool whole = conversion_feed(&conversion->conversion, chunk, len, conversion->buffer, &written);
+
+    if (!file_conversion_write(conversion, written))
+        return false;
+
+    if (!whole)
+    {
+        fprintf(stderr, "%s\n", CONVERSION_ODD_INPUT_MESSAGE);
+        return false;
+    }
+
+    return true;
+}
+
+// Finishes a conversion, writing out any codepoint cut off at the end of the input
+//
+// return: If the rest of the output was written successfully
+static bool file_conversion_finish(file_conversion* conversion)
+{
+    size_t written = conversion_finish(&conversion->conversion, conversion->buffer);
+
+    bool success = file_conversion_write(conversion, written) && fflush(conversion->output) == 0;
+    free(conversion->buffer);
+    return success;
+}
+
+// Converts an input that can only be read sequentially, such as stdin or a pipe
+//
+// input: The input file
+// input_name: The name of the input, for error messages
+//
+// return: If the input was converted successfully
+static bool convert_stream(file_conversion* conversion, FILE* input, char const* input_name)
+{
+    char* chunk = malloc(CHUNK_LEN);
+    if (chunk == NULL)
+    {
+        fprintf(stderr, "Unable to allocate enough memory for the input buffer\n");
+        return false;
+    }
+
+    // fread only returns less than asked at the end of the input,
+    // so every chunk but the last one is full
+    bool success = true;
+    size_t read;
+    do
+    {
+        read = fread(chunk, 1, CHUNK_LEN, input);
+        success = file_conversion_feed(conversion, chunk, read);
+    } while (success && read == CHUNK_LEN);
+
+    if (success && ferror(input))
+    {
+        fprintf(stderr, "Unable to read %s\n", input_name);
+        success = false;
+    }
+
+    free(chunk);
+    return success;
+}
+
+// Converts a memory-mapped input
+//
+// input: The contents of the input
+// input_len: The length of the input, in bytes
+//
+// return: If the input was converted successfully
+static bool convert_mapped(file_conversion* conversion, char const* input, size_t input_len)
+{
+    for (size_t index = 0; index < input_len; index += CHUNK_LEN)
+    {
+        size_t len = input_len - index < CHUNK_LEN ? input_len - index : CHUNK_LEN;
+        if (!file_conversion_feed(conversion, input + index, len))
+            return false;
+    }
+
+    return true;
+}
+
+// Converts a file, memory-mapping it if possible and reading it sequentially otherwise
+//
+// path: The path of the input file
+//
+// return: If the input was converted successfully
+static bool convert_file(file_conversion* conversion, char const* path)
+{
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Unable to open input file %s\n", path);
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    char const* contents = NULL;
+
+    // Empty files can't be mapped, and don't need to be
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping != NULL)
+        contents = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+    if (contents != NULL)
+    {
+        bool success = convert_mapped(conversion, contents, (size_t)size.QuadPart);
+        UnmapViewOfFile(contents);
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return success;
+    }
+
+    if (mapping != NULL)
+        CloseHandle(mapping);
+    CloseHandle(file);
+#else
+    int file = open(path, O_RDONLY);
+    if (file < 0)
+    {
+        fprintf(stderr, "Unable to open input file %s\n", path);
+        return false;
+    }
+
+    // Only regular files can be mapped, and empty ones don't need to be
+    struct stat info;
+    if (fstat(file, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        size_t size = (size_t)info.st_size;
+        void* contents = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (contents != MAP_FAILED)
+        {
+            // The input is read once from start to end, so the kernel can read ahead aggressively
+            // and drop the pages that were already converted
+            madvise(contents, size, MADV_SEQUENTIAL);
+
+            bool success = convert_mapped(conversion, contents, size);
+            munmap(contents, size);
+            close(file);
+            return success;
+        }
+    }
+
+    close(file);
+#endif
+
+    FILE* input = fopen(path, "rb");
+    if (input == NULL)
+    {
+        fprintf(stderr, "Unable to open input file %s\n", path);
+        return false;
+    }
+
+    bool success = convert_stream(conversion, input, path);
+    fclose(input);
+    return success;
+}
+
+int main(int argc, char const* argv[])
+{
+    bool pipelined = false;
+    bool stats = false;
+
+    int first_arg = 1;
+    while (first_arg < argc && strncmp(argv[first_arg], "--", 2) == 0)
+    {
+        if (strcmp(argv[first_arg], "--pipeline") == 0)
+            pipelined = true;
+        else if (strcmp(argv[first_arg], "--stats") == 0)
+            stats = true;
+        else
+            return help(argv[0]);
+
+        first_arg++;
+    }
+
+    int arg_count = argc - first_arg;
+    if (arg_count < 1 || arg_count > 3)
+        return help(argv[0]);
+
+    char const* mode = argv[first_arg];
+
+    bool is_utf8;
+    if (strcmp(mode, "utf8") == 0) { is_utf8 = true; }
+    else if (strcmp(mode, "utf16") == 0) { is_utf8 = false; }
+    else
+    {
+        fprintf(stderr, "Mode must be either 'utf8' or 'utf16', case-sensitive\n");
+        return EXIT_FAILURE;
+    }
+
+    char const* input_path = arg_count >= 2 && strcmp(argv[first_arg + 1], "-") != 0 ? argv[first_arg + 1] : NULL;
+    char const* output_path = arg_count >= 3 && strcmp(argv[first_arg + 2], "-") != 0 ? argv[first_arg + 2] : NULL;
+
+#if defined(_WIN32)
+    // The standard streams would otherwise translate line endings
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    FILE* output = stdout;
+    if (output_path != NULL)
+    {
+        output = fopen(output_path, "wb");
+        if (output == NULL)
+        {
+            fprintf(stderr, "Unable to open file %s for writing\n", output_path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    char const* output_name = output_path != NULL ? output_path : "stdout";
+    bool success;
+
+    if (pipelined)
+    {
+        FILE* input = stdin;
+        if (input_path != NULL)
+        {
+            input = fopen(input_path, "rb");
+            if (input == NULL)
+            {
+                fprintf(stderr, "Unable to open input file %s\n", input_path);
+                return EXIT_FAILURE;
+            }
+        }
+
+        pipeline_stats pipeline_stats;
+        success = convert_pipelined(is_utf8, input, input_path != NULL ? input_path : "stdin", output, output_name, &pipeline_stats);
+
+        if (stats)
+            pipeline_print_stats(&pipeline_stats, stderr);
+
+        if (input != stdin)
+            fclose(input);
+    }
+    else
+    {
+        file_conversion conversion;
+        if (!file_conversion_init(&conversion, is_utf8, output, output_name))
+            return EXIT_FAILURE;
+
+        if (input_path != NULL)
+            success = convert_file(&conversion, input_path);
+        else
+            success = convert_stream(&conversion, stdin, "stdin");
+
+        success = file_conversion_finish(&conversion) && success;
+    }
+
+    if (output != stdout && fclose(output) != 0)
+    {
+        fprintf(stderr, "Unable to write to %s\n", output_path);
+        success = false;
+    }
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}